@@ -41,8 +41,11 @@ def gen_data_bins(db, outfile):
   db.dump_csv('C', outfile)
   db.execute('DROP VIEW C')
 
-def gen_table_bins(db, table, outfile, name_var, dur_ns_var):
-  db.execute('create view B as select (%s) as Name, count(%s) as Calls, sum(%s) as TotalDurationNs from %s group by %s' % (name_var, name_var, dur_ns_var, table, name_var))
+def gen_table_bins(db, table, outfile, name_var, dur_ns_var, weight_var = ''):
+  if weight_var == '':
+    db.execute('create view B as select (%s) as Name, count(%s) as Calls, sum(%s) as TotalDurationNs from %s group by %s' % (name_var, name_var, dur_ns_var, table, name_var))
+  else:
+    db.execute('create view B as select (%s) as Name, cast(round(sum(%s)) as INTEGER) as Calls, cast(round(sum(%s * %s)) as INTEGER) as TotalDurationNs from %s group by %s' % (name_var, weight_var, dur_ns_var, weight_var, table, name_var))
   gen_data_bins(db, outfile)
   db.execute('DROP VIEW B')
   gen_message(outfile)
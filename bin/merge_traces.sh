@@ -79,6 +79,23 @@ for file in begin_ts_file hcc_ops_trace hsa_handles hip_api_trace roctx_trace hs
     -not -path "${OUTPUT_DIR}/*" | xargs cat > "${OUTPUT_DIR}/${file}.txt"
 done
 
+# Binary results are k-way merged by the dispatch timestamps with the processes clocks aligned
+MERGE_TOOL=${ROCP_MERGE_TOOL:-$(dirname $BIN_DIR)/lib/rocprofiler/rocprof-merge}
+BIN_INPUTS=`find ${INPUT_DIRS} -type f -regextype sed -regex ".*/[0-9]\{1,\}_results\.bin" -not -path "${OUTPUT_DIR}/*"`
+OUTPUT_LIST="$OUTPUT_DIR/results.txt"
+if [ -n "$BIN_INPUTS" ] ; then
+  if ! [ -x "$MERGE_TOOL" ] ; then
+    echo "Merging tool $MERGE_TOOL not found!"
+    exit 1
+  fi
+  $MERGE_TOOL -o "$OUTPUT_DIR/results.bin" $BIN_INPUTS
+  if [ "$?" -ne 0 ] ; then
+    echo "Binary results merging failed"
+    exit 1
+  fi
+  OUTPUT_LIST="$OUTPUT_DIR/results.bin"
+fi
+
 if ! [ -d "${BIN_DIR}" ] ; then
   echo "Bin directory $BIN_DIR not found!"
   exit 1
@@ -88,7 +105,6 @@ if [ -z "$ROCP_PYTHON_VERSION" ] ; then
   ROCP_PYTHON_VERSION=python3
 fi
 
-OUTPUT_LIST="$OUTPUT_DIR/results.txt"
 db_output="$OUTPUT_DIR/results.db"
 echo "$ROCP_PYTHON_VERSION $BIN_DIR/tblextr.py $db_output $OUTPUT_LIST"
 $ROCP_PYTHON_VERSION $BIN_DIR/tblextr.py $db_output $OUTPUT_LIST
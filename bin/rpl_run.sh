@@ -48,6 +48,7 @@ HIP_TRACE=0
 
 # Generate stats
 GEN_STATS=0
+GEN_PARQUET=0
 
 # Quoting profiled cmd line
 CMD_QTS=1
@@ -156,11 +157,29 @@ usage() {
   echo ""
   echo "  --basenames <on|off> - to turn on/off truncating of the kernel full function names till the base ones [off]"
   echo "  --timestamp <on|off> - to turn on/off the kernel disoatches timestamps, dispatch/begin/end/complete [off]"
+  echo "  --sample-rate <N> - to profile a random 1/N subset of the kernel dispatches [1 - all dispatches]"
+  echo "  --sample-budget <events/sec> - to profile a random subset of the kernel dispatches bounded by the given rate [0 - disabled]"
+  echo "      The sampled dispatches output the sampling weights, the '--stats' totals are scaled by the weights."
+  echo "  --converge <tolerance %> - to profile a kernel at the background rate once its duration and counters means converge [0 - disabled]"
+  echo "  --converge-rate <N> - the converged kernels background profiling rate 1/N [100]"
+  echo "  --queue-budget <N> - to stop intercepting a queue after N profiled dispatches [0 - unlimited]"
   echo "  --ctx-wait <on|off> - to wait for outstanding contexts on profiler exit [on]"
-  echo "  --ctx-limit <max number> - maximum number of outstanding contexts [0 - unlimited]"
+  echo "  --ctx-limit <max number> - maximum number of outstanding contexts, the per-GPU contexts pool size [0 - pool of 1000, otherwise unlimited]"
+  echo "      Dispatching is blocked while the limit is reached."
   echo "  --heartbeat <rate sec> - to print progress heartbeats [0 - disabled]"
   echo "  --obj-tracking <on|off> - to turn on/off kernels code objects tracking [on]"
   echo "    To support V3 code object"
+  echo "  --binary <on|off> - to turn on/off the binary results format, '<pid>_results.bin' [off]"
+  echo "  --parquet <on|off> - to generate the Parquet results and copies tables, binary format only [off]"
+  echo "  --writer-thread <on|off> - to turn on/off the dedicated results writer thread [on]"
+  echo "  --output-shards <on|off> - to write the binary results to per-thread shards '<pid>_<shard>_results.bin' [off]"
+  echo "    The results writer thread is not used, the shards are merged by the dispatch index"
+  echo "  --writer-queue <size> - results writer queue size in records [4096]"
+  echo "  --writer-flush <msec> - results writer flush interval [100]"
+  echo "  --writer-policy <block|drop-oldest|count> - results writer queue overflow policy [block]"
+  echo "    To block the profiled application, to drop the oldest queued record or to drop the new one counting the misses"
+  echo "  --kernel-stats <on|off|only> - to aggregate kernels statistics on-line, '<pid>_kernel_stats.csv' [off]"
+  echo "    The durations quantiles and counters min/max/avg are aggregated, with 'only' the dispatch records are not output"
   echo ""
   echo "  --stats - generating kernel execution stats, file <output name>.stats.csv"
   echo ""
@@ -186,7 +205,15 @@ usage() {
   echo "    Supported time formats: <number(m|s|ms|us)>"
   echo "  --flush-rate <rate> - to enable trace flush rate (time period)"
   echo "    Supported time formats: <number(m|s|ms|us)>"
+  echo "  --shm-ctrl <ring size[:poll msec]> - to create the live session control channel '/rocprof-<pid>',"
+  echo "    the collection is off on start and is controlled by 'rocprof-shm <pid> enable|disable|metrics|read'"
   echo "  --parallel-kernels - to enable cnocurrent kernels"
+  echo "  --accumulate <dispatches> - to accumulate the counters over the ranges of up to the given number of"
+  echo "      consecutive dispatches of the same kernel, one record per range"
+  echo "  --parallel-kernels-window <dispatches[:usec]> - to enable cnocurrent kernels with the counters"
+  echo "      read per window of dispatches, the window is limited by the dispatches number and optionally by time"
+  echo "  --kernel-replay <on|off> - to collect all 'pmc' groups counters in one run by replaying every profiled dispatch per group [off]"
+  echo "      Kernels updating their input buffers in place are replayed on the updated data."
   echo ""
   echo "Configuration file:"
   echo "  You can set your parameters defaults preferences in the configuration file 'rpl_rc.xml'. The search path sequence: .:${HOME}:<package path>"
@@ -256,7 +283,11 @@ run() {
       fi
     fi
     mkdir -p "$ROCP_OUTPUT_DIR"
-    OUTPUT_LIST="$OUTPUT_LIST $ROCP_OUTPUT_DIR/results.txt"
+    if [ "$ROCP_BINARY_OUTPUT" = "1" ] ; then
+      OUTPUT_LIST="$OUTPUT_LIST $ROCP_OUTPUT_DIR/results.bin"
+    else
+      OUTPUT_LIST="$OUTPUT_LIST $ROCP_OUTPUT_DIR/results.txt"
+    fi
   fi
 
   API_TRACE=""
@@ -301,8 +332,16 @@ run() {
 merge_output() {
   while [ -n "$1" ] ; do
     output_dir=$(echo "$1" | sed "s/\/[^\/]*$//")
+    # The binary results are merged by the dispatch timestamps, the output shards by the dispatch index
+    bin_merged=0
+    merge_key="time"
+    if [ "$ROCP_OUTPUT_SHARDS" = "1" ] ; then merge_key="index"; fi
+    if [ -x "$TLIB_PATH/rocprof-merge" ] && ls $output_dir/[0-9]*_results.bin >/dev/null 2>&1 ; then
+      $TLIB_PATH/rocprof-merge -k $merge_key -o $output_dir/results.bin $output_dir && bin_merged=1
+    fi
     for file_name in `ls $output_dir` ; do
-      output_name=$(echo $file_name | sed -n "/\.txt$/ s/^[0-9]*_//p")
+      output_name=$(echo $file_name | sed -n "/\.\(txt\|bin\)$/ s/^[0-9_]*_//p")
+      if [ "$bin_merged" = 1 ] && [ "$output_name" = "results.bin" ] ; then output_name=""; fi
       if [ -n "$output_name" ] ; then
         trace_file=$output_dir/$file_name
         output_file=$output_dir/$output_name
@@ -400,6 +439,57 @@ while [ 1 ] ; do
     else
       export ROCP_OUTSTANDING_WAIT=0
     fi
+  elif [ "$1" = "--binary" ] ; then
+    if [ "$2" = "on" ] ; then
+      export ROCP_BINARY_OUTPUT=1
+    else
+      export ROCP_BINARY_OUTPUT=0
+    fi
+  elif [ "$1" = "--parquet" ] ; then
+    if [ "$2" = "on" ] ; then
+      GEN_PARQUET=1
+    else
+      GEN_PARQUET=0
+    fi
+  elif [ "$1" = "--writer-thread" ] ; then
+    if [ "$2" = "on" ] ; then
+      export ROCP_WRITER_THREAD=1
+    else
+      export ROCP_WRITER_THREAD=0
+    fi
+  elif [ "$1" = "--output-shards" ] ; then
+    if [ "$2" = "on" ] ; then
+      export ROCP_OUTPUT_SHARDS=1
+    else
+      export ROCP_OUTPUT_SHARDS=0
+    fi
+  elif [ "$1" = "--sample-rate" ] ; then
+    export ROCP_SAMPLE_RATE="$2"
+  elif [ "$1" = "--sample-budget" ] ; then
+    export ROCP_SAMPLE_BUDGET="$2"
+  elif [ "$1" = "--converge" ] ; then
+    export ROCP_CONVERGE_TOL="$2"
+  elif [ "$1" = "--converge-rate" ] ; then
+    export ROCP_CONVERGE_RATE="$2"
+  elif [ "$1" = "--queue-budget" ] ; then
+    export ROCP_QUEUE_BUDGET="$2"
+  elif [ "$1" = "--writer-queue" ] ; then
+    export ROCP_WRITER_QUEUE="$2"
+  elif [ "$1" = "--writer-flush" ] ; then
+    export ROCP_WRITER_FLUSH="$2"
+  elif [ "$1" = "--writer-policy" ] ; then
+    if [ "$2" != "block" -a "$2" != "drop-oldest" -a "$2" != "count" ] ; then
+      error "Option '$ARG_IN', bad policy '$2'"
+    fi
+    export ROCP_WRITER_POLICY="$2"
+  elif [ "$1" = "--kernel-stats" ] ; then
+    if [ "$2" = "on" ] ; then
+      export ROCP_KERNEL_STATS=1
+    elif [ "$2" = "only" ] ; then
+      export ROCP_KERNEL_STATS=2
+    else
+      export ROCP_KERNEL_STATS=0
+    fi
   elif [ "$1" = "--ctx-limit" ] ; then
     export ROCP_OUTSTANDING_MAX="$2"
   elif [ "$1" = "--heartbeat" ] ; then
@@ -455,14 +545,31 @@ while [ 1 ] ; do
     convert_time_val period_rate
     errck "Option '$ARG_IN', rate value"
     export ROCP_FLUSH_RATE="$period_rate"
+  elif [ "$1" = "--shm-ctrl" ] ; then
+    export ROCP_SHM_CTRL="$2"
   elif [ "$1" = "--obj-tracking" ] ; then
     if [ "$2" = "off" ] ; then
       export ROCP_OBJ_TRACKING=0
     fi
+  elif [ "$1" = "--kernel-replay" ] ; then
+    if [ "$2" = "on" ] ; then
+      export ROCP_KERNEL_REPLAY=1
+    else
+      export ROCP_KERNEL_REPLAY=0
+    fi
   elif [ "$1" = "--parallel-kernels" ] ; then
     ARG_VAL=0
     export ROCP_K_CONCURRENT=1
     export AQLPROFILE_READ_API=1
+  elif [ "$1" = "--accumulate" ] ; then
+    export ROCP_K_ACCUMULATE=$2
+  elif [ "$1" = "--parallel-kernels-window" ] ; then
+    export ROCP_K_CONCURRENT=3
+    export ROCP_K_WINDOW=$(echo "$2" | cut -d: -f1)
+    if echo "$2" | grep -q ":" ; then
+      export ROCP_K_WINDOW_TIME=$(echo "$2" | cut -d: -f2)
+    fi
+    export AQLPROFILE_READ_API=1
   elif [ "$1" = "--verbose" ] ; then
     ARG_VAL=0
     export ROCP_VERBOSE_MODE=1
@@ -569,13 +676,26 @@ for name in $input_list; do
   fi
 done
 
+# The binary kernels results without API traces are post-processed natively
+if [ "$ROCP_BINARY_OUTPUT" = "1" -a -z "$ROCTRACER_DOMAIN" -a -x "$TLIB_PATH/rocprof-post" ] ; then
+  POST_TOOL="$TLIB_PATH/rocprof-post"
+  if [ "$GEN_PARQUET" = "1" ] ; then
+    POST_TOOL="$POST_TOOL -p"
+  fi
+else
+  POST_TOOL="$ROCP_PYTHON_VERSION $PROF_BIN_DIR/tblextr.py"
+  if [ "$GEN_PARQUET" = "1" ] ; then
+    echo "Warning: the Parquet output is generated from the binary results without API traces only"
+  fi
+fi
+
 if [ -n "$csv_output" ] ; then
   merge_output $OUTPUT_LIST
   if [ "$GEN_STATS" = "1" ] ; then
     db_output=$(echo $csv_output | sed "s/\.csv/.db/")
-    $ROCP_PYTHON_VERSION $PROF_BIN_DIR/tblextr.py $db_output $OUTPUT_LIST
+    $POST_TOOL $db_output $OUTPUT_LIST
   else
-    $ROCP_PYTHON_VERSION $PROF_BIN_DIR/tblextr.py $csv_output $OUTPUT_LIST
+    $POST_TOOL $csv_output $OUTPUT_LIST
   fi
   if [ "$?" -ne 0 ] ; then
     echo "Profiling data corrupted: '$OUTPUT_LIST'" | tee "$ROCPROFILER_SESS/error"
@@ -0,0 +1,121 @@
+################################################################################
+# Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+################################################################################
+
+# Binary profiling results reader, the format is defined in test/util/rpl_bin.h
+
+import struct, sys
+
+RPL_BIN_MAGIC = 0x424c5052
+RPL_BIN_VERSION_MAJOR = 1
+
+RPL_BIN_HEADER = 1
+RPL_BIN_STRING = 2
+RPL_BIN_DISPATCH = 3
+RPL_BIN_CLOCK = 4
+
+RPL_BIN_VALUE_INT64 = 2
+RPL_BIN_VALUE_DOUBLE = 4
+
+RPL_BIN_DISPATCH_TIME = 1
+RPL_BIN_DISPATCH_WEIGHT = 2
+
+record_fmt = struct.Struct('<II')
+header_fmt = struct.Struct('<IHHII')
+string_fmt = struct.Struct('<II')
+dispatch_fmt = struct.Struct('<14I3QIf4Q')
+value_fmt = struct.Struct('<II8s')
+int64_fmt = struct.Struct('<Q')
+double_fmt = struct.Struct('<d')
+
+# kernel properties in the text output order
+prop_names = ['gpu-id', 'queue-id', 'queue-index', 'pid', 'tid', 'grd', 'wgr', 'lds', 'scr', 'vgpr', 'sgpr', 'fbar', 'sig', 'obj']
+
+def fatal(msg):
+  sys.stderr.write(sys.argv[0] + ": " + msg + "\n");
+  sys.exit(1)
+
+# iterate file records, yields (type, payload)
+def read_records(infile):
+  with open(infile, mode='rb') as fd:
+    data = fd.read()
+  pos = 0
+  size = len(data)
+  while pos < size:
+    if pos + record_fmt.size > size: fatal("truncated record header in '" + infile + "'")
+    (rec_type, rec_size) = record_fmt.unpack_from(data, pos)
+    if rec_size < record_fmt.size or pos + rec_size > size: fatal("bad record size (" + str(rec_size) + ") in '" + infile + "'")
+    yield (rec_type, data[pos + record_fmt.size : pos + rec_size])
+    pos += rec_size
+
+# iterate dispatch records
+# yields dictionaries {index, pid, kernel-name, properties, time, values}
+def read_dispatches(infile):
+  strings = {}
+  version_ok = 0
+  for (rec_type, payload) in read_records(infile):
+    if rec_type == RPL_BIN_HEADER:
+      (magic, major, minor, pid, reserved) = header_fmt.unpack_from(payload, 0)
+      if magic != RPL_BIN_MAGIC: fatal("bad magic (" + hex(magic) + ") in '" + infile + "'")
+      if major != RPL_BIN_VERSION_MAJOR: fatal("unsupported version " + str(major) + "." + str(minor) + " in '" + infile + "'")
+      strings = {}
+      version_ok = 1
+    elif version_ok == 0:
+      fatal("header record expected in '" + infile + "'")
+    elif rec_type == RPL_BIN_STRING:
+      (str_id, length) = string_fmt.unpack_from(payload, 0)
+      strings[str_id] = payload[string_fmt.size : string_fmt.size + length].decode('utf-8', 'replace')
+    elif rec_type == RPL_BIN_DISPATCH:
+      f = dispatch_fmt.unpack_from(payload, 0)
+      (index, gpu_id, queue_id, pid, tid, grd, wgr, lds, scr, vgpr, sgpr, fbar, name_id, value_count) = f[0:14]
+      (queue_index, signal, obj) = f[14:17]
+      (flags, weight) = f[17:19]
+      prop_vals = [gpu_id, queue_id, queue_index, pid, tid, grd, wgr, lds, scr, vgpr, sgpr, fbar, hex(signal), hex(obj)]
+      properties = [(prop_names[i], str(prop_vals[i])) for i in range(len(prop_names))]
+      if flags & RPL_BIN_DISPATCH_WEIGHT: properties.append(('weight', '%.3f' % weight))
+      values = []
+      pos = dispatch_fmt.size
+      for i in range(value_count):
+        (val_name_id, kind, bits) = value_fmt.unpack_from(payload, pos)
+        pos += value_fmt.size
+        if kind == RPL_BIN_VALUE_INT64: val = str(int64_fmt.unpack(bits)[0])
+        elif kind == RPL_BIN_VALUE_DOUBLE: val = '%.10f' % double_fmt.unpack(bits)[0]
+        else: fatal("bad value kind (" + str(kind) + ") in '" + infile + "'")
+        values.append((strings[val_name_id], val))
+      yield {
+        'index': index,
+        'pid': pid,
+        'kernel-name': strings[name_id],
+        'properties': properties,
+        'time': tuple(str(t) for t in f[19:23]) if (flags & RPL_BIN_DISPATCH_TIME) else None,
+        'values': values
+      }
+    # clock records are used on merging only, unknown record types are skipped for forward compatibility
+
+# dumping records in the text format
+if __name__ == '__main__':
+  if len(sys.argv) < 2: fatal("Usage: " + sys.argv[0] + " <binary results file>")
+  for rec in read_dispatches(sys.argv[1]):
+    line = 'dispatch[' + str(rec['index']) + '], ' + ', '.join(var + '(' + val + ')' for (var, val) in rec['properties'])
+    line += ', kernel-name("' + rec['kernel-name'] + '")'
+    if rec['time']: line += ', time(' + ','.join(rec['time']) + ')'
+    print(line)
+    for (var, val) in rec['values']: print('  ' + var + ' (' + val + ')')
@@ -20,15 +20,62 @@
 # THE SOFTWARE.
 ################################################################################
 
-import csv, sqlite3, re, sys
+import csv, sqlite3, re, sys, os, multiprocessing
+from collections import deque
 from functools import reduce
 from txt2params import gen_params
 
+JSON_SUB_PTRN = re.compile(r'(^"|"$)')
+JSON_NAME_PTRN = re.compile(r'(name|Name)')
+
+# format JSON trace events chunk, the (table raw, data raw) pairs
+# called by the pool workers
+def format_json_chunk(args):
+  (table_fields, data_fields, raws) = args
+  events = []
+  for (values, data) in raws:
+    vals_list = []
+    for value_index in range(len(values)):
+      label = table_fields[value_index]
+      value = values[value_index]
+      if JSON_NAME_PTRN.search(label): value = JSON_SUB_PTRN.sub(r'', value)
+      if label != '"Index"':
+        if label == '"dur"' and value == 0:
+          vals_list.append('%s:"%s"' % (label, "1"))
+        else:
+          vals_list.append('%s:"%s"' % (label, value))
+
+    args_list = []
+    for value_index in range(len(data)):
+      label = data_fields[value_index]
+      value = data[value_index]
+      if label[:3] == '"__': continue
+      if JSON_NAME_PTRN.search(label): value = JSON_SUB_PTRN.sub(r'', value)
+      if label != '"Index"' and label != '"roctx-range"': args_list.append('%s:"%s"' % (label, value))
+
+    events.append(',{"ph":"%s",%s,\n  "args":{\n    %s\n  }\n}\n' % ('X', ','.join(vals_list), ',\n    '.join(args_list)))
+  return ''.join(events)
+
 # SQLite Database class
+# The inserted rows are buffered by table and bulk loaded by the prepared insert
+# statement in one transaction, the pending rows are flushed before any query.
+# The DB is generated in the WAL journal mode without syncing.
+#
+# The JSON trace events are streamed from the DB cursors by chunks and formatted
+# by a workers pool, ROCP_JSON_JOBS workers [CPUs number], the memory is bounded
+# by the chunks in flight.
 class SQLiteDB:
+  BATCH_SIZE = 50000
+  JSON_CHUNK_ROWS = 20000
+
   def __init__(self, file_name):
     self.connection = sqlite3.connect(file_name)
+    self.connection.execute('PRAGMA journal_mode=WAL')
+    self.connection.execute('PRAGMA synchronous=OFF')
+    self.connection.execute('PRAGMA temp_store=MEMORY')
     self.tables = {}
+    self.pending = []
+    self.json_pool = None
     self.section_index = 0
 
   def __del__(self):
@@ -54,10 +101,23 @@ class SQLiteDB:
     stm = 'INSERT INTO ' + name + '(' + fields_str + ') VALUES(' + templ_str + ');'
     self.tables[name] = stm
 
-    return (cursor, stm);
+    # table handle, the cursor, the insert statement and the pending rows
+    return (cursor, stm, [])
+
+  # bulk loading the pending rows
+  def _flush_table(self, table):
+    (cursor, stm, rows) = table
+    if len(rows) != 0:
+      cursor.executemany(stm, rows)
+      del rows[:]
+
+  def _flush(self):
+    for table in self.pending: self._flush_table(table)
+    self.pending = []
 
   # add columns to table
   def add_columns(self, name, columns):
+    self._flush()
     cursor = self.connection.cursor()
     for item in columns:
       stm = 'ALTER TABLE ' + name + ' ADD COLUMN "%s" %s' % (item[0], item[1])
@@ -66,52 +126,63 @@ class SQLiteDB:
 
   # add columns with expression
   def add_data_column(self, table_name, data_label, data_type, data_expr):
+    self._flush()
     cursor = self.connection.cursor()
     cursor.execute('ALTER TABLE %s ADD COLUMN "%s" %s' % (table_name, data_label, data_type))
     cursor.execute('UPDATE %s SET %s = (%s);' % (table_name, data_label, data_expr))
 
   def change_rec_name(self, table_name, rec_id, rec_name):
+    self._flush()
     self.connection.execute('UPDATE ' + table_name + ' SET Name = ? WHERE "Index" = ?', (rec_name, rec_id))
   def change_rec_tid(self, table_name, rec_id, tid):
+    self._flush()
     self.connection.execute('UPDATE ' + table_name + ' SET tid = ? WHERE "Index" = ?', (tid, rec_id))
   def change_rec_fld(self, table_name, fld_expr, rec_pat):
+    self._flush()
     self.connection.execute('UPDATE ' + table_name + ' SET ' + fld_expr + ' WHERE ' + rec_pat)
   def table_get_record(self, table_name, rec_pat):
+    self._flush()
     cursor = self.connection.execute('SELECT * FROM ' + table_name + ' WHERE ' + rec_pat)
     raws = cursor.fetchall()
     if len(raws) != 1: raise Exception('Record (' + rec_pat + ') is not unique, table "' + table_name + '"')
     return list(raws[0])
 
-  # populate DB table entry
+  # populate DB table entry, the row is buffered
   def insert_entry(self, table, val_list):
-    (cursor, stm) = table
-    cursor.execute(stm, val_list)
+    rows = table[2]
+    if len(rows) == 0: self.pending.append(table)
+    rows.append(val_list)
+    if len(rows) >= self.BATCH_SIZE: self._flush_table(table)
 
   # populate DB table entry
   def commit_entry(self, table, val_list):
     self.insert_entry(table, val_list)
-    self.connection.commit()
+    self.commit()
 
   # populate DB table data
   def insert_table(self, table, reader):
     for val_list in reader:
       if not val_list[-1]: val_list.pop()
       self.insert_entry(table, val_list)
-    self.connection.commit()
+    self.commit()
 
   # return table fields list
   def _get_fields(self, table_name):
+    self._flush()
     cursor = self.connection.execute('SELECT * FROM ' + table_name)
     return list(map(lambda x: '"%s"' % (x[0]), cursor.description))
 
   # return table raws list
   def _get_raws(self, table_name):
+    self._flush()
     cursor = self.connection.execute('SELECT * FROM ' + table_name)
     return cursor.fetchall()
   def _get_raws_indexed(self, table_name):
+    self._flush()
     cursor = self.connection.execute('SELECT * FROM ' + table_name + ' order by "Index" asc;')
     return cursor.fetchall()
   def _get_raw_by_id(self, table_name, rec_id):
+    self._flush()
     cursor = self.connection.execute('SELECT * FROM ' + table_name + ' WHERE "Index"=?', (rec_id,))
     raws = cursor.fetchall()
     if len(raws) != 1: raise Exception('Index is not unique, table "' + table_name + '"')
@@ -186,67 +257,78 @@ class SQLiteDB:
           fd.write('    "' + key + '": "' + params[nkey] + '",\n')
       fd.write('  }\n')
 
+  def _json_jobs(self):
+    jobs = os.environ.get('ROCP_JSON_JOBS')
+    if jobs is not None: return max(int(jobs), 1)
+    return multiprocessing.cpu_count()
+
   def dump_json(self, table_name, data_name, file_name):
     if not re.search(r'\.json$', file_name):
       raise Exception('wrong output file type: "' + file_name + '"' )
 
-    sub_ptrn = re.compile(r'(^"|"$)')
-    name_ptrn = re.compile(r'(name|Name)')
-
-    table_fields = self._get_fields(table_name)
-    table_raws = self._get_raws(table_name)
-    data_fields = self._get_fields(data_name)
-    data_raws = self._get_raws(data_name)
+    self._flush()
+    table_cursor = self.connection.cursor()
+    table_cursor.execute('SELECT * FROM ' + table_name)
+    table_fields = list(map(lambda x: '"%s"' % (x[0]), table_cursor.description))
+    data_cursor = self.connection.cursor()
+    data_cursor.execute('SELECT * FROM ' + data_name)
+    data_fields = list(map(lambda x: '"%s"' % (x[0]), data_cursor.description))
+    raws_count = self.connection.execute('SELECT count(*) FROM ' + data_name).fetchone()[0]
+
+    # the table and the data raws are of the same order
+    def chunks():
+      while True:
+        table_raws = table_cursor.fetchmany(self.JSON_CHUNK_ROWS)
+        data_raws = data_cursor.fetchmany(self.JSON_CHUNK_ROWS)
+        if len(table_raws) != len(data_raws):
+          raise Exception('JSON table "' + table_name + '" and data "' + data_name + '" mismatch')
+        if len(table_raws) == 0: break
+        yield (table_fields, data_fields, list(zip(table_raws, data_raws)))
+
+    jobs = self._json_jobs() if raws_count > self.JSON_CHUNK_ROWS else 1
+    if jobs > 1 and self.json_pool is None: self.json_pool = multiprocessing.Pool(jobs)
 
     with open(file_name, mode='a') as fd:
-      table_raws_len = len(table_raws)
-      for raw_index in range(table_raws_len):
-        if (raw_index == table_raws_len - 1) or (raw_index % 1000 == 0):
-          sys.stdout.write( \
-            "\rdump json " + str(raw_index) + ":" + str(len(table_raws))  + " "*100 \
-          )
-
-        vals_list = []
-        values = list(table_raws[raw_index])
-        for value_index in range(len(values)):
-          label = table_fields[value_index]
-          value = values[value_index]
-          if name_ptrn.search(label): value = sub_ptrn.sub(r'', value)
-          if label != '"Index"':
-            if label == '"dur"' and value == 0:
-              vals_list.append('%s:"%s"' % (label, "1"))
-            else:
-              vals_list.append('%s:"%s"' % (label, value))
-
-        args_list = []
-        data = list(data_raws[raw_index])
-        for value_index in range(len(data)):
-          label = data_fields[value_index]
-          value = data[value_index]
-          if label[:3] == '"__': continue
-          if name_ptrn.search(label): value = sub_ptrn.sub(r'', value)
-          if label != '"Index"' and label != '"roctx-range"': args_list.append('%s:"%s"' % (label, value))
-
-        fd.write(',{"ph":"%s",%s,\n  "args":{\n    %s\n  }\n}\n' % ('X', ','.join(vals_list), ',\n    '.join(args_list)))
+      raw_index = 0
+      inflight = deque()
+      def write_chunk(text):
+        fd.write(text)
+        sys.stdout.write("\rdump json " + str(raw_index) + ":" + str(raws_count)  + " "*100)
+
+      for chunk in chunks():
+        raw_index += len(chunk[2])
+        if jobs > 1:
+          inflight.append(self.json_pool.apply_async(format_json_chunk, (chunk,)))
+          if len(inflight) >= 2 * jobs: write_chunk(inflight.popleft().get())
+        else:
+          write_chunk(format_json_chunk(chunk))
+      while inflight: write_chunk(inflight.popleft().get())
 
     sys.stdout.write('\n')
 
   # execute query on DB
   def execute(self, cmd):
+    self._flush()
     cursor = self.connection.cursor()
     cursor.execute(cmd)
 
   # commit DB
   def commit(self):
+    self._flush()
     self.connection.commit()
 
   # close DB
   def close(self):
-    self.connection.commit()
+    if self.json_pool is not None:
+      self.json_pool.close()
+      self.json_pool.join()
+      self.json_pool = None
+    self.commit()
     self.connection.close()
 
   # access DB
   def get_raws(self, table_name):
+    self._flush()
     cur = self.connection.cursor()
     cur.execute("SELECT * FROM %s" % table_name)
     return cur.fetchall()
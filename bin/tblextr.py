@@ -20,10 +20,11 @@
 # THE SOFTWARE.
 ################################################################################
 
-import os, sys, re, subprocess, bisect
+import os, sys, re, subprocess
 from sqlitedb import SQLiteDB
 from mem_manager import MemManager
 import dform
+import rplbin
 
 mcopy_data_enabled = 1 if 'ROCP_MCOPY_DATA' in os.environ else 0
 
@@ -106,14 +107,67 @@ def metadata_gen(sysinfo_file, sysinfo_cmd):
   if status != 0:
     raise Exception('Could not run command: "' + sysinfo_cmd + '"')
 
+# add dispatch record method
+def add_dispatch(var_table_pid, dispatch_number, kernel_name, kernel_properties, ts):
+  global max_gpu_id
+  if (var_table_pid, dispatch_number) in var_table: return
+  var_table[(var_table_pid, dispatch_number)] = {
+    'Index': dispatch_number,
+    'KernelName': "\"" + kernel_name + "\""
+  }
+
+  gpu_id = 0
+  queue_id = 0
+  disp_pid = 0
+  disp_tid = 0
+
+  for (var, val) in kernel_properties:
+    var_table[(var_table_pid, dispatch_number)][var] = val
+    if not var in var_list: var_list.append(var);
+    if var == 'gpu-id':
+      gpu_id = int(val)
+      if (gpu_id > max_gpu_id): max_gpu_id = gpu_id
+    if var == 'queue-id': queue_id = int(val)
+    if var == 'pid': disp_pid = int(val)
+    if var == 'tid': disp_tid = int(val)
+
+  if ts:
+    var_table[(var_table_pid, dispatch_number)]['DispatchNs'] = ts[0]
+    var_table[(var_table_pid, dispatch_number)]['BeginNs'] = ts[1]
+    var_table[(var_table_pid, dispatch_number)]['EndNs'] = ts[2]
+    var_table[(var_table_pid, dispatch_number)]['CompleteNs'] = ts[3]
+
+    ## filling dependenciws
+    from_ns = int(ts[0])
+    to_ns = int(ts[1])
+    from_us = int((from_ns - START_NS) / 1000)
+    to_us = int((to_ns - START_NS) / 1000)
+
+    kern_dep_list.append((from_ns, disp_pid, disp_tid))
+
+    gpu_pid = GPU_BASE_PID + int(gpu_id)
+    if not disp_pid in dep_dict: dep_dict[disp_pid] = {}
+    dep_proc = dep_dict[disp_pid]
+    if not gpu_pid in dep_proc: dep_proc[gpu_pid] = { 'pid': HSA_PID, 'from': [], 'to': {}, 'id': [] }
+    dep_str = dep_proc[gpu_pid]
+    to_id = len(dep_str['from'])
+    dep_str['from'].append((from_us, disp_tid, disp_tid))
+    dep_str['to'][to_id] = to_us
+    ##
+
+# add dispatch variable method
+def add_var(var_table_pid, dispatch_number, var, val):
+  if not (var_table_pid, dispatch_number) in var_table: fatal("Error: dispatch number not found '" + str(dispatch_number) + "'")
+  var_table[(var_table_pid, dispatch_number)][var] = val
+  if not var in var_list: var_list.append(var)
+
 # parse results method
 def parse_res(infile):
-  global max_gpu_id
   if not os.path.isfile(infile): return
   inp = open(infile, 'r')
 
   beg_pattern = re.compile("^dispatch\[(\d*)\], (.*) kernel-name\(\"([^\"]*)\"\)")
-  prop_pattern = re.compile("([\w-]+)\((\w+)\)");
+  prop_pattern = re.compile("([\w-]+)\(([\w.]+)\)");
   ts_pattern = re.compile(", time\((\d*),(\d*),(\d*),(\d*)\)")
   # var pattern below matches a variable name and a variable value from a one
   # line text in the format of for example "WRITE_SIZE (0.2500000000)" or
@@ -131,69 +185,38 @@ def parse_res(infile):
 
     m = var_pattern.match(record)
     if m:
-      if not (var_table_pid, dispatch_number) in var_table: fatal("Error: dispatch number not found '" + str(dispatch_number) + "'")
-      var = m.group(1)
-      val = m.group(2)
-      var_table[(var_table_pid, dispatch_number)][var] = val
-      if not var in var_list: var_list.append(var)
+      add_var(var_table_pid, dispatch_number, m.group(1), m.group(2))
 
     m = beg_pattern.match(record)
     if m:
       dispatch_number = m.group(1)
       if not (var_table_pid, dispatch_number) in var_table:
-        var_table[(var_table_pid, dispatch_number)] = {
-          'Index': dispatch_number,
-          'KernelName': "\"" + m.group(3) + "\""
-        }
-
-        gpu_id = 0
-        queue_id = 0
-        disp_pid = 0
-        disp_tid = 0
-
+        kernel_name = m.group(3)
         kernel_properties = m.group(2)
+        prop_list = []
         for prop in kernel_properties.split(', '):
           m = prop_pattern.match(prop)
-          if m:
-            var = m.group(1)
-            val = m.group(2)
-            var_table[(var_table_pid, dispatch_number)][var] = val
-            if not var in var_list: var_list.append(var);
-            if var == 'gpu-id':
-              gpu_id = int(val)
-              if (gpu_id > max_gpu_id): max_gpu_id = gpu_id
-            if var == 'queue-id': queue_id = int(val)
-            if var == 'pid': disp_pid = int(val)
-            if var == 'tid': disp_tid = int(val)
+          if m: prop_list.append((m.group(1), m.group(2)))
           else: fatal('wrong kernel property "' + prop + '" in "'+ kernel_properties + '"')
+        ts = None
         m = ts_pattern.search(record)
-        if m:
-          var_table[(var_table_pid, dispatch_number)]['DispatchNs'] = m.group(1)
-          var_table[(var_table_pid, dispatch_number)]['BeginNs'] = m.group(2)
-          var_table[(var_table_pid, dispatch_number)]['EndNs'] = m.group(3)
-          var_table[(var_table_pid, dispatch_number)]['CompleteNs'] = m.group(4)
-
-          ## filling dependenciws
-          from_ns = int(m.group(1))
-          to_ns = int(m.group(2))
-          from_us = int((from_ns - START_NS) / 1000)
-          to_us = int((to_ns - START_NS) / 1000)
-
-          kern_dep_list.append((from_ns, disp_pid, disp_tid))
-
-          gpu_pid = GPU_BASE_PID + int(gpu_id)
-          if not disp_pid in dep_dict: dep_dict[disp_pid] = {}
-          dep_proc = dep_dict[disp_pid]
-          if not gpu_pid in dep_proc: dep_proc[gpu_pid] = { 'pid': HSA_PID, 'from': [], 'to': {}, 'id': [] }
-          dep_str = dep_proc[gpu_pid]
-          to_id = len(dep_str['from'])
-          dep_str['from'].append((from_us, disp_tid, disp_tid))
-          dep_str['to'][to_id] = to_us
-          ##
+        if m: ts = (m.group(1), m.group(2), m.group(3), m.group(4))
+        add_dispatch(var_table_pid, dispatch_number, kernel_name, prop_list, ts)
 
   inp.close()
 #############################################################
 
+# parse binary results method
+def parse_bin(infile):
+  if not os.path.isfile(infile): return
+  for rec in rplbin.read_dispatches(infile):
+    var_table_pid = 0 if os.getenv('ROCP_MERGE_PIDS') else rec['pid']
+    dispatch_number = str(rec['index'])
+    add_dispatch(var_table_pid, dispatch_number, rec['kernel-name'], rec['properties'], rec['time'])
+    for (var, val) in rec['values']:
+      add_var(var_table_pid, dispatch_number, var, val)
+#############################################################
+
 # Comparator to sort a dictionary of tuples. This comparator will convert
 # the second element of tuple to an int and return the new tuple. Then
 # the dictionary can use the default comparison i.e sort by first element,
@@ -238,7 +261,7 @@ def fill_kernel_db(table_name, db):
   keys = sorted(var_table.keys(), key=tuple_comparator)
 
   for var in set(var_list).difference(set(table_descr[1])):
-    table_descr[1][var] = 'INTEGER'
+    table_descr[1][var] = 'REAL' if var == 'weight' else 'INTEGER'
   table_descr[0] = var_list;
 
   table_handle = db.add_table(table_name, table_descr)
@@ -374,7 +397,7 @@ def fill_api_db(table_name, db, indir, api_name, api_pid, dep_pid, dep_list, dep
   global hsa_activity_found
   global memory_manager
 
-  range_start_times = {}
+  range_ops = {}
   copy_csv = ''
   copy_index = 0
 
@@ -531,26 +554,11 @@ def fill_api_db(table_name, db, indir, api_name, api_pid, dep_pid, dep_list, dep
           copy_index += 1
 
         if op_found:
-          roctx_msg = ''
-
-          if not thread_id in range_start_times:
-            range_start_times[thread_id] = sorted(range_data[thread_id].keys()) if thread_id in range_data else []
-          start_times = range_start_times[thread_id]
-
-          index = bisect.bisect_right(start_times,int(rec_vals[0]))
-          if index > 0:
-            # We found the range that is closest to this operation. Iterate the
-            # range stack this range is part of until we find a range that entirely
-            # contains the operation.
-            range_start = start_times[index - 1]
-            while range_start != 0:
-              (range_end, range_start, msg) = range_data[thread_id][range_start]
-              if int(rec_vals[1]) < range_end:
-                # This range contains the operation.
-                roctx_msg = msg
-                break
-
-          ops_patch_data[(corr_id, proc_id)] = (thread_id, stream_id, kernel_str, roctx_msg)
+          # the roctx range is resolved after the scan
+          ops_patch_data[(corr_id, proc_id)] = (thread_id, stream_id, kernel_str, '')
+          if thread_id in range_data:
+            if not thread_id in range_ops: range_ops[thread_id] = {}
+            range_ops[thread_id][(corr_id, proc_id)] = (int(rec_vals[0]), int(rec_vals[1]))
 
         if op_found:
           op_found = 0
@@ -579,6 +587,27 @@ def fill_api_db(table_name, db, indir, api_name, api_pid, dep_pid, dep_list, dep
         # inserting an API record to DB
         db.insert_entry(table_handle, rec_vals)
 
+  # resolving the operations roctx ranges, by thread in one merge pass of the
+  # operations and the ranges sorted by the begin timestamps
+  for (thread_id, ops) in range_ops.items():
+    thread_ranges = range_data[thread_id]
+    start_times = sorted(thread_ranges.keys())
+    index = 0
+    for (beg_ns, end_ns, key) in sorted((v[0], v[1], k) for (k, v) in ops.items()):
+      while index < len(start_times) and start_times[index] <= beg_ns: index += 1
+      if index == 0: continue
+      # We found the range that is closest to this operation. Iterate the
+      # range stack this range is part of until we find a range that entirely
+      # contains the operation.
+      range_start = start_times[index - 1]
+      while range_start != 0:
+        (range_end, range_start, msg) = thread_ranges[range_start]
+        if end_ns < range_end:
+          # This range contains the operation.
+          (patch_tid, patch_stream, patch_kernel, _) = ops_patch_data[key]
+          if patch_tid == thread_id: ops_patch_data[key] = (patch_tid, patch_stream, patch_kernel, msg)
+          break
+
   # inserting of dispatch events correlated to the dependent dispatches
   for (from_ns, proc_id, thread_id) in dep_list:
     if not proc_id in record_id_dict: record_id_dict[proc_id] = 0
@@ -809,6 +838,9 @@ else:
 if inext == '.txt':
   for f in infiles: parse_res(f)
   if len(var_table) != 0: merge_table()
+elif inext == '.bin':
+  for f in infiles: parse_bin(f)
+  if len(var_table) != 0: merge_table()
 
 if dbfile == '':
   dump_csv(csvfile)
@@ -865,7 +897,9 @@ else:
 
   if len(var_table) != 0:
     dform.post_process_data(db, 'KERN', csvfile)
-    dform.gen_table_bins(db, 'KERN', statfile, 'KernelName', 'DurationNs')
+    # sampled dispatches are scaled by the sampling weights
+    weight_var = 'weight' if 'weight' in var_list else ''
+    dform.gen_table_bins(db, 'KERN', statfile, 'KernelName', 'DurationNs', weight_var)
     if hsa_trace_found and 'BeginNs' in var_list:
       dform.gen_kernel_json_trace(db, 'KERN', GPU_BASE_PID, START_NS, jsonfile)
 
@@ -75,6 +75,18 @@ typedef struct {
   uint32_t k_concurrent;
   uint32_t opt_mode;
   uint32_t obj_dumping;
+  uint32_t kernel_replay;
+  uint32_t sample_rate;
+  uint32_t sample_budget;
+  uint32_t trace_stream;
+  uint32_t k_window;       // concurrent counters window dispatches, k_concurrent 3
+  uint32_t k_window_time;  // concurrent counters window time limit in usec, 0 is unlimited
+  uint32_t k_accumulate;   // same kernel dispatches per accumulated counters range, 0 is off
+  uint32_t q_agents;       // GPU agents indexes mask of the intercepted queues, 0 is all agents
+  uint32_t q_types;        // queue types mask of the intercepted queues, 1 << hsa_queue_type_t, 0 is all
+  uint32_t q_budget;       // profiled dispatches per queue before the queue is detached, 0 is unlimited
+  uint32_t converge_tol;   // per-kernel convergence relative confidence interval in percent, 0 is off
+  uint32_t converge_rate;  // converged kernels background profiling rate 1/N, 0 is the default 100
 } rocprofiler_settings_t;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -249,11 +261,12 @@ typedef struct {
   uint32_t queue_id;                                   // Queue id
   hsa_signal_t completion_signal;                      // Completion signal
   const hsa_kernel_dispatch_packet_t* packet;          // HSA dispatch packet
-  const char* kernel_name;                             // Kernel name
+  const char* kernel_name;                             // Kernel name, valid until code object destroy if objects tracking is enabled
   uint64_t kernel_object;                              // Kernel object address
   const amd_kernel_code_t* kernel_code;                // Kernel code pointer
   uint32_t thread_id;                                   // Thread id
   const rocprofiler_dispatch_record_t* record;         // Dispatch record
+  float weight;                                        // Sampling weight, 1 if sampling is off
 } rocprofiler_callback_data_t;
 
 // Profiling callback type
@@ -269,7 +282,8 @@ typedef struct {
     hsa_status_t (*destroy)(hsa_queue_t* queue, void* data);  // destroy callback
 } rocprofiler_queue_callbacks_t;
 
-// Set queue callbacks
+// Set queue callbacks, the callbacks can be replaced at runtime, the dispatches
+// started/stopped state is kept on the replacement
 hsa_status_t rocprofiler_set_queue_callbacks(
     rocprofiler_queue_callbacks_t callbacks,           // callbacks
     void* data);                                       // [in/out] passed callbacks data
@@ -277,6 +291,30 @@ hsa_status_t rocprofiler_set_queue_callbacks(
 // Remove queue callbacks
 hsa_status_t rocprofiler_remove_queue_callbacks();
 
+// Queue callbacks dispatch filter, the dispatch callback is called only for
+// the selected dispatches. The dispatch index counts the intercepted dispatches,
+// the sampling and the max count are applied per kernel to the matching dispatches.
+typedef struct {
+  const char* kernel_name_regex;                       // kernel name regex, NULL for all kernels
+  uint64_t index_begin;                                // dispatch index range begin
+  uint64_t index_end;                                  // dispatch index range end, zero for no limit
+  uint32_t sample_rate;                                // every Nth dispatch per kernel, zero for all
+  uint32_t kernel_max;                                 // max dispatches per kernel, zero for no limit
+} rocprofiler_dispatch_filter_t;
+
+// Set queue callbacks dispatch filter, NULL filter removes the filter
+hsa_status_t rocprofiler_set_queue_callbacks_filter(
+    const rocprofiler_dispatch_filter_t* filter);     // [in] dispatch filter
+
+// Adding a profiled dispatch observation to the kernel convergence statistics, the
+// duration and the counters values. With the settings converge_tol a kernel is
+// profiled at the background rate once the values means confidence intervals are
+// within the tolerance, the background dispatches have the rate weight.
+hsa_status_t rocprofiler_converge_update(
+    uint64_t kernel_object,                           // [in] dispatch kernel object
+    const double* values,                             // [in] observation values
+    uint32_t count);                                  // [in] values count, the same per kernel
+
 // Start/stop queue callbacks
 hsa_status_t rocprofiler_start_queue_callbacks();
 hsa_status_t rocprofiler_stop_queue_callbacks();
@@ -312,6 +350,16 @@ hsa_status_t rocprofiler_get_group(rocprofiler_t* context,       // [in] profili
                                    uint32_t group_index,         // profiling group index
                                    rocprofiler_group_t* group);  // [out] profiling group
 
+// Plan profiling groups, dry-run not opening a context
+// The metrics features are partitioned to the minimal number of groups fitting the HW
+// counters limits, each group is to be collected by a separate profiling pass
+hsa_status_t rocprofiler_plan_groups(hsa_agent_t agent,                       // GPU handle
+                                     const rocprofiler_feature_t* features,   // [in] profiling features array
+                                     uint32_t feature_count,                  // profiling features count
+                                     uint32_t* group_count,                   // [out] planned groups count
+                                     uint32_t* group_indexes);                // [out] group index per feature,
+                                                                              // optional, can be NULL
+
 // Start profiling
 hsa_status_t rocprofiler_group_start(rocprofiler_group_t* group);  // [in/out] profiling group
 
@@ -324,9 +372,27 @@ hsa_status_t rocprofiler_group_read(rocprofiler_group_t* group);  // [in/out] pr
 // Get profiling data
 hsa_status_t rocprofiler_group_get_data(rocprofiler_group_t* group);  // [in/out] profiling group
 
+// Get the dispatches number covered by the group data, more than one if the counters
+// are accumulated over a range of the same kernel dispatches, see 'k_accumulate'
+hsa_status_t rocprofiler_group_get_dispatch_count(const rocprofiler_group_t* group,  // [in] profiling group
+                                                  uint32_t* count);                  // [out] dispatches number
+
+// Get the kernel objects of the dispatches covered by the group data, the concurrent
+// counters window dispatches, see 'k_concurrent'. The objects array is valid until
+// the group context is reset or closed, the count is zero for a not window group.
+hsa_status_t rocprofiler_group_get_kernel_objects(const rocprofiler_group_t* group,  // [in] profiling group
+                                                  const uint64_t** objects,          // [out] kernel objects array
+                                                  uint32_t* count);                  // [out] kernel objects number
+
 // Get metrics data
 hsa_status_t rocprofiler_get_metrics(const rocprofiler_t* context);  // [in/out] profiling context
 
+// Get metrics data for a batch of contexts
+// The contexts opened with the same metrics are evaluated at once, the results
+// are stored as by 'rocprofiler_get_metrics' for every context
+hsa_status_t rocprofiler_get_metrics_batch(const rocprofiler_t** contexts,  // [in/out] profiling contexts
+                                           uint32_t context_count);         // [in] contexts count
+
 // Definition of output data iterator callback
 typedef hsa_ven_amd_aqlprofile_data_callback_t rocprofiler_trace_data_callback_t;
 
@@ -336,6 +402,16 @@ hsa_status_t rocprofiler_iterate_trace_data(
     rocprofiler_trace_data_callback_t callback,  // callback to iterate the output data
     void* data);                                 // [in/out] callback data
 
+// Method for iterating the events output data asynchronously
+// The data are copied to the host by DMA and the callback is called on the copy
+// completion from the runtime handler thread, the host copy is valid during the callback.
+// The context close does not wait for the outstanding copies, the context is released
+// on the last copy completion and the close can be called from the completion handler.
+hsa_status_t rocprofiler_iterate_trace_data_async(
+    rocprofiler_t* context,                      // [in] profiling context
+    rocprofiler_trace_data_callback_t callback,  // callback to iterate the output data
+    void* data);                                 // [in/out] callback data
+
 ////////////////////////////////////////////////////////////////////////////////
 // Profiling features and data
 //
@@ -349,9 +425,39 @@ typedef enum {
   ROCPROFILER_INFO_KIND_TRACE = 2, // trace info
   ROCPROFILER_INFO_KIND_TRACE_COUNT = 3, // trace features count, int32
   ROCPROFILER_INFO_KIND_TRACE_PARAMETER = 4, // trace parameter info
-  ROCPROFILER_INFO_KIND_TRACE_PARAMETER_COUNT = 5 // trace parameter count, int32
+  ROCPROFILER_INFO_KIND_TRACE_PARAMETER_COUNT = 5, // trace parameter count, int32
+  ROCPROFILER_INFO_KIND_OVERHEAD = 6, // profiler overhead, rocprofiler_overhead_t per section
+  ROCPROFILER_INFO_KIND_QUEUE_STATS = 7 // queues intercepting statistics, rocprofiler_queue_stats_t
 } rocprofiler_info_kind_t;
 
+// Profiler overhead sections, the accounting is enabled by ROCP_OVERHEAD
+typedef enum {
+  ROCPROFILER_OVERHEAD_SUBMIT = 0, // queue packets submit callback
+  ROCPROFILER_OVERHEAD_TRACKER_ALLOC = 1, // dispatch tracker entry allocation
+  ROCPROFILER_OVERHEAD_TRACKER_HANDLER = 2, // dispatch completion handler
+  ROCPROFILER_OVERHEAD_CONTEXT_DATA = 3, // context profiling data collecting
+  ROCPROFILER_OVERHEAD_METRICS_DATA = 4, // context metrics evaluating
+  ROCPROFILER_OVERHEAD_SECTION_COUNT = 5
+} rocprofiler_overhead_section_t;
+
+// Profiler overhead section data
+typedef struct {
+  uint64_t calls; // section calls number
+  uint64_t time_ns; // section accumulated time
+} rocprofiler_overhead_t;
+
+// Queues intercepting statistics, the packets per submit call ratio is the submit
+// coalescing factor
+typedef struct {
+  uint64_t queues; // intercepted queues
+  uint64_t bypassed; // queues created without intercepting by the queue filters
+  uint64_t detached; // queues detached by the per-queue profiled dispatches budget
+  uint64_t submits; // submit callback calls
+  uint64_t packets; // submitted packets
+  uint64_t dispatches; // kernel dispatch packets
+  uint64_t profiled; // profiled kernel dispatches
+} rocprofiler_queue_stats_t;
+
 // Profiling info query
 typedef union {
   rocprofiler_info_kind_t info_kind; // queried profiling info kind
@@ -459,11 +565,20 @@ hsa_status_t rocprofiler_pool_fetch(
   rocprofiler_pool_t* pool,           // profiling pool handle
   rocprofiler_pool_entry_t* entry);   // [out] empty profiling pool entry
 
-// Release profiling pool entry
+// Fetch a batch of profiling pool entries reserved at once,
+// unused entries are to be returned by rocprofiler_pool_release
+hsa_status_t rocprofiler_pool_fetch_batch(
+  rocprofiler_pool_t* pool,           // profiling pool handle
+  rocprofiler_pool_entry_t* entries,  // [out] empty profiling pool entries array
+  uint32_t entry_count);              // entries count, not greater than the pool size
+
+// Release profiling pool entry, the fetched entry which was not dispatched
+// is returned to the pool without the completion handler call
 hsa_status_t rocprofiler_pool_release(
   rocprofiler_pool_entry_t* entry);   // released profiling pool entry
 
-// Iterate fetched profiling pool entries
+// Iterate fetched and not completed profiling pool entries, the iteration doesn't
+// block fetching, must not be called from the pool completion handler
 hsa_status_t rocprofiler_pool_iterate(
   rocprofiler_pool_t* pool,           // profiling pool handle
   hsa_status_t (*callback)(rocprofiler_pool_entry_t* entry, void* data), // callback
@@ -473,6 +588,63 @@ hsa_status_t rocprofiler_pool_iterate(
 hsa_status_t rocprofiler_pool_flush(
   rocprofiler_pool_t* pool);          // profiling pool handle
 
+////////////////////////////////////////////////////////////////////////////////
+// Periodic counters sampler
+//
+// Standalone counters monitoring at a fixed rate. The counters are started once
+// and are read periodically by the sampler thread into a ring of device buffers,
+// the samples are the base counters values accumulated since the start.
+
+// Sampler handle
+typedef void rocprofiler_sampler_t;
+
+// Sampler properties, zero fields select the defaults
+typedef struct {
+  uint32_t rate_hz;                    // sampling rate, 1000 by default
+  uint32_t ring_size;                  // device read buffers number, reads in flight bound, 4 by default
+  uint32_t history;                    // host samples history size, 1024 by default
+  hsa_queue_t* queue;                  // queue for the sampling packets, created if NULL
+  uint32_t queue_depth;                // created queue depth
+} rocprofiler_sampler_properties_t;
+
+// Open sampler for a given agent and a set of base counters
+hsa_status_t rocprofiler_sampler_open(
+  hsa_agent_t agent,                   // GPU handle
+  const rocprofiler_feature_t* features, // [in] sampled metrics array
+  uint32_t feature_count,              // sampled metrics count
+  rocprofiler_sampler_properties_t* properties, // [in/out] sampler properties
+  rocprofiler_sampler_t** sampler);    // [out] sampler handle
+
+// Close sampler, stopping it if running
+hsa_status_t rocprofiler_sampler_close(
+  rocprofiler_sampler_t* sampler);     // sampler handle
+
+// Start sampling, the samples history is reset
+hsa_status_t rocprofiler_sampler_start(
+  rocprofiler_sampler_t* sampler);     // sampler handle
+
+// Stop sampling, the reads in flight are completed
+hsa_status_t rocprofiler_sampler_stop(
+  rocprofiler_sampler_t* sampler);     // sampler handle
+
+// Fetch the samples starting from the given sequence number, not blocking.
+// The latest 'max_count' samples are returned if more are available, the values
+// are stored as 'feature_count' values per sample in the features order.
+// The sequence number is updated to the next sample number, a gap to the first
+// returned sample number means the samples were overwritten in the history.
+hsa_status_t rocprofiler_sampler_fetch(
+  rocprofiler_sampler_t* sampler,      // sampler handle
+  uint64_t* seq,                       // [in/out] first requested sample number
+  uint32_t max_count,                  // samples capacity of the output arrays
+  uint64_t* values,                    // [out] samples values, max_count * feature_count
+  uint64_t* timestamps,                // [out] samples read timestamps ns, can be NULL
+  uint32_t* count);                    // [out] fetched samples count
+
+// Get the number of sampling periods skipped as all the ring buffers were in flight
+hsa_status_t rocprofiler_sampler_get_overruns(
+  const rocprofiler_sampler_t* sampler, // sampler handle
+  uint64_t* overruns);                 // [out] skipped periods count
+
 ////////////////////////////////////////////////////////////////////////////////
 // HSA intercepting API
 
@@ -558,6 +730,27 @@ hsa_status_t rocprofiler_set_hsa_callbacks(
   const rocprofiler_hsa_callbacks_t callbacks, // HSA callback function
   void* arg); // callback user data
 
+// Memory copy completion record, the async copies are tracked if 'memcopy_tracking' is set
+typedef struct {
+  uint64_t index;         // copy index, shared with the dispatches records index sequence
+  hsa_agent_t src_agent;  // source agent, the copy agent for a rect copy
+  hsa_agent_t dst_agent;  // destination agent, the copy agent for a rect copy
+  uint64_t size;          // copy size bytes
+  uint64_t begin;         // copy begin timestamp ns
+  uint64_t end;           // copy end timestamp ns
+} rocprofiler_memcopy_record_t;
+
+// Memory copy completion callback, called from the completion handler thread
+typedef void (*rocprofiler_memcopy_callback_t)(
+  const rocprofiler_memcopy_record_t* record, // [in] copy record, valid during the call
+  void* arg); // [in/out] user passed data
+
+// Set memory copy completion callback, the completed copies are printed to stdout if
+// the callback is not set. The NULL callback restores the printing.
+hsa_status_t rocprofiler_set_memcopy_callback(
+  rocprofiler_memcopy_callback_t callback, // completion callback
+  void* arg); // callback user data
+
 #ifdef __cplusplus
 }  // extern "C" block
 #endif  // __cplusplus
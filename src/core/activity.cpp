@@ -28,8 +28,13 @@ THE SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <atomic>
+#include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // Tracer messages protocol
 #include <prof_protocol.h>
@@ -40,6 +45,20 @@ THE SOFTWARE.
 
 #define PUBLIC_API __attribute__((visibility("default")))
 
+// Activity batch callback, the records array is valid during the callback
+typedef void (*activity_batch_callback_t)(uint32_t op, const activity_record_t* records, uint32_t count, void* arg);
+
+// PC samples histogram entry, the sampled PC is 'code_base + offset'
+struct pcsmp_hist_entry_t {
+  uint64_t offset;  // PC offset from the kernel code entry
+  uint64_t count;   // samples count
+};
+
+// PC samples histogram callback, called per kernel at the session end or flush,
+// the kernel name is NULL if the executables tracking is off
+typedef void (*activity_hist_callback_t)(uint32_t op, const char* kernel_name, uint64_t code_base,
+                                         const pcsmp_hist_entry_t* entries, uint32_t count, void* arg);
+
 // Error handler
 void fatal(const std::string msg) {
   fflush(stdout);
@@ -60,84 +79,182 @@ void check_status(hsa_status_t status) {
 
 // Activity primitives
 namespace activity_prim {
-// PC sampling callback data
-struct pcsmp_callback_data_t {
-  const char* kernel_name;     // sampled kernel name
-  void* data_buffer;           // host buffer for tracing data
-  uint64_t id;                 // sample id
-  uint64_t cycle;              // sample cycle
-  uint64_t pc;                 // sample PC
+// Kernel PC samples histogram
+struct pcsmp_kernel_hist_t {
+  uint64_t code_base;                            // kernel code entry address
+  std::unordered_map<uint64_t, uint64_t> counts; // PC offset to samples count
+};
+
+// PC sampling session, one per agent. The profiling contexts are reused from the
+// agent contexts pool, the samples of a completed context are decoded to the
+// session batch and the batch is delivered by one activity callback call if the
+// batch callback is set, by the per-record callback calls otherwise.
+struct pcsmp_session_t {
+  hsa_agent_t agent;                          // sampled agent
+  rocprofiler_pool_t* pool;                   // the agent contexts pool
+  rocprofiler_feature_t feature;              // PC sampling feature
+  rocprofiler_parameter_t parameter;          // the feature parameter
+  void* data_buffer;                          // host staging buffer for the local trace data
+  uint32_t data_size;                         // the staging buffer size
+  std::vector<activity_record_t> batch;       // decoded samples batch
+  std::mutex hist_mutex;                      // histograms mutex
+  std::map<uint64_t, pcsmp_kernel_hist_t> hist_map; // histograms by kernel object
+};
+
+// PC sample data as copied from the trace buffer
+struct pcsmp_sample_t {
+  uint64_t pc;
+  uint64_t cycle;
 };
 
+// Contexts pool size per agent
+static const uint32_t PCSMP_POOL_SIZE = 16;
+
 uint32_t activity_op = UINT32_MAX;
 void* activity_arg = NULL;
 std::atomic<activity_async_callback_t> activity_callback{NULL};
-rocprofiler_t* context = NULL;
+std::atomic<activity_batch_callback_t> activity_batch_callback{NULL};
+void* activity_batch_arg = NULL;
+std::atomic<activity_hist_callback_t> activity_hist_callback{NULL};
+void* activity_hist_arg = NULL;
+
+std::mutex session_mutex;
+std::map<uint64_t, pcsmp_session_t*> session_map;
 
 hsa_status_t trace_data_cb(hsa_ven_amd_aqlprofile_info_type_t info_type,
                            hsa_ven_amd_aqlprofile_info_data_t* info_data,
                            void* data) {
-  const pcsmp_callback_data_t* pcsmp_data = (pcsmp_callback_data_t*) data;
+  pcsmp_session_t* session = reinterpret_cast<pcsmp_session_t*>(data);
+  if (info_type != HSA_VEN_AMD_AQLPROFILE_INFO_TRACE_DATA) return HSA_STATUS_SUCCESS;
 
   activity_record_t record{};
   record.op = activity_op;
-  record.pc_sample.se = pcsmp_data->id;
-  record.pc_sample.cycle = pcsmp_data->cycle;
-  record.pc_sample.pc = pcsmp_data->pc;
-  activity_async_callback_t fun = activity_callback.load(std::memory_order_acquire);
-  if (fun) {
-    (fun)(activity_op, &record, activity_arg);
-  } else {
-    free((void*)(pcsmp_data->kernel_name));
+  record.pc_sample.se = info_data->sample_id;
+  if (info_data->trace_data.size >= sizeof(pcsmp_sample_t)) {
+    const pcsmp_sample_t* sample = reinterpret_cast<const pcsmp_sample_t*>(info_data->trace_data.ptr);
+    if (rocprofiler::TraceProfile::IsLocal()) {
+      // The local memory sample is copied to the staging buffer
+      rocprofiler::util::HsaRsrcFactory* hsa_rsrc = &rocprofiler::util::HsaRsrcFactory::Instance();
+      if (hsa_rsrc->Memcpy(session->agent, session->data_buffer, sample, sizeof(pcsmp_sample_t)) == false) {
+        fatal("PC sample copy failed");
+      }
+      sample = reinterpret_cast<const pcsmp_sample_t*>(session->data_buffer);
+    }
+    record.pc_sample.cycle = sample->cycle;
+    record.pc_sample.pc = sample->pc;
   }
+  session->batch.push_back(record);
   return HSA_STATUS_SUCCESS;
 }
 
-bool context_handler(rocprofiler_group_t group, void* arg) {
-  hsa_agent_t agent{};
-  hsa_status_t status = rocprofiler_get_agent(group.context, &agent);
+// Pool completion handler, called serialized per pool
+bool context_handler(const rocprofiler_pool_entry_t* entry, void* arg) {
+  pcsmp_session_t* session = reinterpret_cast<pcsmp_session_t*>(arg);
+  session->batch.clear();
+  hsa_status_t status = rocprofiler_iterate_trace_data(entry->context, trace_data_cb, session);
   check_status(status);
-  const rocprofiler::util::AgentInfo* agent_info = rocprofiler::util::HsaRsrcFactory::Instance().GetAgentInfo(agent);
 
-  pcsmp_callback_data_t pcsmp_data{};
-  pcsmp_data.kernel_name = (const char*)arg;
-  pcsmp_data.data_buffer = rocprofiler::util::HsaRsrcFactory::Instance().AllocateSysMemory(agent_info, rocprofiler::TraceProfile::GetSize());
-  status = rocprofiler_iterate_trace_data(group.context, trace_data_cb, &pcsmp_data);
-  check_status(status);
+  if (session->batch.empty()) return false;
+
+  // Aggregation mode, the samples are accumulated to the kernel histogram
+  if (activity_hist_callback.load(std::memory_order_acquire) != NULL) {
+    const uint64_t kernel_object = *reinterpret_cast<const uint64_t*>(entry->payload);
+    std::lock_guard<std::mutex> lck(session->hist_mutex);
+    auto it = session->hist_map.find(kernel_object);
+    if (it == session->hist_map.end()) {
+      const amd_kernel_code_t* kernel_code = rocprofiler::util::HsaRsrcFactory::Instance().GetKernelCode(kernel_object);
+      it = session->hist_map.insert({kernel_object, pcsmp_kernel_hist_t{}}).first;
+      it->second.code_base = kernel_object + kernel_code->kernel_code_entry_byte_offset;
+    }
+    pcsmp_kernel_hist_t& hist = it->second;
+    for (const activity_record_t& record : session->batch) hist.counts[record.pc_sample.pc - hist.code_base] += 1;
+    return false;
+  }
+
+  activity_batch_callback_t batch_fun = activity_batch_callback.load(std::memory_order_acquire);
+  if (batch_fun) {
+    (batch_fun)(activity_op, &(session->batch[0]), session->batch.size(), activity_batch_arg);
+  } else {
+    activity_async_callback_t fun = activity_callback.load(std::memory_order_acquire);
+    if (fun) for (activity_record_t& record : session->batch) (fun)(activity_op, &record, activity_arg);
+  }
   return false;
 }
 
+// Emitting the sessions histograms, the sampled dispatches are drained first
+void flush_histograms() {
+  activity_hist_callback_t fun = activity_hist_callback.load(std::memory_order_acquire);
+  if (fun == NULL) return;
+
+  std::lock_guard<std::mutex> lck(session_mutex);
+  std::vector<pcsmp_hist_entry_t> entries;
+  for (auto& item : session_map) {
+    pcsmp_session_t* session = item.second;
+    hsa_status_t status = rocprofiler_pool_flush(session->pool);
+    check_status(status);
+
+    std::lock_guard<std::mutex> hist_lck(session->hist_mutex);
+    for (auto& hist_item : session->hist_map) {
+      const rocprofiler::util::HsaRsrcFactory::kernel_info_t* info =
+        rocprofiler::util::HsaRsrcFactory::GetKernelInfo(hist_item.first);
+      const char* kernel_name = (info != NULL) ? info->name.load(std::memory_order_acquire) : NULL;
+      const pcsmp_kernel_hist_t& hist = hist_item.second;
+      entries.clear();
+      for (const auto& count : hist.counts) entries.push_back(pcsmp_hist_entry_t{count.first, count.second});
+      std::sort(entries.begin(), entries.end(),
+        [](const pcsmp_hist_entry_t& a, const pcsmp_hist_entry_t& b) { return a.offset < b.offset; });
+      (fun)(activity_op, kernel_name, hist.code_base, entries.data(), entries.size(), activity_hist_arg);
+    }
+    session->hist_map.clear();
+  }
+}
+
+// Return the agent session, created on the first dispatch to the agent
+pcsmp_session_t* get_session(const hsa_agent_t& agent) {
+  std::lock_guard<std::mutex> lck(session_mutex);
+  auto it = session_map.find(agent.handle);
+  if (it != session_map.end()) return it->second;
+
+  rocprofiler::util::HsaRsrcFactory* hsa_rsrc = &rocprofiler::util::HsaRsrcFactory::Instance();
+  const rocprofiler::util::AgentInfo* agent_info = hsa_rsrc->GetAgentInfo(agent);
+
+  pcsmp_session_t* session = new pcsmp_session_t{};
+  session->agent = agent;
+  session->parameter.parameter_name = HSA_VEN_AMD_AQLPROFILE_PARAMETER_NAME_COMPUTE_UNIT_TARGET;
+  session->parameter.value = 0;
+  session->feature.kind =
+    (rocprofiler_feature_kind_t)(ROCPROFILER_FEATURE_KIND_TRACE | ROCPROFILER_FEATURE_KIND_PCSMP_MOD);
+  session->feature.parameters = &(session->parameter);
+  session->feature.parameter_count = 1;
+  session->data_size = sizeof(pcsmp_sample_t);
+  session->data_buffer = hsa_rsrc->AllocateSysMemory(agent_info, session->data_size);
+  if (session->data_buffer == NULL) fatal("PC sampling staging buffer allocation failed");
+
+  rocprofiler_pool_properties_t properties{};
+  properties.num_entries = PCSMP_POOL_SIZE;
+  properties.payload_bytes = sizeof(uint64_t);
+  properties.handler = context_handler;
+  properties.handler_arg = session;
+  hsa_status_t status = rocprofiler_pool_open(agent, &(session->feature), 1, &(session->pool), 0, &properties);
+  check_status(status);
+
+  session_map[agent.handle] = session;
+  return session;
+}
+
 // Kernel disoatch callback
 hsa_status_t dispatch_callback(const rocprofiler_callback_data_t* callback_data, void* user_data,
                                rocprofiler_group_t* group) {
-  // context features
-  const rocprofiler_feature_kind_t trace_kind =
-    (rocprofiler_feature_kind_t)(ROCPROFILER_FEATURE_KIND_TRACE | ROCPROFILER_FEATURE_KIND_PCSMP_MOD);
-  const uint32_t feature_count = 1;
-  const uint32_t parameter_count = 1;
-  rocprofiler_feature_t* features = new rocprofiler_feature_t[feature_count];
-  memset(features, 0, feature_count * sizeof(rocprofiler_feature_t));
-  rocprofiler_parameter_t* parameters = new rocprofiler_parameter_t[parameter_count];
-  memset(features, 0, parameter_count * sizeof(rocprofiler_parameter_t));
-  parameters[0].parameter_name = HSA_VEN_AMD_AQLPROFILE_PARAMETER_NAME_COMPUTE_UNIT_TARGET;
-  parameters[0].value = 0;
-
-  features[0].kind = trace_kind;
-  features[0].parameters = parameters;
-  features[0].parameter_count = parameter_count;
-
-  // context properties
-  rocprofiler_properties_t properties{};
-  properties.handler = context_handler;
-  properties.handler_arg = (void*)strdup(callback_data->kernel_name);
+  pcsmp_session_t* session = get_session(callback_data->agent);
 
-  // Open profiling context
-  hsa_status_t status = rocprofiler_open(callback_data->agent, features, feature_count,
-                                         &context, 0 /*ROCPROFILER_MODE_SINGLEGROUP*/, &properties);
+  // Fetching a reused context, waiting for a completed one if the pool is full
+  rocprofiler_pool_entry_t pool_entry{};
+  hsa_status_t status = rocprofiler_pool_fetch(session->pool, &pool_entry);
   check_status(status);
+  *reinterpret_cast<uint64_t*>(pool_entry.payload) = callback_data->kernel_object;
 
   // Get group[0]
-  status = rocprofiler_get_group(context, 0, group);
+  status = rocprofiler_get_group(pool_entry.context, 0, group);
   check_status(status);
 
   return status;
@@ -162,12 +279,33 @@ PUBLIC_API bool InitActivityCallback(void* callback, void* arg) {
   return true;
 }
 
+// Batch activity callback, the decoded PC samples of a dispatch are delivered by one call
+PUBLIC_API bool InitActivityBatchCallback(void* callback, void* arg) {
+  activity_prim::activity_batch_arg = arg;
+  activity_prim::activity_batch_callback.store((activity_batch_callback_t)callback, std::memory_order_release);
+  return true;
+}
+
+// Histogram activity callback, enables the PC samples aggregation mode. Only the per-kernel
+// PC offset histograms are emitted at the session end or by FlushActivityHistogram
+PUBLIC_API bool InitActivityHistogramCallback(void* callback, void* arg) {
+  activity_prim::activity_hist_arg = arg;
+  activity_prim::activity_hist_callback.store((activity_hist_callback_t)callback, std::memory_order_release);
+  return true;
+}
+
+PUBLIC_API bool FlushActivityHistogram() {
+  activity_prim::flush_histograms();
+  return true;
+}
+
 PUBLIC_API bool EnableActivityCallback(uint32_t op, bool enable) {
   if (enable) {
     activity_prim::activity_op = op;
     rocprofiler_start_queue_callbacks();
   } else {
     rocprofiler_stop_queue_callbacks();
+    activity_prim::flush_histograms();
   }
   return true;
 }
@@ -0,0 +1,228 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef SRC_CORE_COMPLETION_ENGINE_H_
+#define SRC_CORE_COMPLETION_ENGINE_H_
+
+#include <hsa.h>
+#include <hsa_ext_amd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/exception.h"
+#include "util/hsa_rsrc_factory.h"
+
+namespace rocprofiler {
+
+// Completion engine, a replacement of the per signal ROCr async handlers.
+// Signals are distributed round-robin over a set of worker threads, every
+// worker waits for any of its outstanding signals and its wake signal and
+// reaps all completed ones in a batch. The worker wait set is persistent and
+// limited, the registered signals over the limit wait for the reaped slots. The handlers have hsa_amd_signal_handler
+// semantic, returning true keeps waiting on the signal. A handler returning true
+// for a still completed signal is deferred and retried after a short timeout.
+// The outstanding signals are passed to the ROCr async handlers on the engine stop.
+class CompletionEngine {
+  public:
+  typedef std::mutex mutex_t;
+  typedef hsa_amd_signal_handler handler_t;
+
+  // Worker threads number limit
+  static const uint32_t THREADS_MAX = 64;
+
+  struct waiter_t {
+    hsa_signal_t signal;
+    hsa_signal_value_t value;
+    handler_t handler;
+    void* arg;
+  };
+  typedef std::vector<waiter_t> waiter_vector_t;
+
+  CompletionEngine(const uint32_t& thread_count, const util::hsa_pfn_t* hsa_api) :
+    hsa_api_(hsa_api),
+    stop_(false),
+    next_(0),
+    defer_timeout_(0)
+  {
+    uint64_t frequency = 0;
+    hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY, &frequency);
+    if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_system_get_info");
+    defer_timeout_ = frequency / DEFER_TIMEOUT_DIV;
+
+    uint32_t count = thread_count;
+    if (count > THREADS_MAX) count = THREADS_MAX;
+    for (uint32_t i = 0; i < count; ++i) {
+      worker_t* worker = new worker_t;
+      status = hsa_api_->hsa_signal_create(1, 0, NULL, &(worker->wake));
+      if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_signal_create");
+      workers_.push_back(worker);
+    }
+    for (worker_t* worker : workers_) worker->thread = std::thread(Run, this, worker);
+  }
+
+  // The workers pass their outstanding signals to the ROCr async handlers
+  ~CompletionEngine() {
+    stop_.store(true, std::memory_order_release);
+    for (worker_t* worker : workers_) {
+      hsa_api_->hsa_signal_store_screlease(worker->wake, 0);
+      worker->thread.join();
+      hsa_api_->hsa_signal_destroy(worker->wake);
+      delete worker;
+    }
+  }
+
+  // Register signal handler to be called when the signal value is less than the given value
+  void Register(const hsa_signal_t& signal, const hsa_signal_value_t& value, handler_t handler, void* arg) {
+    const uint32_t index = next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    worker_t* worker = workers_[index];
+    {
+      std::lock_guard<mutex_t> lck(worker->mutex);
+      worker->incoming.push_back(waiter_t{signal, value, handler, arg});
+    }
+    hsa_api_->hsa_signal_store_screlease(worker->wake, 0);
+  }
+
+  private:
+  // Deferred handlers retry timeout, 10us
+  static const uint64_t DEFER_TIMEOUT_DIV = 100000;
+  // Worker wait set limit, the signals over the limit are waited for when the slots are reaped
+  static const uint32_t WAIT_SET_MAX = 256;
+
+  struct worker_t {
+    std::thread thread;
+    mutex_t mutex;
+    waiter_vector_t incoming;
+    // Wake signal, decremented on a new registered signal and on the engine stop
+    hsa_signal_t wake;
+  };
+
+  // Worker wait set, the wake signal is the first slot and the pending waiters are
+  // in the next slots. The arrays are persistent, the reaped slots are swap-removed.
+  struct wait_set_t {
+    waiter_vector_t waiters;
+    std::vector<hsa_signal_t> signals;
+    std::vector<hsa_signal_condition_t> conds;
+    std::vector<hsa_signal_value_t> values;
+
+    explicit wait_set_t(const hsa_signal_t& wake) { Add(waiter_t{wake, 1, NULL, NULL}); }
+    uint32_t Size() const { return waiters.size() - 1; }
+    void Add(const waiter_t& waiter) {
+      waiters.push_back(waiter);
+      signals.push_back(waiter.signal);
+      conds.push_back(HSA_SIGNAL_CONDITION_LT);
+      values.push_back(waiter.value);
+    }
+    void Remove(const uint32_t& index) {
+      waiters[index] = waiters.back();
+      signals[index] = signals.back();
+      values[index] = values.back();
+      waiters.pop_back();
+      signals.pop_back();
+      conds.pop_back();
+      values.pop_back();
+    }
+  };
+
+  static void Run(CompletionEngine* engine, worker_t* worker) {
+    const util::hsa_pfn_t* hsa_api = engine->hsa_api_;
+    wait_set_t set(worker->wake);
+    waiter_vector_t deferred;
+    waiter_vector_t retry;
+
+    while (true) {
+      // Fetching new registered signals up to the wait set limit, the rest is fetched
+      // when the slots are reaped. The wake signal is rearmed before.
+      hsa_api->hsa_signal_store_relaxed(worker->wake, 1);
+      {
+        std::lock_guard<mutex_t> lck(worker->mutex);
+        const uint32_t room = WAIT_SET_MAX - set.Size();
+        const uint32_t count = (worker->incoming.size() < room) ? worker->incoming.size() : room;
+        for (uint32_t i = 0; i < count; ++i) set.Add(worker->incoming[i]);
+        worker->incoming.erase(worker->incoming.begin(), worker->incoming.begin() + count);
+      }
+      if (engine->stop_.load(std::memory_order_acquire)) break;
+
+      // Waiting for the wake signal or any pending signal, the deferred
+      // completed signals are not waited for and are retried after the timeout
+      const uint32_t index = hsa_api->hsa_amd_signal_wait_any(
+        set.signals.size(), &(set.signals[0]), &(set.conds[0]), &(set.values[0]),
+        (deferred.empty()) ? UINT64_MAX : engine->defer_timeout_, HSA_WAIT_STATE_BLOCKED, NULL);
+
+      // Reaping all completed signals, the kept ones are deferred. Not needed if
+      // only the wake signal is completed.
+      if (index != 0) {
+        uint32_t i = 1;
+        while (i < set.waiters.size()) {
+          const waiter_t& waiter = set.waiters[i];
+          const hsa_signal_value_t value = hsa_api->hsa_signal_load_relaxed(waiter.signal);
+          if (value >= waiter.value) {
+            ++i;
+            continue;
+          }
+          if (waiter.handler(value, waiter.arg)) retry.push_back(waiter);
+          set.Remove(i);
+        }
+      }
+
+      // Retrying the deferred handlers, the not completed signals are waited for again
+      for (const waiter_t& waiter : deferred) {
+        const hsa_signal_value_t value = hsa_api->hsa_signal_load_relaxed(waiter.signal);
+        if (value >= waiter.value) {
+          std::lock_guard<mutex_t> lck(worker->mutex);
+          worker->incoming.push_back(waiter);
+        } else if (waiter.handler(value, waiter.arg)) {
+          retry.push_back(waiter);
+        }
+      }
+      deferred.swap(retry);
+      retry.clear();
+    }
+
+    // Passing the outstanding signals to the ROCr async handlers
+    waiter_vector_t outstanding(set.waiters.begin() + 1, set.waiters.end());
+    outstanding.insert(outstanding.end(), deferred.begin(), deferred.end());
+    {
+      std::lock_guard<mutex_t> lck(worker->mutex);
+      outstanding.insert(outstanding.end(), worker->incoming.begin(), worker->incoming.end());
+      worker->incoming.clear();
+    }
+    for (const waiter_t& waiter : outstanding) {
+      const hsa_status_t status = hsa_api->hsa_amd_signal_async_handler(
+        waiter.signal, HSA_SIGNAL_CONDITION_LT, waiter.value, waiter.handler, waiter.arg);
+      if (status != HSA_STATUS_SUCCESS) EXC_ABORT(status, "hsa_amd_signal_async_handler");
+    }
+  }
+
+  const util::hsa_pfn_t* hsa_api_;
+  std::atomic<bool> stop_;
+  std::atomic<uint32_t> next_;
+  uint64_t defer_timeout_;
+  std::vector<worker_t*> workers_;
+};
+
+} // namespace rocprofiler
+
+#endif // SRC_CORE_COMPLETION_ENGINE_H_
@@ -27,17 +27,24 @@ THE SOFTWARE.
 
 #include <hsa.h>
 #include <hsa_ext_amd.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h> // usleep
 #include <atomic>
+#include <deque>
 #include <list>
 #include <map>
 #include <mutex>
 #include <vector>
 
+#include "core/gpu_command.h"
 #include "core/group_set.h"
 #include "core/metrics.h"
+#include "core/overhead.h"
 #include "core/profile.h"
 #include "core/queue.h"
+#include "core/trace_stream.h"
 #include "core/types.h"
 #include "util/exception.h"
 #include "util/hsa_rsrc_factory.h"
@@ -75,6 +82,34 @@ template <class Map> class MetricArgs : public xml::args_cache_t {
   const Map& map_;
 };
 
+// Metrics arguments slots, registering the expressions variables in the dense slots array
+template <class Map> class MetricSlots : public xml::slots_cache_t {
+ public:
+  MetricSlots(const Map& map, info_vector_t* vec) : map_(map), vec_(vec) {}
+  bool Lookup(const std::string& name, uint32_t& result) const {
+    auto it = map_.find(name);
+    if (it == map_.end()) return false;
+    rocprofiler_feature_t* info = it->second;
+    if (info == NULL) return false;
+    auto ret = slots_.insert({info, vec_->size()});
+    if (ret.second) vec_->push_back(info);
+    result = ret.first->second;
+    return true;
+  }
+
+ private:
+  const Map& map_;
+  info_vector_t* const vec_;
+  mutable std::map<const rocprofiler_feature_t*, uint32_t> slots_;
+};
+
+// Atomic group state, copyable as the groups are copied to the context groups set
+// on the context construction before the state is used
+struct group_state_t : std::atomic<uint32_t> {
+  explicit group_state_t(const uint32_t& value) : std::atomic<uint32_t>(value) {}
+  group_state_t(const group_state_t& other) : std::atomic<uint32_t>(other.load(std::memory_order_relaxed)) {}
+};
+
 // Profiling group
 class Group {
  public:
@@ -86,12 +121,17 @@ class Group {
         trace_profile_(agent_info),
         n_profiles_(0),
         refs_(1),
+        active_(0),
         context_(context),
         index_(index),
         barrier_signal_{},
         dispatch_signal_{},
         orig_signal_{},
-        record_{}
+        record_{},
+        dispatch_count_(1),
+        counter_count_(0),
+        counter_values_(NULL),
+        counter_samples_(NULL)
         {}
 
   void Insert(const profile_info_t& info) {
@@ -100,6 +140,7 @@ class Group {
     switch (kind) {
       case ROCPROFILER_FEATURE_KIND_METRIC:
         pmc_profile_.Insert(info);
+        ++counter_count_;
         break;
       case ROCPROFILER_FEATURE_KIND_TRACE:
         trace_profile_.Insert(info);
@@ -130,6 +171,12 @@ class Group {
 
   void GetTraceProfiles(profile_vector_t& vec) { trace_profile_.GetProfiles(vec); }
 
+  // Mark the profiles completion signals as waited by the async handler
+  void SetArmed(const bool& b) {
+    pmc_profile_.SetArmed(b);
+    trace_profile_.SetArmed(b);
+  }
+
   info_vector_t& GetInfoVector() { return info_vector_; }
   const pkt_vector_t& GetStartVector() const { return start_vector_; }
   const pkt_vector_t& GetStopVector() const { return stop_vector_; }
@@ -158,12 +205,38 @@ class Group {
   rocprofiler_dispatch_record_t* GetRecord() {
     return &record_;
   }
+  // Dispatches number covered by the group data, more than one for an accumulated range
+  void SetDispatchCount(const uint32_t& count) { dispatch_count_ = count; }
+  uint32_t GetDispatchCount() const { return dispatch_count_; }
+  // Kernel objects of the dispatches covered by the group data, the counters window dispatches
+  void ClearKernelObjects() { kernel_objects_.clear(); }
+  void AddKernelObject(const uint64_t& kernel_object) { kernel_objects_.push_back(kernel_object); }
+  const std::vector<uint64_t>& GetKernelObjects() const { return kernel_objects_; }
+
+  // Counters values slots in the context counters arrays, in the PMC profile features order
+  uint32_t GetCounterCount() const { return counter_count_; }
+  void SetCounters(uint64_t* values, uint32_t* samples) {
+    counter_values_ = values;
+    counter_samples_ = samples;
+  }
+  uint64_t* GetCounterValues() const { return counter_values_; }
+  uint32_t* GetCounterSamples() const { return counter_samples_; }
+  void ClearCounters() {
+    if (counter_count_ == 0) return;
+    memset(counter_values_, 0, counter_count_ * sizeof(*counter_values_));
+    memset(counter_samples_, 0, counter_count_ * sizeof(*counter_samples_));
+  }
 
   atomic_refs_t* AtomicRefsCount() { return reinterpret_cast<atomic_refs_t*>(&refs_); }
   void ResetRefsCount() { AtomicRefsCount()->store(n_profiles_, std::memory_order_release); }
   void IncrRefsCount() { AtomicRefsCount()->fetch_add(1, std::memory_order_acq_rel); }
   uint32_t FetchDecrRefsCount() { return AtomicRefsCount()->fetch_sub(1, std::memory_order_acq_rel); }
 
+  // Toggle the group active state, return true if the group was inactive
+  bool ToggleActive() {
+    return active_.fetch_xor(1, std::memory_order_acq_rel) == 0;
+  }
+
  private:
   PmcProfile pmc_profile_;
   TraceProfile trace_profile_;
@@ -173,6 +246,7 @@ class Group {
   pkt_vector_t read_vector_;
   uint32_t n_profiles_;
   refs_t refs_;
+  group_state_t active_;
   Context* const context_;
   const uint32_t index_;
   // completion signal of after-dispatch barrier
@@ -181,6 +255,11 @@ class Group {
   hsa_signal_t dispatch_signal_;
   hsa_signal_t orig_signal_;
   rocprofiler_dispatch_record_t record_;
+  uint32_t dispatch_count_;
+  std::vector<uint64_t> kernel_objects_;
+  uint32_t counter_count_;
+  uint64_t* counter_values_;
+  uint32_t* counter_samples_;
 };
 
 // Profiling context
@@ -195,7 +274,13 @@ class Context {
     obj->Construct(agent_info, queue, info, info_count, handler, handler_arg);
   }
 
-  static void Release(Context* obj) { obj->Destruct(); }
+  // The in place context cannot be released with outstanding trace data copies
+  static void Release(Context* obj) {
+    if (obj->trace_refs_.load(std::memory_order_acquire) != 1) {
+      EXC_RAISING(HSA_STATUS_ERROR, "context release with in-flight trace data copies");
+    }
+    obj->Destruct();
+  }
 
   static Context* Create(const util::AgentInfo* agent_info, Queue* queue, rocprofiler_feature_t* info,
                          const uint32_t info_count, rocprofiler_handler_t handler, void* handler_arg)
@@ -212,7 +297,9 @@ class Context {
     return obj;
   }
 
-  static void Destroy(Context* obj) { if (obj != NULL) delete obj; }
+  // The context is deleted by the last reference, the close does not wait for the in-flight
+  // trace data copies and the context is deleted then by the last copy completion
+  static void Destroy(Context* obj) { if (obj != NULL) obj->ReleaseRef(); }
 
   void Reset(const uint32_t& group_index) { set_[group_index].ResetRefsCount(); }
 
@@ -270,11 +357,17 @@ class Context {
     Stop(group_index, submit_queue);
   }
 
+  // The PMC data are accumulated to the group counters values, the trace data
+  // are set to the features
   struct callback_data_t {
+    Context* context;
     const profile_t* profile;
     info_vector_t* info_vector;
     size_t index;
     char* ptr;
+    size_t capacity;
+    uint64_t* values;
+    uint32_t* samples;
   };
 
   void RestoreSignals(const profile_tuple_t& tuple) {
@@ -286,32 +379,90 @@ class Context {
   }
 
   void GetData(const uint32_t& group_index) {
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_CONTEXT_DATA);
+    Group* group = &set_[group_index];
     const profile_vector_t profile_vector = GetProfiles(group_index);
+    ReleaseTraceBuffers();
+    group->ClearCounters();
     for (auto& tuple : profile_vector) {
       // Wait for stop packet to complete
       hsa_rsrc_->SignalWaitRestore(tuple.completion_signal, 1);
       // Restore other signals
       RestoreSignals(tuple);
-      for (rocprofiler_feature_t* rinfo : *(tuple.info_vector)) rinfo->data.kind = ROCPROFILER_DATA_KIND_UNINIT;
-      callback_data_t callback_data{tuple.profile, tuple.info_vector, tuple.info_vector->size(), NULL};
+      const bool is_pmc = (tuple.profile->type == HSA_VEN_AMD_AQLPROFILE_EVENT_TYPE_PMC);
+      if (!is_pmc) {
+        for (rocprofiler_feature_t* rinfo : *(tuple.info_vector)) rinfo->data.kind = ROCPROFILER_DATA_KIND_UNINIT;
+      }
+      callback_data_t callback_data{this, tuple.profile, tuple.info_vector, tuple.info_vector->size(), NULL, 0,
+                                    (is_pmc) ? group->GetCounterValues() : NULL,
+                                    (is_pmc) ? group->GetCounterSamples() : NULL};
       const hsa_status_t status =
           api_->hsa_ven_amd_aqlprofile_iterate_data(tuple.profile, DataCallback, &callback_data);
       if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "context iterate data failed");
+      if (is_pmc) PublishCounters(*(tuple.info_vector), group->GetCounterValues(), group->GetCounterSamples());
     }
   }
 
   void GetMetricsData() const {
-    const MetricArgs<info_map_t> args(info_map_);
-    for (const auto& v : metrics_map_) {
-      const std::string& name = v.first;
-      const Metric* metric = v.second;
-      const xml::Expr* expr = metric->GetExpr();
-      if (expr) {
-        auto it = info_map_.find(name);
-        if (it == info_map_.end())
-          EXC_RAISING(HSA_STATUS_ERROR, "metric '" << name << "', rocprofiler info is not found " << this);
-        rocprofiler_feature_t* info = it->second;
-        info->data.result_double = expr->Eval(args);
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_METRICS_DATA);
+    // Loading the metrics arguments
+    for (unsigned i = 0; i < arg_vector_.size(); ++i) arg_values_[i] = ArgValue(i);
+
+    for (const metric_prog_t& metric : metric_progs_) {
+      rocprofiler_feature_t* info = metric.info;
+      if (metric.prog.Empty()) {
+        const MetricArgs<info_map_t> args(info_map_);
+        info->data.result_double = metric.expr->Eval(args);
+      } else {
+        info->data.result_double = metric.prog.Eval(arg_values_.data());
+      }
+      info->data.kind = ROCPROFILER_DATA_KIND_DOUBLE;
+    }
+  }
+
+  // Batch metrics evaluation, the metrics are evaluated for all the contexts at once
+  // in the structure-of-arrays layout. The contexts with metrics different from the first
+  // context ones are evaluated separately.
+  static void GetMetricsDataBatch(const Context* const* contexts, const uint32_t count) {
+    static thread_local std::vector<const Context*> batch;
+    static thread_local std::vector<xml::args_t> args;
+    static thread_local std::vector<xml::args_t> results;
+    if (count == 0) return;
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_METRICS_DATA);
+
+    const Context* first = contexts[0];
+    batch.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+      const Context* context = contexts[i];
+      if (first->IsBatchCompatible(context)) batch.push_back(context);
+      else context->GetMetricsData();
+    }
+
+    // Loading the metrics arguments, slot-major
+    const uint32_t batch_size = batch.size();
+    const uint32_t slot_count = first->arg_vector_.size();
+    args.resize((size_t)slot_count * batch_size);
+    results.resize(batch_size);
+    for (uint32_t i = 0; i < batch_size; ++i) {
+      const Context* context = batch[i];
+      for (uint32_t slot = 0; slot < slot_count; ++slot) {
+        args[(size_t)slot * batch_size + i] = context->ArgValue(slot);
+      }
+    }
+
+    for (uint32_t m = 0; m < first->metric_progs_.size(); ++m) {
+      const xml::expr_prog_t& prog = first->metric_progs_[m].prog;
+      if (!prog.Empty()) prog.EvalBatch(args.data(), batch_size, batch_size, results.data());
+      for (uint32_t i = 0; i < batch_size; ++i) {
+        const Context* context = batch[i];
+        const metric_prog_t& metric = context->metric_progs_[m];
+        rocprofiler_feature_t* info = metric.info;
+        if (prog.Empty()) {
+          const MetricArgs<info_map_t> margs(context->info_map_);
+          info->data.result_double = metric.expr->Eval(margs);
+        } else {
+          info->data.result_double = results[i];
+        }
         info->data.kind = ROCPROFILER_DATA_KIND_DOUBLE;
       }
     }
@@ -328,11 +479,27 @@ class Context {
     }
   }
 
+  // Asynchronous trace data iterating, the local memory trace data are copied to
+  // the staging memory by DMA and the callback is called on the copy completion
+  // from the completion handler thread. Each copy holds a context reference.
+  void IterateTraceDataAsync(rocprofiler_trace_data_callback_t callback, void* data) {
+    profile_vector_t profile_vector;
+    set_[0].GetTraceProfiles(profile_vector);
+    for (auto& tuple : profile_vector) {
+      if (pcsmp_mode_) const_cast<profile_t*>(tuple.profile)->event_count = UINT32_MAX;
+      trace_async_arg_t arg{this, tuple.profile, callback, data};
+      const hsa_status_t status =
+        api_->hsa_ven_amd_aqlprofile_iterate_data(tuple.profile, TraceAsyncCallback, &arg);
+      if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "context iterate data failed");
+    }
+  }
+
   static bool Handler(hsa_signal_value_t value, void* arg) {
     Group* group = reinterpret_cast<Group*>(arg);
     Context* context = group->GetContext();
     auto r = group->FetchDecrRefsCount();
     if (r == 1) {
+      group->SetArmed(false);
       const rocprofiler_group_t group_descr = context->GetGroupDescr(group);
       context->handler_(group_descr, context->handler_arg_);
     }
@@ -345,6 +512,9 @@ class Context {
 
   // Concurrent profiling mode
   static bool k_concurrent_;
+  // Kernel replay mode, the counters out of HW limit are spilled to the next groups
+  // and the dispatch is replayed once per group
+  static bool k_replay_;
 
  private:
   Context(const util::AgentInfo* agent_info, Queue* queue, rocprofiler_feature_t* info,
@@ -357,20 +527,20 @@ class Context {
         metrics_(NULL),
         handler_(handler),
         handler_arg_(handler_arg),
-        pcsmp_mode_(false)
+        pcsmp_mode_(false),
+        trace_refs_(1),
+        counter_values_(NULL),
+        counter_samples_(NULL)
   {}
 
   ~Context() { Destruct(); }
 
   void Destruct() {
-    for (const auto& v : info_map_) {
-      const std::string& name = v.first;
-      const rocprofiler_feature_t* info = v.second;
-      if ((info->kind == ROCPROFILER_FEATURE_KIND_METRIC) &&
-          (metrics_map_.find(name) == metrics_map_.end())) {
-        delete info;
-      }
-    }
+    ReleaseTraceBuffers();
+    free(counter_values_);
+    free(counter_samples_);
+    counter_values_ = NULL;
+    counter_samples_ = NULL;
   }
 
   void Construct(const util::AgentInfo* agent_info, Queue* queue, rocprofiler_feature_t* info,
@@ -383,6 +553,8 @@ class Context {
 
     metrics_ = MetricsDict::Create(agent_info);
     if (metrics_ == NULL) EXC_RAISING(HSA_STATUS_ERROR, "MetricsDict create failed");
+    PmcAgents::Set(agent_info->dev_index);
+    GpuCommands::Prepare(agent_info, k_concurrent_);
 
     if (Initialize(info, info_count) == false) {
       fprintf(stdout, "\nInput metrics out of HW limit. Proposed metrics group set:\n"); fflush(stdout);
@@ -393,8 +565,11 @@ class Context {
     Finalize();
 
     if (handler != NULL) {
-      for (unsigned group_index = 0; group_index < set_.size(); ++group_index) {
+      // The replayed groups complete in order, the handler is set for the last one
+      const unsigned first_index = (k_replay_) ? set_.size() - 1 : 0;
+      for (unsigned group_index = first_index; group_index < set_.size(); ++group_index) {
         set_[group_index].ResetRefsCount();
+        set_[group_index].SetArmed(true);
         const profile_vector_t profile_vector = GetProfiles(group_index);
         for (auto& tuple : profile_vector) {
           set_[group_index].SetDispatchSignal(tuple.dispatch_signal);
@@ -437,9 +612,7 @@ class Context {
         const Metric* metric = metrics_->Get(name);
         if (metric == NULL)
           EXC_RAISING(HSA_STATUS_ERROR, "input metric '" << name << "' is not found");
-#if 0
-        std::cout << "    " << name << (metric->GetExpr() ? " = " + metric->GetExpr()->String() : " counter") << std::endl;
-#endif
+        VERB_LOGGING("metric " << name << (metric->GetExpr() ? " = " + metric->GetExpr()->String() : " counter"));
 
         metrics_map_[name] = metric;
         counters_vec_t counters_vec = metric->GetCounters();
@@ -475,7 +648,7 @@ class Context {
             block_status.max_counters = block_counters;
           }
           if (block_status.counter_index >= block_status.max_counters) {
-            return false;
+            if (k_replay_ == false) return false;
 
             block_status.counter_index = 0;
             block_status.group_index += 1;
@@ -509,9 +682,109 @@ class Context {
       }
     }
 
+    AllocCounters();
+    CompileMetrics();
+
     return true;
   }
 
+  // Allocating the counters values and samples numbers arrays, the groups slots
+  // ranges are cache line aligned
+  void AllocCounters() {
+    const uint32_t align = COUNTERS_ALIGN / sizeof(uint64_t);
+    uint32_t total = 0;
+    for (const Group& group : set_) total += align_size(group.GetCounterCount(), align);
+    if (total == 0) return;
+    void* values = NULL;
+    void* samples = NULL;
+    if ((posix_memalign(&values, COUNTERS_ALIGN, total * sizeof(uint64_t)) != 0) ||
+        (posix_memalign(&samples, COUNTERS_ALIGN, total * sizeof(uint32_t)) != 0)) {
+      free(values);
+      EXC_RAISING(HSA_STATUS_ERROR, "counters arrays allocation failed, size(" << total << ")");
+    }
+    counter_values_ = reinterpret_cast<uint64_t*>(values);
+    counter_samples_ = reinterpret_cast<uint32_t*>(samples);
+    memset(counter_values_, 0, total * sizeof(uint64_t));
+    memset(counter_samples_, 0, total * sizeof(uint32_t));
+
+    uint32_t base = 0;
+    for (Group& group : set_) {
+      group.SetCounters(counter_values_ + base, counter_samples_ + base);
+      // The group counters are in the group features order skipping the traces
+      uint32_t slot = base;
+      for (const rocprofiler_feature_t* info : group.GetInfoVector()) {
+        if (info->kind == ROCPROFILER_FEATURE_KIND_METRIC) counter_slots_[info] = slot++;
+      }
+      base += align_size(group.GetCounterCount(), align);
+    }
+  }
+
+  // Setting the group counters values to the features
+  static void PublishCounters(const info_vector_t& info_vector, const uint64_t* values, const uint32_t* samples) {
+    for (uint32_t i = 0; i < info_vector.size(); ++i) {
+      rocprofiler_feature_t* rinfo = info_vector[i];
+      rinfo->data.result_int64 = values[i];
+      rinfo->data.kind = (samples[i] != 0) ? ROCPROFILER_DATA_KIND_INT64 : ROCPROFILER_DATA_KIND_UNINIT;
+    }
+  }
+
+  // Return the metric argument value by the argument slot, loaded from the counters
+  // values array if the argument is a collected counter
+  xml::args_t ArgValue(const uint32_t& index) const {
+    const uint32_t slot = arg_slots_[index];
+    if (slot == UINT32_MAX) return GetArgValue(arg_vector_[index]);
+    if (counter_samples_[slot] == 0)
+      EXC_RAISING(HSA_STATUS_ERROR, "var '" << arg_vector_[index]->name << "' is uninitialized");
+    return counter_values_[slot];
+  }
+
+  // Return the metric argument value
+  static xml::args_t GetArgValue(const rocprofiler_feature_t* info) {
+    if (info->data.kind == ROCPROFILER_DATA_KIND_UNINIT)
+      EXC_RAISING(HSA_STATUS_ERROR, "var '" << info->name << "' is uninitialized");
+    if (info->data.kind != ROCPROFILER_DATA_KIND_INT64)
+      EXC_RAISING(HSA_STATUS_ERROR, "var '" << info->name << "' is of incompatible type, not INT64");
+    return info->data.result_int64;
+  }
+
+  // The contexts have the same compiled metrics and arguments slots
+  bool IsBatchCompatible(const Context* context) const {
+    if (context == this) return true;
+    if ((context->metric_progs_.size() != metric_progs_.size()) ||
+        (context->arg_vector_.size() != arg_vector_.size())) return false;
+    for (uint32_t m = 0; m < metric_progs_.size(); ++m) {
+      if (context->metric_progs_[m].expr != metric_progs_[m].expr) return false;
+    }
+    return true;
+  }
+
+  // Compiling the metrics expressions to the linear programs over the dense arguments array,
+  // the programs stored in the metrics database are linked without the tree compiling.
+  // The expressions which cannot be compiled are evaluated by the expression tree
+  void CompileMetrics() {
+    const MetricSlots<info_map_t> slots(info_map_, &arg_vector_);
+    for (const auto& v : metrics_map_) {
+      const std::string& name = v.first;
+      const Metric* metric = v.second;
+      const xml::Expr* expr = metric->GetExpr();
+      if (expr) {
+        auto it = info_map_.find(name);
+        if (it == info_map_.end())
+          EXC_RAISING(HSA_STATUS_ERROR, "metric '" << name << "', rocprofiler info is not found " << this);
+        metric_progs_.push_back(metric_prog_t{it->second, expr, xml::expr_prog_t()});
+        xml::expr_prog_t* prog = &(metric_progs_.back().prog);
+        const ExprMetric* expr_metric = dynamic_cast<const ExprMetric*>(metric);
+        if ((expr_metric == NULL) || !expr_metric->Link(slots, prog)) expr->Compile(slots, prog);
+      }
+    }
+    arg_values_.resize(arg_vector_.size());
+    arg_slots_.clear();
+    for (const rocprofiler_feature_t* info : arg_vector_) {
+      auto it = counter_slots_.find(info);
+      arg_slots_.push_back((it != counter_slots_.end()) ? it->second : UINT32_MAX);
+    }
+  }
+
   void Finalize() {
     for (unsigned index = 0; index < set_.size(); ++index) {
       const hsa_status_t status = set_[index].Finalize(k_concurrent_);
@@ -544,7 +817,12 @@ class Context {
     }
     callback_data->index = index;
 
-    if (index < info_vector.size()) {
+    if ((index < info_vector.size()) && (callback_data->values != NULL)) {
+      if (ainfo_type != HSA_VEN_AMD_AQLPROFILE_INFO_PMC_DATA)
+        EXC_RAISING(HSA_STATUS_ERROR, "unexpected PMC profile data type = " << ainfo_type);
+      callback_data->values[index] += ainfo_data->pmc_data.result;
+      callback_data->samples[index] += 1;
+    } else if (index < info_vector.size()) {
       rocprofiler_feature_t* const rinfo = info_vector[index];
       rinfo->data.kind = ROCPROFILER_DATA_KIND_UNINIT;
 
@@ -553,15 +831,44 @@ class Context {
         rinfo->data.result_int64 += ainfo_data->pmc_data.result;
         rinfo->data.kind = ROCPROFILER_DATA_KIND_INT64;
       } else if (ainfo_type == HSA_VEN_AMD_AQLPROFILE_INFO_TRACE_DATA) {
-        if (rinfo->data.result_bytes.copy) {
+        if (rinfo->data.result_bytes.copy && TraceStream::IsOn()) {
+          // Streaming readback, the host data buffer is grown by the samples data
+          if (sample_id == 0) {
+            rinfo->data.result_bytes.ptr = NULL;
+            rinfo->data.result_bytes.size = 0;
+            callback_data->capacity = 0;
+          }
+          const char* src = reinterpret_cast<char*>(ainfo_data->trace_data.ptr);
+          const uint32_t size = ainfo_data->trace_data.size;
+          const uint32_t offset = rinfo->data.result_bytes.size;
+          const uint32_t total = offset + sizeof(uint32_t) + align_size(size, sizeof(uint32_t));
+          char* result_bytes_ptr = reinterpret_cast<char*>(rinfo->data.result_bytes.ptr);
+          if (total > callback_data->capacity) {
+            char* ptr = callback_data->context->AllocTraceBuffer(total, &(callback_data->capacity));
+            if (offset != 0) memcpy(ptr, result_bytes_ptr, offset);
+            callback_data->context->FreeTraceBuffer(result_bytes_ptr);
+            result_bytes_ptr = ptr;
+          }
+          uint32_t* header = reinterpret_cast<uint32_t*>(result_bytes_ptr + offset);
+          char* dest = result_bytes_ptr + offset + sizeof(*header);
+
+          if (TraceProfile::IsLocal()) {
+            const util::AgentInfo* agent_info = util::HsaRsrcFactory::Instance().GetAgentInfo(profile->agent);
+            TraceStream::Get(agent_info)->Drain(dest, src, size);
+          } else {
+            memcpy(dest, src, size);
+          }
+          *header = size;
+          rinfo->data.result_bytes.ptr = result_bytes_ptr;
+          rinfo->data.result_bytes.size = total;
+          rinfo->data.result_bytes.instance_count = sample_id + 1;
+          rinfo->data.kind = ROCPROFILER_DATA_KIND_BYTES;
+        } else if (rinfo->data.result_bytes.copy) {
           const bool trace_local = TraceProfile::IsLocal();
           util::HsaRsrcFactory* hsa_rsrc = &util::HsaRsrcFactory::Instance();
           if (sample_id == 0) {
               const uint32_t output_buffer_size = profile->output_buffer.size;
-              const uint32_t output_buffer_size64 = profile->output_buffer.size / sizeof(uint64_t);
-              const util::AgentInfo* agent_info = hsa_rsrc->GetAgentInfo(profile->agent);
-              void* ptr = (trace_local) ? hsa_rsrc->AllocateSysMemory(agent_info, output_buffer_size) :
-                                         calloc(output_buffer_size64, sizeof(uint64_t));
+              void* ptr = callback_data->context->AllocTraceBuffer(output_buffer_size, NULL);
               rinfo->data.result_bytes.size = output_buffer_size;
               rinfo->data.result_bytes.ptr = ptr;
               callback_data->ptr = reinterpret_cast<char*>(ptr);
@@ -611,13 +918,122 @@ class Context {
     return status;
   }
 
+  struct trace_async_arg_t {
+    Context* context;
+    const profile_t* profile;
+    rocprofiler_trace_data_callback_t callback;
+    void* data;
+  };
+
+  struct trace_copy_t {
+    Context* context;
+    rocprofiler_trace_data_callback_t callback;
+    void* data;
+    hsa_ven_amd_aqlprofile_info_type_t info_type;
+    hsa_ven_amd_aqlprofile_info_data_t info_data;
+    hsa_signal_t signal;
+  };
+
+  // Issuing the trace sample copy, the not local data are passed to the callback in place
+  static hsa_status_t TraceAsyncCallback(hsa_ven_amd_aqlprofile_info_type_t info_type,
+                                         hsa_ven_amd_aqlprofile_info_data_t* info_data, void* data) {
+    const trace_async_arg_t* arg = reinterpret_cast<trace_async_arg_t*>(data);
+    if ((info_type != HSA_VEN_AMD_AQLPROFILE_INFO_TRACE_DATA) || !TraceProfile::IsLocal()) {
+      return arg->callback(info_type, info_data, arg->data);
+    }
+
+    Context* context = arg->context;
+    util::HsaRsrcFactory* hsa_rsrc = context->hsa_rsrc_;
+    const void* src = info_data->trace_data.ptr;
+    const size_t size = info_data->trace_data.size;
+    void* ptr = hsa_rsrc->AllocateStagingMemory(context->agent_info_, size);
+    if (ptr == NULL) EXC_RAISING(HSA_STATUS_ERROR, "Trace data staging allocation failed, size(" << size << ")");
+    trace_copy_t* copy = new trace_copy_t{context, arg->callback, arg->data, info_type, *info_data, {}};
+    copy->info_data.trace_data.ptr = ptr;
+    if (hsa_rsrc->CreateSignal(1, &(copy->signal)) == false) {
+      hsa_rsrc->ReleaseStagingMemory(ptr);
+      delete copy;
+      EXC_RAISING(HSA_STATUS_ERROR, "Trace data copy signal creation failed");
+    }
+
+    // The copy reference is taken before the copy is issued
+    context->trace_refs_.fetch_add(1, std::memory_order_relaxed);
+    if (hsa_rsrc->MemcpyAsync(arg->profile->agent, ptr, src, size, copy->signal) == false) {
+      TraceCopyRelease(copy);
+      EXC_RAISING(HSA_STATUS_ERROR, "Trace data async copy failed, src(" << src << ") size(" << size << ")");
+    }
+    const hsa_status_t status = hsa_rsrc->HsaApi()->hsa_amd_signal_async_handler(
+        copy->signal, HSA_SIGNAL_CONDITION_LT, 1, TraceCopyHandler, copy);
+    if (status != HSA_STATUS_SUCCESS) {
+      // The issued copy is completed before the staging memory is released
+      hsa_rsrc->HsaApi()->hsa_signal_wait_scacquire(copy->signal, HSA_SIGNAL_CONDITION_LT, 1,
+                                                    UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
+      TraceCopyRelease(copy);
+      EXC_RAISING(status, "hsa_amd_signal_async_handler");
+    }
+    return HSA_STATUS_SUCCESS;
+  }
+
+  static bool TraceCopyHandler(hsa_signal_value_t value, void* arg) {
+    trace_copy_t* copy = reinterpret_cast<trace_copy_t*>(arg);
+    copy->callback(copy->info_type, &(copy->info_data), copy->data);
+    TraceCopyRelease(copy);
+    return false;
+  }
+
+  // Releasing the copy resources and the copy context reference
+  static void TraceCopyRelease(trace_copy_t* copy) {
+    Context* context = copy->context;
+    util::HsaRsrcFactory* hsa_rsrc = context->hsa_rsrc_;
+    hsa_rsrc->ReleaseStagingMemory(copy->info_data.trace_data.ptr);
+    hsa_rsrc->HsaApi()->hsa_signal_destroy(copy->signal);
+    delete copy;
+    context->ReleaseRef();
+  }
+
+  void ReleaseRef() {
+    if (trace_refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  // The copied trace data buffers are taken from the staging memory arena and are
+  // released on the next data collection or on the context destruction
+  char* AllocTraceBuffer(const size_t& size, size_t* capacity) {
+    char* ptr = reinterpret_cast<char*>(hsa_rsrc_->AllocateStagingMemory(agent_info_, size, capacity));
+    if (ptr == NULL) EXC_RAISING(HSA_STATUS_ERROR, "Trace data host buffer allocation failed, size(" << size << ")");
+    trace_buffers_.push_back(ptr);
+    return ptr;
+  }
+
+  void FreeTraceBuffer(void* ptr) {
+    if (ptr == NULL) return;
+    for (auto it = trace_buffers_.begin(); it != trace_buffers_.end(); ++it) {
+      if (*it == ptr) {
+        trace_buffers_.erase(it);
+        hsa_rsrc_->ReleaseStagingMemory(ptr);
+        break;
+      }
+    }
+  }
+
+  void ReleaseTraceBuffers() {
+    for (void* ptr : trace_buffers_) hsa_rsrc_->ReleaseStagingMemory(ptr);
+    trace_buffers_.clear();
+  }
+
+  // The expressions counters features are views of the counters values, kept in
+  // the context storage with stable addresses
   rocprofiler_feature_t* NewCounterInfo(const counter_t* counter) {
-    rocprofiler_feature_t* info = new rocprofiler_feature_t{};
+    counter_infos_.emplace_back();
+    rocprofiler_feature_t* info = &(counter_infos_.back());
+    *info = rocprofiler_feature_t{};
     info->kind = ROCPROFILER_FEATURE_KIND_METRIC;
-    info->name = counter->name.c_str();
+    info->name = counter->name;
     return info;
   }
 
+  // Counters arrays groups slots alignment
+  static const uint32_t COUNTERS_ALIGN = 64;
+
   // GPU handel
   const hsa_agent_t agent_;
   const util::AgentInfo* agent_info_;
@@ -635,18 +1051,41 @@ class Context {
   std::map<block_des_t, block_status_t, lt_block_des> groups_map_;
   // Info map
   info_map_t info_map_;
+  // Expressions counters features
+  std::deque<rocprofiler_feature_t> counter_infos_;
   // Metrics map
   std::map<std::string, const Metric*> metrics_map_;
+  // Compiled metrics
+  struct metric_prog_t {
+    rocprofiler_feature_t* info;
+    const xml::Expr* expr;
+    xml::expr_prog_t prog;
+  };
+  std::vector<metric_prog_t> metric_progs_;
+  // Metrics arguments dense slots and values
+  info_vector_t arg_vector_;
+  mutable std::vector<xml::args_t> arg_values_;
+  // Metrics arguments counters values slots, UINT32_MAX if not a collected counter
+  std::vector<uint32_t> arg_slots_;
+  // Counters values and samples numbers arrays and the features counters slots
+  std::map<const rocprofiler_feature_t*, uint32_t> counter_slots_;
   // Context completion handler
   rocprofiler_handler_t handler_;
   void* handler_arg_;
 
   // PC sampling mode
   bool pcsmp_mode_;
+  // Copied trace data buffers
+  std::vector<void*> trace_buffers_;
+  // Context references, the owner one and one per in-flight asynchronous trace data copy
+  std::atomic<uint32_t> trace_refs_;
+  uint64_t* counter_values_;
+  uint32_t* counter_samples_;
 };
 
 #define CONTEXT_INSTANTIATE() \
-  bool rocprofiler::Context::k_concurrent_ = false;
+  bool rocprofiler::Context::k_concurrent_ = false; \
+  bool rocprofiler::Context::k_replay_ = false;
 
 }  // namespace rocprofiler
 
@@ -25,7 +25,9 @@ THE SOFTWARE.
 
 #include "inc/rocprofiler.h"
 
-#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 #include "core/context.h"
 
@@ -34,11 +36,20 @@ class ContextPool {
   public:
   typedef uint64_t index_t;
   typedef std::mutex mutex_t;
+  typedef hsa_status_t (*callback_t)(rocprofiler_pool_entry_t* entry, void* data);
+
+  // Pool entry states
+  enum {
+    ENTRY_FREE = 0,
+    ENTRY_FETCHED = 1,
+    ENTRY_COMPLETED = 2,
+    ENTRY_RELEASED = 3
+  };
 
   struct entry_t {
     ContextPool* pool;
     Context* context;
-    std::atomic<bool> completed;
+    std::atomic<uint32_t> state;
   };
 
   static ContextPool* Create(
@@ -57,50 +68,70 @@ class ContextPool {
 
   static void Destroy(ContextPool* pool) { delete pool; }
 
-  void Fetch(rocprofiler_pool_entry_t* pool_entry) {
+  // Fetching a number of entries reserved by one index update,
+  // waiting for the completed entries to be drained if the pool is full
+  void Fetch(rocprofiler_pool_entry_t* pool_entries, const uint32_t& count = 1) {
     if (constructed_ == false) {
       Construct(agent_info_, info_, info_count_);
     }
-    const index_t write_index = write_index_.fetch_add(entry_size_bytes_, std::memory_order_relaxed);
-    while (write_index >= (read_index_.load(std::memory_order_acquire) + array_size_bytes_)) {
-      check_completed();
-      std::this_thread::yield();
+    if (count == 0) return;
+    if (count > num_entries_) EXC_RAISING(HSA_STATUS_ERROR, "fetch count exceeds pool size, " << count << " > " << num_entries_);
+
+    const index_t write_index = write_index_.fetch_add(entry_size_bytes_ * count, std::memory_order_relaxed);
+    const index_t last_index = write_index + entry_size_bytes_ * (count - 1);
+    if (IsFree(last_index) == false) Wait(last_index);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      entry_t* entry = GetPoolEntry(write_index + entry_size_bytes_ * i, &pool_entries[i]);
+      if (entry->state.load(std::memory_order_acquire) != ENTRY_FREE) EXC_RAISING(HSA_STATUS_ERROR, "Corrupted pool entry");
+      entry->state.store(ENTRY_FETCHED, std::memory_order_release);
+    }
+  }
+
+  // Returning a fetched entry to the pool without the completion handler call
+  static void Release(rocprofiler_pool_entry_t* pool_entry) {
+    char* ptr = reinterpret_cast<char*>(pool_entry->payload) - aligned64(sizeof(entry_t));
+    entry_t* entry = reinterpret_cast<entry_t*>(ptr);
+    uint32_t state = ENTRY_FETCHED;
+    if (entry->state.compare_exchange_strong(state, ENTRY_RELEASED, std::memory_order_acq_rel) == false) {
+      EXC_RAISING(HSA_STATUS_ERROR, "released pool entry is not fetched or already completed");
     }
-    entry_t* entry = GetPoolEntry(write_index, pool_entry);
-    if (entry->completed.load(std::memory_order_relaxed) != false) EXC_RAISING(HSA_STATUS_ERROR, "Corrupted pool entry");
+    entry->pool->check_completed();
   }
 
   void Flush() {
     check_completed();
   }
-#if 0
-  template <class F>
-  F for_each(const F& f_p) {
-    F f = f_p;
-    while (sync_flag_.test_and_set(std::memory_order_acquire) != false) {
-      std::this_thread::yield();
-    }
 
-    index_t read_index = read_index_.load(std::memory_order_relaxed);
-    const index_t write_index = write_index_.load(std::memory_order_relaxed);
-    while(read_index < write_index) {
-      rocprofiler_pool_entry_t pool_entry{};
-      entry_t* entry = GetPoolEntry(read_index, &pool_entry);
-      const bool completed = entry->completed.load(std::memory_order_acquire);
-      if (completed == false) {
-        f(entry->context, entry->payload);
+  // Iterating the fetched and not completed entries, the completed entries
+  // draining is deferred while iterating, the entries fetching is not blocked
+  hsa_status_t Iterate(callback_t callback, void* data) {
+    hsa_status_t status = HSA_STATUS_SUCCESS;
+    if (constructed_ == false) return status;
+    {
+      std::lock_guard<mutex_t> lck(drain_mutex_);
+      const index_t read_index = read_index_.load(std::memory_order_acquire);
+      index_t end_index = write_index_.load(std::memory_order_acquire);
+      if (end_index > (read_index + array_size_bytes_)) end_index = read_index + array_size_bytes_;
+      for (index_t index = read_index; index < end_index; index += entry_size_bytes_) {
+        rocprofiler_pool_entry_t pool_entry{};
+        entry_t* entry = GetPoolEntry(index, &pool_entry);
+        if (entry->state.load(std::memory_order_acquire) == ENTRY_FETCHED) {
+          status = callback(&pool_entry, data);
+          if (status != HSA_STATUS_SUCCESS) break;
+        }
       }
     }
-
-    return f;
+    check_completed();
+    return status;
   }
-#endif
+
   private:
   static unsigned aligned64(const unsigned& size) { return (size + 0x3f) & ~0x3fu; }
 
   static bool context_handler(rocprofiler_group_t group, void* arg) {
     entry_t* entry = reinterpret_cast<entry_t*>(arg);
-    entry->completed.store(true, std::memory_order_release);
+    entry->state.store(ENTRY_COMPLETED, std::memory_order_release);
     entry->pool->check_completed();
     return true;
   }
@@ -114,13 +145,16 @@ class ContextPool {
     rocprofiler_pool_handler_t pool_handler,
     void* pool_handler_arg
   ) :
+    num_entries_(num_entries),
     payload_off_(aligned64(sizeof(entry_t))),
     entry_size_bytes_(payload_off_ + aligned64(payload_bytes)),
     array_size_bytes_(entry_size_bytes_ * num_entries),
+    array_data_(NULL),
     array_(NULL),
     read_index_(0),
     write_index_(0),
-    sync_flag_(false),
+    drain_requests_(0),
+    waiters_(0),
 
     agent_info_(agent_info),
     info_(info),
@@ -151,17 +185,19 @@ class ContextPool {
   }
 
   ~ContextPool() {
-    const char* end = array_ + array_size_bytes_;
-    for (char* ptr = array_; ptr < end; ptr += entry_size_bytes_) {
-      entry_t* entry = reinterpret_cast<entry_t*>(ptr);
-      Context::Destroy(entry->context);
+    if (constructed_ == true) {
+      const char* end = array_ + array_size_bytes_;
+      for (char* ptr = array_; ptr < end; ptr += entry_size_bytes_) {
+        entry_t* entry = reinterpret_cast<entry_t*>(ptr);
+        Context::Destroy(entry->context);
+      }
+      free(array_data_);
     }
-    free(array_);
   }
 
-  char* GetArrayPtr(const uint32_t& index) { return array_ + (index % array_size_bytes_); }
+  char* GetArrayPtr(const index_t& index) { return array_ + (index % array_size_bytes_); }
 
-  entry_t* GetPoolEntry(const uint32_t& index, rocprofiler_pool_entry_t* pool_entry) {
+  entry_t* GetPoolEntry(const index_t& index, rocprofiler_pool_entry_t* pool_entry) {
     char* ptr = GetArrayPtr(index);
     entry_t* entry = reinterpret_cast<entry_t*>(ptr);
     void* payload = ptr + payload_off_;
@@ -171,34 +207,69 @@ class ContextPool {
     return entry;
   }
 
+  // Check if the entry index is within the free pool range
+  bool IsFree(const index_t& index) const {
+    return index < (read_index_.load() + array_size_bytes_);
+  }
+
+  // Waiting for the entry index to be freed, helping to drain the completed entries
+  void Wait(const index_t& index) {
+    while (IsFree(index) == false) {
+      check_completed();
+      std::unique_lock<mutex_t> lck(wait_mutex_);
+      waiters_.fetch_add(1);
+      wait_cond_.wait(lck, [this, &index] { return IsFree(index); });
+      waiters_.fetch_sub(1);
+    }
+  }
+
+  // Draining the completed entries in the fetch order. A concurrent drain request
+  // doesn't wait for the current drainer, the drainer rescans the pool instead.
   void check_completed() {
-    if (sync_flag_.test_and_set(std::memory_order_acquire) == false) {
+    drain_requests_.fetch_add(1, std::memory_order_acq_rel);
+    bool drained = false;
+    while (drain_mutex_.try_lock() == true) {
+      const uint32_t requests = drain_requests_.load(std::memory_order_acquire);
       index_t read_index = read_index_.load(std::memory_order_relaxed);
       const index_t write_index = write_index_.load(std::memory_order_relaxed);
       while(read_index < write_index) {
         rocprofiler_pool_entry_t pool_entry{};
         entry_t* entry = GetPoolEntry(read_index, &pool_entry);
-        if (entry->completed.load(std::memory_order_acquire) == true) {
-          pool_handler_(&pool_entry, pool_handler_arg_);
-          entry->completed.store(false, std::memory_order_relaxed);
+        const uint32_t state = entry->state.load(std::memory_order_acquire);
+        if ((state == ENTRY_COMPLETED) || (state == ENTRY_RELEASED)) {
+          if (state == ENTRY_COMPLETED) pool_handler_(&pool_entry, pool_handler_arg_);
+          entry->state.store(ENTRY_FREE, std::memory_order_release);
           read_index += entry_size_bytes_;
-          read_index_.store(read_index, std::memory_order_release);
+          read_index_.store(read_index);
+          drained = true;
         } else {
           break;
         }
       }
-      sync_flag_.clear(std::memory_order_release);
+      drain_mutex_.unlock();
+      if (drain_requests_.load(std::memory_order_acquire) == requests) break;
+    }
+
+    // Waking up the producers waiting for free entries
+    if ((drained == true) && (waiters_.load() != 0)) {
+      std::lock_guard<mutex_t> lck(wait_mutex_);
+      wait_cond_.notify_all();
     }
   }
 
+  const uint32_t num_entries_;
   const uint32_t payload_off_;
   const uint32_t entry_size_bytes_;
   const uint32_t array_size_bytes_;
   char* array_data_;
   char* array_;
-  volatile std::atomic<index_t> read_index_;
-  volatile std::atomic<index_t> write_index_;
-  volatile std::atomic_flag sync_flag_;
+  std::atomic<index_t> read_index_;
+  std::atomic<index_t> write_index_;
+  std::atomic<uint32_t> drain_requests_;
+  std::atomic<uint32_t> waiters_;
+  mutex_t drain_mutex_;
+  mutex_t wait_mutex_;
+  std::condition_variable wait_cond_;
 
   const util::AgentInfo* agent_info_;
   rocprofiler_feature_t* info_;
@@ -1,64 +1,80 @@
-#ifndef _CORE_TIMER_H_
-#define _CORE_TIMER_H_
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
 
-template <int Size>
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_CORE_TIMER_H
+#define _SRC_CORE_CORE_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>
+
+namespace rocprofiler {
+
+// TSC based timer, the ticks are converted to ns by the measured TSC frequency
 class CoreTimer {
-  CoreTimer() {
-    index_ = 0;
-    freq_in_100mhz_ = MeasureTSCFreqHz();
-  }
-  ~CoreTimer() {
-    if (index_ >= Size) {
-      printf("ERROR: memory corruption: out of timer data");
-      abort();
-    }
-  }
+ public:
+  typedef uint64_t tick_t;
 
   // retrieve time
-  double Get() {
-    double n = 0;
-    // AMD Linux timing
-    unsigned int unused;
-    n = __rdtscp(&unused);
-    data_[index_] = 10 * n / freq_in_100mhz_; // unit is ns
-    index_ += 1;
-  }
+  static inline tick_t Get() { return __rdtsc(); }
 
-  double Print() 
+  // Converting the ticks to ns, the TSC period is measured on the first call,
+  // the calls are the overhead reports so the measuring is not on the startup path
+  static uint64_t TicksToNs(const tick_t& ticks) {
+    static const uint64_t ns_mult = MeasureTSCPeriod();
+    return (ns_mult != 0) ? uint64_t(((unsigned __int128)ticks * ns_mult) >> FIXED_SHIFT) : ticks;
+  }
 
-  private:
-  // timer data
-  double data_[Size];
-  // data index
-  uint32_t index_;
-  // frequency
-  double freq_in_100mhz_;
+ private:
+  static const uint64_t MEASURE_INTERVAL_US = 10000;
+  static const uint32_t FIXED_SHIFT = 32;
 
   // timing methods
-  uint64_t CoreTimer::CoarseTimestampUs() {
+  static uint64_t CoarseTimestampUs() {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
     return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
   }
-  
-  uint64_t CoreTimer::MeasureTSCFreqHz() {
-    // Make a coarse interval measurement of TSC ticks for 1 gigacycles.
+
+  // Returning the TSC tick period in ns, 32 bits fixed point
+  static uint64_t MeasureTSCPeriod() {
+    // Make a coarse interval measurement of TSC ticks
     unsigned int unused;
     uint64_t tscTicksEnd;
-  
+    uint64_t coarseEndUs;
+
     uint64_t coarseBeginUs = CoarseTimestampUs();
     uint64_t tscTicksBegin = __rdtscp(&unused);
     do {
       tscTicksEnd = __rdtscp(&unused);
-    } while (tscTicksEnd - tscTicksBegin < 1000000000);
-  
-    uint64_t coarseEndUs = CoarseTimestampUs();
-  
-    // Compute the TSC frequency and round to nearest 100MHz.
+      coarseEndUs = CoarseTimestampUs();
+    } while (coarseEndUs - coarseBeginUs < MEASURE_INTERVAL_US);
+
     uint64_t coarseIntervalNs = (coarseEndUs - coarseBeginUs) * 1000;
     uint64_t tscIntervalTicks = tscTicksEnd - tscTicksBegin;
-    return (tscIntervalTicks * 10 + (coarseIntervalNs / 2)) / coarseIntervalNs;
+    return (tscIntervalTicks != 0) ? uint64_t(((unsigned __int128)coarseIntervalNs << FIXED_SHIFT) / tscIntervalTicks) : 0;
   }
 };
 
-#endif // _CORE_TIMER_H_
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_CORE_TIMER_H
@@ -0,0 +1,193 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_DISPATCH_CONVERGE_H
+#define _SRC_CORE_DISPATCH_CONVERGE_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace rocprofiler {
+
+// Per-kernel adaptive dispatch profiling. The profiled dispatches observations,
+// the duration and the counters values, are accumulated per kernel and the kernel
+// is converged once the confidence interval of every value mean is within the
+// relative tolerance. A converged kernel dispatches are profiled at the background
+// rate 1/N with the weight N, a background observation off the converged mean
+// restarts the kernel statistics.
+class DispatchConverge {
+ public:
+  DispatchConverge(const uint32_t& tolerance_pct, const uint32_t& rate) :
+    tolerance_(double(tolerance_pct) / 100),
+    rate_((rate > 1) ? rate : RATE_DEFAULT),
+    table_{},
+    table_full_(false)
+  {}
+
+  ~DispatchConverge() {
+    for (auto& item : map_) delete item.second;
+  }
+
+  // Checking the kernel dispatch, returns true and scales the weight if the dispatch is profiled
+  bool Check(const uint64_t& kernel_object, float* weight) {
+    kernel_t* kernel = Find(kernel_object);
+    if ((kernel == NULL) || !kernel->converged.load(std::memory_order_relaxed)) return true;
+    if ((kernel->skipped.fetch_add(1, std::memory_order_relaxed) % rate_) != 0) return false;
+    *weight *= rate_;
+    return true;
+  }
+
+  // Adding the profiled dispatch observation values
+  void Update(const uint64_t& kernel_object, const double* values, const uint32_t& count) {
+    kernel_t* kernel = Find(kernel_object);
+    if (kernel == NULL) kernel = Insert(kernel_object);
+
+    std::lock_guard<std::mutex> lck(kernel->mutex);
+    if (kernel->mean.size() != count) Restart(kernel, count);
+    if (kernel->converged.load(std::memory_order_relaxed) && IsPhaseChange(kernel, values)) Restart(kernel, count);
+
+    // Welford running mean and variance
+    const uint64_t n = ++(kernel->samples);
+    for (uint32_t i = 0; i < count; ++i) {
+      const double delta = values[i] - kernel->mean[i];
+      kernel->mean[i] += delta / n;
+      kernel->m2[i] += delta * (values[i] - kernel->mean[i]);
+    }
+    if (!kernel->converged.load(std::memory_order_relaxed) && IsConverged(kernel)) {
+      kernel->skipped.store(0, std::memory_order_relaxed);
+      kernel->converged.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // Converged kernels number
+  uint32_t GetConvergedCount() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    uint32_t count = 0;
+    for (const auto& item : map_) count += item.second->converged.load(std::memory_order_relaxed) ? 1 : 0;
+    return count;
+  }
+
+ private:
+  struct kernel_t {
+    std::mutex mutex;
+    uint64_t samples;
+    std::vector<double> mean;
+    std::vector<double> m2;
+    std::atomic<bool> converged;
+    std::atomic<uint64_t> skipped;
+    kernel_t() : samples(0), converged(false), skipped(0) {}
+  };
+  struct table_entry_t {
+    std::atomic<uint64_t> key;
+    std::atomic<kernel_t*> kernel;
+  };
+
+  static const uint32_t RATE_DEFAULT = 100;
+  // Minimum observations number to estimate the variance
+  static const uint64_t SAMPLES_MIN = 16;
+  // The 95% confidence interval normal quantile
+  static constexpr double CI_QUANTILE = 1.96;
+  // Phase change, the deviation from the converged mean by standard deviations
+  static constexpr double PHASE_SIGMAS = 4;
+  static const uint32_t TABLE_SIZE = 4096;
+
+  static void Restart(kernel_t* kernel, const uint32_t& count) {
+    kernel->samples = 0;
+    kernel->mean.assign(count, 0);
+    kernel->m2.assign(count, 0);
+    kernel->converged.store(false, std::memory_order_relaxed);
+  }
+
+  bool IsConverged(const kernel_t* kernel) const {
+    const uint64_t n = kernel->samples;
+    if (n < SAMPLES_MIN) return false;
+    for (uint32_t i = 0; i < kernel->mean.size(); ++i) {
+      const double half_width = CI_QUANTILE * sqrt(kernel->m2[i] / (n - 1) / n);
+      if (half_width > (tolerance_ * fabs(kernel->mean[i]))) return false;
+    }
+    return true;
+  }
+
+  bool IsPhaseChange(const kernel_t* kernel, const double* values) const {
+    const uint64_t n = kernel->samples;
+    for (uint32_t i = 0; i < kernel->mean.size(); ++i) {
+      const double deviation = fabs(values[i] - kernel->mean[i]);
+      const double sigma = sqrt(kernel->m2[i] / (n - 1));
+      if ((deviation > (PHASE_SIGMAS * sigma)) && (deviation > (tolerance_ * fabs(kernel->mean[i])))) return true;
+    }
+    return false;
+  }
+
+  // Lock-free kernels lookup table, the kernels are not removed. The table is filled
+  // under mutex_, the map lookup is used if the table is full.
+  static uint32_t Hash(const uint64_t& key) { return (key >> 6) & (TABLE_SIZE - 1); }
+
+  kernel_t* Find(const uint64_t& key) {
+    const uint32_t hash = Hash(key);
+    for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+      table_entry_t& entry = table_[(hash + i) & (TABLE_SIZE - 1)];
+      const uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+      if (entry_key == key) return entry.kernel.load(std::memory_order_acquire);
+      if (entry_key == 0) return NULL;
+    }
+    if (!table_full_.load(std::memory_order_acquire)) return NULL;
+    std::lock_guard<std::mutex> lck(mutex_);
+    auto it = map_.find(key);
+    return (it != map_.end()) ? it->second : NULL;
+  }
+
+  kernel_t* Insert(const uint64_t& key) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    auto ret = map_.insert({key, NULL});
+    if (!ret.second) return ret.first->second;
+    kernel_t* kernel = new kernel_t;
+    ret.first->second = kernel;
+
+    const uint32_t hash = Hash(key);
+    for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+      table_entry_t& entry = table_[(hash + i) & (TABLE_SIZE - 1)];
+      if (entry.key.load(std::memory_order_relaxed) == 0) {
+        entry.kernel.store(kernel, std::memory_order_release);
+        entry.key.store(key, std::memory_order_release);
+        return kernel;
+      }
+    }
+    table_full_.store(true, std::memory_order_release);
+    return kernel;
+  }
+
+  const double tolerance_;
+  const uint32_t rate_;
+  table_entry_t table_[TABLE_SIZE];
+  std::atomic<bool> table_full_;
+  std::mutex mutex_;
+  std::map<uint64_t, kernel_t*> map_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_DISPATCH_CONVERGE_H
@@ -0,0 +1,150 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_DISPATCH_FILTER_H
+#define _SRC_CORE_DISPATCH_FILTER_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <string>
+
+#include "inc/rocprofiler.h"
+#include "util/exception.h"
+
+namespace rocprofiler {
+
+// Dispatch filter, selects the dispatches to be passed to the dispatch callback.
+// The kernel name match and the per-kernel dispatch counters are kept in a lock-free
+// table by the kernel object, the kernel name is resolved once per kernel object.
+class DispatchFilter {
+ public:
+  explicit DispatchFilter(const rocprofiler_dispatch_filter_t& filter) :
+    filter_(filter),
+    name_regex_(NULL),
+    dispatch_index_(0),
+    table_full_(false)
+  {
+    if (filter.kernel_name_regex != NULL) {
+      name_string_ = filter.kernel_name_regex;
+      try {
+        name_regex_ = new std::regex(name_string_, std::regex::optimize);
+      } catch (const std::regex_error& e) {
+        EXC_RAISING(HSA_STATUS_ERROR_INVALID_ARGUMENT, "bad kernel name regex '" << name_string_ << "', " << e.what());
+      }
+    }
+    filter_.kernel_name_regex = NULL;
+    if (filter_.sample_rate == 0) filter_.sample_rate = 1;
+  }
+
+  ~DispatchFilter() {
+    delete name_regex_;
+    for (auto& v : map_) delete v.second;
+  }
+
+  // Checking the dispatch, the kernel name is queried only on a kernel object first dispatch
+  template <class Name>
+  bool Check(const uint64_t& kernel_object, const Name& kernel_name_fun) {
+    const uint64_t index = dispatch_index_.fetch_add(1, std::memory_order_relaxed);
+    if (index < filter_.index_begin) return false;
+    if ((filter_.index_end != 0) && (index >= filter_.index_end)) return false;
+
+    entry_t* entry = GetEntry(kernel_object, kernel_name_fun);
+    if (entry->match == false) return false;
+
+    const uint64_t count = entry->count.fetch_add(1, std::memory_order_relaxed);
+    if ((count % filter_.sample_rate) != 0) return false;
+    if ((filter_.kernel_max != 0) && ((count / filter_.sample_rate) >= filter_.kernel_max)) return false;
+    return true;
+  }
+
+ private:
+  struct entry_t {
+    std::atomic<uint64_t> key;
+    bool match;
+    std::atomic<uint64_t> count;
+  };
+  typedef std::map<uint64_t, entry_t*> map_t;
+  static const uint32_t TABLE_SIZE = 1024;
+
+  static uint32_t Hash(const uint64_t& key) { return (key >> 6) & (TABLE_SIZE - 1); }
+
+  template <class Name>
+  bool Match(const Name& kernel_name_fun) const {
+    if (name_regex_ == NULL) return true;
+    const char* kernel_name = kernel_name_fun();
+    return (kernel_name != NULL) ? std::regex_search(kernel_name, *name_regex_) : false;
+  }
+
+  // The table entries are filled under the mutex and never removed, the map
+  // is used if the table is full
+  template <class Name>
+  entry_t* GetEntry(const uint64_t& key, const Name& kernel_name_fun) {
+    const uint32_t hash = Hash(key);
+    for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+      entry_t& entry = table_[(hash + i) & (TABLE_SIZE - 1)];
+      const uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+      if (entry_key == key) return &entry;
+      if (entry_key == 0) break;
+    }
+
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (table_full_ == false) {
+      for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+        entry_t& entry = table_[(hash + i) & (TABLE_SIZE - 1)];
+        const uint64_t entry_key = entry.key.load(std::memory_order_relaxed);
+        if (entry_key == key) return &entry;
+        if (entry_key == 0) {
+          entry.match = Match(kernel_name_fun);
+          entry.count.store(0, std::memory_order_relaxed);
+          entry.key.store(key, std::memory_order_release);
+          return &entry;
+        }
+      }
+      table_full_ = true;
+    }
+
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      entry_t* entry = new entry_t;
+      entry->key.store(key, std::memory_order_relaxed);
+      entry->match = Match(kernel_name_fun);
+      entry->count.store(0, std::memory_order_relaxed);
+      it = map_.insert({key, entry}).first;
+    }
+    return it->second;
+  }
+
+  rocprofiler_dispatch_filter_t filter_;
+  std::string name_string_;
+  std::regex* name_regex_;
+  std::atomic<uint64_t> dispatch_index_;
+  entry_t table_[TABLE_SIZE]{};
+  bool table_full_;
+  map_t map_;
+  std::mutex mutex_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_DISPATCH_FILTER_H
@@ -0,0 +1,117 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_DISPATCH_SAMPLER_H
+#define _SRC_CORE_DISPATCH_SAMPLER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+
+namespace rocprofiler {
+
+// Statistical dispatch sampler, a sampled dispatch is assigned the weight of
+// the inverse of its sampling probability.
+// With a rate N the dispatches are sampled randomly with 1/N probability.
+// With a budget of events per second the probability is adjusted per time window
+// by the previous window dispatches count, the sampled dispatches number is bounded
+// by the window quota.
+class DispatchSampler {
+ public:
+  DispatchSampler(const uint32_t& rate, const uint32_t& budget) :
+    rate_(rate),
+    quota_(0),
+    prob_(PROB_ONE),
+    window_begin_(Now()),
+    window_count_(0),
+    window_sampled_(0)
+  {
+    if (budget != 0) {
+      quota_ = (uint64_t(budget) * WINDOW_NS) / NS_PER_SEC;
+      if (quota_ == 0) quota_ = 1;
+    } else if (rate_ > 1) {
+      prob_.store(PROB_ONE / rate_, std::memory_order_relaxed);
+    }
+  }
+
+  // Sampling the dispatch, returns true and the weight if the dispatch is sampled
+  bool Sample(float* weight) {
+    if (quota_ != 0) UpdateWindow();
+
+    const uint64_t prob = prob_.load(std::memory_order_relaxed);
+    if ((prob < PROB_ONE) && (Random() >= prob)) return false;
+    if ((quota_ != 0) &&
+        (window_sampled_.fetch_add(1, std::memory_order_relaxed) >= quota_)) return false;
+
+    *weight = float(double(PROB_ONE) / double(prob));
+    return true;
+  }
+
+ private:
+  static const uint64_t PROB_ONE = 1ull << 32;
+  static const uint64_t NS_PER_SEC = 1000000000ull;
+  static const uint64_t WINDOW_NS = 100000000ull;  // 100ms
+
+  static uint64_t Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return uint64_t(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+  }
+
+  // Per-thread xorshift generator, 32 bits random value
+  static uint64_t Random() {
+    static thread_local uint64_t state = 0;
+    if (state == 0) state = (reinterpret_cast<uintptr_t>(&state) ^ Now()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state >> 32;
+  }
+
+  // Starting a new window, the probability is set by the previous window
+  // dispatches rate scaled to the window length
+  void UpdateWindow() {
+    window_count_.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t now = Now();
+    uint64_t begin = window_begin_.load(std::memory_order_relaxed);
+    if (((now - begin) >= WINDOW_NS) &&
+        window_begin_.compare_exchange_strong(begin, now, std::memory_order_relaxed)) {
+      const uint64_t count = window_count_.exchange(0, std::memory_order_relaxed);
+      const uint64_t expected = (count * WINDOW_NS) / (now - begin);
+      const uint64_t prob = (expected > quota_) ? (quota_ * PROB_ONE) / expected : PROB_ONE;
+      prob_.store((prob != 0) ? prob : 1, std::memory_order_relaxed);
+      window_sampled_.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  const uint32_t rate_;
+  uint64_t quota_;
+  std::atomic<uint64_t> prob_;
+  std::atomic<uint64_t> window_begin_;
+  std::atomic<uint64_t> window_count_;
+  std::atomic<uint64_t> window_sampled_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_DISPATCH_SAMPLER_H
@@ -23,8 +23,10 @@ THE SOFTWARE.
 #include "gpu_command.h"
 
 #include <hsa.h>
+#include <string.h>
 
 #include <map>
+#include <mutex>
 
 #include "core/profile.h"
 #include "util/exception.h"
@@ -82,41 +84,93 @@ size_t CreateGpuCommand(gpu_cmd_op_t op,
   return (packet_count * sizeof(packet_t));
 }
 
+namespace {
+// Control queue size, the commands are issued one at a time
+const uint32_t CONTROL_QUEUE_SIZE = 64;
+
 struct gpu_cmd_entry_t {
   packet_t command[Profile::LEGACY_SLOT_SIZE_PKT];
   uint32_t size;
 };
-struct gpu_cmd_key_t {
-  gpu_cmd_op_t op;
-  uint32_t chip_id;
-};
-struct gpu_cmd_fncomp_t {
-  bool operator() (const gpu_cmd_key_t& a, const gpu_cmd_key_t& b) const {
-    return (a.op < b.op) || ((a.op == b.op) && (a.chip_id < b.chip_id));
-  }
+struct gpu_agent_cmds_t {
+  std::mutex mutex;
+  gpu_cmd_entry_t commands[NUMBER_GPU_CMD_OP];
+  hsa_signal_t signal;
+  hsa_queue_t* queue;
 };
-typedef std::map<gpu_cmd_key_t, gpu_cmd_entry_t, gpu_cmd_fncomp_t> gpu_cmd_map_t;
-
-size_t GetGpuCommand(gpu_cmd_op_t op,
-                       const rocprofiler::util::AgentInfo* agent_info,
-                       packet_t** command_out) {
-  thread_local gpu_cmd_map_t map;
-
-  // Getting chip-id
-  uint32_t chip_id = 0;
-  hsa_agent_info_t attribute = static_cast<hsa_agent_info_t>(HSA_AMD_AGENT_INFO_CHIP_ID);
-  hsa_status_t status = hsa_agent_get_info(agent_info->dev_id, attribute, &chip_id);
-  if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_agent_get_info failed");
-
-  // Query/create a command
-  auto ret = map.insert({gpu_cmd_key_t{op, chip_id}, gpu_cmd_entry_t{}});
-  gpu_cmd_map_t::iterator it = ret.first;
+typedef std::map<uint32_t, gpu_agent_cmds_t*> gpu_cmd_map_t;
+
+std::mutex map_mutex;
+gpu_cmd_map_t* map = NULL;
+
+void BuildCommand(gpu_agent_cmds_t* cmds, gpu_cmd_op_t op, const rocprofiler::util::AgentInfo* agent_info) {
+  gpu_cmd_entry_t& entry = cmds->commands[op];
+  if (entry.size == 0) entry.size = CreateGpuCommand(op, agent_info, entry.command, Profile::LEGACY_SLOT_SIZE_PKT);
+}
+
+// Getting the agent commands, the PMC enable/disable commands are built on the agent first use
+gpu_agent_cmds_t* GetAgentCommands(const rocprofiler::util::AgentInfo* agent_info) {
+  std::lock_guard<std::mutex> lck(map_mutex);
+  if (map == NULL) map = new gpu_cmd_map_t;
+  auto ret = map->insert({agent_info->dev_index, NULL});
   if (ret.second) {
-    it->second.size = CreateGpuCommand(op, agent_info, it->second.command, Profile::LEGACY_SLOT_SIZE_PKT);
+    gpu_agent_cmds_t* cmds = new gpu_agent_cmds_t;
+    for (gpu_cmd_entry_t& entry : cmds->commands) entry.size = 0;
+    cmds->queue = NULL;
+    BuildCommand(cmds, PMC_ENABLE_GPU_CMD_OP, agent_info);
+    BuildCommand(cmds, PMC_DISABLE_GPU_CMD_OP, agent_info);
+    hsa_status_t status = hsa_signal_create(1, 0, NULL, &(cmds->signal));
+    if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "signal_create " << std::hex << status);
+    ret.first->second = cmds;
+  }
+  return ret.first->second;
+}
+
+hsa_queue_t* GetControlQueue(gpu_agent_cmds_t* cmds, const rocprofiler::util::AgentInfo* agent_info) {
+  if (cmds->queue == NULL) {
+    rocprofiler::util::HsaRsrcFactory* hsa_rsrc = &rocprofiler::util::HsaRsrcFactory::Instance();
+    if (hsa_rsrc->CreateQueue(agent_info, CONTROL_QUEUE_SIZE, &(cmds->queue)) == false) {
+      EXC_RAISING(HSA_STATUS_ERROR, "CreateQueue(" << agent_info->dev_index << ")");
+    }
+  }
+  return cmds->queue;
+}
+}  // namespace
+
+void GpuCommands::Prepare(const rocprofiler::util::AgentInfo* agent_info, const bool& control_queue) {
+  gpu_agent_cmds_t* cmds = GetAgentCommands(agent_info);
+  if (control_queue) {
+    std::lock_guard<std::mutex> lck(cmds->mutex);
+    GetControlQueue(cmds, agent_info);
   }
+}
+
+void GpuCommands::Issue(gpu_cmd_op_t op, const rocprofiler::util::AgentInfo* agent_info, hsa_queue_t* queue) {
+  if (op >= NUMBER_GPU_CMD_OP) EXC_RAISING(HSA_STATUS_ERROR, "bad op value (" << op << ")");
+  rocprofiler::util::HsaRsrcFactory* hsa_rsrc = &rocprofiler::util::HsaRsrcFactory::Instance();
+  gpu_agent_cmds_t* cmds = GetAgentCommands(agent_info);
 
-  *command_out = it->second.command;
-  return it->second.size;
+  std::lock_guard<std::mutex> lck(cmds->mutex);
+  BuildCommand(cmds, op, agent_info);
+  if (queue == NULL) queue = GetControlQueue(cmds, agent_info);
+
+  // The cached command is kept intact, the copy is set with the agent signal
+  const gpu_cmd_entry_t& entry = cmds->commands[op];
+  packet_t command[Profile::LEGACY_SLOT_SIZE_PKT];
+  memcpy(command, entry.command, entry.size);
+  command[0].completion_signal = cmds->signal;
+  hsa_rsrc->HsaApi()->hsa_signal_store_relaxed(cmds->signal, 1);
+  hsa_rsrc->Submit(queue, command, entry.size);
+  hsa_rsrc->SignalWait(cmds->signal, 1);
+}
+
+void GpuCommands::Destroy() {
+  std::lock_guard<std::mutex> lck(map_mutex);
+  if (map != NULL) {
+    for (auto& item : *map) delete item.second;
+    delete map;
+    map = NULL;
+  }
 }
 
 }  // namespace rocprofiler
@@ -25,6 +25,8 @@ THE SOFTWARE.
 
 #include <hsa.h>
 
+#include <atomic>
+
 #include "core/types.h"
 #include "util/exception.h"
 #include "util/hsa_rsrc_factory.h"
@@ -37,21 +39,35 @@ enum gpu_cmd_op_t {
   NUMBER_GPU_CMD_OP
 };
 
-size_t GetGpuCommand(gpu_cmd_op_t op,
-                       const rocprofiler::util::AgentInfo* agent_info,
-                       packet_t** command_out);
+// GPU agents with the PMC used, the PMC disabling is skipped for the agents never profiled,
+// the agents above the mask width are always disabled
+class PmcAgents {
+ public:
+  static void Set(const uint32_t& dev_index) { mask_.fetch_or(Bit(dev_index), std::memory_order_relaxed); }
+  static bool IsSet(const uint32_t& dev_index) { return (mask_.load(std::memory_order_relaxed) & Bit(dev_index)) != 0; }
+
+ private:
+  static uint64_t Bit(const uint32_t& dev_index) { return (dev_index < 63) ? (1ull << dev_index) : (1ull << 63); }
+  static std::atomic<uint64_t> mask_;
+};
+
+// Per-agent GPU commands cache. The PMC enable/disable commands are built once per agent,
+// the commands are issued with a reused completion signal to the given queue or to
+// the agent persistent control queue.
+class GpuCommands {
+ public:
+  // Building the agent commands ahead of the first use, and the control queue if requested
+  static void Prepare(const util::AgentInfo* agent_info, const bool& control_queue);
+  // Issuing the command and waiting for the completion, on the control queue if NULL
+  static void Issue(gpu_cmd_op_t op, const util::AgentInfo* agent_info, hsa_queue_t* queue);
+  // The cached HSA memory, queues and signals are released with the runtime
+  static void Destroy();
+};
 
 static inline size_t IssueGpuCommand(gpu_cmd_op_t op,
                                      const rocprofiler::util::AgentInfo* agent_info,
                                      hsa_queue_t* queue) {
-  packet_t* command;
-  const size_t size = GetGpuCommand(op, agent_info, &command);
-  hsa_status_t status = hsa_signal_create(1, 0, NULL, &(command->completion_signal));
-  if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "signal_create " << std::hex << status);
-  rocprofiler::util::HsaRsrcFactory::Instance().Submit(queue, command, size);
-  rocprofiler::util::HsaRsrcFactory::Instance().SignalWait(command->completion_signal, 1);
-  status = hsa_signal_destroy(command->completion_signal);
-  if (status != HSA_STATUS_SUCCESS) EXC_ABORT(status, "signal_destroy " << std::hex << status);
+  GpuCommands::Issue(op, agent_info, queue);
   return HSA_STATUS_SUCCESS;
 }
 
@@ -24,7 +24,9 @@ THE SOFTWARE.
 #define SRC_CORE_GROUP_SET_H_
 
 #include <stdio.h>
+#include <algorithm>
 #include <map>
+#include <set>
 #include <vector>
 
 #include "core/metrics.h"
@@ -102,6 +104,8 @@ class MetricsGroup {
   bool AddMetric(const Metric* metric) {
     // Blocks utilization delta
     blocks_map_t blocks_delta;
+    // The metric counters, a counter can be referenced more than once by an expression
+    std::set<std::string> counters_set;
 
     // Process metrics counters
     const counters_vec_t& counters_vec = metric->GetCounters();
@@ -114,22 +118,12 @@ class MetricsGroup {
       // For metrics expressions checking that there is no the same counter in the input metrics
       // and also that the counter wasn't registered already by another input metric expression
       if (info_map_.find(counter->name) != info_map_.end()) continue;
+      if (counters_set.insert(counter->name).second == false) continue;
 
       const block_des_t block_des = {event->block_name, event->block_index};
       auto ret = blocks_map_.insert({block_des, {}});
       block_status_t& block_status = ret.first->second;
-      if (ret.second == true) {
-        profile_t query = {};
-        query.agent = agent_info_->dev_id;
-        query.type = HSA_VEN_AMD_AQLPROFILE_EVENT_TYPE_PMC;
-        query.events = event;
-
-        uint32_t block_counters;
-        hsa_status_t status = util::HsaRsrcFactory::Instance().AqlProfileApi()->hsa_ven_amd_aqlprofile_get_info(
-            &query, HSA_VEN_AMD_AQLPROFILE_INFO_BLOCK_COUNTERS, &block_counters);
-        if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "get block_counters info");
-        block_status.max_counters = block_counters;
-      }
+      if (ret.second == true) block_status.max_counters = GetBlockCounters(agent_info_, event);
 
       ret = blocks_delta.insert({block_des, block_status});
       block_status_t& delta_status = ret.first->second;
@@ -150,6 +144,22 @@ class MetricsGroup {
     return true;
   }
 
+  const std::vector<const Metric*>& GetMetrics() const { return metrics_vec_; }
+
+  // Return the HW block counters number
+  static uint32_t GetBlockCounters(const util::AgentInfo* agent_info, const event_t* event) {
+    profile_t query = {};
+    query.agent = agent_info->dev_id;
+    query.type = HSA_VEN_AMD_AQLPROFILE_EVENT_TYPE_PMC;
+    query.events = event;
+
+    uint32_t block_counters;
+    hsa_status_t status = util::HsaRsrcFactory::Instance().AqlProfileApi()->hsa_ven_amd_aqlprofile_get_info(
+        &query, HSA_VEN_AMD_AQLPROFILE_INFO_BLOCK_COUNTERS, &block_counters);
+    if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "get block_counters info");
+    return block_counters;
+  }
+
   private:
   const Metric* NewCounterInfo(const std::string& name) const {
     return GetMetric(metrics_, name);
@@ -167,11 +177,210 @@ class MetricsGroup {
   std::vector<const Metric*> metrics_vec_;
 };
 
+// Metrics groups planner
+// The metrics are partitioned to the minimal number of groups, the profiling passes,
+// each group fitting the HW blocks counters limits. The counters are shared by all
+// metrics of a group, the metrics are placed to the group adding the least new counters
+// and then the groups are tried to be eliminated by moving their metrics to the others.
+class GroupPlanner {
+  public:
+  typedef std::vector<const Metric*> metrics_vec_t;
+  typedef std::vector<metrics_vec_t> plan_t;
+
+  GroupPlanner(const util::AgentInfo* agent_info) : agent_info_(agent_info) {}
+
+  void AddMetric(const Metric* metric) {
+    if (!metrics_index_.insert({metric->GetName(), metrics_.size()}).second) return;
+
+    metric_t m{metric, {}, 0};
+    std::map<uint32_t, uint32_t> block_load;
+    for (const counter_t* counter : metric->GetCounters()) {
+      auto ret = counters_index_.insert({counter->name, counter_blocks_.size()});
+      if (ret.second == true) counter_blocks_.push_back(GetBlock(&(counter->event)));
+      const uint32_t id = ret.first->second;
+      if (std::find(m.counters.begin(), m.counters.end(), id) == m.counters.end()) {
+        m.counters.push_back(id);
+        block_load[counter_blocks_[id]] += 1;
+      }
+    }
+    // Scaled load of the most utilized block
+    for (const auto& v : block_load) {
+      const uint32_t load = (v.second * 1000) / block_caps_[v.first];
+      if (load > m.weight) m.weight = load;
+    }
+    metrics_.push_back(m);
+  }
+
+  // Return the planned groups
+  void Plan(plan_t* plan) {
+    groups_.clear();
+
+    // Placing first the metrics most utilizing a block and then the bigger ones
+    std::vector<uint32_t> order(metrics_.size());
+    for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [this](const uint32_t& a, const uint32_t& b) {
+      const metric_t& ma = metrics_[a];
+      const metric_t& mb = metrics_[b];
+      return (ma.weight > mb.weight) ||
+        ((ma.weight == mb.weight) && (ma.counters.size() > mb.counters.size()));
+    });
+    for (const uint32_t& m : order) {
+      if (Place(m, groups_.size()) == false) {
+        groups_.push_back(NewGroup());
+        if (Fits(groups_.back(), metrics_[m]) == false) {
+          AQL_EXC_RAISING(HSA_STATUS_ERROR, "Metric '" << metrics_[m].metric->GetName() << "' doesn't fit in one group");
+        }
+        Add(groups_.back(), m);
+      }
+    }
+
+    // Eliminating groups, the groups with less metrics are tried first
+    bool improved = true;
+    while (improved && (groups_.size() > 1)) {
+      improved = false;
+      std::vector<uint32_t> candidates(groups_.size());
+      for (uint32_t g = 0; g < candidates.size(); ++g) candidates[g] = g;
+      std::stable_sort(candidates.begin(), candidates.end(), [this](const uint32_t& a, const uint32_t& b) {
+        return groups_[a].metrics.size() < groups_[b].metrics.size();
+      });
+      for (const uint32_t& g : candidates) {
+        if (Eliminate(g) == true) {
+          improved = true;
+          break;
+        }
+      }
+    }
+
+    plan->clear();
+    for (const group_t& group : groups_) {
+      plan->push_back(metrics_vec_t());
+      for (const uint32_t& m : group.metrics) plan->back().push_back(metrics_[m].metric);
+    }
+  }
+
+  // Lower bound of the groups number by the HW blocks counters limits
+  uint32_t LowerBound() const {
+    std::vector<uint32_t> block_load(block_caps_.size(), 0);
+    for (const uint32_t& block : counter_blocks_) block_load[block] += 1;
+    uint32_t bound = (metrics_.empty()) ? 0 : 1;
+    for (uint32_t b = 0; b < block_caps_.size(); ++b) {
+      const uint32_t n = (block_load[b] + block_caps_[b] - 1) / block_caps_[b];
+      if (n > bound) bound = n;
+    }
+    return bound;
+  }
+
+  private:
+  struct metric_t {
+    const Metric* metric;
+    std::vector<uint32_t> counters;
+    uint32_t weight;
+  };
+
+  struct group_t {
+    std::vector<uint32_t> metrics;
+    std::vector<uint32_t> counter_refs;
+    std::vector<uint32_t> block_usage;
+  };
+
+  uint32_t GetBlock(const event_t* event) {
+    const block_des_t block_des = {event->block_name, event->block_index};
+    auto ret = blocks_index_.insert({block_des, block_caps_.size()});
+    if (ret.second == true) {
+      const uint32_t caps = MetricsGroup::GetBlockCounters(agent_info_, event);
+      block_caps_.push_back((caps != 0) ? caps : 1);
+    }
+    return ret.first->second;
+  }
+
+  group_t NewGroup() const {
+    group_t group;
+    group.counter_refs.assign(counter_blocks_.size(), 0);
+    group.block_usage.assign(block_caps_.size(), 0);
+    return group;
+  }
+
+  // New counters number if the metric fits in the group, -1 otherwise
+  int Cost(const group_t& group, const metric_t& metric) const {
+    std::map<uint32_t, uint32_t> delta;
+    int cost = 0;
+    for (const uint32_t& c : metric.counters) {
+      if (group.counter_refs[c] != 0) continue;
+      const uint32_t block = counter_blocks_[c];
+      if ((group.block_usage[block] + ++delta[block]) > block_caps_[block]) return -1;
+      ++cost;
+    }
+    return cost;
+  }
+
+  bool Fits(const group_t& group, const metric_t& metric) const { return Cost(group, metric) >= 0; }
+
+  void Add(group_t& group, const uint32_t& m) {
+    group.metrics.push_back(m);
+    for (const uint32_t& c : metrics_[m].counters) {
+      if (group.counter_refs[c]++ == 0) group.block_usage[counter_blocks_[c]] += 1;
+    }
+  }
+
+  void Remove(group_t& group, const uint32_t& m) {
+    group.metrics.erase(std::find(group.metrics.begin(), group.metrics.end(), m));
+    for (const uint32_t& c : metrics_[m].counters) {
+      if (--group.counter_refs[c] == 0) group.block_usage[counter_blocks_[c]] -= 1;
+    }
+  }
+
+  // Placing the metric to the group adding the least counters, the excluded group is skipped
+  bool Place(const uint32_t& m, const uint32_t& excluded) {
+    int best_cost = -1;
+    uint32_t best = 0;
+    for (uint32_t g = 0; g < groups_.size(); ++g) {
+      if (g == excluded) continue;
+      const int cost = Cost(groups_[g], metrics_[m]);
+      if ((cost >= 0) && ((best_cost < 0) || (cost < best_cost))) {
+        best_cost = cost;
+        best = g;
+      }
+    }
+    if (best_cost < 0) return false;
+    Add(groups_[best], m);
+    return true;
+  }
+
+  // Moving all group metrics to the other groups, the groups are restored on failure
+  bool Eliminate(const uint32_t& index) {
+    const std::vector<group_t> saved = groups_;
+    const std::vector<uint32_t> metrics = groups_[index].metrics;
+    for (const uint32_t& m : metrics) {
+      if (Place(m, index) == false) {
+        groups_ = saved;
+        return false;
+      }
+    }
+    groups_.erase(groups_.begin() + index);
+    return true;
+  }
+
+  // Agent info
+  const util::AgentInfo* const agent_info_;
+  // Input metrics and the index by name
+  std::vector<metric_t> metrics_;
+  std::map<std::string, uint32_t> metrics_index_;
+  // Counters blocks and the index by counter name
+  std::vector<uint32_t> counter_blocks_;
+  std::map<std::string, uint32_t> counters_index_;
+  // Blocks counters limits and the index by block descriptor
+  std::vector<uint32_t> block_caps_;
+  std::map<block_des_t, uint32_t, lt_block_des> blocks_index_;
+  // Planned groups
+  std::vector<group_t> groups_;
+};
+
 // Metrics groups class
 class MetricsGroupSet {
   public:
   MetricsGroupSet(const util::AgentInfo* agent_info, const rocprofiler_feature_t* info_array, const uint32_t info_count) :
-    agent_info_(agent_info)
+    agent_info_(agent_info),
+    lower_bound_(0)
   {
     metrics_ = MetricsDict::Create(agent_info);
     if (metrics_ == NULL) EXC_RAISING(HSA_STATUS_ERROR, "MetricsDict create failed");
@@ -184,6 +393,16 @@ class MetricsGroupSet {
 
   uint32_t GetSize() const { return groups_.size(); }
 
+  // Lower bound of the groups number by the HW blocks counters limits
+  uint32_t GetLowerBound() const { return lower_bound_; }
+
+  // Return the group index of a given metric
+  uint32_t GetGroupIndex(const std::string& name) const {
+    auto it = group_index_.find(name);
+    if (it == group_index_.end()) EXC_RAISING(HSA_STATUS_ERROR, "metric '" << name << "' is not planned");
+    return it->second;
+  }
+
   void Print(FILE* file) const {
     for (const auto* group : groups_) {
       fprintf(stdout, " pmc : "); fflush(stdout);
@@ -193,34 +412,25 @@ class MetricsGroupSet {
 
   private:
   void Initialize(const rocprofiler_feature_t* info_array, const uint32_t info_count) {
-    std::multimap<uint32_t, const Metric*, std::greater<uint32_t> > input_metrics;
+    GroupPlanner planner(agent_info_);
     for (unsigned i = 0; i < info_count; ++i) {
       const rocprofiler_feature_t* info = &info_array[i];
       if (info->kind != ROCPROFILER_FEATURE_KIND_METRIC) continue;
-      const Metric* metric = MetricsGroup::GetMetric(metrics_, info);
-      const uint32_t counters_num = metric->GetCounters().size();
-      input_metrics.insert({counters_num, metric});
-
-      if (MetricsGroup(agent_info_).AddMetric(metric) == false) {
-        AQL_EXC_RAISING(HSA_STATUS_ERROR, "Metric '" << metric->GetName() << "' doesn't fit in one group");
-      }
-    }
-#if 0
-    for (const auto& entry : input_metrics) {
-      printf("%u %s\n", entry.first, entry.second->GetName().c_str());
+      planner.AddMetric(MetricsGroup::GetMetric(metrics_, info));
     }
-#endif
-    auto end = input_metrics.end();
-    while (!input_metrics.empty()) {
+
+    GroupPlanner::plan_t plan;
+    planner.Plan(&plan);
+    lower_bound_ = planner.LowerBound();
+
+    for (const auto& metrics_vec : plan) {
       MetricsGroup* group = NextGroup();
-      auto it = input_metrics.begin();
-      do {
-        auto curr = it++;
-        const Metric* metric = curr->second;
-        if (group->AddMetric(metric) == true) {
-          input_metrics.erase(curr);
+      for (const Metric* metric : metrics_vec) {
+        if (group->AddMetric(metric) == false) {
+          AQL_EXC_RAISING(HSA_STATUS_ERROR, "Metric '" << metric->GetName() << "' planned group overflow");
         }
-      } while (it != end);
+        group_index_[metric->GetName()] = groups_.size() - 1;
+      }
     }
   }
 
@@ -235,6 +445,10 @@ class MetricsGroupSet {
   const MetricsDict* metrics_;
   // Metrics group vector
   std::vector<MetricsGroup*> groups_;
+  // Metrics group index map
+  std::map<std::string, uint32_t> group_index_;
+  // Groups number lower bound
+  uint32_t lower_bound_;
 };
 
 }  // namespace rocprofiler
@@ -39,7 +39,9 @@ extern decltype(hsa_amd_queue_intercept_register)* hsa_amd_queue_intercept_regis
 
 class HsaProxyQueue : public ProxyQueue {
  public:
+  // The runtime interceptors cannot be unregistered
   hsa_status_t SetInterceptCB(on_submit_cb_t on_submit_cb, void* data) {
+    if (on_submit_cb == NULL) return HSA_STATUS_ERROR_INVALID_ARGUMENT;
     return hsa_amd_queue_intercept_register_fn(queue_, on_submit_cb, data);
   }
 
@@ -29,20 +29,38 @@ void InterceptQueue::HsaIntercept(HsaApiTable* table) {
 }
 
 InterceptQueue::mutex_t InterceptQueue::mutex_;
-rocprofiler_queue_callbacks_t InterceptQueue::callbacks_ = {};
-void* InterceptQueue::callback_data_ = NULL;
-std::atomic<rocprofiler_callback_t> InterceptQueue::dispatch_callback_{NULL};
+std::atomic<const InterceptQueue::callbacks_set_t*> InterceptQueue::callbacks_set_{NULL};
+std::atomic<const InterceptQueue::callbacks_set_t*> InterceptQueue::dispatch_set_{NULL};
+std::vector<const InterceptQueue::callbacks_set_t*> InterceptQueue::callbacks_retired_;
+bool InterceptQueue::started_ = false;
+std::atomic<DispatchFilter*> InterceptQueue::filter_{NULL};
+std::vector<DispatchFilter*> InterceptQueue::filter_retired_;
+DispatchSampler* InterceptQueue::sampler_ = NULL;
+DispatchConverge* InterceptQueue::converge_ = NULL;
+uint32_t InterceptQueue::queue_agents_ = 0;
+uint32_t InterceptQueue::queue_types_ = 0;
+uint32_t InterceptQueue::queue_budget_ = 0;
+rocprofiler_queue_stats_t InterceptQueue::queue_stats_{};
 InterceptQueue::obj_map_t InterceptQueue::obj_map_{};
+InterceptQueue::obj_table_entry_t InterceptQueue::obj_table_[InterceptQueue::OBJ_TABLE_SIZE]{};
+std::atomic<bool> InterceptQueue::obj_table_full_{false};
 const char* InterceptQueue::kernel_none_ = "";
 Tracker* InterceptQueue::tracker_ = NULL;
 bool InterceptQueue::tracker_on_ = false;
 bool InterceptQueue::in_create_call_ = false;
 InterceptQueue::queue_id_t InterceptQueue::current_queue_id = 0;
 
-rocprofiler_hsa_callback_fun_t InterceptQueue::submit_callback_fun_ = NULL;
-void* InterceptQueue::submit_callback_arg_ = NULL;
+std::atomic<const InterceptQueue::submit_set_t*> InterceptQueue::submit_set_{NULL};
+std::vector<const InterceptQueue::submit_set_t*> InterceptQueue::submit_retired_;
 
 bool InterceptQueue::opt_mode_ = false;
 uint32_t InterceptQueue::k_concurrent_ = K_CONC_OFF;
 std::once_flag InterceptQueue::once_flag_;
+uint32_t InterceptQueue::window_dispatches_ = InterceptQueue::WINDOW_DISPATCHES_DEFAULT;
+uint64_t InterceptQueue::window_ns_ = 0;
+std::thread* InterceptQueue::window_timer_ = NULL;
+std::mutex InterceptQueue::window_timer_mutex_;
+std::condition_variable InterceptQueue::window_timer_cond_;
+bool InterceptQueue::window_timer_stop_ = false;
+uint32_t InterceptQueue::accum_dispatches_ = 0;
 }  // namespace rocprofiler
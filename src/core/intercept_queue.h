@@ -28,11 +28,18 @@ THE SOFTWARE.
 #include <sys/syscall.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include "core/context.h"
+#include "core/dispatch_converge.h"
+#include "core/dispatch_filter.h"
+#include "core/dispatch_sampler.h"
 #include "core/proxy_queue.h"
 #include "core/tracker.h"
 #include "core/types.h"
@@ -43,7 +50,8 @@ namespace rocprofiler {
 enum {
   K_CONC_OFF = 0,
   K_CONC_PMC = 1,
-  K_CONC_TRACE = 2
+  K_CONC_TRACE = 2,
+  K_CONC_WINDOW = 3
 };
 
 extern decltype(hsa_queue_create)* hsa_queue_create_fn;
@@ -69,17 +77,6 @@ static inline void print_packet(const void* in_p, const uint32_t& in_n, const ui
   fflush(stdout);
 }
 
-static std::mutex ctx_a_mutex;
-typedef std::map<Context*, bool> ctx_a_map_t;
-static ctx_a_map_t* ctx_a_map = NULL;
-static bool ck_ctx_inactive(Context* context) {
-  std::lock_guard<std::mutex> lock(ctx_a_mutex);
-  if (ctx_a_map == NULL) ctx_a_map = new ctx_a_map_t;
-  auto ret = ctx_a_map->insert({context, true});
-  if (ret.second == false) ctx_a_map->erase(context);
-  return ret.second;
-}
-
 class InterceptQueue {
  public:
   typedef std::recursive_mutex mutex_t;
@@ -100,6 +97,15 @@ class InterceptQueue {
     hsa_status_t status = HSA_STATUS_ERROR;
 
     if (in_create_call_) EXC_ABORT(status, "recursive InterceptQueueCreate()");
+
+    // The queues filtered out by the queue policy are created by the original call,
+    // the explicitly tracked queues are always intercepted
+    if (!tracker_on && !CheckQueue(agent, type)) {
+      status = hsa_queue_create_fn(agent, size, type, callback, data, private_segment_size,
+                                   group_segment_size, queue);
+      if (status == HSA_STATUS_SUCCESS) ++(queue_stats_.bypassed);
+      return status;
+    }
     in_create_call_ = true;
 
     ProxyQueue* proxy = ProxyQueue::Create(agent, size, type, queue_event_callback, data, private_segment_size,
@@ -114,19 +120,16 @@ class InterceptQueue {
 
     InterceptQueue* obj = new InterceptQueue(agent, *queue, proxy);
     obj_map_[(uint64_t)(*queue)] = obj;
-    if (k_concurrent_ == K_CONC_TRACE) {
-      status = proxy->SetInterceptCB(OnSubmitCB_ctrace, obj);
-    } else if (opt_mode_) {
-      status = proxy->SetInterceptCB(OnSubmitCB_opt, obj);
-    } else {
-      status = proxy->SetInterceptCB(OnSubmitCB, obj);
-    }
+    ObjTableSet((uint64_t)(*queue), obj);
+    status = proxy->SetInterceptCB(SelectSubmitCB(tracker_ != NULL), obj);
     obj->queue_event_callback_ = callback;
     obj->queue_id = current_queue_id;
     ++current_queue_id;
+    ++(queue_stats_.queues);
 
-    if (callbacks_.create != NULL) {
-      status = callbacks_.create(*queue, callback_data_);
+    const callbacks_set_t* set = callbacks_set_.load(std::memory_order_acquire);
+    if ((set != NULL) && (set->callbacks.create != NULL)) {
+      status = set->callbacks.create(*queue, set->data);
     }
 
     in_create_call_ = false;
@@ -159,94 +162,76 @@ class InterceptQueue {
       return hsa_queue_destroy_fn(queue);
     }
 
-    if (callbacks_.destroy != NULL) {
-      status = callbacks_.destroy(queue, callback_data_);
+    const callbacks_set_t* set = callbacks_set_.load(std::memory_order_acquire);
+    if ((set != NULL) && (set->callbacks.destroy != NULL)) {
+      status = set->callbacks.destroy(queue, set->data);
     }
 
     if (status == HSA_STATUS_SUCCESS) {
+      GetObj(queue)->FlushRanges();
       status = DelObj(queue);
     }
 
     return status;
   }
 
-  static void OnSubmitCB_opt(const void* in_packets, uint64_t count, uint64_t user_que_idx, void* data,
-                         hsa_amd_queue_intercept_packet_writer writer) {
-    const packet_t* packets_arr = reinterpret_cast<const packet_t*>(in_packets);
-    InterceptQueue* obj = reinterpret_cast<InterceptQueue*>(data);
-    Queue* proxy = obj->proxy_;
-
-    // Travers input packets
-    for (uint64_t j = 0; j < count; ++j) {
-      const packet_t* packet = &packets_arr[j];
-      bool to_submit = true;
-
-      // Checking for dispatch packet type
-      if ((GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) &&
-          (dispatch_callback_.load(std::memory_order_acquire) != NULL)) {
-        const hsa_kernel_dispatch_packet_t* dispatch_packet =
-            reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
-        const hsa_signal_t completion_signal = dispatch_packet->completion_signal;
-
-        rocprofiler_callback_data_t data = {obj->agent_info_->dev_id,
-                                            obj->agent_info_->dev_index,
-                                            obj->queue_,
-                                            user_que_idx,
-                                            obj->queue_id,
-                                            completion_signal,
-                                            dispatch_packet,
-                                            NULL,  // kernel_name
-                                            0,  // kernel_object
-                                            NULL,  // kernel_code
-                                            0, // (uint32_t)syscall(__NR_gettid),
-                                            NULL};  // record
-
-        // Calling dispatch callback
-        rocprofiler_group_t group = {};
-        hsa_status_t status = (dispatch_callback_.load())(&data, callback_data_, &group);
-        Context* context = reinterpret_cast<Context*>(group.context);
-        // Injecting profiling start/stop packets
-        if ((status == HSA_STATUS_SUCCESS) && (context != NULL)) {
-          if (group.feature_count != 0) {
-            if (tracker_ != NULL) {
-              Group* context_group = context->GetGroup(group.index);
-              const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = context_group->GetDispatchSignal();
-              Tracker::Enable_opt(context_group, completion_signal);
-              context_group->IncrRefsCount();
-            }
-
-            const pkt_vector_t& start_vector = context->StartPackets(group.index);
-            const pkt_vector_t& stop_vector = context->StopPackets(group.index);
-            pkt_vector_t packets = start_vector;
-            packets.insert(packets.end(), *packet);
-            packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
-            if (writer != NULL) {
-              writer(&packets[0], packets.size());
-            } else {
-              proxy->Submit(&packets[0], packets.size());
-            }
-            to_submit = false;
-          }
-        }
-      }
-
-      // Submitting the original packets if profiling was not enabled
-      if (to_submit) {
-        if (writer != NULL) {
-          writer(packet, 1);
-        } else {
-          proxy->Submit(packet, 1);
-        }
-      }
+  // Submit callback mode traits, the submit callback is instantiated per mode so the
+  // per-packet mode checks are resolved at compile time
+  //   k_concurrent - the concurrent profiling mode, K_CONC_TRACE for the trace mode
+  //   opt_mode - the contexts pools mode, the kernel info is not queried
+  //   tracking - the dispatches timestamps are tracked
+  //   accumulate - the same kernel dispatches counters are accumulated over ranges
+  template <uint32_t k_concurrent, bool opt_mode, bool tracking, bool accumulate>
+  struct submit_mode_t {
+    static const bool is_opt = opt_mode;
+    static const bool is_serial = (k_concurrent == K_CONC_OFF);
+    static const bool is_trace = (k_concurrent == K_CONC_TRACE);
+    static const bool is_window = (k_concurrent == K_CONC_WINDOW);
+    static const bool is_tracked = tracking;
+    static const bool is_accum = accumulate && (k_concurrent == K_CONC_OFF);
+    // The submit callbacks are not called in the contexts pools mode
+    static const bool has_submit = !opt_mode;
+  };
+
+  typedef void (*submit_cb_t)(const void* in_packets, uint64_t count, uint64_t user_que_idx, void* data,
+                              hsa_amd_queue_intercept_packet_writer writer);
+
+  // Return the submit callback instantiation for the current profiling mode
+  static submit_cb_t SelectSubmitCB(const bool& tracking) {
+    if (k_concurrent_ == K_CONC_TRACE) return OnSubmitCB<submit_mode_t<K_CONC_TRACE, false, false, false> >;
+    if (opt_mode_) {
+      return (tracking) ? OnSubmitCB<submit_mode_t<K_CONC_OFF, true, true, false> > :
+                          OnSubmitCB<submit_mode_t<K_CONC_OFF, true, false, false> >;
+    }
+    // The concurrent modes force the tracking on
+    if (k_concurrent_ == K_CONC_WINDOW) return OnSubmitCB<submit_mode_t<K_CONC_WINDOW, false, true, false> >;
+    if (k_concurrent_ == K_CONC_PMC) return OnSubmitCB<submit_mode_t<K_CONC_PMC, false, true, false> >;
+    if (accum_dispatches_ > 1) {
+      return (tracking) ? OnSubmitCB<submit_mode_t<K_CONC_OFF, false, true, true> > :
+                          OnSubmitCB<submit_mode_t<K_CONC_OFF, false, false, true> >;
     }
+    return (tracking) ? OnSubmitCB<submit_mode_t<K_CONC_OFF, false, true, false> > :
+                        OnSubmitCB<submit_mode_t<K_CONC_OFF, false, false, false> >;
   }
 
+  template <class Mode>
   static void OnSubmitCB(const void* in_packets, uint64_t count, uint64_t user_que_idx, void* data,
                          hsa_amd_queue_intercept_packet_writer writer) {
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_SUBMIT);
     const packet_t* packets_arr = reinterpret_cast<const packet_t*>(in_packets);
     InterceptQueue* obj = reinterpret_cast<InterceptQueue*>(data);
     Queue* proxy = obj->proxy_;
 
+    // The detached queue packets are passed as is
+    if (obj->detached_.load(std::memory_order_relaxed)) {
+      SubmitPackets(writer, proxy, packets_arr, count);
+      return;
+    }
+    obj->submits_.fetch_add(1, std::memory_order_relaxed);
+    obj->packets_.fetch_add(count, std::memory_order_relaxed);
+    // The window timer does not close the window of a submit in progress
+    if (Mode::is_window) obj->submitting_.fetch_add(1, std::memory_order_acq_rel);
+
     ////////////////////////////////////////////////
 #if INTERCEPT_QUEUE_TRACE
     const uint32_t header_val = *(uint32_t*)in_packets;
@@ -261,64 +246,87 @@ class InterceptQueue {
 #endif
     ////////////////////////////////////////////////
 
-    if (submit_callback_fun_) {
-      mutex_.lock();
-      auto* callback_fun = submit_callback_fun_;
-      void* callback_arg = submit_callback_arg_;
-      mutex_.unlock();
-
-      if (callback_fun) {
-        for (uint64_t j = 0; j < count; ++j) {
-          const packet_t* packet = &packets_arr[j];
-          const hsa_kernel_dispatch_packet_t* dispatch_packet =
-              reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
-
-          const char* kernel_name = NULL;
-          if (GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) {
-            uint64_t kernel_object = dispatch_packet->kernel_object;
-            const amd_kernel_code_t* kernel_code = GetKernelCode(kernel_object);
-            kernel_name = (GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) ?
-              QueryKernelName(kernel_object, kernel_code) : NULL;
-          }
-
-          // Prepareing submit callback data
-          rocprofiler_hsa_callback_data_t data{};
-          data.submit.packet = (void*)packet;
-          data.submit.kernel_name = kernel_name;
-          data.submit.queue = obj->queue_;
-          data.submit.device_type = obj->agent_info_->dev_type;
-          data.submit.device_id = obj->agent_info_->dev_index;
+    if (Mode::has_submit) CallSubmitCallback(obj, packets_arr, count);
 
-          callback_fun(ROCPROFILER_HSA_CB_ID_SUBMIT, &data, callback_arg);
-        }
-      }
-    }
+    // Packets staging buffer, it is used once a packets sequence is injected
+    pkt_vector_t& packets = GetPacketsScratch();
+    bool injected = false;
+    uint32_t dispatches = 0;
+    uint32_t profiled = 0;
+    bool exhausted = false;
+    // The input packets not staged nor submitted, and a profiled dispatch is not submitted yet
+    const packet_t* unstaged = packets_arr;
+    bool pending_profiled = false;
 
     // Travers input packets
     for (uint64_t j = 0; j < count; ++j) {
       const packet_t* packet = &packets_arr[j];
       bool to_submit = true;
+      float weight = 1;
+
+      // Counters window, the window dispatches are passed through and the window
+      // is closed by the dispatches number, by the time or at a barrier packet
+      const uint32_t packet_type = GetHeaderType(packet);
+      if (Mode::is_window && obj->range_open_.load(std::memory_order_acquire) &&
+          ((packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) || (packet_type == HSA_PACKET_TYPE_BARRIER_AND) ||
+           (packet_type == HSA_PACKET_TYPE_BARRIER_OR))) {
+        std::lock_guard<std::mutex> lck(obj->range_mutex_);
+        window_t* window = &(obj->window_);
+        if (window->read_vector != NULL) {
+          const bool expired = (window_ns_ != 0) &&
+            ((util::HsaRsrcFactory::Instance().TimestampNs() - window->begin_ns) >= window_ns_);
+          if (!injected) packets.insert(packets.end(), unstaged, packet);
+          injected = true;
+          if ((packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) && !expired) {
+            packets.insert(packets.end(), *packet);
+            window->group->AddKernelObject(reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet)->kernel_object);
+            if (++(window->dispatches) >= window_dispatches_) obj->CloseWindow(packets);
+            continue;
+          }
+          obj->CloseWindow(packets);
+        }
+      }
 
-      // Checking for dispatch packet type
-      if ((GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) &&
-          (dispatch_callback_.load(std::memory_order_acquire) != NULL)) {
+      // Accumulated counters range, the same kernel dispatches are passed through and the
+      // range is closed by the dispatches number, by another kernel or at a barrier packet
+      if (Mode::is_accum && obj->range_open_.load(std::memory_order_acquire) &&
+          ((packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) || (packet_type == HSA_PACKET_TYPE_BARRIER_AND) ||
+           (packet_type == HSA_PACKET_TYPE_BARRIER_OR))) {
+        std::lock_guard<std::mutex> lck(obj->range_mutex_);
+        accum_t* accum = &(obj->accum_);
+        if (accum->group != NULL) {
+          if (!injected) packets.insert(packets.end(), unstaged, packet);
+          injected = true;
+          if ((packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) &&
+              (reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet)->kernel_object == accum->kernel_object)) {
+            packets.insert(packets.end(), *packet);
+            if (++(accum->dispatches) >= accum_dispatches_) obj->CloseAccum(packets);
+            continue;
+          }
+          obj->CloseAccum(packets);
+        }
+      }
+
+      // Checking for dispatch packet type, the trace mode dispatches are not filtered
+      const callbacks_set_t* set = dispatch_set_.load(std::memory_order_acquire);
+      if (packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) ++dispatches;
+      if ((packet_type == HSA_PACKET_TYPE_KERNEL_DISPATCH) && (set != NULL) && !exhausted &&
+          (Mode::is_trace || CheckDispatch(packet, &weight))) {
         const hsa_kernel_dispatch_packet_t* dispatch_packet =
             reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
         const hsa_signal_t completion_signal = dispatch_packet->completion_signal;
 
         // Adding kernel timing tracker
         Tracker::entry_t* tracker_entry = NULL;
-
-        const bool is_serial = (k_concurrent_ == K_CONC_OFF);
-        if (tracker_ != NULL) {
-          tracker_entry = tracker_->Alloc(obj->agent_info_->dev_id, dispatch_packet->completion_signal, is_serial);
-          if (is_serial) const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = tracker_entry->signal;
+        if (Mode::is_tracked && !Mode::is_opt) {
+          tracker_entry = tracker_->Alloc(obj->agent_info_->dev_id, dispatch_packet->completion_signal, Mode::is_serial);
+          if (Mode::is_serial) const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = tracker_entry->signal;
         }
 
-        // Prepareing dispatch callback data
-        uint64_t kernel_object = dispatch_packet->kernel_object;
-        const amd_kernel_code_t* kernel_code = GetKernelCode(kernel_object);
-        const char* kernel_name = QueryKernelName(kernel_object, kernel_code);
+        // Prepareing dispatch callback data, the kernel info is not queried in the contexts pools mode
+        const uint64_t kernel_object = (Mode::is_opt) ? 0 : dispatch_packet->kernel_object;
+        const amd_kernel_code_t* kernel_code = (Mode::is_opt) ? NULL : GetKernelCode(kernel_object);
+        const char* kernel_name = (Mode::is_opt) ? NULL : QueryKernelName(kernel_object, kernel_code);
 
         rocprofiler_callback_data_t data = {obj->agent_info_->dev_id,
                                             obj->agent_info_->dev_index,
@@ -330,212 +338,179 @@ class InterceptQueue {
                                             kernel_name,
                                             kernel_object,
                                             kernel_code,
-                                            (uint32_t)syscall(__NR_gettid),
-                                            (tracker_entry) ? tracker_entry->record : NULL};
+                                            (Mode::is_opt) ? 0 : (uint32_t)syscall(__NR_gettid),
+                                            (tracker_entry) ? tracker_entry->record : NULL,
+                                            weight};
+
+        // The previous profiled dispatches are submitted before the dispatch callback,
+        // the callback can wait for their completion on a pool fetch or a contexts limit
+        if (pending_profiled) {
+          if (injected) {
+            SubmitPackets(writer, proxy, packets.data(), packets.size());
+            packets.clear();
+          } else {
+            SubmitPackets(writer, proxy, unstaged, packet - unstaged);
+            unstaged = packet;
+          }
+          pending_profiled = false;
+        }
 
         // Calling dispatch callback
         rocprofiler_group_t group = {};
-        hsa_status_t status = (dispatch_callback_.load())(&data, callback_data_, &group);
-        // Injecting profiling start/stop/read packets
-        if ((status != HSA_STATUS_SUCCESS) || (group.context == NULL)) {
-          if (tracker_entry != NULL) {
-            if (is_serial) const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = tracker_entry->orig;
-            tracker_->Delete(tracker_entry);
+        hsa_status_t status = set->callbacks.dispatch(&data, set->data, &group);
+        Context* context = reinterpret_cast<Context*>(group.context);
+        const bool is_profiled = (status == HSA_STATUS_SUCCESS) && (context != NULL);
+        // The trace mode is not budgeted as the trace is stopped by the next dispatch
+        if (is_profiled) {
+          ++profiled;
+          pending_profiled = true;
+          if (!Mode::is_trace && (queue_budget_ != 0)) exhausted = obj->ChargeBudget();
+        }
+        if (Mode::is_trace) {
+          if (is_profiled) {
+            if (!injected) packets.insert(packets.end(), unstaged, packet);
+            injected = true;
+            InjectTrace(context, group.index, packet, packets);
+            to_submit = false;
           }
-        } else {
-          Context* context = reinterpret_cast<Context*>(group.context);
-
-          if (group.feature_count != 0) {
-            const pkt_vector_t& start_vector = context->StartPackets(group.index);
-            const pkt_vector_t& stop_vector = context->StopPackets(group.index);
-            const pkt_vector_t& read_vector = context->ReadPackets(group.index);
-            pkt_vector_t packets;
-
-            if (is_serial) {                    // serial
-              packets = start_vector;
-              packets.insert(packets.end(), *packet);
-              packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
-            } else {                            // concurrent
-              // Insert start packets once
-              auto inject_start = [&packets](const pkt_vector_t& starts) mutable {
-                packets = starts;
-              };
-              std::call_once(once_flag_, inject_start, start_vector);
-              // Reads at both kernel start and end (also with barriers)
-              assert(read_vector.size() >= 2 * start_vector.size());
-              auto mid = read_vector.begin() + read_vector.size()/2;
-              // Read at kernel start
-              packets.insert(packets.end(), read_vector.begin(), mid);
-              // Kernel dispatch packet
-              assert(tracker_entry != NULL);
-              // Bind dispatch and barrier signals with tracker entry
-              tracker_->SetHandler(tracker_entry, context->GetGroup(group.index));
-              const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = context->GetGroup(group.index)->GetDispatchSignal();
-              packets.insert(packets.end(), *packet);
-              // Read at kernel end
-              packets.insert(packets.end(), mid, read_vector.end());
-            }
-
-            if (tracker_entry != NULL) {
-              Group* context_group = context->GetGroup(group.index);
-              context_group->IncrRefsCount();
-              tracker_->EnableContext(tracker_entry, Context::Handler, reinterpret_cast<void*>(context_group));
-            }
-
-            if (writer != NULL) {
-              writer(&packets[0], packets.size());
-            } else {
-              proxy->Submit(&packets[0], packets.size());
-            }
+        } else if (Mode::is_opt) {
+          if (is_profiled && (group.feature_count != 0)) {
+            if (!injected) packets.insert(packets.end(), unstaged, packet);
+            injected = true;
+            InjectOpt<Mode>(context, group.index, packet, completion_signal, packets);
             to_submit = false;
-          } else {
-            if (tracker_entry != NULL) {
-              void* context_handler_arg = NULL;
-              rocprofiler_handler_t context_handler_fun = context->GetHandler(&context_handler_arg);
-              tracker_->EnableDispatch(tracker_entry, context_handler_fun, context_handler_arg);
-            }
           }
+        } else if (!is_profiled) {
+          if (tracker_entry != NULL) {
+            if (Mode::is_serial) const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = tracker_entry->orig;
+            tracker_->Delete(tracker_entry);
+          }
+        } else if (group.feature_count != 0) {
+          if (!injected) packets.insert(packets.end(), unstaged, packet);
+          injected = true;
+          InjectPmc<Mode>(obj, context, group.index, packet, tracker_entry, packets);
+          to_submit = false;
+        } else if (tracker_entry != NULL) {
+          void* context_handler_arg = NULL;
+          rocprofiler_handler_t context_handler_fun = context->GetHandler(&context_handler_arg);
+          tracker_->EnableDispatch(tracker_entry, context_handler_fun, context_handler_arg);
         }
       }
 
-      // Submitting the original packets if profiling was not enabled
-      if (to_submit) {
-        if (writer != NULL) {
-          writer(packet, 1);
-        } else {
-          proxy->Submit(packet, 1);
-        }
-      }
+      // Appending the original packet if profiling was not enabled
+      if (to_submit && injected) packets.insert(packets.end(), *packet);
+    }
+    obj->dispatches_.fetch_add(dispatches, std::memory_order_relaxed);
+    obj->profiled_.fetch_add(profiled, std::memory_order_relaxed);
+
+    // The exhausted queue open window or range is closed by the submitted packets
+    if (exhausted) {
+      if (!injected) packets.insert(packets.end(), unstaged, packets_arr + count);
+      injected = true;
+      std::lock_guard<std::mutex> lck(obj->range_mutex_);
+      if (obj->window_.read_vector != NULL) obj->CloseWindow(packets);
+      if (obj->accum_.group != NULL) obj->CloseAccum(packets);
     }
-  }
-
-  static void OnSubmitCB_ctrace(const void* in_packets, uint64_t count, uint64_t user_que_idx, void* data,
-                         hsa_amd_queue_intercept_packet_writer writer) {
-    const packet_t* packets_arr = reinterpret_cast<const packet_t*>(in_packets);
-    InterceptQueue* obj = reinterpret_cast<InterceptQueue*>(data);
-    Queue* proxy = obj->proxy_;
 
-    if (submit_callback_fun_) {
-      mutex_.lock();
-      auto* callback_fun = submit_callback_fun_;
-      void* callback_arg = submit_callback_arg_;
-      mutex_.unlock();
-
-      if (callback_fun) {
-        for (uint64_t j = 0; j < count; ++j) {
-          const packet_t* packet = &packets_arr[j];
-          const hsa_kernel_dispatch_packet_t* dispatch_packet =
-              reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
-
-          const char* kernel_name = NULL;
-          if (GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) {
-            uint64_t kernel_object = dispatch_packet->kernel_object;
-            const amd_kernel_code_t* kernel_code = GetKernelCode(kernel_object);
-            kernel_name = (GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) ?
-              QueryKernelName(kernel_object, kernel_code) : NULL;
-          }
+    // Submitting the rest of the packets with one writer call, the input packets
+    // are passed as is if there were no injected packets
+    if (injected) {
+      SubmitPackets(writer, proxy, packets.data(), packets.size());
+    } else {
+      SubmitPackets(writer, proxy, unstaged, (packets_arr + count) - unstaged);
+    }
+    if (exhausted) obj->Detach();
+    if (Mode::is_window) obj->submitting_.fetch_sub(1, std::memory_order_acq_rel);
+  }
 
-          // Prepareing submit callback data
-          rocprofiler_hsa_callback_data_t data{};
-          data.submit.packet = (void*)packet;
-          data.submit.kernel_name = kernel_name;
-          data.submit.queue = obj->queue_;
-          data.submit.device_type = obj->agent_info_->dev_type;
-          data.submit.device_id = obj->agent_info_->dev_index;
+  // The callbacks set can be replaced at runtime, the dispatches are started on the first set
+  // and the started state is kept on the replacement
+  static void SetCallbacks(rocprofiler_queue_callbacks_t callbacks, void* data) {
+    std::lock_guard<mutex_t> lck(mutex_);
+    const callbacks_set_t* set = new callbacks_set_t{callbacks, data};
+    const callbacks_set_t* prev = callbacks_set_.exchange(set, std::memory_order_acq_rel);
+    if (prev != NULL) callbacks_retired_.push_back(prev);
+    else started_ = true;
+    PublishDispatch();
+    if ((k_concurrent_ == K_CONC_WINDOW) && (window_ns_ != 0)) StartWindowTimer();
+  }
 
-          callback_fun(ROCPROFILER_HSA_CB_ID_SUBMIT, &data, callback_arg);
-        }
-      }
-    }
+  // The open windows and ranges are closed as the profiling data are collected next on unloading
+  static void RemoveCallbacks() {
+    StopWindowTimer();
+    std::lock_guard<mutex_t> lck(mutex_);
+    const callbacks_set_t* prev = callbacks_set_.exchange(NULL, std::memory_order_acq_rel);
+    if (prev != NULL) callbacks_retired_.push_back(prev);
+    started_ = false;
+    PublishDispatch();
+    FlushAllRanges();
+  }
 
-    // Travers input packets
-    for (uint64_t j = 0; j < count; ++j) {
-      const packet_t* packet = &packets_arr[j];
-      bool to_submit = true;
+  // The replaced filters are retired and not deleted as the submit callbacks
+  // may still use them
+  static void SetFilter(const rocprofiler_dispatch_filter_t* filter) {
+    DispatchFilter* obj = (filter != NULL) ? new DispatchFilter(*filter) : NULL;
+    std::lock_guard<mutex_t> lck(mutex_);
+    DispatchFilter* prev = filter_.exchange(obj, std::memory_order_acq_rel);
+    if (prev != NULL) filter_retired_.push_back(prev);
+  }
 
-      // Checking for dispatch packet type
-      if ((GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) &&
-          (dispatch_callback_.load(std::memory_order_acquire) != NULL)) {
-        const hsa_kernel_dispatch_packet_t* dispatch_packet =
-            reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
-        const hsa_signal_t completion_signal = dispatch_packet->completion_signal;
+  // The sampler is set on the tool loading
+  static void SetSampler(const uint32_t& rate, const uint32_t& budget) {
+    std::lock_guard<mutex_t> lck(mutex_);
+    if (sampler_ == NULL) sampler_ = new DispatchSampler(rate, budget);
+  }
 
-        // Prepareing dispatch callback data
-        uint64_t kernel_object = dispatch_packet->kernel_object;
-        const amd_kernel_code_t* kernel_code = GetKernelCode(kernel_object);
-        const char* kernel_name = QueryKernelName(kernel_object, kernel_code);
+  // The per-kernel adaptive profiling is set on the tool loading
+  static void SetConverge(const uint32_t& tolerance_pct, const uint32_t& rate) {
+    std::lock_guard<mutex_t> lck(mutex_);
+    if (converge_ == NULL) converge_ = new DispatchConverge(tolerance_pct, rate);
+  }
+  static DispatchConverge* GetConverge() { return converge_; }
 
-        rocprofiler_callback_data_t data = {obj->agent_info_->dev_id,
-                                            obj->agent_info_->dev_index,
-                                            obj->queue_,
-                                            user_que_idx,
-                                            obj->queue_id,
-                                            completion_signal,
-                                            dispatch_packet,
-                                            kernel_name,
-                                            kernel_object,
-                                            kernel_code,
-                                            (uint32_t)syscall(__NR_gettid),
-                                            NULL};
+  static void Start() {
+    std::lock_guard<mutex_t> lck(mutex_);
+    started_ = true;
+    PublishDispatch();
+  }
+  static void Stop() {
+    std::lock_guard<mutex_t> lck(mutex_);
+    started_ = false;
+    PublishDispatch();
+    FlushAllRanges();
+  }
 
-        // Calling dispatch callback
-        rocprofiler_group_t group = {};
-        hsa_status_t status = (dispatch_callback_.load())(&data, callback_data_, &group);
-
-        // Injecting profiling start/stop packets
-        if ((status == HSA_STATUS_SUCCESS) && (group.context != NULL)) {
-          Context* context = reinterpret_cast<Context*>(group.context);
-          const bool ctx_inactive = ck_ctx_inactive(context);
-
-          const pkt_vector_t& start_vector = context->StartPackets(group.index);
-          const pkt_vector_t& stop_vector = context->StopPackets(group.index);
-          pkt_vector_t packets;
-          if (ctx_inactive) packets = start_vector;
-          packets.insert(packets.end(), *packet);
-          if (!ctx_inactive) packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
-          if (writer != NULL) {
-            writer(&packets[0], packets.size());
-          } else {
-            proxy->Submit(&packets[0], packets.size());
-          }
-          to_submit = false;
-        }
-      }
+  // Accumulated counters range dispatches number, 0 or 1 to disable
+  static void SetAccumulate(const uint32_t& dispatches) { accum_dispatches_ = dispatches; }
 
-      // Submitting the original packets if profiling was not enabled
-      if (to_submit) {
-        if (writer != NULL) {
-          writer(packet, 1);
-        } else {
-          proxy->Submit(packet, 1);
-        }
-      }
-    }
+  // Concurrent counters window by dispatches number and by time, the window is
+  // not limited by time if the time is 0
+  static void SetWindow(const uint32_t& dispatches, const uint64_t& time_ns) {
+    window_dispatches_ = (dispatches != 0) ? dispatches : WINDOW_DISPATCHES_DEFAULT;
+    window_ns_ = time_ns;
   }
 
-  static void SetCallbacks(rocprofiler_queue_callbacks_t callbacks, void* data) {
+  static void SetSubmitCallback(rocprofiler_hsa_callback_fun_t fun, void* arg) {
     std::lock_guard<mutex_t> lck(mutex_);
-    if (callback_data_ != NULL) {
-      EXC_ABORT(HSA_STATUS_ERROR, "reassigning queue callbacks - not supported");
-    }
-    callbacks_ = callbacks;
-    callback_data_ = data;
-    Start();
+    const submit_set_t* set = (fun != NULL) ? new submit_set_t{fun, arg} : NULL;
+    const submit_set_t* prev = submit_set_.exchange(set, std::memory_order_acq_rel);
+    if (prev != NULL) submit_retired_.push_back(prev);
   }
 
-  static void RemoveCallbacks() {
+  // Queue policy, GPU agents indexes and queue types masks of the intercepted queues,
+  // 0 for all, and the profiled dispatches budget per queue, 0 is unlimited
+  static void SetQueuePolicy(const uint32_t& agents, const uint32_t& types, const uint32_t& budget) {
     std::lock_guard<mutex_t> lck(mutex_);
-    callbacks_ = {};
-    Stop();
+    queue_agents_ = agents;
+    queue_types_ = types;
+    queue_budget_ = budget;
   }
 
-  static inline void Start() { dispatch_callback_.store(callbacks_.dispatch, std::memory_order_release); }
-  static inline void Stop() { dispatch_callback_.store(NULL, std::memory_order_relaxed); }
-
-  static void SetSubmitCallback(rocprofiler_hsa_callback_fun_t fun, void* arg) {
+  // Queues statistics, the destroyed queues counts are accumulated
+  static void GetQueueStats(rocprofiler_queue_stats_t* stats) {
     std::lock_guard<mutex_t> lck(mutex_);
-    submit_callback_fun_ = fun;
-    submit_callback_arg_ = arg;
+    *stats = queue_stats_;
+    for (const auto& item : obj_map_) item.second->AddStats(stats);
   }
 
   static void TrackerOn(bool on) { tracker_on_ = on; }
@@ -555,12 +530,223 @@ class InterceptQueue {
     if (obj->queue_event_callback_) obj->queue_event_callback_(status, obj->queue_, arg);
   }
 
+  // Per-thread scratch buffer for assembling the profiled dispatch packets.
+  // The buffer capacity is kept between the submit calls, so the dispatch path
+  // does not allocate once the buffer has grown to the largest packets sequence.
+  static pkt_vector_t& GetPacketsScratch() {
+    static thread_local pkt_vector_t packets;
+    packets.clear();
+    if (packets.capacity() < PACKETS_SCRATCH_SIZE) packets.reserve(PACKETS_SCRATCH_SIZE);
+    return packets;
+  }
+
+  // Calling the submit callback for the submitted packets if the callback is set
+  static void CallSubmitCallback(const InterceptQueue* obj, const packet_t* packets_arr, const uint64_t& count) {
+    const submit_set_t* submit = submit_set_.load(std::memory_order_acquire);
+    if ((submit == NULL) || (submit->fun == NULL)) return;
+    auto* callback_fun = submit->fun;
+    void* callback_arg = submit->arg;
+
+    for (uint64_t j = 0; j < count; ++j) {
+      const packet_t* packet = &packets_arr[j];
+      const hsa_kernel_dispatch_packet_t* dispatch_packet =
+          reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
+
+      const char* kernel_name = NULL;
+      if (GetHeaderType(packet) == HSA_PACKET_TYPE_KERNEL_DISPATCH) {
+        uint64_t kernel_object = dispatch_packet->kernel_object;
+        const amd_kernel_code_t* kernel_code = GetKernelCode(kernel_object);
+        kernel_name = QueryKernelName(kernel_object, kernel_code);
+      }
+
+      // Prepareing submit callback data
+      rocprofiler_hsa_callback_data_t data{};
+      data.submit.packet = (void*)packet;
+      data.submit.kernel_name = kernel_name;
+      data.submit.queue = obj->queue_;
+      data.submit.device_type = obj->agent_info_->dev_type;
+      data.submit.device_id = obj->agent_info_->dev_index;
+
+      callback_fun(ROCPROFILER_HSA_CB_ID_SUBMIT, &data, callback_arg);
+    }
+  }
+
+  // Trace mode, the context is started before the first and stopped after the second dispatch
+  static void InjectTrace(Context* context, const uint32_t& group_index, const packet_t* packet, pkt_vector_t& packets) {
+    const bool ctx_inactive = context->GetGroup(group_index)->ToggleActive();
+    const pkt_vector_t& start_vector = context->StartPackets(group_index);
+    const pkt_vector_t& stop_vector = context->StopPackets(group_index);
+    if (ctx_inactive) packets.insert(packets.end(), start_vector.begin(), start_vector.end());
+    packets.insert(packets.end(), *packet);
+    if (!ctx_inactive) packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
+  }
+
+  // Contexts pools mode, the dispatch is wrapped by the start/stop packets
+  template <class Mode>
+  static void InjectOpt(Context* context, const uint32_t& group_index, const packet_t* packet,
+                        const hsa_signal_t& completion_signal, pkt_vector_t& packets) {
+    if (Mode::is_tracked) {
+      Group* context_group = context->GetGroup(group_index);
+      const_cast<hsa_kernel_dispatch_packet_t*>(reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet))
+        ->completion_signal = context_group->GetDispatchSignal();
+      Tracker::Enable_opt(context_group, completion_signal);
+      context_group->IncrRefsCount();
+    }
+    const pkt_vector_t& start_vector = context->StartPackets(group_index);
+    const pkt_vector_t& stop_vector = context->StopPackets(group_index);
+    packets.insert(packets.end(), start_vector.begin(), start_vector.end());
+    packets.insert(packets.end(), *packet);
+    packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
+  }
+
+  // Injecting profiling start/stop/read packets of the serial, replay and concurrent modes
+  template <class Mode>
+  static void InjectPmc(InterceptQueue* obj, Context* context, uint32_t group_index, const packet_t* packet,
+                        Tracker::entry_t* tracker_entry, pkt_vector_t& packets) {
+    const hsa_kernel_dispatch_packet_t* dispatch_packet =
+        reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet);
+    // Kernel replay, the dispatch is submitted once per context group
+    const uint32_t group_count = context->GetGroupCount();
+    const bool is_replay = Mode::is_serial && Context::k_replay_ && (group_count > 1);
+    if (is_replay) group_index = group_count - 1;
+
+    const pkt_vector_t& start_vector = context->StartPackets(group_index);
+    const pkt_vector_t& stop_vector = context->StopPackets(group_index);
+
+    if (is_replay) {                    // serial replay
+      for (uint32_t index = 0; index < group_count; ++index) {
+        const pkt_vector_t& starts = context->StartPackets(index);
+        const pkt_vector_t& stops = context->StopPackets(index);
+        packets.insert(packets.end(), starts.begin(), starts.end());
+        packets.insert(packets.end(), *packet);
+        // The replays are serialized by the barrier bit and only the last one
+        // signals the dispatch completion, the kernel arguments are not reused
+        // by the application until then
+        hsa_kernel_dispatch_packet_t* replay =
+            reinterpret_cast<hsa_kernel_dispatch_packet_t*>(&packets.back());
+        if (index != 0) replay->header |= 1 << HSA_PACKET_HEADER_BARRIER;
+        if (index != (group_count - 1)) replay->completion_signal = hsa_signal_t{};
+        packets.insert(packets.end(), stops.begin(), stops.end());
+      }
+    } else if (Mode::is_serial) {       // serial
+      packets.insert(packets.end(), start_vector.begin(), start_vector.end());
+      packets.insert(packets.end(), *packet);
+      if (Mode::is_accum) {
+        // Stop at the accumulated range end
+        std::lock_guard<std::mutex> lck(obj->range_mutex_);
+        obj->accum_ = accum_t{context->GetGroup(group_index), &stop_vector, dispatch_packet->kernel_object, 1};
+        obj->range_open_.store(true, std::memory_order_release);
+      } else {
+        packets.insert(packets.end(), stop_vector.begin(), stop_vector.end());
+      }
+    } else {                            // concurrent
+      const pkt_vector_t& read_vector = context->ReadPackets(group_index);
+      // Insert start packets once
+      auto inject_start = [&packets](const pkt_vector_t& starts) mutable {
+        packets.insert(packets.end(), starts.begin(), starts.end());
+      };
+      std::call_once(once_flag_, inject_start, start_vector);
+      // Reads at both kernel start and end (also with barriers)
+      assert(read_vector.size() >= 2 * start_vector.size());
+      auto mid = read_vector.begin() + read_vector.size()/2;
+      // Read at kernel start
+      packets.insert(packets.end(), read_vector.begin(), mid);
+      // Kernel dispatch packet
+      assert(tracker_entry != NULL);
+      // Bind dispatch and barrier signals with tracker entry, the window dispatch is completed
+      // by the dispatch signal as the barrier is submitted at the window end
+      tracker_->SetHandler(tracker_entry, context->GetGroup(group_index), Mode::is_window);
+      const_cast<hsa_kernel_dispatch_packet_t*>(dispatch_packet)->completion_signal = context->GetGroup(group_index)->GetDispatchSignal();
+      packets.insert(packets.end(), *packet);
+      if (Mode::is_window) {
+        // Read at the window end
+        std::lock_guard<std::mutex> lck(obj->range_mutex_);
+        const uint64_t begin_ns = (window_ns_ != 0) ? util::HsaRsrcFactory::Instance().TimestampNs() : 0;
+        Group* window_group = context->GetGroup(group_index);
+        window_group->ClearKernelObjects();
+        window_group->AddKernelObject(dispatch_packet->kernel_object);
+        obj->window_ = window_t{&read_vector, window_group, 1, begin_ns};
+        obj->range_open_.store(true, std::memory_order_release);
+        if (window_dispatches_ <= 1) obj->CloseWindow(packets);
+      } else {
+        // Read at kernel end
+        packets.insert(packets.end(), mid, read_vector.end());
+      }
+    }
+
+    if (tracker_entry != NULL) {
+      Group* context_group = context->GetGroup(group_index);
+      context_group->IncrRefsCount();
+      tracker_->EnableContext(tracker_entry, Context::Handler, reinterpret_cast<void*>(context_group));
+    }
+  }
+
+  // Submitting the packets sequence to the queue
+  static void SubmitPackets(hsa_amd_queue_intercept_packet_writer writer, Queue* proxy,
+                            const packet_t* packets, const uint64_t& count) {
+    if (count == 0) return;
+    if (writer != NULL) {
+      writer(packets, count);
+    } else {
+      proxy->Submit(packets, count);
+    }
+  }
+
+  // Checking the queue policy agents and types masks
+  static bool CheckQueue(const hsa_agent_t& agent, const hsa_queue_type32_t& type) {
+    if ((queue_types_ != 0) && ((type >= 32) || ((queue_types_ & (1u << type)) == 0))) return false;
+    if (queue_agents_ != 0) {
+      const util::AgentInfo* agent_info = util::HsaRsrcFactory::Instance().GetAgentInfo(agent);
+      if ((agent_info == NULL) || (agent_info->dev_index >= 32) ||
+          ((queue_agents_ & (1u << agent_info->dev_index)) == 0)) return false;
+    }
+    return true;
+  }
+
+  // Charging a profiled dispatch to the queue budget, true if the budget is exhausted
+  bool ChargeBudget() { return (budget_used_.fetch_add(1, std::memory_order_relaxed) + 1) >= queue_budget_; }
+
+  // Detaching the queue submit callback, the proxy queue callback is removed if supported
+  // and the packets are passed as is otherwise
+  void Detach() {
+    if (detached_.exchange(true, std::memory_order_relaxed)) return;
+    proxy_->SetInterceptCB(NULL, this);
+    std::lock_guard<mutex_t> lck(mutex_);
+    ++(queue_stats_.detached);
+  }
+
+  void AddStats(rocprofiler_queue_stats_t* stats) const {
+    stats->submits += submits_.load(std::memory_order_relaxed);
+    stats->packets += packets_.load(std::memory_order_relaxed);
+    stats->dispatches += dispatches_.load(std::memory_order_relaxed);
+    stats->profiled += profiled_.load(std::memory_order_relaxed);
+  }
+
+  // Checking the dispatch filter, the sampler and the kernel convergence, true if there are none
+  static bool CheckDispatch(const packet_t* packet, float* weight) {
+    const uint64_t kernel_object =
+        reinterpret_cast<const hsa_kernel_dispatch_packet_t*>(packet)->kernel_object;
+    DispatchFilter* filter = filter_.load(std::memory_order_acquire);
+    if (filter != NULL) {
+      const bool selected = filter->Check(kernel_object, [kernel_object]() {
+        return QueryKernelName(kernel_object, GetKernelCode(kernel_object));
+      });
+      if (!selected) return false;
+    }
+    if ((sampler_ != NULL) && !sampler_->Sample(weight)) return false;
+    return (converge_ != NULL) ? converge_->Check(kernel_object, weight) : true;
+  }
+
   static hsa_packet_type_t GetHeaderType(const packet_t* packet) {
     const packet_word_t* header = reinterpret_cast<const packet_word_t*>(packet);
     return static_cast<hsa_packet_type_t>((*header >> HSA_PACKET_HEADER_TYPE) & header_type_mask);
   }
 
   static const amd_kernel_code_t* GetKernelCode(uint64_t kernel_object) {
+    // Cached kernel code if the executables are tracked
+    if (util::HsaRsrcFactory::IsExecutableTracking()) {
+      return util::HsaRsrcFactory::Instance().GetKernelCode(kernel_object);
+    }
     const amd_kernel_code_t* kernel_code = NULL;
     hsa_status_t status =
         util::HsaRsrcFactory::Instance().LoaderApi()->hsa_ven_amd_loader_query_host_address(
@@ -591,15 +777,72 @@ class InterceptQueue {
     return kernel_symname;
   }
 
+  // Lock-free lookup table of the intercept queue objects, the keys of the destroyed
+  // queues are tombstoned and the tombstone slots are reused. The table is modified
+  // under mutex_, the map lookup is used if the table is full.
+  static uint32_t ObjTableHash(const uint64_t& key) { return (key >> 6) & (OBJ_TABLE_SIZE - 1); }
+
+  static void ObjTableSet(const uint64_t& key, InterceptQueue* obj) {
+    const uint32_t hash = ObjTableHash(key);
+    obj_table_entry_t* slot = NULL;
+    for (uint32_t i = 0; i < OBJ_TABLE_SIZE; ++i) {
+      obj_table_entry_t& entry = obj_table_[(hash + i) & (OBJ_TABLE_SIZE - 1)];
+      const uint64_t entry_key = entry.key.load(std::memory_order_relaxed);
+      if (entry_key == key) {
+        entry.obj.store(obj, std::memory_order_release);
+        return;
+      }
+      if ((entry_key == OBJ_TABLE_TOMBSTONE) && (slot == NULL)) slot = &entry;
+      if (entry_key == 0) {
+        if (slot == NULL) slot = &entry;
+        break;
+      }
+    }
+    if (slot != NULL) {
+      slot->obj.store(obj, std::memory_order_release);
+      slot->key.store(key, std::memory_order_release);
+    } else {
+      obj_table_full_.store(true, std::memory_order_release);
+    }
+  }
+
+  static void ObjTableDel(const uint64_t& key) {
+    const uint32_t hash = ObjTableHash(key);
+    for (uint32_t i = 0; i < OBJ_TABLE_SIZE; ++i) {
+      obj_table_entry_t& entry = obj_table_[(hash + i) & (OBJ_TABLE_SIZE - 1)];
+      const uint64_t entry_key = entry.key.load(std::memory_order_relaxed);
+      if (entry_key == key) {
+        entry.obj.store(NULL, std::memory_order_release);
+        entry.key.store(OBJ_TABLE_TOMBSTONE, std::memory_order_release);
+        break;
+      }
+      if (entry_key == 0) break;
+    }
+  }
+
+  static bool ObjTableGet(const uint64_t& key, InterceptQueue** obj) {
+    const uint32_t hash = ObjTableHash(key);
+    for (uint32_t i = 0; i < OBJ_TABLE_SIZE; ++i) {
+      obj_table_entry_t& entry = obj_table_[(hash + i) & (OBJ_TABLE_SIZE - 1)];
+      const uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+      if (entry_key == key) {
+        *obj = entry.obj.load(std::memory_order_acquire);
+        return true;
+      }
+      if (entry_key == 0) break;
+    }
+    return false;
+  }
+
   // method to get an intercept queue object
   static InterceptQueue* GetObj(const hsa_queue_t* queue) {
-    std::lock_guard<mutex_t> lck(mutex_);
     InterceptQueue* obj = NULL;
-    obj_map_t::const_iterator it = obj_map_.find((uint64_t)queue);
-    if (it != obj_map_.end()) {
-      obj = it->second;
-      assert(queue == obj->queue_);
+    if ((ObjTableGet((uint64_t)queue, &obj) == false) && obj_table_full_.load(std::memory_order_acquire)) {
+      std::lock_guard<mutex_t> lck(mutex_);
+      obj_map_t::const_iterator it = obj_map_.find((uint64_t)queue);
+      if (it != obj_map_.end()) obj = it->second;
     }
+    assert((obj == NULL) || (queue == obj->queue_));
     return obj;
   }
 
@@ -611,6 +854,8 @@ class InterceptQueue {
     if (it != obj_map_.end()) {
       const InterceptQueue* obj = it->second;
       assert(queue == obj->queue_);
+      ObjTableDel((uint64_t)queue);
+      obj->AddStats(&queue_stats_);
       delete obj;
       obj_map_.erase(it);
       status = HSA_STATUS_SUCCESS;
@@ -620,38 +865,230 @@ class InterceptQueue {
 
   InterceptQueue(const hsa_agent_t& agent, hsa_queue_t* const queue, ProxyQueue* proxy) :
     queue_(queue),
-    proxy_(proxy)
+    proxy_(proxy),
+    submits_(0),
+    packets_(0),
+    dispatches_(0),
+    profiled_(0),
+    budget_used_(0),
+    detached_(false),
+    range_open_(false),
+    submitting_(0)
   {
     agent_info_ = util::HsaRsrcFactory::Instance().GetAgentInfo(agent);
     queue_event_callback_ = NULL;
+    window_ = window_t{};
+    accum_ = accum_t{};
   }
 
   ~InterceptQueue() {
     ProxyQueue::Destroy(proxy_);
   }
 
+  // Concurrent counters window, the counters are read before the window first dispatch
+  // and after all the window dispatches completion. The read packets are of the
+  // first dispatch context, the counters deltas cover all the window dispatches,
+  // the window dispatches number and kernel objects are kept by the context group.
+  struct window_t {
+    const pkt_vector_t* read_vector;  // the window context read packets, NULL if no window
+    Group* group;                     // the window context group
+    uint32_t dispatches;              // the window dispatches number
+    uint64_t begin_ns;                // the window opening timestamp
+  };
+
+  // Appending the window end read packets, a barrier bit packet waits for the
+  // window dispatches. Called under range_mutex_
+  void CloseWindow(pkt_vector_t& packets) {
+    packet_t barrier{};
+    reinterpret_cast<hsa_barrier_and_packet_t*>(&barrier)->header =
+      HSA_PACKET_TYPE_BARRIER_AND | (1 << HSA_PACKET_HEADER_BARRIER);
+    packets.push_back(barrier);
+    const pkt_vector_t& read_vector = *(window_.read_vector);
+    packets.insert(packets.end(), read_vector.begin() + read_vector.size() / 2, read_vector.end());
+    window_.group->SetDispatchCount(window_.dispatches);
+    window_ = window_t{};
+    range_open_.store(false, std::memory_order_release);
+  }
+
+  // Accumulated counters range, the counters are started before the range first
+  // dispatch and stopped after the last one, the range dispatches are of the same kernel
+  struct accum_t {
+    Group* group;                     // the range context group, NULL if no range
+    const pkt_vector_t* stop_vector;  // the range context stop packets
+    uint64_t kernel_object;           // the range kernel object
+    uint32_t dispatches;              // the range dispatches number
+  };
+
+  // Appending the range stop packets, the group data cover the range dispatches.
+  // Called under range_mutex_
+  void CloseAccum(pkt_vector_t& packets) {
+    accum_.group->SetDispatchCount(accum_.dispatches);
+    packets.insert(packets.end(), accum_.stop_vector->begin(), accum_.stop_vector->end());
+    accum_ = accum_t{};
+    range_open_.store(false, std::memory_order_release);
+  }
+
+  // Closing the open window or range by submitting its end packets to the queue,
+  // the packets are passed through by the submit callback
+  void FlushRanges() {
+    if (!range_open_.load(std::memory_order_acquire)) return;
+    pkt_vector_t packets;
+    range_mutex_.lock();
+    if (window_.read_vector != NULL) CloseWindow(packets);
+    if (accum_.group != NULL) CloseAccum(packets);
+    range_mutex_.unlock();
+    if (!packets.empty()) {
+      util::HsaRsrcFactory::Submit(queue_, &packets[0], packets.size() * sizeof(packet_t));
+    }
+  }
+
+  // Closing the open windows and ranges of all queues, called under mutex_
+  static void FlushAllRanges() {
+    if ((k_concurrent_ == K_CONC_WINDOW) || (accum_dispatches_ > 1)) {
+      for (auto& item : obj_map_) item.second->FlushRanges();
+    }
+  }
+
+  // Closing the window if expired and no submit is in progress, the window is
+  // otherwise closed by the next submitted packet
+  void CloseExpiredWindow(const uint64_t& now_ns) {
+    if (!range_open_.load(std::memory_order_acquire)) return;
+    pkt_vector_t packets;
+    range_mutex_.lock();
+    if ((window_.read_vector != NULL) && (submitting_.load(std::memory_order_acquire) == 0) &&
+        ((now_ns - window_.begin_ns) >= window_ns_)) {
+      CloseWindow(packets);
+    }
+    range_mutex_.unlock();
+    if (!packets.empty()) {
+      util::HsaRsrcFactory::Submit(queue_, &packets[0], packets.size() * sizeof(packet_t));
+    }
+  }
+
+  // Window timer, the expired windows are closed without waiting for a next packet.
+  // Started with the queue callbacks if the window time is limited.
+  static void StartWindowTimer() {
+    std::lock_guard<std::mutex> lck(window_timer_mutex_);
+    if (window_timer_ != NULL) return;
+    window_timer_stop_ = false;
+    window_timer_ = new std::thread(WindowTimer);
+  }
+
+  static void StopWindowTimer() {
+    std::thread* timer = NULL;
+    {
+      std::lock_guard<std::mutex> lck(window_timer_mutex_);
+      timer = window_timer_;
+      window_timer_ = NULL;
+      window_timer_stop_ = true;
+      window_timer_cond_.notify_one();
+    }
+    if (timer != NULL) {
+      timer->join();
+      delete timer;
+    }
+  }
+
+  static void WindowTimer() {
+    const std::chrono::nanoseconds period((window_ns_ / 2 > WINDOW_TIMER_MIN_NS) ? window_ns_ / 2 : WINDOW_TIMER_MIN_NS);
+    std::unique_lock<std::mutex> lck(window_timer_mutex_);
+    while (!window_timer_stop_) {
+      window_timer_cond_.wait_for(lck, period);
+      if (window_timer_stop_) break;
+      lck.unlock();
+      {
+        std::lock_guard<mutex_t> obj_lck(mutex_);
+        const uint64_t now_ns = util::HsaRsrcFactory::Instance().TimestampNs();
+        for (auto& item : obj_map_) item.second->CloseExpiredWindow(now_ns);
+      }
+      lck.lock();
+    }
+  }
+
+  // Queue callbacks with the callbacks data and the submit callback with its argument
+  // are swapped by one pointer, the submit path is lock-free. The replaced sets are
+  // retired and not deleted as the submit callbacks may still use them.
+  struct callbacks_set_t {
+    rocprofiler_queue_callbacks_t callbacks;
+    void* data;
+  };
+  struct submit_set_t {
+    rocprofiler_hsa_callback_fun_t fun;
+    void* arg;
+  };
+
+  // The dispatch set is published if started and the dispatch callback is set, called under mutex_
+  static void PublishDispatch() {
+    const callbacks_set_t* set = callbacks_set_.load(std::memory_order_relaxed);
+    const bool on = started_ && (set != NULL) && (set->callbacks.dispatch != NULL);
+    dispatch_set_.store(on ? set : NULL, std::memory_order_release);
+  }
+
   static const packet_word_t header_type_mask = (1ul << HSA_PACKET_HEADER_WIDTH_TYPE) - 1;
+  // Initial packets scratch buffer capacity
+  static const uint32_t PACKETS_SCRATCH_SIZE = 64;
+  // Default concurrent counters window dispatches number
+  static const uint32_t WINDOW_DISPATCHES_DEFAULT = 16;
+  // Minimal window timer period, 100us
+  static const uint64_t WINDOW_TIMER_MIN_NS = 100000;
+  static uint32_t window_dispatches_;
+  static uint64_t window_ns_;
+  static std::thread* window_timer_;
+  static std::mutex window_timer_mutex_;
+  static std::condition_variable window_timer_cond_;
+  static bool window_timer_stop_;
+  static uint32_t accum_dispatches_;
 
   static mutex_t mutex_;
-  static rocprofiler_queue_callbacks_t callbacks_;
-  static void* callback_data_;
-  static std::atomic<rocprofiler_callback_t> dispatch_callback_;
+  static std::atomic<const callbacks_set_t*> callbacks_set_;
+  static std::atomic<const callbacks_set_t*> dispatch_set_;
+  static std::vector<const callbacks_set_t*> callbacks_retired_;
+  static bool started_;
+  static std::atomic<DispatchFilter*> filter_;
+  static std::vector<DispatchFilter*> filter_retired_;
+  static DispatchSampler* sampler_;
+  static DispatchConverge* converge_;
+  static uint32_t queue_agents_;
+  static uint32_t queue_types_;
+  static uint32_t queue_budget_;
+  static rocprofiler_queue_stats_t queue_stats_;
 
   static obj_map_t obj_map_;
+  struct obj_table_entry_t {
+    std::atomic<uint64_t> key;
+    std::atomic<InterceptQueue*> obj;
+  };
+  static const uint32_t OBJ_TABLE_SIZE = 1024;
+  static const uint64_t OBJ_TABLE_TOMBSTONE = 1;
+  static obj_table_entry_t obj_table_[OBJ_TABLE_SIZE];
+  static std::atomic<bool> obj_table_full_;
   static const char* kernel_none_;
   static Tracker* tracker_;
   static bool tracker_on_;
   static bool in_create_call_;
   static queue_id_t current_queue_id;
 
-  static rocprofiler_hsa_callback_fun_t submit_callback_fun_;
-  static void* submit_callback_arg_;
+  static std::atomic<const submit_set_t*> submit_set_;
+  static std::vector<const submit_set_t*> submit_retired_;
 
   hsa_queue_t* const queue_;
   ProxyQueue* const proxy_;
   const util::AgentInfo* agent_info_;
   queue_event_callback_t queue_event_callback_;
   queue_id_t queue_id;
+  std::mutex range_mutex_;
+  window_t window_;
+  accum_t accum_;
+  std::atomic<uint64_t> submits_;
+  std::atomic<uint64_t> packets_;
+  std::atomic<uint64_t> dispatches_;
+  std::atomic<uint64_t> profiled_;
+  std::atomic<uint32_t> budget_used_;
+  std::atomic<bool> detached_;
+  // An accumulated range or a counters window is open, checked before taking range_mutex_
+  std::atomic<bool> range_open_;
+  // Submit callbacks in progress, the window mode only
+  std::atomic<uint32_t> submitting_;
 
   static std::once_flag once_flag_;
 };
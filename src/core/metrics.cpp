@@ -25,4 +25,11 @@ THE SOFTWARE.
 namespace rocprofiler {
 MetricsDict::map_t* MetricsDict::map_ = NULL;
 MetricsDict::mutex_t MetricsDict::mutex_;
+std::thread MetricsDict::prefetch_thread_;
+
+// Joining the prefetch thread at exit if it was not joined, the joinable thread
+// object destruction terminates the process. Destructed before the thread object.
+static struct MetricsPrefetchGuard {
+  ~MetricsPrefetchGuard() { MetricsDict::PrefetchWait(); }
+} metrics_prefetch_guard;
 }
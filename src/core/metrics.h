@@ -23,6 +23,7 @@ THE SOFTWARE.
 #ifndef SRC_CORE_METRICS_H_
 #define SRC_CORE_METRICS_H_
 
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -34,6 +35,7 @@ THE SOFTWARE.
 #include <map>
 #include <vector>
 
+#include "core/metrics_db.h"
 #include "core/types.h"
 #include "util/exception.h"
 #include "util/hsa_rsrc_factory.h"
@@ -43,16 +45,19 @@ THE SOFTWARE.
 
 namespace rocprofiler {
 struct counter_t {
-  std::string name;
+  const char* name;
   event_t event;
 };
 typedef std::vector<const counter_t*> counters_vec_t;
 
 class Metric {
  public:
-  Metric(const std::string& name) : name_(name) {}
+  Metric(const std::string& name) : name_str_(name), name_(name_str_.c_str()) {}
+  // The name is referenced, the names of the metrics imported from the mapped database
+  Metric(const char* name) : name_(name) {}
   virtual ~Metric() {}
   std::string GetName() const { return name_; }
+  const char* GetNameRef() const { return name_; }
   virtual void GetCounters(counters_vec_t& vec) const = 0;
   counters_vec_t GetCounters() const {
     counters_vec_t counters;
@@ -62,12 +67,14 @@ class Metric {
   virtual const xml::Expr* GetExpr() const = 0;
 
  private:
-  const std::string name_;
+  const std::string name_str_;
+  const char* const name_;
 };
 
 class BaseMetric : public Metric {
  public:
-  BaseMetric(const std::string& name, const counter_t& counter) : Metric(name), counter_(counter) {}
+  BaseMetric(const std::string& name, const event_t& event) : Metric(name), counter_{GetNameRef(), event} {}
+  BaseMetric(const char* name, const event_t& event) : Metric(name), counter_{name, event} {}
   void GetCounters(counters_vec_t& vec) const { vec.push_back(&counter_); }
   const xml::Expr* GetExpr() const { return NULL; }
 
@@ -78,16 +85,58 @@ class BaseMetric : public Metric {
 class ExprMetric : public Metric {
  public:
   ExprMetric(const std::string& name, const counters_vec_t& counters, const xml::Expr* expr)
-      : Metric(name), counters_(counters), expr_(expr) {}
+      : Metric(name), counters_(counters), expr_(expr), ops_(NULL), op_count_(0) {}
+  // The name and the compiled expression are referenced in the mapped database
+  ExprMetric(const char* name, const counters_vec_t& counters, const xml::Expr* expr,
+             const MetricsDb::op_t* ops, const uint32_t& op_count)
+      : Metric(name), counters_(counters), expr_(expr), ops_(ops), op_count_(op_count) {}
   ~ExprMetric() { delete expr_; }
   void GetCounters(counters_vec_t& vec) const {
     vec.insert(vec.end(), counters_.begin(), counters_.end());
   }
   const xml::Expr* GetExpr() const { return expr_; }
 
+  // Linking the stored compiled expression to the given slots, the metric counters indexes
+  // are translated to the slots. Returns false if there is no the compiled expression.
+  bool Link(const xml::slots_cache_t& slots, xml::expr_prog_t* prog) const {
+    prog->Clear();
+    for (uint32_t i = 0; i < op_count_; ++i) {
+      const MetricsDb::op_t& op = ops_[i];
+      uint32_t slot = 0;
+      if (op.code > xml::expr_prog_t::OP_MAX) break;
+      if (op.code == xml::expr_prog_t::OP_VAR) {
+        if ((op.slot >= counters_.size()) || !slots.Lookup(counters_[op.slot]->name, slot)) break;
+      }
+      prog->Emit((xml::expr_prog_t::op_code_t)op.code, slot, op.value);
+    }
+    const bool suc = (prog->GetCode().size() == op_count_) && prog->Valid();
+    if (!suc) prog->Clear();
+    return suc;
+  }
+
  private:
   const counters_vec_t counters_;
   const xml::Expr* expr_;
+  const MetricsDb::op_t* const ops_;
+  const uint32_t op_count_;
+};
+
+// Metric counters slots, the counter name to the metric counters index
+class CounterSlots : public xml::slots_cache_t {
+ public:
+  CounterSlots(const counters_vec_t& counters) : counters_(counters) {}
+  bool Lookup(const std::string& name, uint32_t& result) const {
+    for (uint32_t i = 0; i < counters_.size(); ++i) {
+      if (name == counters_[i]->name) {
+        result = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const counters_vec_t& counters_;
 };
 
 class MetricsDict {
@@ -124,7 +173,31 @@ class MetricsDict {
     return ret.first->second;
   }
 
+  // Creating the GPU agents dictionaries in the background thread, a context
+  // creation waits on the mutex for the dictionary being constructed
+  static void Prefetch() {
+    if ((getenv("ROCP_METRICS") == NULL) || prefetch_thread_.joinable()) return;
+    util::HsaRsrcFactory* rsrc = &util::HsaRsrcFactory::Instance();
+    prefetch_thread_ = std::thread([rsrc]() {
+      try {
+        const uint32_t gpu_count = rsrc->GetCountOfGpuAgents();
+        for (uint32_t gpu_id = 0; gpu_id < gpu_count; ++gpu_id) {
+          const util::AgentInfo* agent_info = NULL;
+          if (rsrc->GetGpuAgentInfo(gpu_id, &agent_info)) Create(agent_info);
+        }
+      } catch (std::exception& e) {
+        // The error is raised again on the dictionary use
+        (void)e;
+      }
+    });
+  }
+
+  static void PrefetchWait() {
+    if (prefetch_thread_.joinable()) prefetch_thread_.join();
+  }
+
   static void Destroy() {
+    PrefetchWait();
     if (map_ != NULL) {
       for (auto& entry : *map_) delete entry.second;
       delete map_;
@@ -159,8 +232,8 @@ class MetricsDict {
         const hsa_ven_amd_aqlprofile_block_name_t block_id = (hsa_ven_amd_aqlprofile_block_name_t)query.id;
         if ((query.instance_count > 1) && (indexed == false)) EXC_RAISING(HSA_STATUS_ERROR, "Malformed indexed metric name '" << name << "'");
         const uint32_t event_id = atol(event_str.c_str());
-        const counter_t counter = {name, {block_id, block_index, event_id}};
-        metric = new BaseMetric(name, counter);
+        const event_t event = {block_id, block_index, event_id};
+        metric = new BaseMetric(name, event);
       }
     }
 
@@ -174,6 +247,11 @@ class MetricsDict {
   std::string GetAgentName() const { return agent_name_; }
 
   xml::Xml::nodes_t GetNodes() const {
+    // The metrics .xml is not parsed if the metrics are imported from the database
+    if ((xml_ == NULL) && !xml_name_.empty()) {
+      std::lock_guard<mutex_t> lck(mutex_);
+      if (xml_ == NULL) xml_ = CreateXml(agent_info_);
+    }
     auto nodes_vec = GetNodes(agent_name_);
     auto global_vec = GetNodes("global");
     nodes_vec.insert(nodes_vec.end(), global_vec.begin(), global_vec.end());
@@ -185,32 +263,166 @@ class MetricsDict {
     return (xml_ != NULL) ? xml_->GetNodes("top." + scope + ".metric") : xml::Xml::nodes_t();
   }
 
-  MetricsDict(const util::AgentInfo* agent_info) : xml_(NULL), agent_info_(agent_info) {
+  MetricsDict(const util::AgentInfo* agent_info) : xml_(NULL), agent_info_(agent_info), db_(NULL) {
     const char* xml_name = getenv("ROCP_METRICS");
     if (xml_name != NULL) {
-      xml_ = xml::Xml::Create(xml_name);
-      if (xml_ == NULL) EXC_RAISING(HSA_STATUS_ERROR, "metrics .xml open error '" << xml_name << "'");
-      xml_->AddConst("top.const.metric", "MAX_WAVE_SIZE", agent_info->max_wave_size);
-      xml_->AddConst("top.const.metric", "CU_NUM", agent_info->cu_num);
-      xml_->AddConst("top.const.metric", "SIMD_NUM", agent_info->simds_per_cu * agent_info->cu_num);
-      xml_->AddConst("top.const.metric", "SE_NUM", agent_info->se_num);
-      ImportMetrics(agent_info, "const");
+      xml_name_ = xml_name;
       agent_name_ = agent_info->name;
-      if (std::string("gfx906") == agent_info->name ||
-          std::string("gfx908") == agent_info->name ||
-          std::string("gfx90a") == agent_info->name) {
-        ImportMetrics(agent_info, agent_info->name);
-      } else {
+      if (std::string("gfx906") != agent_info->name &&
+          std::string("gfx908") != agent_info->name &&
+          std::string("gfx90a") != agent_info->name) {
         agent_name_ = agent_info->gfxip;
-        ImportMetrics(agent_info, agent_info->gfxip);
       }
+
+      // Importing the metrics from the compiled database if it is up to date,
+      // the database stays mapped for the imported metrics names and expressions
+      db_ = new MetricsDb(DbKey(agent_info), agent_name_);
+      if (db_->Map() && ImportDb(*db_)) return;
+
+      xml_ = CreateXml(agent_info);
+      ImportMetrics(agent_info, "const");
+      ImportMetrics(agent_info, agent_name_);
       ImportMetrics(agent_info, "global");
+      StoreDb(*db_);
+      delete db_;
+      db_ = NULL;
+    }
+  }
+
+  xml::Xml* CreateXml(const util::AgentInfo* agent_info) const {
+    xml::Xml* xml = xml::Xml::Create(xml_name_);
+    if (xml == NULL) EXC_RAISING(HSA_STATUS_ERROR, "metrics .xml open error '" << xml_name_ << "'");
+    xml->AddConst("top.const.metric", "MAX_WAVE_SIZE", agent_info->max_wave_size);
+    xml->AddConst("top.const.metric", "CU_NUM", agent_info->cu_num);
+    xml->AddConst("top.const.metric", "SIMD_NUM", agent_info->simds_per_cu * agent_info->cu_num);
+    xml->AddConst("top.const.metric", "SE_NUM", agent_info->se_num);
+    return xml;
+  }
+
+  static std::string RealPath(const std::string& path) {
+    char* real_path = realpath(path.c_str(), NULL);
+    const std::string str = (real_path != NULL) ? real_path : path;
+    free(real_path);
+    return str;
+  }
+
+  // The libraries resolving the stored counters ids, the profiler library and
+  // the aqlprofile library, the database is rebuilt if any of them is upgraded
+  static std::vector<std::string> LibraryFiles() {
+    std::vector<std::string> files;
+    const void* addrs[] = {
+      reinterpret_cast<const void*>(&MetricsDict::RealPath),
+      reinterpret_cast<const void*>(util::HsaRsrcFactory::Instance().AqlProfileApi()->hsa_ven_amd_aqlprofile_get_info)
+    };
+    for (const void* addr : addrs) {
+      Dl_info info{};
+      if ((addr != NULL) && (dladdr(addr, &info) != 0) && (info.dli_fname != NULL)) files.push_back(RealPath(info.dli_fname));
+    }
+    return files;
+  }
+
+  // Compiled database key, the metrics file, the agent name, the metrics constants
+  // and the libraries files and aqlprofile interface version
+  std::string DbKey(const util::AgentInfo* agent_info) const {
+    std::ostringstream oss;
+    oss << RealPath(xml_name_) << ";" << agent_name_
+        << ";" << agent_info->max_wave_size
+        << ";" << agent_info->cu_num
+        << ";" << agent_info->simds_per_cu * agent_info->cu_num
+        << ";" << agent_info->se_num
+        << ";" << hsa_ven_amd_aqlprofile_VERSION_MAJOR;
+    for (const std::string& file : LibraryFiles()) oss << ";" << file;
+    return oss.str();
+  }
+
+  // Importing the metrics from the mapped database, the metrics reference the mapped
+  // names and compiled expressions. Returns false and leaves the dictionary empty on failure
+  bool ImportDb(const MetricsDb& db) {
+    bool suc = true;
+    try {
+      std::vector<const Metric*> metrics;
+      db.ForEach([this, &metrics](const MetricsDb::view_t& view) {
+        const Metric* metric = NULL;
+        if (view.kind == MetricsDb::KIND_BASE) {
+          const hsa_ven_amd_aqlprofile_block_name_t block_id = (hsa_ven_amd_aqlprofile_block_name_t)view.block_id;
+          const event_t event = {block_id, view.block_index, view.event_id};
+          metric = new BaseMetric(view.name, event);
+        } else {
+          counters_vec_t counters_vec;
+          for (uint32_t i = 0; i < view.ref_count; ++i) metrics[view.refs[i]]->GetCounters(counters_vec);
+          xml::Expr* expr_obj = new xml::Expr(view.expr, new ExprCache(&cache_));
+          metric = new ExprMetric(view.name, counters_vec, expr_obj, view.ops, view.op_count);
+        }
+        AddMetric(metric);
+        metrics.push_back(metric);
+      });
+    } catch (...) {
+      suc = false;
+    }
+    if (!suc) {
+      for (auto& entry : cache_) delete entry.second;
+      cache_.clear();
+      order_.clear();
     }
+    return suc;
+  }
+
+  // Storing the imported metrics to the database
+  void StoreDb(const MetricsDb& db) const {
+    if (!db.Enabled()) return;
+
+    const std::string xml_path = RealPath(xml_name_);
+    const std::size_t pos = xml_path.rfind('/');
+    const std::string path = (pos != std::string::npos) ? xml_path.substr(0, pos + 1) : "";
+    std::vector<std::string> files(1, xml_path);
+    for (auto* node : xml_->GetNodes("top.include")) files.push_back(RealPath(path + node->opts["file"].str()));
+    // The libraries are validated by the sizes and modification times as the metrics files
+    const std::vector<std::string> lib_files = LibraryFiles();
+    if (lib_files.size() != 2) return;
+    files.insert(files.end(), lib_files.begin(), lib_files.end());
+
+    std::map<std::string, uint32_t> index_map;
+    std::vector<MetricsDb::metric_t> metrics;
+    for (const Metric* metric : order_) {
+      MetricsDb::metric_t rec{};
+      rec.name = metric->GetName();
+      const xml::Expr* expr = metric->GetExpr();
+      if (expr == NULL) {
+        const counters_vec_t counters_vec = metric->GetCounters();
+        const event_t& event = counters_vec[0]->event;
+        rec.kind = MetricsDb::KIND_BASE;
+        rec.block_id = event.block_name;
+        rec.block_index = event.block_index;
+        rec.event_id = event.counter_id;
+      } else {
+        rec.kind = MetricsDb::KIND_EXPR;
+        rec.expr = expr->GetStr();
+        for (const std::string& var : expr->GetVars()) {
+          auto it = index_map.find(var);
+          if (it == index_map.end()) return;
+          rec.refs.push_back(it->second);
+        }
+        // Compiling the expression over the metric counters
+        const counters_vec_t counters_vec = metric->GetCounters();
+        const CounterSlots slots(counters_vec);
+        xml::expr_prog_t prog;
+        if (expr->Compile(slots, &prog)) {
+          for (const xml::expr_prog_t::op_t& op : prog.GetCode()) {
+            rec.ops.push_back(MetricsDb::op_t{(uint32_t)op.code, op.slot, op.value});
+          }
+        }
+      }
+      index_map[rec.name] = metrics.size();
+      metrics.push_back(rec);
+    }
+
+    db.Store(files, metrics);
   }
 
   ~MetricsDict() {
     xml::Xml::Destroy(xml_);
     for (auto& entry : cache_) delete entry.second;
+    delete db_;
   }
 
   static hsa_ven_amd_aqlprofile_id_query_t Translate(const util::AgentInfo* agent_info, const std::string& block_name) {
@@ -255,13 +467,13 @@ class MetricsDict {
               block_insance << block_name << "[" << block_index << "]";
               std::ostringstream alias;
               alias << block_insance.str() << ":" << event_str;
-              const counter_t counter = {full_name.str(), {block_id, block_index, event_id}};
-              AddMetric(full_name.str(), alias.str(), counter);
+              const event_t event = {block_id, block_index, event_id};
+              AddMetric(full_name.str(), alias.str(), event);
             }
           } else {
             const std::string alias = block_name + ":" + event_str;
-            const counter_t counter = {name, {block_id, 0, event_id}};
-            AddMetric(name, alias, counter);
+            const event_t event = {block_id, 0, event_id};
+            AddMetric(name, alias, event);
           }
         } else {
           xml::Expr* expr_obj = NULL;
@@ -304,12 +516,13 @@ class MetricsDict {
     }
   }
 
-  const Metric* AddMetric(const std::string& name, const std::string& /*alias*/, const counter_t& counter) {
+  const Metric* AddMetric(const std::string& name, const std::string& /*alias*/, const event_t& event) {
     const Metric* metric = NULL;
     const auto ret = cache_.insert({name, NULL});
     if (ret.second) {
-      metric = new BaseMetric(name, counter);
+      metric = new BaseMetric(name, event);
       ret.first->second = metric;
+      order_.push_back(metric);
     } else EXC_RAISING(HSA_STATUS_ERROR, "metric redefined '" << name << "'");
     return metric;
   }
@@ -320,10 +533,22 @@ class MetricsDict {
     if (ret.second) {
       metric = new ExprMetric(name, counters_vec, expr_obj);
       ret.first->second = metric;
+      order_.push_back(metric);
     } else EXC_RAISING(HSA_STATUS_ERROR, "expr-metric redefined '" << name << "'");
     return metric;
   }
 
+  // Adding the imported metric object
+  void AddMetric(const Metric* metric) {
+    const auto ret = cache_.insert({metric->GetName(), metric});
+    if (ret.second) order_.push_back(metric);
+    else {
+      const std::string name = metric->GetName();
+      delete metric;
+      EXC_RAISING(HSA_STATUS_ERROR, "imported metric redefined '" << name << "'");
+    }
+  }
+
   void Print() {
     for (auto& v : cache_) {
       const Metric* metric = v.second;
@@ -331,18 +556,24 @@ class MetricsDict {
       printf("> Metric '%s'\n", metric->GetName().c_str());
       metric->GetCounters(counters_vec);
       for (auto c : counters_vec) {
-        printf("  counter %s, b(%u), i (%u), e (%u)\n", c->name.c_str(), c->event.block_name, c->event.block_index, c->event.counter_id);
+        printf("  counter %s, b(%u), i (%u), e (%u)\n", c->name, c->event.block_name, c->event.block_index, c->event.counter_id);
       }
     }
   }
 
-  xml::Xml* xml_;
+  mutable xml::Xml* xml_;
   const util::AgentInfo* agent_info_;
+  std::string xml_name_;
   std::string agent_name_;
   cache_t cache_;
+  // Metrics in the import order, the referenced metrics go first
+  std::vector<const Metric*> order_;
+  // Mapped compiled database, referenced by the imported metrics
+  MetricsDb* db_;
 
   static map_t* map_;
   static mutex_t mutex_;
+  static std::thread prefetch_thread_;
 };
 
 }  // namespace rocprofiler
@@ -0,0 +1,352 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef SRC_CORE_METRICS_DB_H_
+#define SRC_CORE_METRICS_DB_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace rocprofiler {
+// Compiled metrics database
+//
+// The metrics resolved for a given gfx target are stored to a cache file
+// which is memory mapped on the next start. The file keeps the source files
+// and the resolving libraries sizes and modification times and is rebuilt
+// if any of them has changed.
+// The database file name includes the hash of the agent key, the file is
+// ignored on any format, key or bounds mismatch.
+// The file stays mapped while the imported metrics reference its names and
+// compiled expressions.
+class MetricsDb {
+ public:
+  static const uint32_t MAGIC = 0x444d5052;  // "RPMD"
+  static const uint32_t VERSION = 3;
+  enum { KIND_BASE = 0, KIND_EXPR = 1 };
+
+  // Compiled expression operation, the slot is the index in the metric counters
+  struct op_t {
+    uint32_t code;
+    uint32_t slot;
+    double value;
+  };
+
+  // Metric description to store
+  struct metric_t {
+    uint32_t kind;
+    std::string name;
+    std::string expr;
+    uint32_t block_id;
+    uint32_t block_index;
+    uint32_t event_id;
+    // Indexes of the metrics referenced by the expression
+    std::vector<uint32_t> refs;
+    // Compiled expression, empty if the expression cannot be compiled
+    std::vector<op_t> ops;
+  };
+
+  // Mapped metric record
+  struct view_t {
+    uint32_t kind;
+    const char* name;
+    const char* expr;
+    uint32_t block_id;
+    uint32_t block_index;
+    uint32_t event_id;
+    uint32_t ref_count;
+    const uint32_t* refs;
+    uint32_t op_count;
+    const op_t* ops;
+  };
+
+  // The key identifies the metrics set, agent name, metrics constants and the metrics file
+  MetricsDb(const std::string& key, const std::string& agent_name) :
+    hash_(Hash(key)),
+    data_(NULL),
+    size_(0),
+    metrics_off_(0)
+  {
+    const std::string dir = GetDir();
+    if (!dir.empty()) {
+      char hash_str[32];
+      snprintf(hash_str, sizeof(hash_str), "%016lx", (unsigned long)hash_);
+      path_ = dir + "/metrics_" + agent_name + "_" + hash_str + ".db";
+    }
+  }
+
+  ~MetricsDb() { Unmap(); }
+
+  bool Enabled() const { return !path_.empty(); }
+  const std::string& GetPath() const { return path_; }
+
+  // Mapping and validating the database file
+  bool Map() {
+    if (!Enabled()) return false;
+    const int fd = open(path_.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size >= (off_t)sizeof(header_t))) {
+      void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        data_ = reinterpret_cast<const char*>(ptr);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+    if ((data_ != NULL) && !Validate()) Unmap();
+    return (data_ != NULL);
+  }
+
+  // Iterating the mapped metrics records, the records are in the order of the storing
+  template <class F> void ForEach(const F& f) const {
+    const header_t* header = reinterpret_cast<const header_t*>(data_);
+    size_t pos = metrics_off_;
+    for (uint32_t i = 0; i < header->metric_count; ++i) {
+      const metric_rec_t* rec = reinterpret_cast<const metric_rec_t*>(data_ + pos);
+      view_t view{};
+      view.kind = rec->kind;
+      view.name = reinterpret_cast<const char*>(rec + 1);
+      view.expr = view.name + rec->name_len + 1;
+      view.block_id = rec->block_id;
+      view.block_index = rec->block_index;
+      view.event_id = rec->event_id;
+      view.ref_count = rec->ref_count;
+      view.refs = reinterpret_cast<const uint32_t*>(data_ + pos + RefsOffset(rec));
+      view.op_count = rec->op_count;
+      view.ops = reinterpret_cast<const op_t*>(data_ + pos + OpsOffset(rec));
+      f(view);
+      pos += rec->size;
+    }
+  }
+
+  // Storing the database, the file is written to a temporary file and renamed
+  bool Store(const std::vector<std::string>& files, const std::vector<metric_t>& metrics) const {
+    if (!Enabled()) return false;
+
+    std::vector<char> buf(sizeof(header_t));
+    for (const std::string& file : files) {
+      struct stat st;
+      if (stat(file.c_str(), &st) != 0) return false;
+      file_rec_t rec{};
+      rec.size = st.st_size;
+      rec.mtime_sec = st.st_mtim.tv_sec;
+      rec.mtime_nsec = st.st_mtim.tv_nsec;
+      rec.name_len = file.length();
+      Append(&buf, &rec, sizeof(rec));
+      Append(&buf, file.c_str(), file.length() + 1);
+      Pad(&buf);
+    }
+    for (const metric_t& metric : metrics) {
+      const size_t pos = buf.size();
+      metric_rec_t rec{};
+      rec.kind = metric.kind;
+      rec.name_len = metric.name.length();
+      rec.expr_len = metric.expr.length();
+      rec.block_id = metric.block_id;
+      rec.block_index = metric.block_index;
+      rec.event_id = metric.event_id;
+      rec.ref_count = metric.refs.size();
+      rec.op_count = metric.ops.size();
+      Append(&buf, &rec, sizeof(rec));
+      Append(&buf, metric.name.c_str(), metric.name.length() + 1);
+      Append(&buf, metric.expr.c_str(), metric.expr.length() + 1);
+      buf.resize(pos + RefsOffset(&rec), 0);
+      if (!metric.refs.empty()) Append(&buf, &metric.refs[0], metric.refs.size() * sizeof(uint32_t));
+      Pad(&buf);
+      if (!metric.ops.empty()) Append(&buf, &metric.ops[0], metric.ops.size() * sizeof(op_t));
+      reinterpret_cast<metric_rec_t*>(&buf[pos])->size = buf.size() - pos;
+    }
+
+    header_t* header = reinterpret_cast<header_t*>(&buf[0]);
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->hash = hash_;
+    header->size = buf.size();
+    header->file_count = files.size();
+    header->metric_count = metrics.size();
+
+    char pid_str[32];
+    snprintf(pid_str, sizeof(pid_str), ".%u", (unsigned)getpid());
+    const std::string tmp_path = path_ + pid_str;
+    const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+    bool suc = true;
+    size_t off = 0;
+    while (suc && (off < buf.size())) {
+      const ssize_t ret = write(fd, &buf[off], buf.size() - off);
+      if (ret > 0) off += ret;
+      else if ((ret == -1) && (errno == EINTR)) continue;
+      else suc = false;
+    }
+    if (close(fd) != 0) suc = false;
+    if (suc) suc = (rename(tmp_path.c_str(), path_.c_str()) == 0);
+    if (!suc) unlink(tmp_path.c_str());
+    return suc;
+  }
+
+ private:
+  struct header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t size;
+    uint32_t file_count;
+    uint32_t metric_count;
+  };
+
+  struct file_rec_t {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t name_len;
+    uint32_t reserved;
+  };
+
+  struct metric_rec_t {
+    uint32_t size;
+    uint32_t kind;
+    uint32_t name_len;
+    uint32_t expr_len;
+    uint32_t block_id;
+    uint32_t block_index;
+    uint32_t event_id;
+    uint32_t ref_count;
+    uint32_t op_count;
+    uint32_t reserved;
+  };
+
+  static const size_t ALIGN = 8;
+
+  static size_t AlignSize(size_t size) { return (size + ALIGN - 1) & ~(ALIGN - 1); }
+
+  // Offset of the references in the metric record
+  static size_t RefsOffset(const metric_rec_t* rec) {
+    const size_t off = sizeof(metric_rec_t) + rec->name_len + 1 + rec->expr_len + 1;
+    return (off + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+  }
+
+  // Offset of the compiled expression in the metric record
+  static size_t OpsOffset(const metric_rec_t* rec) {
+    return AlignSize(RefsOffset(rec) + (size_t)rec->ref_count * sizeof(uint32_t));
+  }
+
+  static void Append(std::vector<char>* buf, const void* data, size_t size) {
+    const char* ptr = reinterpret_cast<const char*>(data);
+    buf->insert(buf->end(), ptr, ptr + size);
+  }
+
+  static void Pad(std::vector<char>* buf) { buf->resize(AlignSize(buf->size()), 0); }
+
+  // FNV-1a hash
+  static uint64_t Hash(const std::string& str) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : str) {
+      hash ^= (uint8_t)c;
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  // Database directory, ROCP_METRICS_DB env or the user cache directory
+  // The database is disabled if ROCP_METRICS_DB is 'off'
+  static std::string GetDir() {
+    std::string dir;
+    const char* db_env = getenv("ROCP_METRICS_DB");
+    if (db_env != NULL) {
+      if ((strcmp(db_env, "off") == 0) || (strcmp(db_env, "0") == 0)) return "";
+      dir = db_env;
+    } else {
+      const char* cache_home = getenv("XDG_CACHE_HOME");
+      const char* home = getenv("HOME");
+      if ((cache_home != NULL) && (*cache_home != '\0')) dir = cache_home;
+      else if (home != NULL) dir = std::string(home) + "/.cache";
+      else return "";
+      mkdir(dir.c_str(), 0755);
+      dir += "/rocprofiler";
+    }
+    if ((mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST)) return "";
+    return dir;
+  }
+
+  void Unmap() {
+    if (data_ != NULL) munmap(const_cast<char*>(data_), size_);
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  // Checking the header, the records bounds and the source files
+  bool Validate() {
+    const header_t* header = reinterpret_cast<const header_t*>(data_);
+    if ((header->magic != MAGIC) || (header->version != VERSION) ||
+        (header->hash != hash_) || (header->size != size_)) return false;
+
+    size_t pos = sizeof(header_t);
+    for (uint32_t i = 0; i < header->file_count; ++i) {
+      if ((pos + sizeof(file_rec_t)) > size_) return false;
+      const file_rec_t* rec = reinterpret_cast<const file_rec_t*>(data_ + pos);
+      const size_t rec_size = AlignSize(sizeof(file_rec_t) + rec->name_len + 1);
+      if ((pos + rec_size) > size_) return false;
+      const char* name = reinterpret_cast<const char*>(rec + 1);
+      if (name[rec->name_len] != '\0') return false;
+      struct stat st;
+      if (stat(name, &st) != 0) return false;
+      if (((uint64_t)st.st_size != rec->size) || (st.st_mtim.tv_sec != rec->mtime_sec) ||
+          (st.st_mtim.tv_nsec != rec->mtime_nsec)) return false;
+      pos += rec_size;
+    }
+
+    metrics_off_ = pos;
+    for (uint32_t i = 0; i < header->metric_count; ++i) {
+      if ((pos + sizeof(metric_rec_t)) > size_) return false;
+      const metric_rec_t* rec = reinterpret_cast<const metric_rec_t*>(data_ + pos);
+      if ((rec->size > (size_ - pos)) ||
+          (rec->size < (OpsOffset(rec) + (size_t)rec->op_count * sizeof(op_t)))) return false;
+      const char* name = reinterpret_cast<const char*>(rec + 1);
+      if ((name[rec->name_len] != '\0') || (name[rec->name_len + 1 + rec->expr_len] != '\0')) return false;
+      const uint32_t* refs = reinterpret_cast<const uint32_t*>(data_ + pos + RefsOffset(rec));
+      for (uint32_t j = 0; j < rec->ref_count; ++j) if (refs[j] >= i) return false;
+      pos += rec->size;
+    }
+    return (pos == size_);
+  }
+
+  const uint64_t hash_;
+  std::string path_;
+  const char* data_;
+  size_t size_;
+  size_t metrics_off_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // SRC_CORE_METRICS_DB_H_
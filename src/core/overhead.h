@@ -0,0 +1,126 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_OVERHEAD_H
+#define _SRC_CORE_OVERHEAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+#include "core/core_timer.h"
+#include "inc/rocprofiler.h"
+
+namespace rocprofiler {
+
+// Profiler hot paths overhead accounting, enabled by ROCP_OVERHEAD.
+// The calls and the TSC ticks are accumulated in per-thread records written only
+// by the owner thread, the records are summed on the query.
+// The sections time is inclusive, a handler time includes the nested sections.
+class Overhead {
+ public:
+  typedef rocprofiler_overhead_section_t section_t;
+  static const uint32_t SECTION_COUNT = ROCPROFILER_OVERHEAD_SECTION_COUNT;
+
+  // Section scope timer
+  class Scope {
+   public:
+    explicit Scope(const section_t& section) :
+      section_(section),
+      begin_(enabled_ ? CoreTimer::Get() : 0)
+    {}
+    ~Scope() { if (begin_ != 0) Add(section_, CoreTimer::Get() - begin_); }
+
+   private:
+    const section_t section_;
+    const CoreTimer::tick_t begin_;
+  };
+
+  static bool GetEnabled() {
+    const char* str = getenv("ROCP_OVERHEAD");
+    return (str != NULL) && (atoi(str) != 0);
+  }
+
+  static bool IsEnabled() { return enabled_; }
+
+  static void Add(const section_t& section, const CoreTimer::tick_t& ticks) {
+    record_t* record = GetRecord();
+    record->calls[section].store(record->calls[section].load(std::memory_order_relaxed) + 1,
+                                 std::memory_order_relaxed);
+    record->ticks[section].store(record->ticks[section].load(std::memory_order_relaxed) + ticks,
+                                 std::memory_order_relaxed);
+  }
+
+  // Returning the sections accumulated calls and time
+  static void Get(rocprofiler_overhead_t* data) {
+    for (uint32_t i = 0; i < SECTION_COUNT; ++i) data[i] = {};
+    for (record_t* record = head_.load(std::memory_order_acquire); record != NULL; record = record->next) {
+      for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+        data[i].calls += record->calls[i].load(std::memory_order_relaxed);
+        data[i].time_ns += record->ticks[i].load(std::memory_order_relaxed);
+      }
+    }
+    for (uint32_t i = 0; i < SECTION_COUNT; ++i) data[i].time_ns = CoreTimer::TicksToNs(data[i].time_ns);
+  }
+
+  static void Report(FILE* file) {
+    if (!enabled_) return;
+    rocprofiler_overhead_t data[SECTION_COUNT];
+    Get(data);
+    fprintf(file, "ROCProfiler: overhead:\n");
+    for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+      fprintf(file, "  %s calls(%lu) time(%luns) avg(%luns)\n", section_names_[i], data[i].calls,
+              data[i].time_ns, (data[i].calls != 0) ? data[i].time_ns / data[i].calls : 0);
+    }
+    fflush(file);
+  }
+
+ private:
+  struct record_t {
+    std::atomic<uint64_t> calls[SECTION_COUNT];
+    std::atomic<uint64_t> ticks[SECTION_COUNT];
+    record_t* next;
+  };
+
+  // The thread record is registered on the first use and kept after the thread exit
+  static record_t* GetRecord() {
+    static thread_local record_t* record = NULL;
+    if (record == NULL) {
+      record = new record_t{};
+      record_t* head = head_.load(std::memory_order_relaxed);
+      do {
+        record->next = head;
+      } while (!head_.compare_exchange_weak(head, record, std::memory_order_release,
+                                            std::memory_order_relaxed));
+    }
+    return record;
+  }
+
+  static bool enabled_;
+  static std::atomic<record_t*> head_;
+  static const char* section_names_[SECTION_COUNT];
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_OVERHEAD_H
@@ -26,6 +26,12 @@ THE SOFTWARE.
 #include "inc/rocprofiler.h"
 
 #include <hsa.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "core/types.h"
@@ -96,6 +102,90 @@ template <class Item> class Config : protected ConfigBase<Item> {
   }
 };
 
+// Finalized PMC profile resources cache.
+// The command/output buffers, the start/stop/read packets and the signals of
+// a released profile are kept per agent and events set and reused by the next
+// profile finalized for the same configuration.
+class ProfileCache {
+ public:
+  typedef std::string key_t;
+  struct entry_t {
+    hsa_ven_amd_aqlprofile_descriptor_t command_buffer;
+    hsa_ven_amd_aqlprofile_descriptor_t output_buffer;
+    pkt_vector_t start_vector;
+    pkt_vector_t stop_vector;
+    pkt_vector_t read_vector;
+    hsa_signal_t completion_signal;
+    hsa_signal_t dispatch_signal;
+    hsa_signal_t barrier_signal;
+    hsa_signal_t read_signal;
+  };
+  typedef std::vector<entry_t*> entry_vector_t;
+  typedef std::map<key_t, entry_vector_t> map_t;
+  typedef std::mutex mutex_t;
+
+  static bool Enabled() { return limit_ != 0; }
+
+  // Key is the agent, the concurrent mode and the ordered events and parameters,
+  // the output buffer layout follows the events order
+  static key_t Key(const profile_t* profile, const bool& is_concurrent) {
+    key_t key;
+    key.append(reinterpret_cast<const char*>(&profile->agent.handle), sizeof(profile->agent.handle));
+    key.append(reinterpret_cast<const char*>(&profile->type), sizeof(profile->type));
+    key.push_back(is_concurrent ? 1 : 0);
+    key.append(reinterpret_cast<const char*>(profile->events),
+               profile->event_count * sizeof(event_t));
+    key.append(reinterpret_cast<const char*>(profile->parameters),
+               profile->parameter_count * sizeof(parameter_t));
+    return key;
+  }
+
+  static entry_t* Get(const key_t& key) {
+    std::lock_guard<mutex_t> lck(mutex_);
+    entry_t* entry = NULL;
+    if (map_ != NULL) {
+      auto it = map_->find(key);
+      if ((it != map_->end()) && !it->second.empty()) {
+        entry = it->second.back();
+        it->second.pop_back();
+      }
+    }
+    return entry;
+  }
+
+  static bool Put(const key_t& key, entry_t* entry) {
+    std::lock_guard<mutex_t> lck(mutex_);
+    if (map_ == NULL) map_ = new map_t;
+    entry_vector_t& vec = (*map_)[key];
+    if (vec.size() >= limit_) return false;
+    vec.push_back(entry);
+    return true;
+  }
+
+  // The cached HSA memory and signals are released with the runtime
+  static void Destroy() {
+    std::lock_guard<mutex_t> lck(mutex_);
+    if (map_ != NULL) {
+      for (auto& item : *map_) {
+        for (entry_t* entry : item.second) delete entry;
+      }
+      delete map_;
+      map_ = NULL;
+    }
+  }
+
+  static uint32_t GetLimit() {
+    const char* str = getenv("ROCP_PROFILE_CACHE");
+    return (str != NULL) ? strtoul(str, NULL, 0) : LIMIT_DFLT;
+  }
+
+ private:
+  static const uint32_t LIMIT_DFLT = 16;
+  static uint32_t limit_;
+  static map_t* map_;
+  static mutex_t mutex_;
+};
+
 class Profile {
  public:
   static const uint32_t LEGACY_SLOT_SIZE_PKT =
@@ -109,10 +199,12 @@ class Profile {
     barrier_signal_ = {};
     read_signal_ = {};
     is_legacy_ = (strncmp(agent_info->name, "gfx8", 4) == 0);
+    is_armed_ = false;
   }
 
   virtual ~Profile() {
     info_vector_.clear();
+    Recycle();
     if (profile_.command_buffer.ptr) util::HsaRsrcFactory::FreeMemory(profile_.command_buffer.ptr);
     if (profile_.output_buffer.ptr) util::HsaRsrcFactory::FreeMemory(profile_.output_buffer.ptr);
     if (profile_.events) free(const_cast<event_t*>(profile_.events));
@@ -176,6 +268,32 @@ class Profile {
     hsa_status_t status = HSA_STATUS_SUCCESS;
 
     if (!info_vector_.empty()) {
+      const uint32_t start_index = start_vector.size();
+      const uint32_t stop_index = stop_vector.size();
+      const uint32_t read_index = read_vector.size();
+
+      // Reusing cached resources of the same configuration
+      if ((profile_.type == HSA_VEN_AMD_AQLPROFILE_EVENT_TYPE_PMC) && ProfileCache::Enabled()) {
+        cache_key_ = ProfileCache::Key(&profile_, is_concurrent);
+        ProfileCache::entry_t* entry = ProfileCache::Get(cache_key_);
+        if (entry != NULL) {
+          profile_.command_buffer = entry->command_buffer;
+          profile_.output_buffer = entry->output_buffer;
+          completion_signal_ = entry->completion_signal;
+          dispatch_signal_ = entry->dispatch_signal;
+          barrier_signal_ = entry->barrier_signal;
+          read_signal_ = entry->read_signal;
+          start_vector_.swap(entry->start_vector);
+          stop_vector_.swap(entry->stop_vector);
+          read_vector_.swap(entry->read_vector);
+          delete entry;
+          start_vector.insert(start_vector.end(), start_vector_.begin(), start_vector_.end());
+          stop_vector.insert(stop_vector.end(), stop_vector_.begin(), stop_vector_.end());
+          read_vector.insert(read_vector.end(), read_vector_.begin(), read_vector_.end());
+          return status;
+        }
+      }
+
       util::HsaRsrcFactory* rsrc = &util::HsaRsrcFactory::Instance();
       const pfn_t* api = rsrc->AqlProfileApi();
       packet_t start{};
@@ -290,11 +408,21 @@ class Profile {
           }
         }
       }
+
+      // Keeping the profile own packets for the cache
+      if (!cache_key_.empty()) {
+        start_vector_.assign(start_vector.begin() + start_index, start_vector.end());
+        stop_vector_.assign(stop_vector.begin() + stop_index, stop_vector.end());
+        read_vector_.assign(read_vector.begin() + read_index, read_vector.end());
+      }
     }
 
     return status;
   }
 
+  // Set if the completion signal async handler is pending
+  void SetArmed(const bool& b) { is_armed_ = b; }
+
   void GetProfiles(profile_vector_t& vec) {
     if (!info_vector_.empty()) {
       vec.push_back(profile_tuple_t{&profile_, &info_vector_, completion_signal_,
@@ -307,8 +435,46 @@ class Profile {
  protected:
   virtual hsa_status_t Allocate(util::HsaRsrcFactory* rsrc) = 0;
 
+  // Returning the finalized resources to the cache, the resources are not
+  // recycled if the completion signal can still be waited by the async handler
+  void Recycle() {
+    if (cache_key_.empty() || is_armed_ || !completion_signal_.handle) return;
+    if (!profile_.command_buffer.ptr || !profile_.output_buffer.ptr) return;
+
+    ProfileCache::entry_t* entry = new ProfileCache::entry_t;
+    entry->command_buffer = profile_.command_buffer;
+    entry->output_buffer = profile_.output_buffer;
+    entry->completion_signal = completion_signal_;
+    entry->dispatch_signal = dispatch_signal_;
+    entry->barrier_signal = barrier_signal_;
+    entry->read_signal = read_signal_;
+    entry->start_vector.swap(start_vector_);
+    entry->stop_vector.swap(stop_vector_);
+    entry->read_vector.swap(read_vector_);
+
+    if (ProfileCache::Put(cache_key_, entry)) {
+      const hsa_signal_t signals[] = {completion_signal_, dispatch_signal_, barrier_signal_, read_signal_};
+      for (const hsa_signal_t& signal : signals) {
+        if (signal.handle) hsa_signal_store_screlease(signal, 1);
+      }
+      profile_.command_buffer = {};
+      profile_.output_buffer = {};
+      completion_signal_ = {};
+      dispatch_signal_ = {};
+      barrier_signal_ = {};
+      read_signal_ = {};
+    } else {
+      delete entry;
+    }
+  }
+
   const util::AgentInfo* const agent_info_;
   bool is_legacy_;
+  bool is_armed_;
+  ProfileCache::key_t cache_key_;
+  pkt_vector_t start_vector_;
+  pkt_vector_t stop_vector_;
+  pkt_vector_t read_vector_;
   profile_t profile_;
   info_vector_t info_vector_;
   hsa_signal_t completion_signal_;
@@ -62,6 +62,7 @@ class ProxyQueue : public Queue {
                             void* data, uint32_t private_segment_size, uint32_t group_segment_size,
                             hsa_queue_t** queue) = 0;
   virtual hsa_status_t Cleanup() const = 0;
+  // The NULL callback detaches the queue, an error is returned if not supported
   virtual hsa_status_t SetInterceptCB(on_submit_cb_t on_submit_cb, void* data) = 0;
   virtual void Submit(const packet_t* packet) = 0;
 
@@ -34,8 +34,11 @@ THE SOFTWARE.
 #include "core/hsa_queue.h"
 #include "core/hsa_interceptor.h"
 #include "core/intercept_queue.h"
+#include "core/overhead.h"
 #include "core/proxy_queue.h"
+#include "core/sampler.h"
 #include "core/simple_proxy_queue.h"
+#include "core/trace_stream.h"
 #include "util/exception.h"
 #include "util/hsa_rsrc_factory.h"
 #include "util/logger.h"
@@ -206,15 +209,20 @@ uint32_t LoadTool() {
     settings.intercept_mode = (intercept_mode != 0) ? 1 : 0;
     settings.trace_size = TraceProfile::GetSize();
     settings.trace_local = TraceProfile::IsLocal() ? 1: 0;
+    settings.trace_stream = TraceStream::GetChunk();
     settings.timeout = util::HsaRsrcFactory::GetTimeoutNs();
     settings.timestamp_on = InterceptQueue::IsTrackerOn() ? 1 : 0;
     settings.code_obj_tracking = 1;
 
+    // The metrics are parsed in the background while the tool and the application initialize
+    MetricsDict::Prefetch();
+
     if (handler) handler();
     else if (handler_prop) handler_prop(&settings);
 
     TraceProfile::SetSize(settings.trace_size);
     TraceProfile::SetLocal(settings.trace_local != 0);
+    TraceStream::SetChunk(settings.trace_stream);
     util::HsaRsrcFactory::SetTimeoutNs(settings.timeout);
     InterceptQueue::TrackerOn(settings.timestamp_on != 0);
     if (settings.intercept_mode != 0) intercept_mode = DISPATCH_INTERCEPT_MODE;
@@ -225,8 +233,19 @@ uint32_t LoadTool() {
       Context::k_concurrent_ = settings.k_concurrent;
       InterceptQueue::k_concurrent_ = settings.k_concurrent;
       InterceptQueue::TrackerOn(true);
+      InterceptQueue::SetWindow(settings.k_window, (uint64_t)settings.k_window_time * 1000);
+    }
+    // The kernel replay is supported by the serial dispatch intercepting
+    if (settings.kernel_replay && (settings.k_concurrent == 0)) Context::k_replay_ = true;
+    // The counters accumulated ranges are supported by the serial dispatch intercepting
+    const bool accumulate = (settings.k_accumulate > 1) && (settings.k_concurrent == 0) && !Context::k_replay_;
+    if (accumulate) InterceptQueue::SetAccumulate(settings.k_accumulate);
+    if (settings.opt_mode && !Context::k_replay_ && !accumulate) InterceptQueue::opt_mode_ = true;
+    if ((settings.sample_rate > 1) || (settings.sample_budget != 0)) {
+      InterceptQueue::SetSampler(settings.sample_rate, settings.sample_budget);
     }
-    if (settings.opt_mode) InterceptQueue::opt_mode_ = true;
+    InterceptQueue::SetQueuePolicy(settings.q_agents, settings.q_types, settings.q_budget);
+    if (settings.converge_tol != 0) InterceptQueue::SetConverge(settings.converge_tol, settings.converge_rate);
   }
 
   ONLOAD_TRACE("end intercept_mode(" << intercept_mode << ")");
@@ -244,16 +263,11 @@ void PmcStopper() {
       fprintf(stderr, "Error: GetGpuAgentInfo(%u) \n", gpu_id);
       abort();
     }
+    // The agent was never profiled
+    if (!PmcAgents::IsSet(agent_info->dev_index)) continue;
 
-    // Create queue
-    hsa_queue_t* queue;
-    const bool ret = rsrc->CreateQueue(agent_info, 10, &queue);
-    if (ret != true) EXC_RAISING(HSA_STATUS_ERROR, "CreateQueue(" << gpu_id << ")");
-
-    // Issue PMC-enable GPU command
-    IssueGpuCommand(PMC_DISABLE_GPU_CMD_OP, agent_info, queue);
-
-    rsrc->HsaApi()->hsa_queue_destroy(queue);
+    // Issue PMC-disable GPU command on the agent control queue
+    IssueGpuCommand(PMC_DISABLE_GPU_CMD_OP, agent_info, NULL);
   }
 }
 
@@ -261,6 +275,7 @@ void PmcStopper() {
 void UnloadTool() {
   ONLOAD_TRACE("tool handle(" << tool_handle << ")");
 
+  MetricsDict::PrefetchWait();
   if (Context::k_concurrent_) PmcStopper();
 
   if (tool_handle) {
@@ -273,6 +288,7 @@ void UnloadTool() {
     handler();
     dlclose(tool_handle);
   }
+  Overhead::Report(stdout);
   ONLOAD_TRACE_END();
 }
 
@@ -285,6 +301,8 @@ CONSTRUCTOR_API void constructor() {
 DESTRUCTOR_API void destructor() {
   ONLOAD_TRACE_BEG();
   rocprofiler::MetricsDict::Destroy();
+  rocprofiler::ProfileCache::Destroy();
+  rocprofiler::GpuCommands::Destroy();
   util::HsaRsrcFactory::Destroy();
   util::Logger::Destroy();
   ONLOAD_TRACE_END();
@@ -327,15 +345,32 @@ hsa_status_t CreateQueuePro(
     queue);
   if (status != HSA_STATUS_SUCCESS) return status;
 
-  // Issue PMC-enable GPU command
-  IssueGpuCommand(PMC_ENABLE_GPU_CMD_OP, agent, *queue);
+  // Issue PMC-enable GPU command, the control queue is prepared for the unload PMC stopping
+  const util::AgentInfo* agent_info = util::HsaRsrcFactory::Instance().GetAgentInfo(agent);
+  GpuCommands::Prepare(agent_info, Context::k_concurrent_);
+  IssueGpuCommand(PMC_ENABLE_GPU_CMD_OP, agent_info, *queue);
+  PmcAgents::Set(agent_info->dev_index);
 
   return HSA_STATUS_SUCCESS;
 }
 
+// Memory copy completion callback, the copies are printed if not set
+std::atomic<rocprofiler_memcopy_callback_t> memcopy_callback{NULL};
+void* memcopy_callback_arg = NULL;
+
+// The copy record is released here
 bool async_copy_handler(hsa_signal_value_t value, void* arg) {
   Tracker::entry_t* entry = reinterpret_cast<Tracker::entry_t*>(arg);
-  printf("%lu: async-copy time(%lu,%lu)\n", entry->index, entry->record->begin, entry->record->end);
+  const rocprofiler_memcopy_callback_t callback = memcopy_callback.load(std::memory_order_acquire);
+  if (callback != NULL) {
+    const rocprofiler_memcopy_record_t record = {entry->index, entry->agent, entry->copy_dst, entry->copy_size,
+                                                 entry->record->begin, entry->record->end};
+    callback(&record, memcopy_callback_arg);
+  } else {
+    printf("%lu: async-copy time(%lu,%lu)\n", entry->index, entry->record->begin, entry->record->end);
+  }
+  delete entry->record;
+  entry->record = NULL;
   return false;
 }
 
@@ -345,7 +380,9 @@ hsa_status_t hsa_amd_memory_async_copy_interceptor(
     const hsa_signal_t* dep_signals, hsa_signal_t completion_signal)
 {
   Tracker* tracker = &Tracker::Instance();
-  Tracker::entry_t* tracker_entry = tracker->Alloc(hsa_agent_t{}, completion_signal);
+  Tracker::entry_t* tracker_entry = tracker->Alloc(src_agent, completion_signal);
+  tracker_entry->copy_dst = dst_agent;
+  tracker_entry->copy_size = size;
   hsa_status_t status = hsa_amd_memory_async_copy_fn(dst, dst_agent, src,
                                                      src_agent, size, num_dep_signals,
                                                      dep_signals, tracker_entry->signal);
@@ -364,7 +401,9 @@ hsa_status_t hsa_amd_memory_async_copy_rect_interceptor(
     hsa_signal_t completion_signal)
 {
   Tracker* tracker = &Tracker::Instance();
-  Tracker::entry_t* tracker_entry = tracker->Alloc(hsa_agent_t{}, completion_signal);
+  Tracker::entry_t* tracker_entry = tracker->Alloc(copy_agent, completion_signal);
+  tracker_entry->copy_dst = copy_agent;
+  tracker_entry->copy_size = (uint64_t)range->x * range->y * range->z;
   hsa_status_t status = hsa_amd_memory_async_copy_rect_fn(dst, dst_offset, src,
                                                           src_offset, range, copy_agent,
                                                           dir, num_dep_signals, dep_signals,
@@ -380,9 +419,27 @@ hsa_status_t hsa_amd_memory_async_copy_rect_interceptor(
 rocprofiler_properties_t rocprofiler_properties;
 uint32_t TraceProfile::output_buffer_size_ = 0x2000000;  // 32M
 bool TraceProfile::output_buffer_local_ = true;
+uint32_t TraceStream::chunk_size_ = 0;
+std::atomic<uint64_t> PmcAgents::mask_{0};
+std::map<uint64_t, TraceStream*> TraceStream::map_;
+std::mutex TraceStream::map_mutex_;
+uint32_t ProfileCache::limit_ = ProfileCache::GetLimit();
+bool Overhead::enabled_ = Overhead::GetEnabled();
+std::atomic<Overhead::record_t*> Overhead::head_{NULL};
+const char* Overhead::section_names_[Overhead::SECTION_COUNT] = {
+  "submit-callback",
+  "tracker-alloc",
+  "tracker-handler",
+  "context-data",
+  "metrics-data"
+};
+ProfileCache::map_t* ProfileCache::map_ = NULL;
+ProfileCache::mutex_t ProfileCache::mutex_;
 std::atomic<Tracker*> Tracker::instance_{};
 Tracker::mutex_t Tracker::glob_mutex_;
-Tracker::counter_t Tracker::counter_ = 0;
+std::atomic<Tracker::counter_t> Tracker::counter_{};
+thread_local Tracker::retired_t Tracker::slab_retired_{};
+std::atomic<uint64_t> Tracker::generations_{};
 util::Logger::mutex_t util::Logger::mutex_;
 std::atomic<util::Logger*> util::Logger::instance_{};
 }
@@ -614,6 +671,25 @@ PUBLIC_API hsa_status_t rocprofiler_group_get_data(rocprofiler_group_t* group) {
   API_METHOD_SUFFIX
 }
 
+// Get the dispatches number covered by the group data
+PUBLIC_API hsa_status_t rocprofiler_group_get_dispatch_count(const rocprofiler_group_t* group, uint32_t* count) {
+  API_METHOD_PREFIX
+  rocprofiler::Context* context = reinterpret_cast<rocprofiler::Context*>(group->context);
+  *count = context->GetGroup(group->index)->GetDispatchCount();
+  API_METHOD_SUFFIX
+}
+
+// Get the kernel objects of the dispatches covered by the group data
+PUBLIC_API hsa_status_t rocprofiler_group_get_kernel_objects(const rocprofiler_group_t* group,
+                                                             const uint64_t** objects, uint32_t* count) {
+  API_METHOD_PREFIX
+  rocprofiler::Context* context = reinterpret_cast<rocprofiler::Context*>(group->context);
+  const std::vector<uint64_t>& kernel_objects = context->GetGroup(group->index)->GetKernelObjects();
+  *objects = (kernel_objects.empty()) ? NULL : kernel_objects.data();
+  *count = kernel_objects.size();
+  API_METHOD_SUFFIX
+}
+
 // Get metrics data
 PUBLIC_API hsa_status_t rocprofiler_get_metrics(const rocprofiler_t* handle) {
   API_METHOD_PREFIX
@@ -622,6 +698,32 @@ PUBLIC_API hsa_status_t rocprofiler_get_metrics(const rocprofiler_t* handle) {
   API_METHOD_SUFFIX
 }
 
+// Plan profiling groups
+PUBLIC_API hsa_status_t rocprofiler_plan_groups(hsa_agent_t agent, const rocprofiler_feature_t* features,
+                                                uint32_t feature_count, uint32_t* group_count,
+                                                uint32_t* group_indexes) {
+  API_METHOD_PREFIX
+  const rocprofiler::util::AgentInfo* agent_info = rocprofiler::util::HsaRsrcFactory::Instance().GetAgentInfo(agent);
+  if (agent_info == NULL) EXC_RAISING(HSA_STATUS_ERROR, "agent is not found");
+  rocprofiler::MetricsGroupSet group_set(agent_info, features, feature_count);
+  *group_count = group_set.GetSize();
+  if (group_indexes != NULL) {
+    for (uint32_t i = 0; i < feature_count; ++i) {
+      const rocprofiler_feature_t* info = &features[i];
+      group_indexes[i] = (info->kind == ROCPROFILER_FEATURE_KIND_METRIC) ? group_set.GetGroupIndex(info->name) : 0;
+    }
+  }
+  API_METHOD_SUFFIX
+}
+
+// Get metrics data for a batch of contexts
+PUBLIC_API hsa_status_t rocprofiler_get_metrics_batch(const rocprofiler_t** handles, uint32_t count) {
+  API_METHOD_PREFIX
+  const rocprofiler::Context* const* contexts = reinterpret_cast<const rocprofiler::Context* const*>(handles);
+  rocprofiler::Context::GetMetricsDataBatch(contexts, count);
+  API_METHOD_SUFFIX
+}
+
 // Set/remove queue callbacks
 PUBLIC_API hsa_status_t rocprofiler_set_queue_callbacks(rocprofiler_queue_callbacks_t callbacks, void* data) {
   API_METHOD_PREFIX
@@ -636,6 +738,23 @@ PUBLIC_API hsa_status_t rocprofiler_remove_queue_callbacks() {
   API_METHOD_SUFFIX
 }
 
+// Set queue callbacks dispatch filter
+PUBLIC_API hsa_status_t rocprofiler_set_queue_callbacks_filter(const rocprofiler_dispatch_filter_t* filter) {
+  API_METHOD_PREFIX
+  rocprofiler::InterceptQueue::SetFilter(filter);
+  API_METHOD_SUFFIX
+}
+
+// Adding kernel convergence observation
+PUBLIC_API hsa_status_t rocprofiler_converge_update(uint64_t kernel_object, const double* values, uint32_t count) {
+  API_METHOD_PREFIX
+  rocprofiler::DispatchConverge* converge = rocprofiler::InterceptQueue::GetConverge();
+  if (converge == NULL) EXC_RAISING(HSA_STATUS_ERROR, "kernel convergence is not enabled");
+  if ((values == NULL) && (count != 0)) EXC_RAISING(HSA_STATUS_ERROR, "NULL values");
+  converge->Update(kernel_object, values, count);
+  API_METHOD_SUFFIX
+}
+
 // Start/stop queue callbacks
 PUBLIC_API hsa_status_t rocprofiler_start_queue_callbacks() {
   API_METHOD_PREFIX
@@ -657,6 +776,14 @@ PUBLIC_API hsa_status_t rocprofiler_iterate_trace_data(
   API_METHOD_SUFFIX
 }
 
+PUBLIC_API hsa_status_t rocprofiler_iterate_trace_data_async(
+    rocprofiler_t* handle, hsa_ven_amd_aqlprofile_data_callback_t callback, void* data) {
+  API_METHOD_PREFIX
+  rocprofiler::Context* context = reinterpret_cast<rocprofiler::Context*>(handle);
+  context->IterateTraceDataAsync(callback, data);
+  API_METHOD_SUFFIX
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Open profiling pool
 PUBLIC_API hsa_status_t rocprofiler_pool_open(hsa_agent_t agent,        // GPU handle
@@ -705,7 +832,37 @@ PUBLIC_API hsa_status_t rocprofiler_pool_fetch(rocprofiler_pool_t* pool,  // pro
   API_METHOD_SUFFIX
 }
 
-// Fetch profiling pool entry
+// Fetch a batch of profiling pool entries
+PUBLIC_API hsa_status_t rocprofiler_pool_fetch_batch(rocprofiler_pool_t* pool,  // profiling pool handle
+                                    rocprofiler_pool_entry_t* entries,          // [out] empty profling pool entries
+                                    uint32_t entry_count)                       // entries count
+{
+  API_METHOD_PREFIX
+  rocprofiler::ContextPool* context_pool = reinterpret_cast<rocprofiler::ContextPool*>(pool);
+  context_pool->Fetch(entries, entry_count);
+  API_METHOD_SUFFIX
+}
+
+// Release profiling pool entry
+PUBLIC_API hsa_status_t rocprofiler_pool_release(rocprofiler_pool_entry_t* entry)  // released profiling pool entry
+{
+  API_METHOD_PREFIX
+  rocprofiler::ContextPool::Release(entry);
+  API_METHOD_SUFFIX
+}
+
+// Iterate fetched profiling pool entries
+PUBLIC_API hsa_status_t rocprofiler_pool_iterate(rocprofiler_pool_t* pool,  // profiling pool handle
+                                    hsa_status_t (*callback)(rocprofiler_pool_entry_t* entry, void* data), // callback
+                                    void* data)                             // [in/out] data passed to callback
+{
+  API_METHOD_PREFIX
+  rocprofiler::ContextPool* context_pool = reinterpret_cast<rocprofiler::ContextPool*>(pool);
+  status = context_pool->Iterate(callback, data);
+  API_METHOD_SUFFIX
+}
+
+// Flush completed entries in profiling pool
 PUBLIC_API hsa_status_t rocprofiler_pool_flush(rocprofiler_pool_t* pool)  // profiling pool handle
 {
   API_METHOD_PREFIX
@@ -714,6 +871,80 @@ PUBLIC_API hsa_status_t rocprofiler_pool_flush(rocprofiler_pool_t* pool)  // pro
   API_METHOD_SUFFIX
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Open periodic counters sampler
+PUBLIC_API hsa_status_t rocprofiler_sampler_open(hsa_agent_t agent,
+                                                 const rocprofiler_feature_t* features,
+                                                 uint32_t feature_count,
+                                                 rocprofiler_sampler_properties_t* properties,
+                                                 rocprofiler_sampler_t** sampler) {
+  API_METHOD_PREFIX
+  rocprofiler::util::HsaRsrcFactory* hsa_rsrc = &rocprofiler::util::HsaRsrcFactory::Instance();
+  const rocprofiler::util::AgentInfo* agent_info = hsa_rsrc->GetAgentInfo(agent);
+  if (agent_info == NULL) {
+    EXC_RAISING(HSA_STATUS_ERROR, "agent is not found");
+  }
+
+  hsa_queue_t* created_queue = NULL;
+  if (properties->queue == NULL) {
+    if (hsa_rsrc->CreateQueue(agent_info, properties->queue_depth, &(properties->queue)) == false) {
+      EXC_RAISING(HSA_STATUS_ERROR, "CreateQueue() failed");
+    }
+    created_queue = properties->queue;
+  }
+
+  rocprofiler::Sampler* obj = new rocprofiler::Sampler(
+    agent_info,
+    new rocprofiler::HsaQueue(agent_info, properties->queue),
+    features,
+    feature_count,
+    properties->rate_hz,
+    properties->ring_size,
+    properties->history
+  );
+  obj->SetCreatedQueue(created_queue);
+  *sampler = reinterpret_cast<rocprofiler_sampler_t*>(obj);
+  API_METHOD_SUFFIX
+}
+
+// Close periodic counters sampler
+PUBLIC_API hsa_status_t rocprofiler_sampler_close(rocprofiler_sampler_t* sampler) {
+  API_METHOD_PREFIX
+  delete reinterpret_cast<rocprofiler::Sampler*>(sampler);
+  API_METHOD_SUFFIX
+}
+
+// Start sampling
+PUBLIC_API hsa_status_t rocprofiler_sampler_start(rocprofiler_sampler_t* sampler) {
+  API_METHOD_PREFIX
+  reinterpret_cast<rocprofiler::Sampler*>(sampler)->Start();
+  API_METHOD_SUFFIX
+}
+
+// Stop sampling
+PUBLIC_API hsa_status_t rocprofiler_sampler_stop(rocprofiler_sampler_t* sampler) {
+  API_METHOD_PREFIX
+  reinterpret_cast<rocprofiler::Sampler*>(sampler)->Stop();
+  API_METHOD_SUFFIX
+}
+
+// Fetch the latest samples
+PUBLIC_API hsa_status_t rocprofiler_sampler_fetch(rocprofiler_sampler_t* sampler, uint64_t* seq,
+                                                  uint32_t max_count, uint64_t* values,
+                                                  uint64_t* timestamps, uint32_t* count) {
+  API_METHOD_PREFIX
+  *count = reinterpret_cast<rocprofiler::Sampler*>(sampler)->Fetch(seq, max_count, values, timestamps);
+  API_METHOD_SUFFIX
+}
+
+// Get the skipped sampling periods count
+PUBLIC_API hsa_status_t rocprofiler_sampler_get_overruns(const rocprofiler_sampler_t* sampler,
+                                                         uint64_t* overruns) {
+  API_METHOD_PREFIX
+  *overruns = reinterpret_cast<const rocprofiler::Sampler*>(sampler)->GetOverruns();
+  API_METHOD_SUFFIX
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Return the info for a given info kind
 PUBLIC_API hsa_status_t rocprofiler_get_info(
@@ -722,7 +953,8 @@ PUBLIC_API hsa_status_t rocprofiler_get_info(
   void *data)
 {
   API_METHOD_PREFIX
-  if (agent == NULL) EXC_RAISING(HSA_STATUS_ERROR, "NULL agent");
+  // The overhead and the queues info is not agent specific
+  if ((agent == NULL) && (kind != ROCPROFILER_INFO_KIND_OVERHEAD) && (kind != ROCPROFILER_INFO_KIND_QUEUE_STATS)) EXC_RAISING(HSA_STATUS_ERROR, "NULL agent");
   uint32_t* result_32bit_ptr = reinterpret_cast<uint32_t*>(data);
 
   switch (kind) {
@@ -732,6 +964,12 @@ PUBLIC_API hsa_status_t rocprofiler_get_info(
     case ROCPROFILER_INFO_KIND_TRACE_COUNT:
       *result_32bit_ptr = 1;
       break;
+    case ROCPROFILER_INFO_KIND_OVERHEAD:
+      rocprofiler::Overhead::Get(reinterpret_cast<rocprofiler_overhead_t*>(data));
+      break;
+    case ROCPROFILER_INFO_KIND_QUEUE_STATS:
+      rocprofiler::InterceptQueue::GetQueueStats(reinterpret_cast<rocprofiler_queue_stats_t*>(data));
+      break;
     default:
       EXC_RAISING(HSA_STATUS_ERROR, "unknown info kind(" << kind << ")");
   }
@@ -904,3 +1142,11 @@ extern "C" PUBLIC_API hsa_status_t rocprofiler_set_hsa_callbacks(const rocprofil
   rocprofiler::InterceptQueue::SetSubmitCallback(callbacks.submit, arg);
   API_METHOD_SUFFIX
 }
+
+// Set memory copy completion callback
+extern "C" PUBLIC_API hsa_status_t rocprofiler_set_memcopy_callback(rocprofiler_memcopy_callback_t callback, void* arg) {
+  API_METHOD_PREFIX
+  rocprofiler::memcopy_callback_arg = arg;
+  rocprofiler::memcopy_callback.store(callback, std::memory_order_release);
+  API_METHOD_SUFFIX
+}
@@ -0,0 +1,343 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_SAMPLER_H
+#define _SRC_CORE_SAMPLER_H
+
+#include <hsa.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "core/metrics.h"
+#include "core/profile.h"
+#include "core/queue.h"
+#include "core/types.h"
+#include "util/exception.h"
+#include "util/hsa_rsrc_factory.h"
+
+namespace rocprofiler {
+
+// Periodic counters sampler, the standalone counters monitoring at a fixed rate.
+// The counters are started once and a read packet is submitted every period.
+// The reads are landing in a ring of device output buffers, a buffer per read
+// in flight, and are reaped by the engine thread without blocking the submits.
+// The reaped samples are decoded to dense arrays of the features values and
+// are kept in a host history ring polled by Fetch().
+// The samples are the raw counters values accumulated since the start, only
+// the base counters are supported. The sampler owns the given queue object and
+// the HSA queue if it was created for the sampler.
+class Sampler {
+ public:
+  typedef std::mutex mutex_t;
+
+  static const uint32_t RATE_DFLT = 1000;
+  static const uint32_t RING_SIZE_DFLT = 4;
+  static const uint32_t HISTORY_DFLT = 1024;
+
+  Sampler(const util::AgentInfo* agent_info, Queue* queue, const rocprofiler_feature_t* features,
+          const uint32_t& feature_count, const uint32_t& rate, const uint32_t& ring_size,
+          const uint32_t& history) :
+    agent_info_(agent_info),
+    queue_(queue),
+    base_(agent_info),
+    feature_count_(feature_count),
+    period_ns_(NS_PER_SEC / ((rate != 0) ? rate : uint32_t(RATE_DFLT))),
+    history_((history != 0) ? history : uint32_t(HISTORY_DFLT)),
+    submit_index_(0),
+    reap_index_(0),
+    head_(0),
+    overruns_(0),
+    running_(false),
+    created_queue_(NULL)
+  {
+    if (feature_count_ == 0) EXC_RAISING(HSA_STATUS_ERROR, "no features");
+    const MetricsDict* metrics = MetricsDict::Create(agent_info_);
+    if (metrics == NULL) EXC_RAISING(HSA_STATUS_ERROR, "MetricsDict create failed");
+
+    // Features base counters events, in the features order
+    std::set<std::string> names;
+    for (const rocprofiler_feature_t* f = features; f < features + feature_count_; ++f) {
+      if (f->kind != ROCPROFILER_FEATURE_KIND_METRIC) {
+        EXC_RAISING(HSA_STATUS_ERROR, "bad feature kind (" << f->kind << ")");
+      }
+      const std::string name = f->name;
+      const Metric* metric = metrics->Get(name);
+      if (metric == NULL) EXC_RAISING(HSA_STATUS_ERROR, "input metric '" << name << "' is not found");
+      if (dynamic_cast<const BaseMetric*>(metric) == NULL) {
+        EXC_RAISING(HSA_STATUS_ERROR, "derived metric '" << name << "' is not supported");
+      }
+      if (names.insert(name).second == false) {
+        EXC_RAISING(HSA_STATUS_ERROR, "duplicated metric '" << name << "'");
+      }
+      const counter_t* counter = metric->GetCounters()[0];
+      base_.Insert(profile_info_t{&(counter->event), NULL, 0, const_cast<rocprofiler_feature_t*>(f)});
+      events_.push_back(counter->event);
+    }
+
+    // Start/stop packets of the sampled counters
+    pkt_vector_t read_vector;
+    hsa_status_t status = base_.Finalize(start_vector_, stop_vector_, read_vector);
+    if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "sampler profile finalize");
+    profile_vector_t profiles;
+    base_.GetProfiles(profiles);
+    stop_signal_ = profiles[0].completion_signal;
+
+    slots_.resize((ring_size != 0) ? ring_size : uint32_t(RING_SIZE_DFLT));
+    for (slot_t& slot : slots_) InitSlot(&slot);
+
+    values_.assign(uint64_t(history_) * feature_count_, 0);
+    timestamps_.assign(history_, 0);
+  }
+
+  ~Sampler() {
+    Stop();
+    for (slot_t& slot : slots_) {
+      if (slot.profile.command_buffer.ptr) util::HsaRsrcFactory::FreeMemory(slot.profile.command_buffer.ptr);
+      if (slot.profile.output_buffer.ptr) util::HsaRsrcFactory::FreeMemory(slot.profile.output_buffer.ptr);
+      if (slot.signal.handle) {
+        hsa_status_t status = hsa_signal_destroy(slot.signal);
+        if (status != HSA_STATUS_SUCCESS) EXC_ABORT(status, "signal_destroy " << std::hex << status);
+      }
+    }
+    delete queue_;
+    if (created_queue_ != NULL) util::HsaRsrcFactory::HsaApi()->hsa_queue_destroy(created_queue_);
+  }
+
+  void SetCreatedQueue(hsa_queue_t* queue) { created_queue_ = queue; }
+
+  void Start() {
+    std::lock_guard<mutex_t> lck(control_mutex_);
+    if (running_.load(std::memory_order_relaxed)) EXC_RAISING(HSA_STATUS_ERROR, "sampler is running");
+    {
+      std::lock_guard<mutex_t> hlck(history_mutex_);
+      head_ = 0;
+    }
+    submit_index_ = 0;
+    reap_index_ = 0;
+    overruns_.store(0, std::memory_order_relaxed);
+    queue_->Submit(&start_vector_[0], start_vector_.size());
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread(Run, this);
+  }
+
+  void Stop() {
+    std::lock_guard<mutex_t> lck(control_mutex_);
+    if (!running_.load(std::memory_order_relaxed)) return;
+    running_.store(false, std::memory_order_release);
+    thread_.join();
+    // Draining the reads in flight
+    while (reap_index_ != submit_index_) {
+      util::HsaRsrcFactory::Instance().SignalWait(slots_[reap_index_ % slots_.size()].signal, 1);
+      Reap();
+    }
+    queue_->Submit(&stop_vector_[0], stop_vector_.size());
+    util::HsaRsrcFactory::Instance().SignalWaitRestore(stop_signal_, 1);
+  }
+
+  // Fetching the samples from the given sequence number, the latest 'max_count'
+  // samples are returned if more are available. The values are stored by the
+  // sample as 'feature_count' values, the sequence number is updated to the
+  // next sample number.
+  uint32_t Fetch(uint64_t* seq, const uint32_t& max_count, uint64_t* values, uint64_t* timestamps) {
+    std::lock_guard<mutex_t> lck(history_mutex_);
+    uint64_t begin = *seq;
+    if (head_ > history_ && begin < head_ - history_) begin = head_ - history_;
+    if (head_ > max_count && begin < head_ - max_count) begin = head_ - max_count;
+    if (begin > head_) begin = head_;
+    uint32_t count = 0;
+    for (uint64_t n = begin; n < head_; ++n, ++count) {
+      const uint32_t index = n % history_;
+      if (values != NULL) {
+        memcpy(values + uint64_t(count) * feature_count_, &values_[uint64_t(index) * feature_count_],
+               feature_count_ * sizeof(uint64_t));
+      }
+      if (timestamps != NULL) timestamps[count] = timestamps_[index];
+    }
+    *seq = head_;
+    return count;
+  }
+
+  // The periods skipped because all the ring buffers were in flight
+  uint64_t GetOverruns() const { return overruns_.load(std::memory_order_relaxed); }
+  uint32_t GetFeatureCount() const { return feature_count_; }
+
+ private:
+  static const uint64_t NS_PER_SEC = 1000000000ull;
+
+  // Ring slot, a read packet with its output buffer and completion signal
+  struct slot_t {
+    profile_t profile;
+    pkt_vector_t read_vector;
+    hsa_signal_t signal;
+    uint64_t timestamp;
+  };
+
+  struct decode_t {
+    uint64_t* values;
+    uint32_t count;
+    uint32_t index;
+  };
+
+  void InitSlot(slot_t* slot) {
+#ifdef AQLPROF_NEW_API
+    util::HsaRsrcFactory* rsrc = &util::HsaRsrcFactory::Instance();
+    const pfn_t* api = rsrc->AqlProfileApi();
+    slot->profile = {};
+    slot->profile.agent = agent_info_->dev_id;
+    slot->profile.type = HSA_VEN_AMD_AQLPROFILE_EVENT_TYPE_PMC;
+    slot->profile.events = &events_[0];
+    slot->profile.event_count = events_.size();
+    slot->timestamp = 0;
+
+    hsa_status_t status = api->hsa_ven_amd_aqlprofile_start(&(slot->profile), NULL);
+    if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "aqlprofile_start(NULL)");
+    slot->profile.command_buffer.ptr =
+      rsrc->AllocateSysMemory(agent_info_, slot->profile.command_buffer.size);
+    // Uncached kernarg memory, the counters values are visible to CPU
+    slot->profile.output_buffer.ptr =
+      rsrc->AllocateKernArgMemory(agent_info_, slot->profile.output_buffer.size);
+    if (!slot->profile.command_buffer.ptr || !slot->profile.output_buffer.ptr) {
+      EXC_RAISING(HSA_STATUS_ERROR, "sampler buffers allocation failed");
+    }
+
+    // The slot start packet is generated only to set up the command buffer,
+    // the counters are started once by the base profile
+    packet_t start{};
+    packet_t read{};
+    status = api->hsa_ven_amd_aqlprofile_start(&(slot->profile), &start);
+    if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "aqlprofile_start");
+    status = api->hsa_ven_amd_aqlprofile_read(&(slot->profile), &read);
+    if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "aqlprofile_read");
+
+    status = hsa_signal_create(1, 0, NULL, &(slot->signal));
+    if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "signal_create " << std::hex << status);
+    read.completion_signal = slot->signal;
+
+    if (strncmp(agent_info_->name, "gfx8", 4) == 0) {
+      slot->read_vector.assign(Profile::LEGACY_SLOT_SIZE_PKT, packet_t{});
+      status = api->hsa_ven_amd_aqlprofile_legacy_get_pm4(
+          &read, reinterpret_cast<void*>(&(slot->read_vector[0])));
+      if (status != HSA_STATUS_SUCCESS) AQL_EXC_RAISING(status, "hsa_ven_amd_aqlprofile_legacy_get_pm4");
+    } else {
+      slot->read_vector.assign(1, read);
+    }
+#else
+    EXC_RAISING(HSA_STATUS_ERROR, "Read API disabled");
+#endif
+  }
+
+  static void Run(Sampler* sampler) {
+    typedef std::chrono::steady_clock clock_t;
+    const std::chrono::nanoseconds period(sampler->period_ns_);
+    clock_t::time_point next = clock_t::now();
+    while (sampler->running_.load(std::memory_order_acquire)) {
+      sampler->Reap();
+      sampler->Submit();
+      next += period;
+      const clock_t::time_point now = clock_t::now();
+      // The missed periods are not caught up
+      if (next < now) next = now;
+      else std::this_thread::sleep_until(next);
+    }
+  }
+
+  // Submitting the next slot read, the period is skipped if the slot is in flight
+  void Submit() {
+    if (submit_index_ - reap_index_ == slots_.size()) {
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    slot_t& slot = slots_[submit_index_ % slots_.size()];
+    slot.timestamp = util::HsaRsrcFactory::Instance().TimestampNs();
+    queue_->Submit(&slot.read_vector[0], slot.read_vector.size());
+    ++submit_index_;
+  }
+
+  // Reaping the completed slots in the submit order
+  void Reap() {
+    const util::hsa_pfn_t* hsa_api = util::HsaRsrcFactory::HsaApi();
+    while (reap_index_ != submit_index_) {
+      slot_t& slot = slots_[reap_index_ % slots_.size()];
+      if (hsa_api->hsa_signal_load_relaxed(slot.signal) != 0) break;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      hsa_api->hsa_signal_store_relaxed(slot.signal, 1);
+
+      std::lock_guard<mutex_t> lck(history_mutex_);
+      const uint32_t index = head_ % history_;
+      uint64_t* values = &values_[uint64_t(index) * feature_count_];
+      memset(values, 0, feature_count_ * sizeof(uint64_t));
+      decode_t decode{values, feature_count_, feature_count_};
+      const hsa_status_t status = util::HsaRsrcFactory::Instance().AqlProfileApi()->
+          hsa_ven_amd_aqlprofile_iterate_data(&slot.profile, DecodeCallback, &decode);
+      if (status != HSA_STATUS_SUCCESS) EXC_ABORT(status, "sampler iterate data failed");
+      timestamps_[index] = slot.timestamp;
+      ++head_;
+      ++reap_index_;
+    }
+  }
+
+  // The event instances values are summed, a new event starts from sample 0
+  static hsa_status_t DecodeCallback(hsa_ven_amd_aqlprofile_info_type_t info_type,
+                                     hsa_ven_amd_aqlprofile_info_data_t* info_data, void* data) {
+    decode_t* decode = reinterpret_cast<decode_t*>(data);
+    if (info_type == HSA_VEN_AMD_AQLPROFILE_INFO_PMC_DATA) {
+      if (info_data->sample_id == 0) decode->index = (decode->index == decode->count) ? 0 : decode->index + 1;
+      if (decode->index < decode->count) decode->values[decode->index] += info_data->pmc_data.result;
+    }
+    return HSA_STATUS_SUCCESS;
+  }
+
+  const util::AgentInfo* const agent_info_;
+  Queue* const queue_;
+  PmcProfile base_;
+  const uint32_t feature_count_;
+  const uint64_t period_ns_;
+  const uint32_t history_;
+  std::vector<event_t> events_;
+  pkt_vector_t start_vector_;
+  pkt_vector_t stop_vector_;
+  hsa_signal_t stop_signal_;
+  std::vector<slot_t> slots_;
+  // Engine thread state
+  uint64_t submit_index_;
+  uint64_t reap_index_;
+  // Samples history ring
+  mutex_t history_mutex_;
+  std::vector<uint64_t> values_;
+  std::vector<uint64_t> timestamps_;
+  uint64_t head_;
+  std::atomic<uint64_t> overruns_;
+  mutex_t control_mutex_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+  hsa_queue_t* created_queue_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_SAMPLER_H
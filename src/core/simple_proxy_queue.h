@@ -24,6 +24,9 @@ THE SOFTWARE.
 #define _SRC_CORE_SIMPLE_PROXY_QUEUE_H
 
 #include <hsa.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
 #include <atomic>
 #include <map>
 #include <mutex>
@@ -62,19 +65,24 @@ class SimpleProxyQueue : public ProxyQueue {
     auto it = queue_map_->find(signal.handle);
     if (it != queue_map_->end()) {
       SimpleProxyQueue* instance = it->second;
-      instance->mutex_lock();
-      const uint64_t begin = instance->submit_index_;
+      // Claiming the submitted packets range, the submit index is monotonic
       const uint64_t end = que_idx + 1;
-      instance->submit_index_ = end;
-      instance->mutex_unlock();
-      for (uint64_t j = begin; j < end; ++j) {
-        // Submited packet
+      uint64_t begin = instance->submit_index_.load(std::memory_order_relaxed);
+      while ((begin < end) && !instance->submit_index_.compare_exchange_weak(begin, end));
+      // Submitted packets are passed in the contiguous ring ranges
+      uint64_t j = begin;
+      while (j < end) {
         const uint32_t idx = j & instance->queue_mask_;
+        uint64_t count = end - j;
+        if ((idx + count) > (instance->queue_mask_ + 1)) count = instance->queue_mask_ + 1 - idx;
         packet_t* packet = reinterpret_cast<packet_t*>(instance->queue_->base_address) + idx;
-        if (instance->on_submit_cb_ != NULL)
-          instance->on_submit_cb_(packet, 1, j, instance->on_submit_cb_data_, NULL);
+        // The callback can be detached concurrently
+        const on_submit_cb_t on_submit_cb = instance->on_submit_cb_.load(std::memory_order_acquire);
+        if (on_submit_cb != NULL)
+          on_submit_cb(packet, count, j, instance->on_submit_cb_data_, NULL);
         else
-          instance->Submit(packet);
+          instance->Submit(packet, count);
+        j += count;
       }
     } else {
       hsa_signal_store_relaxed_fn(signal, que_idx);
@@ -86,7 +94,7 @@ class SimpleProxyQueue : public ProxyQueue {
     auto it = queue_map_->find(queue->doorbell_signal.handle);
     if (it != queue_map_->end()) {
       SimpleProxyQueue* instance = it->second;
-      index = instance->submit_index_;
+      index = instance->submit_index_.load(std::memory_order_relaxed);
     } else {
       index = hsa_queue_load_read_index_relaxed_fn(queue);
     }
@@ -117,41 +125,52 @@ class SimpleProxyQueue : public ProxyQueue {
     }
   }
 
+  // The callback data is published with the callback, the data is kept on detaching
   hsa_status_t SetInterceptCB(on_submit_cb_t on_submit_cb, void* data) {
-    on_submit_cb_ = on_submit_cb;
-    on_submit_cb_data_ = data;
+    if (on_submit_cb != NULL) on_submit_cb_data_ = data;
+    on_submit_cb_.store(on_submit_cb, std::memory_order_release);
     return HSA_STATUS_SUCCESS;
   }
 
-  void Submit(const packet_t* packet) {
+  void Submit(const packet_t* packet) { Submit(packet, 1); }
+
+  // Submitting a packets sequence with one write index update and one doorbell ring
+  void Submit(const packet_t* packet, const size_t& count) {
+    if (count == 0) return;
+    if (count > size_) {
+      for (size_t i = 0; i < count; i += size_) {
+        Submit(packet + i, ((count - i) < size_) ? (count - i) : size_);
+      }
+      return;
+    }
+
     // Compute the write index of queue
     const uint64_t que_idx = hsa_queue_load_write_index_relaxed_fn(queue_);
+    const uint64_t last_idx = que_idx + count - 1;
 
     // Waiting untill there is a free space in the queue
-    while (que_idx >= (hsa_queue_load_read_index_relaxed_fn(queue_) + size_));
+    WaitFreeSpace(last_idx);
 
     // Increment the write index
-    hsa_queue_store_write_index_relaxed_fn(queue_, que_idx + 1);
+    hsa_queue_store_write_index_relaxed_fn(queue_, que_idx + count);
 
+    // Copy the packets to the queue, the packets after the first one are copied
+    // as is since the in-order CP is waiting for the first packet header
     const uint32_t mask = queue_->size - 1;
     const uint32_t idx = que_idx & mask;
-
-    // Copy packet to the queue
-    const packet_word_t* src = reinterpret_cast<const packet_word_t*>(packet);
-    packet_word_t* dst = reinterpret_cast<packet_word_t*>(base_address_ + idx);
-    for (unsigned i = 1; i < sizeof(packet_t) / sizeof(packet_word_t); ++i) {
-      dst[i] = src[i];
+    if (count > 1) {
+      const size_t first_count = ((idx + count) > (mask + 1)) ? (mask + 1 - idx) : count;
+      if (first_count > 1) {
+        memcpy(base_address_ + idx + 1, packet + 1, (first_count - 1) * sizeof(packet_t));
+      }
+      if (first_count < count) {
+        memcpy(base_address_, packet + first_count, (count - first_count) * sizeof(packet_t));
+      }
     }
+    Publish(packet, base_address_ + idx);
 
-    // To maintain global order to ensure the prior copy of the packet contents is made visible
-    // before the header is updated.
-    // With in-order CP it will wait until the first packet in the blob will be valid.
-    std::atomic<packet_word_t>* header_atomic_ptr =
-        reinterpret_cast<std::atomic<packet_word_t>*>(&dst[0]);
-    header_atomic_ptr->store(src[0], std::memory_order_release);
-
-    // Doorbell signaling to submit the packet
-    hsa_signal_store_relaxed_fn(doorbell_signal_, que_idx);
+    // Doorbell signaling to submit the packets
+    hsa_signal_store_relaxed_fn(doorbell_signal_, last_idx);
   }
 
   SimpleProxyQueue()
@@ -229,6 +248,40 @@ class SimpleProxyQueue : public ProxyQueue {
     return status;
   }
 
+  // Waiting untill the given queue index slot is free, spinning shortly and then
+  // yielding and sleeping with backoff as there is no signal on read index update
+  void WaitFreeSpace(const uint64_t& que_idx) const {
+    uint32_t iter = 0;
+    long sleep_ns = SLEEP_MIN_NS;
+    while (que_idx >= (hsa_queue_load_read_index_relaxed_fn(queue_) + size_)) {
+      if (iter < SPIN_ITERS) {
+        ++iter;
+      } else if (iter < (SPIN_ITERS + YIELD_ITERS)) {
+        ++iter;
+        sched_yield();
+      } else {
+        const timespec ts = {0, sleep_ns};
+        nanosleep(&ts, NULL);
+        if (sleep_ns < SLEEP_MAX_NS) sleep_ns *= 2;
+      }
+    }
+  }
+
+  // Copying the packet body and then storing the header.
+  // To maintain global order to ensure the prior copy of the packet contents is made visible
+  // before the header is updated.
+  // With in-order CP it will wait until the first packet in the blob will be valid.
+  static void Publish(const packet_t* packet, packet_t* slot) {
+    const packet_word_t* src = reinterpret_cast<const packet_word_t*>(packet);
+    packet_word_t* dst = reinterpret_cast<packet_word_t*>(slot);
+    for (unsigned i = 1; i < sizeof(packet_t) / sizeof(packet_word_t); ++i) {
+      dst[i] = src[i];
+    }
+    std::atomic<packet_word_t>* header_atomic_ptr =
+        reinterpret_cast<std::atomic<packet_word_t>*>(&dst[0]);
+    header_atomic_ptr->store(src[0], std::memory_order_release);
+  }
+
   void mutex_lock() {
 #if ROCP_PROXY_LOCK
     mutex_.lock();
@@ -246,13 +299,17 @@ class SimpleProxyQueue : public ProxyQueue {
   const util::AgentInfo* agent_info_;
   hsa_queue_t* queue_;
   static const uintptr_t align_mask_ = sizeof(packet_t) - 1;
+  static const uint32_t SPIN_ITERS = 64;
+  static const uint32_t YIELD_ITERS = 64;
+  static const long SLEEP_MIN_NS = 1000;
+  static const long SLEEP_MAX_NS = 100000;
   packet_t* base_address_;
   hsa_signal_t doorbell_signal_;
   uint64_t queue_index_;
   uint64_t queue_mask_;
-  uint64_t submit_index_;
+  std::atomic<uint64_t> submit_index_;
   std::mutex mutex_;
-  on_submit_cb_t on_submit_cb_;
+  std::atomic<on_submit_cb_t> on_submit_cb_;
   void* on_submit_cb_data_;
   void* data_array_;
 };
@@ -0,0 +1,116 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef _SRC_CORE_TRACE_STREAM_H
+#define _SRC_CORE_TRACE_STREAM_H
+
+#include <string.h>
+
+#include <map>
+#include <mutex>
+
+#include "util/exception.h"
+#include "util/hsa_rsrc_factory.h"
+
+namespace rocprofiler {
+
+// Streaming trace readback, the device trace data are drained to the host by
+// chunks through a pair of pinned staging buffers per agent. A chunk DMA copy
+// is overlapped with the host copy of the previous chunk, so the pinned memory
+// is bounded by two chunks and is not reserved per context.
+class TraceStream {
+ public:
+  static void SetChunk(const uint32_t& size) { chunk_size_ = size; }
+  static uint32_t GetChunk() { return chunk_size_; }
+  static bool IsOn() { return chunk_size_ != 0; }
+
+  // Returning the agent stream, created on the first use
+  static TraceStream* Get(const util::AgentInfo* agent_info) {
+    std::lock_guard<std::mutex> lck(map_mutex_);
+    auto it = map_.find(agent_info->dev_id.handle);
+    if (it == map_.end()) {
+      it = map_.insert({agent_info->dev_id.handle, new TraceStream(agent_info)}).first;
+    }
+    return it->second;
+  }
+
+  // Draining the device data to the host memory
+  void Drain(char* dst, const char* src, const size_t& size) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (size == 0) return;
+
+    size_t issued = 0;
+    size_t done = 0;
+    uint32_t cur = 0;
+    Issue(0, src, size, &issued);
+    while (done < size) {
+      const uint32_t next = cur ^ 1;
+      if (issued < size) Issue(next, src, size, &issued);
+      rsrc_->SignalWait(signal_[cur], 1);
+      memcpy(dst + done, staging_[cur], pending_[cur]);
+      done += pending_[cur];
+      cur = next;
+    }
+  }
+
+ private:
+  static const uint32_t STAGING_COUNT = 2;
+
+  explicit TraceStream(const util::AgentInfo* agent_info) :
+    agent_info_(agent_info),
+    rsrc_(&util::HsaRsrcFactory::Instance()),
+    chunk_bytes_(chunk_size_)
+  {
+    for (uint32_t i = 0; i < STAGING_COUNT; ++i) {
+      staging_[i] = rsrc_->AllocateSysMemory(agent_info_, chunk_bytes_);
+      if (staging_[i] == NULL) EXC_RAISING(HSA_STATUS_ERROR, "trace stream staging buffer allocation failed");
+      if (rsrc_->CreateSignal(1, &signal_[i]) == false) EXC_RAISING(HSA_STATUS_ERROR, "trace stream signal creation failed");
+      pending_[i] = 0;
+    }
+  }
+
+  void Issue(const uint32_t& index, const char* src, const size_t& size, size_t* issued) {
+    const size_t remaining = size - *issued;
+    const size_t bytes = (remaining < chunk_bytes_) ? remaining : chunk_bytes_;
+    if (rsrc_->MemcpyAsync(agent_info_->dev_id, staging_[index], src + *issued, bytes, signal_[index]) == false) {
+      EXC_RAISING(HSA_STATUS_ERROR, "trace stream copy failed, src(" << (void*)(src + *issued) << ") size(" << bytes << ")");
+    }
+    pending_[index] = bytes;
+    *issued += bytes;
+  }
+
+  const util::AgentInfo* agent_info_;
+  util::HsaRsrcFactory* rsrc_;
+  const size_t chunk_bytes_;
+  uint8_t* staging_[STAGING_COUNT];
+  hsa_signal_t signal_[STAGING_COUNT];
+  size_t pending_[STAGING_COUNT];
+  std::mutex mutex_;
+
+  static uint32_t chunk_size_;
+  static std::map<uint64_t, TraceStream*> map_;
+  static std::mutex map_mutex_;
+};
+
+}  // namespace rocprofiler
+
+#endif  // _SRC_CORE_TRACE_STREAM_H
@@ -27,11 +27,15 @@ THE SOFTWARE.
 #include <assert.h>
 #include <hsa.h>
 #include <hsa_ext_amd.h>
+#include <stdlib.h>
 
 #include <atomic>
 #include <list>
 #include <mutex>
+#include <new>
 
+#include "core/completion_engine.h"
+#include "core/overhead.h"
 #include "util/hsa_rsrc_factory.h"
 #include "inc/rocprofiler.h"
 #include "util/exception.h"
@@ -48,12 +52,20 @@ class Tracker {
   typedef std::list<entry_t*> sig_list_t;
   typedef sig_list_t::iterator sig_list_it_t;
   typedef uint64_t counter_t;
+  // Entries slab chunk size and alignment
+  static const uint32_t SLAB_ALIGN = 64;
+  static const uint32_t SLAB_CHUNK_SHIFT = 10;
+  static const uint32_t SLAB_CHUNK_SIZE = 1 << SLAB_CHUNK_SHIFT;
+  static const uint32_t SLAB_CHUNK_MAX = 1024;
+  // Tracked signals lists shards, the entries are sharded by the GPU agent
+  static const uint32_t SHARD_COUNT = 16;
 
   struct entry_t {
     counter_t index;
     std::atomic<bool> valid;
     Tracker* tracker;
     sig_list_t::iterator it;
+    uint32_t shard_id;
     hsa_agent_t agent;
     hsa_signal_t orig;
     hsa_signal_t signal;
@@ -63,8 +75,28 @@ class Tracker {
     bool is_context;
     bool is_memcopy;
     bool is_proxy;
+    // Memory copy attributes, the source agent is 'agent'
+    hsa_agent_t copy_dst;
+    uint64_t copy_size;
+    // Slab entry attributes
+    bool is_slab;
+    uint32_t slab_id;
+    uint32_t slab_next;
+    hsa_signal_t slab_signal;
   };
 
+  // Cache-line aligned slab entry
+  struct slab_entry_t {
+    entry_t entry;
+  } __attribute__((aligned(SLAB_ALIGN)));
+
+  // Cache-line aligned tracked signals list shard
+  struct shard_t {
+    sig_list_t sig_list;
+    mutex_t mutex;
+    mutex_t handler_mutex;
+  } __attribute__((aligned(SLAB_ALIGN)));
+
   static Tracker* Create() {
     std::lock_guard<mutex_t> lck(glob_mutex_);
     Tracker* obj = instance_.load(std::memory_order_relaxed);
@@ -90,10 +122,11 @@ class Tracker {
 
   // Add tracker entry
   entry_t* Alloc(const hsa_agent_t& agent, const hsa_signal_t& orig, bool proxy=true) {
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_TRACKER_ALLOC);
     hsa_status_t status = HSA_STATUS_ERROR;
 
     // Creating a new tracker entry
-    entry_t* entry = new entry_t{};
+    entry_t* entry = (slab_on_) ? SlabAlloc() : new entry_t{};
     assert(entry);
     entry->tracker = this;
     entry->agent = agent;
@@ -109,35 +142,75 @@ class Tracker {
     if (proxy) {
       entry->is_proxy = true;
       const hsa_signal_value_t signal_value = (orig.handle) ? hsa_api_.hsa_signal_load_relaxed(orig) : 1;
-      status = hsa_api_.hsa_signal_create(signal_value, 0, NULL, &(entry->signal));
-      if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_signal_create");
-      status = hsa_api_.hsa_amd_signal_async_handler(entry->signal, HSA_SIGNAL_CONDITION_LT, signal_value, Handler, entry);
-      if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_amd_signal_async_handler");
+      if (entry->slab_signal.handle != 0) {
+        // Recycling the completed slab entry signal
+        entry->signal = entry->slab_signal;
+        hsa_api_.hsa_signal_store_relaxed(entry->signal, signal_value);
+      } else {
+        status = hsa_api_.hsa_signal_create(signal_value, 0, NULL, &(entry->signal));
+        if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_signal_create");
+        if (entry->is_slab) entry->slab_signal = entry->signal;
+      }
+      SignalHandler(entry->signal, signal_value, entry);
     }
 
     // Adding antry to the list
-    mutex_.lock();
-    entry->it = sig_list_.insert(sig_list_.end(), entry);
-    entry->index = counter_++;
-    mutex_.unlock();
+    if (slab_on_) {
+      entry->index = counter_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      const util::AgentInfo* agent_info = hsa_rsrc_->GetAgentInfo(agent);
+      entry->shard_id = (agent_info != NULL) ? agent_info->dev_index % SHARD_COUNT : 0;
+      shard_t* shard = &shards_[entry->shard_id];
+      shard->mutex.lock();
+      entry->it = shard->sig_list.insert(shard->sig_list.end(), entry);
+      entry->index = counter_.fetch_add(1, std::memory_order_relaxed);
+      shard->mutex.unlock();
+    }
 
     return entry;
   }
 
-  void SetHandler(entry_t* entry, Group* group) {
+  // Binding the entry to the concurrent mode group signals, the entry is completed by the
+  // after-dispatch barrier signal, or by the dispatch signal if the barrier is submitted
+  // later at the counters window end
+  void SetHandler(entry_t* entry, Group* group, const bool& on_dispatch = false) {
     hsa_signal_t& dispatch_signal = group->GetDispatchSignal();
-    hsa_signal_t& handler_signal = group->GetBarrierSignal();
+    hsa_signal_t& handler_signal = (on_dispatch) ? dispatch_signal : group->GetBarrierSignal();
     entry->signal = dispatch_signal;
-    hsa_status_t status = hsa_api_.hsa_amd_signal_async_handler(handler_signal, HSA_SIGNAL_CONDITION_LT, 1, Handler, entry);
-    if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_amd_signal_async_handler");
+    SignalHandler(handler_signal, 1, entry);
+  }
+
+  // Register signal completion handler, with the completion engine if enabled
+  // or with the ROCr async handler otherwise
+  void SignalHandler(const hsa_signal_t& signal, const hsa_signal_value_t& value, hsa_amd_signal_handler handler, void* arg) {
+    if (engine_ != NULL) {
+      engine_->Register(signal, value, handler, arg);
+    } else {
+      hsa_status_t status = hsa_api_.hsa_amd_signal_async_handler(signal, HSA_SIGNAL_CONDITION_LT, value, handler, arg);
+      if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_amd_signal_async_handler");
+    }
+  }
+  void SignalHandler(const hsa_signal_t& signal, const hsa_signal_value_t& value, entry_t* entry) {
+    SignalHandler(signal, value, (engine_ != NULL) ? EngineHandler : Handler, entry);
   }
 
   // Delete tracker entry
   void Delete(entry_t* entry) {
+    if (entry->is_slab) {
+      // The signal of a completed entry has no pending async handler and is kept
+      // for reuse, otherwise the signal is destroyed
+      if (entry->is_proxy && entry->signal.handle && !entry->valid.load(std::memory_order_relaxed)) {
+        hsa_api_.hsa_signal_destroy(entry->signal);
+        entry->slab_signal = {};
+      }
+      SlabFree(entry);
+      return;
+    }
     if (entry->is_proxy && entry->signal.handle) hsa_api_.hsa_signal_destroy(entry->signal);
-    mutex_.lock();
-    sig_list_.erase(entry->it);
-    mutex_.unlock();
+    shard_t* shard = &shards_[entry->shard_id];
+    shard->mutex.lock();
+    shard->sig_list.erase(entry->it);
+    shard->mutex.unlock();
     delete entry;
   }
 
@@ -177,13 +250,12 @@ class Tracker {
       util::HsaRsrcFactory::Instance().HsaApi()->hsa_signal_load_relaxed(orig_signal) : 1;
     hsa_signal_t& dispatch_signal = group->GetDispatchSignal();
     util::HsaRsrcFactory::Instance().HsaApi()->hsa_signal_store_screlease(dispatch_signal, signal_value);
-    hsa_status_t status =
-      util::HsaRsrcFactory::Instance().HsaApi()->hsa_amd_signal_async_handler(dispatch_signal, HSA_SIGNAL_CONDITION_LT, signal_value, Handler_opt, group);
-    if (status != HSA_STATUS_SUCCESS) EXC_RAISING(status, "hsa_amd_signal_async_handler");
+    Instance().SignalHandler(dispatch_signal, signal_value, Handler_opt, group);
   }
 
   // Tracker handler
   static bool Handler_opt(hsa_signal_value_t signal_value, void* arg) {
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_TRACKER_HANDLER);
     Group* group = reinterpret_cast<Group*>(arg);
     Context* context = group->GetContext();
     hsa_signal_t dispatch_signal = group->GetDispatchSignal();
@@ -213,32 +285,188 @@ class Tracker {
   Tracker() :
     outstanding_(0),
     hsa_rsrc_(&(util::HsaRsrcFactory::Instance())),
-    hsa_api_(*(hsa_rsrc_->HsaApi()))
-  {}
+    hsa_api_(*(hsa_rsrc_->HsaApi())),
+    slab_on_(!ordering_enabled_),
+    slab_head_(0),
+    slab_deferred_(0),
+    slab_count_(0),
+    generation_(generations_.fetch_add(1, std::memory_order_relaxed) + 1),
+    engine_(NULL)
+  {
+    const char* slab_env = getenv("ROCP_TRACKER_SLAB");
+    if ((slab_env != NULL) && (atoi(slab_env) == 0)) slab_on_ = false;
+    for (uint32_t i = 0; i < SLAB_CHUNK_MAX; ++i) slab_chunks_[i] = NULL;
+
+    // Completion engine threads, the ROCr async handlers are used by default,
+    // the not positive values disable the engine and the threads number is limited
+    const char* engine_env = getenv("ROCP_COMPLETION_THREADS");
+    const long engine_val = (engine_env != NULL) ? atol(engine_env) : 0;
+    uint32_t engine_threads = (engine_val > 0) ? (uint32_t)engine_val : 0;
+    if ((engine_val > 0) && ((unsigned long)engine_val > CompletionEngine::THREADS_MAX)) engine_threads = CompletionEngine::THREADS_MAX;
+    if (engine_threads != 0) engine_ = new CompletionEngine(engine_threads, &hsa_api_);
+  }
 
   ~Tracker() {
     if (trace_on_) {
-      fprintf(stdout, "Tracker::DESTR: sig list %d, outst %lu\n", (int)(sig_list_.size()), outstanding_.load());
+      size_t sig_count = 0;
+      for (uint32_t i = 0; i < SHARD_COUNT; ++i) sig_count += shards_[i].sig_list.size();
+      fprintf(stdout, "Tracker::DESTR: sig list %d, outst %lu\n", (int)sig_count, outstanding_.load());
       fflush(stdout);
     }
 
-    auto it = sig_list_.begin();
-    auto end = sig_list_.end();
-    while (it != end) {
-      auto cur = it++;
+    // Stopping the completion engine
+    delete engine_;
+    engine_ = NULL;
+
+    // Releasing the slab entries signals and chunks, the outstanding entries have
+    // the handler set and are not completed, their records are released
+    const uint32_t chunk_count = slab_count_.load() >> SLAB_CHUNK_SHIFT;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+      slab_entry_t* chunk = slab_chunks_[i];
+      for (uint32_t j = 0; j < SLAB_CHUNK_SIZE; ++j) {
+        entry_t& entry = chunk[j].entry;
+        if ((entry.handler.load(std::memory_order_acquire) != NULL) && !entry.valid.load(std::memory_order_acquire)) {
+          delete entry.record;
+          entry.record = NULL;
+        }
+        if (chunk[j].entry.slab_signal.handle) hsa_api_.hsa_signal_destroy(chunk[j].entry.slab_signal);
+        chunk[j].~slab_entry_t();
+      }
+      free(chunk);
+    }
+
+    for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+      auto it = shards_[i].sig_list.begin();
+      auto end = shards_[i].sig_list.end();
+      while (it != end) {
+        auto cur = it++;
 // The wait should be optiona as there possible some inter kernel dependencies and it possible to wait for
 // the kernels will never be lunched as the application was finished by some reason.
 #if 0
-      // FIXME: currently the signal value for tracking signals are taken from original application signal
-      hsa_rsrc_->SignalWait((*cur)->signal, 1);
+        // FIXME: currently the signal value for tracking signals are taken from original application signal
+        hsa_rsrc_->SignalWait((*cur)->signal, 1);
 #endif
-      Erase(cur);
+        Erase(cur);
+      }
     }
   }
 
   // Delete an entry by iterator
   void Erase(const sig_list_it_t& it) { Delete(*it); }
 
+  // Slab free list head is packed as (tag << 32 | (slab_id + 1)), zero id means an empty list,
+  // the tag is incremented on every update to avoid ABA
+  static uint64_t SlabHead(uint64_t tag, uint32_t next) { return (tag << 32) | next; }
+  entry_t* SlabEntry(uint32_t slab_id) const {
+    return &(slab_chunks_[slab_id >> SLAB_CHUNK_SHIFT][slab_id & (SLAB_CHUNK_SIZE - 1)].entry);
+  }
+
+  // Allocate an entry from the slab free list, the deferred entries are drained first
+  // if the free list is empty
+  entry_t* SlabAlloc() {
+    entry_t* entry = NULL;
+    uint64_t head = slab_head_.load(std::memory_order_acquire);
+    while (entry == NULL) {
+      const uint32_t top = head & UINT32_MAX;
+      if (top == 0) {
+        if (SlabDrain() == false) SlabGrow();
+        head = slab_head_.load(std::memory_order_acquire);
+        continue;
+      }
+      entry_t* top_entry = SlabEntry(top - 1);
+      const uint64_t next = SlabHead((head >> 32) + 1, top_entry->slab_next);
+      if (slab_head_.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        entry = top_entry;
+      }
+    }
+
+    // Resetting the entry
+    entry->index = 0;
+    entry->valid.store(false, std::memory_order_relaxed);
+    entry->it = sig_list_it_t();
+    entry->shard_id = 0;
+    entry->agent = {};
+    entry->orig = {};
+    entry->signal = {};
+    entry->record = NULL;
+    entry->handler.store(NULL, std::memory_order_relaxed);
+    entry->arg = NULL;
+    entry->is_context = false;
+    entry->is_memcopy = false;
+    entry->is_proxy = false;
+    entry->copy_dst = {};
+    entry->copy_size = 0;
+    return entry;
+  }
+
+  // Retiring a completed slab entry from its completion handler. The entry signal handler is
+  // still registered until the handler returns, the entry is deferred by the next completion
+  // on the same handler thread, the handlers of a thread are called sequentially.
+  // The retired entry of a destroyed tracker is dropped by the tracker generation check.
+  void SlabRetire(entry_t* entry) {
+    const retired_t prev = slab_retired_;
+    slab_retired_ = retired_t{generation_, entry};
+    if ((prev.entry != NULL) && (prev.generation == generation_)) SlabDefer(prev.entry);
+  }
+
+  // Pushing a retired entry to the deferred free list
+  void SlabDefer(entry_t* entry) {
+    entry->handler.store(NULL, std::memory_order_relaxed);
+    uint32_t top = slab_deferred_.load(std::memory_order_relaxed);
+    do {
+      entry->slab_next = top;
+    } while (!slab_deferred_.compare_exchange_weak(top, entry->slab_id + 1,
+                                                   std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // Moving the deferred entries to the free list, false if there were no deferred entries.
+  // The whole list is taken at once, so the drain has no ABA issue.
+  bool SlabDrain() {
+    uint32_t top = slab_deferred_.exchange(0, std::memory_order_acquire);
+    if (top == 0) return false;
+    while (top != 0) {
+      entry_t* entry = SlabEntry(top - 1);
+      top = entry->slab_next;
+      SlabFree(entry);
+    }
+    return true;
+  }
+
+  // Return an entry to the slab free list
+  void SlabFree(entry_t* entry) {
+    entry->handler.store(NULL, std::memory_order_relaxed);
+    uint64_t head = slab_head_.load(std::memory_order_relaxed);
+    do {
+      entry->slab_next = head & UINT32_MAX;
+    } while (!slab_head_.compare_exchange_weak(head, SlabHead((head >> 32) + 1, entry->slab_id + 1),
+                                               std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // Add a new chunk of entries to the slab
+  void SlabGrow() {
+    std::lock_guard<mutex_t> lck(mutex_);
+    // Other thread could have already refilled the free list
+    if ((slab_head_.load(std::memory_order_acquire) & UINT32_MAX) != 0) return;
+
+    const uint32_t base = slab_count_.load(std::memory_order_relaxed);
+    const uint32_t chunk_index = base >> SLAB_CHUNK_SHIFT;
+    if (chunk_index >= SLAB_CHUNK_MAX) EXC_RAISING(HSA_STATUS_ERROR_OUT_OF_RESOURCES, "Tracker slab overflow");
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, SLAB_ALIGN, SLAB_CHUNK_SIZE * sizeof(slab_entry_t)) != 0) {
+      EXC_RAISING(HSA_STATUS_ERROR_OUT_OF_RESOURCES, "Tracker slab allocation failed");
+    }
+    slab_entry_t* chunk = reinterpret_cast<slab_entry_t*>(ptr);
+    for (uint32_t j = 0; j < SLAB_CHUNK_SIZE; ++j) {
+      new (&chunk[j]) slab_entry_t{};
+      chunk[j].entry.is_slab = true;
+      chunk[j].entry.slab_id = base + j;
+    }
+    slab_chunks_[chunk_index] = chunk;
+    slab_count_.store(base + SLAB_CHUNK_SIZE, std::memory_order_release);
+
+    for (uint32_t j = 0; j < SLAB_CHUNK_SIZE; ++j) SlabFree(&(chunk[j].entry));
+  }
+
   // Entry completion
   inline void Complete(hsa_signal_value_t signal_value, entry_t* entry) {
     record_t* record = entry->record;
@@ -288,12 +516,14 @@ class Tracker {
       rocprofiler_group_t group{};
       reinterpret_cast<rocprofiler_handler_t>(handler)(group, entry->arg);
     }
-    // Delete tracker entry
-    entry->tracker->Delete(entry);
+    // Delete tracker entry, the completed slab entry is recycled after the handler return
+    if (entry->is_slab) entry->tracker->SlabRetire(entry);
+    else entry->tracker->Delete(entry);
   }
 
   // Handler for packet completion
   static bool Handler(hsa_signal_value_t signal_value, void* arg) {
+    Overhead::Scope overhead(ROCPROFILER_OVERHEAD_TRACKER_HANDLER);
     // Acquire entry
     entry_t* entry = reinterpret_cast<entry_t*>(arg);
     volatile std::atomic<void*>* ptr = &entry->handler;
@@ -306,13 +536,16 @@ class Tracker {
     if (ordering_enabled_ == false) {
       HandleEntry(signal_value, entry);
     } else {
+      // The handling is ordered per agent shard
+      shard_t* shard = &(tracker->shards_[entry->shard_id]);
+
       // Acquire last entry
-      entry_t* back = tracker->sig_list_.back();
+      entry_t* back = shard->sig_list.back();
       volatile std::atomic<void*>* ptr = &back->handler;
       while (ptr->load(std::memory_order_acquire) == NULL) sched_yield();
 
-      tracker->handler_mutex_.lock();
-      sig_list_it_t it = tracker->sig_list_.begin();
+      shard->handler_mutex.lock();
+      sig_list_it_t it = shard->sig_list.begin();
       sig_list_it_t end = back->it;
       while (it != end) {
         entry = *(it++);
@@ -322,27 +555,51 @@ class Tracker {
           break;
         }
       }
-      tracker->handler_mutex_.unlock();
+      shard->handler_mutex.unlock();
     }
 
     return false;
   }
 
+  // Handler for packet completion with the completion engine.
+  // The entry is deferred by the engine if its handler is not published yet, instead of spinning.
+  static bool EngineHandler(hsa_signal_value_t signal_value, void* arg) {
+    entry_t* entry = reinterpret_cast<entry_t*>(arg);
+    if (entry->handler.load(std::memory_order_acquire) == NULL) return true;
+    return Handler(signal_value, arg);
+  }
+
   // instance
   static std::atomic<Tracker*> instance_;
   static mutex_t glob_mutex_;
-  static counter_t counter_;
+  static std::atomic<counter_t> counter_;
 
-  // Tracked signals list
-  sig_list_t sig_list_;
-  // Inter-thread synchronization
+  // Tracked signals lists, used if the slab is disabled
+  shard_t shards_[SHARD_COUNT];
+  // Slab growing synchronization
   mutex_t mutex_;
-  mutex_t handler_mutex_;
   // Outstanding dispatches
   std::atomic<uint64_t> outstanding_;
   // HSA resources factory
   util::HsaRsrcFactory* hsa_rsrc_;
   const util::hsa_pfn_t& hsa_api_;
+  // Entries slab, used if the handling ordering is disabled
+  bool slab_on_;
+  std::atomic<uint64_t> slab_head_;
+  // Deferred free list head, (slab_id + 1), zero means an empty list
+  std::atomic<uint32_t> slab_deferred_;
+  std::atomic<uint32_t> slab_count_;
+  slab_entry_t* slab_chunks_[SLAB_CHUNK_MAX];
+  // The last retired entry of the handler thread and its tracker generation
+  struct retired_t {
+    uint64_t generation;
+    entry_t* entry;
+  };
+  static thread_local retired_t slab_retired_;
+  static std::atomic<uint64_t> generations_;
+  const uint64_t generation_;
+  // Batched completion engine
+  CompletionEngine* engine_;
   // Handling ordering enabled
   static const bool ordering_enabled_ = false;
   // Enable tracing
@@ -123,6 +123,7 @@ HsaRsrcFactory::HsaRsrcFactory(bool initialize_hsa) : initialize_hsa_(initialize
 
   cpu_pool_ = NULL;
   kern_arg_pool_ = NULL;
+  staging_cached_ = 0;
 
   InitHsaApiTable(NULL);
 
@@ -137,6 +138,7 @@ HsaRsrcFactory::HsaRsrcFactory(bool initialize_hsa) : initialize_hsa_(initialize
   CHECK_STATUS("Error Calling hsa_iterate_agents", status);
   if (cpu_pool_ == NULL) CHECK_STATUS("CPU memory pool is not found", HSA_STATUS_ERROR);
   if (kern_arg_pool_ == NULL) CHECK_STATUS("Kern-arg memory pool is not found", HSA_STATUS_ERROR);
+  SetNumaAffinity();
 
   // Get AqlProfile API table
   aqlprofile_api_ = {0};
@@ -173,6 +175,7 @@ HsaRsrcFactory::HsaRsrcFactory(bool initialize_hsa) : initialize_hsa_(initialize
 // Destructor of the class
 HsaRsrcFactory::~HsaRsrcFactory() {
   delete timer_;
+  for (auto& v : staging_free_) for (void* ptr : v.second) FreeMemory(ptr);
   for (auto p : cpu_list_) delete p;
   for (auto p : gpu_list_) delete p;
   if (initialize_hsa_) {
@@ -218,11 +221,13 @@ void HsaRsrcFactory::InitHsaApiTable(HsaApiTable* table) {
 
       hsa_api_.hsa_amd_agent_iterate_memory_pools = table->amd_ext_->hsa_amd_agent_iterate_memory_pools_fn;
       hsa_api_.hsa_amd_memory_pool_get_info = table->amd_ext_->hsa_amd_memory_pool_get_info_fn;
+      hsa_api_.hsa_amd_agent_memory_pool_get_info = table->amd_ext_->hsa_amd_agent_memory_pool_get_info_fn;
       hsa_api_.hsa_amd_memory_pool_allocate = table->amd_ext_->hsa_amd_memory_pool_allocate_fn;
       hsa_api_.hsa_amd_agents_allow_access = table->amd_ext_->hsa_amd_agents_allow_access_fn;
       hsa_api_.hsa_amd_memory_async_copy = table->amd_ext_->hsa_amd_memory_async_copy_fn;
 
       hsa_api_.hsa_amd_signal_async_handler = table->amd_ext_->hsa_amd_signal_async_handler_fn;
+      hsa_api_.hsa_amd_signal_wait_any = table->amd_ext_->hsa_amd_signal_wait_any_fn;
       hsa_api_.hsa_amd_profiling_set_profiler_enabled = table->amd_ext_->hsa_amd_profiling_set_profiler_enabled_fn;
       hsa_api_.hsa_amd_profiling_get_async_copy_time = table->amd_ext_->hsa_amd_profiling_get_async_copy_time_fn;
       hsa_api_.hsa_amd_profiling_get_dispatch_time = table->amd_ext_->hsa_amd_profiling_get_dispatch_time_fn;
@@ -259,11 +264,13 @@ void HsaRsrcFactory::InitHsaApiTable(HsaApiTable* table) {
 
       hsa_api_.hsa_amd_agent_iterate_memory_pools = hsa_amd_agent_iterate_memory_pools;
       hsa_api_.hsa_amd_memory_pool_get_info = hsa_amd_memory_pool_get_info;
+      hsa_api_.hsa_amd_agent_memory_pool_get_info = hsa_amd_agent_memory_pool_get_info;
       hsa_api_.hsa_amd_memory_pool_allocate = hsa_amd_memory_pool_allocate;
       hsa_api_.hsa_amd_agents_allow_access = hsa_amd_agents_allow_access;
       hsa_api_.hsa_amd_memory_async_copy = hsa_amd_memory_async_copy;
 
       hsa_api_.hsa_amd_signal_async_handler = hsa_amd_signal_async_handler;
+      hsa_api_.hsa_amd_signal_wait_any = hsa_amd_signal_wait_any;
       hsa_api_.hsa_amd_profiling_set_profiler_enabled = hsa_amd_profiling_set_profiler_enabled;
       hsa_api_.hsa_amd_profiling_get_async_copy_time = hsa_amd_profiling_get_async_copy_time;
       hsa_api_.hsa_amd_profiling_get_dispatch_time = hsa_amd_profiling_get_dispatch_time;
@@ -320,6 +327,7 @@ const AgentInfo* HsaRsrcFactory::AddAgentInfo(const hsa_agent_t agent) {
     agent_info->dev_id = agent;
     agent_info->dev_type = HSA_DEVICE_TYPE_CPU;
     agent_info->dev_index = cpu_list_.size();
+    hsa_api_.hsa_agent_get_info(agent, HSA_AGENT_INFO_NODE, &agent_info->numa_node);
 
     status = hsa_api_.hsa_amd_agent_iterate_memory_pools(agent, FindStandardPool, &agent_info->cpu_pool);
     if ((status == HSA_STATUS_INFO_BREAK) && (cpu_pool_ == NULL)) cpu_pool_ = &agent_info->cpu_pool;
@@ -376,6 +384,37 @@ const AgentInfo* HsaRsrcFactory::AddAgentInfo(const hsa_agent_t agent) {
   return agent_info;
 }
 
+// Set the GPU agents nearest CPU memory pools
+// The CPU agent distance is the NUMA distance of the CPU memory pool link from the GPU agent
+void HsaRsrcFactory::SetNumaAffinity() {
+  for (const AgentInfo* gpu_info : gpu_list_) {
+    AgentInfo* agent_info = const_cast<AgentInfo*>(gpu_info);
+    const AgentInfo* near_info = NULL;
+    uint32_t near_distance = UINT32_MAX;
+    for (const AgentInfo* cpu_info : cpu_list_) {
+      if ((cpu_info->cpu_pool.handle == 0) || (cpu_info->kern_arg_pool.handle == 0)) continue;
+      uint32_t hops = 0;
+      hsa_status_t status = hsa_api_.hsa_amd_agent_memory_pool_get_info(
+          agent_info->dev_id, cpu_info->cpu_pool, HSA_AMD_AGENT_MEMORY_POOL_INFO_NUM_LINK_HOPS, &hops);
+      if ((status != HSA_STATUS_SUCCESS) || (hops == 0)) continue;
+      std::vector<hsa_amd_memory_pool_link_info_t> links(hops);
+      status = hsa_api_.hsa_amd_agent_memory_pool_get_info(
+          agent_info->dev_id, cpu_info->cpu_pool, HSA_AMD_AGENT_MEMORY_POOL_INFO_LINK_INFO, links.data());
+      if (status != HSA_STATUS_SUCCESS) continue;
+      uint32_t distance = 0;
+      for (const auto& link : links) distance += link.numa_distance;
+      if (distance < near_distance) {
+        near_distance = distance;
+        near_info = cpu_info;
+      }
+    }
+    if (near_info == NULL) near_info = cpu_list_[0];
+    agent_info->cpu_pool = near_info->cpu_pool;
+    agent_info->kern_arg_pool = near_info->kern_arg_pool;
+    agent_info->numa_node = near_info->numa_node;
+  }
+}
+
 // Return systen agent info
 const AgentInfo* HsaRsrcFactory::GetAgentInfo(const hsa_agent_t agent) {
   const AgentInfo* agent_info = NULL;
@@ -492,7 +531,8 @@ uint8_t* HsaRsrcFactory::AllocateKernArgMemory(const AgentInfo* agent_info, size
   uint8_t* buffer = NULL;
   if (!cpu_agents_.empty()) {
     size = (size + MEM_PAGE_MASK) & ~MEM_PAGE_MASK;
-    status = hsa_api_.hsa_amd_memory_pool_allocate(*kern_arg_pool_, size, 0, reinterpret_cast<void**>(&buffer));
+    const hsa_amd_memory_pool_t* pool = (agent_info->kern_arg_pool.handle != 0) ? &agent_info->kern_arg_pool : kern_arg_pool_;
+    status = hsa_api_.hsa_amd_memory_pool_allocate(*pool, size, 0, reinterpret_cast<void**>(&buffer));
     // Both the CPU and GPU can access the kernel arguments
     if (status == HSA_STATUS_SUCCESS) {
       hsa_agent_t ag_list[1] = {agent_info->dev_id};
@@ -504,6 +544,7 @@ uint8_t* HsaRsrcFactory::AllocateKernArgMemory(const AgentInfo* agent_info, size
 }
 
 // Allocate system memory accessible by both CPU and GPU
+// The memory is allocated from the GPU agent nearest NUMA node pool
 // @param agent_info Agent from whose memory region to allocate
 // @param size Size of memory in terms of bytes
 // @return uint8_t* Pointer to buffer, null if allocation fails.
@@ -512,7 +553,8 @@ uint8_t* HsaRsrcFactory::AllocateSysMemory(const AgentInfo* agent_info, size_t s
   uint8_t* buffer = NULL;
   size = (size + MEM_PAGE_MASK) & ~MEM_PAGE_MASK;
   if (!cpu_agents_.empty()) {
-    status = hsa_api_.hsa_amd_memory_pool_allocate(*cpu_pool_, size, 0, reinterpret_cast<void**>(&buffer));
+    const hsa_amd_memory_pool_t* pool = (agent_info->cpu_pool.handle != 0) ? &agent_info->cpu_pool : cpu_pool_;
+    status = hsa_api_.hsa_amd_memory_pool_allocate(*pool, size, 0, reinterpret_cast<void**>(&buffer));
     // Both the CPU and GPU can access the memory
     if (status == HSA_STATUS_SUCCESS) {
       hsa_agent_t ag_list[1] = {agent_info->dev_id};
@@ -536,6 +578,60 @@ uint8_t* HsaRsrcFactory::AllocateCmdMemory(const AgentInfo* agent_info, size_t s
   return ptr;
 }
 
+// Allocate pinned staging memory from the arena
+uint8_t* HsaRsrcFactory::AllocateStagingMemory(const AgentInfo* agent_info, size_t size, size_t* capacity) {
+  uint32_t index = 0;
+  while ((index < STAGING_CLASS_COUNT) && ((size_t(1) << (STAGING_CLASS_MIN + index)) < size)) ++index;
+  if (index == STAGING_CLASS_COUNT) return NULL;
+  const size_t class_size = size_t(1) << (STAGING_CLASS_MIN + index);
+  if (capacity != NULL) *capacity = class_size;
+  // The size class lists are per NUMA node
+  const uint32_t key = agent_info->numa_node * STAGING_CLASS_COUNT + index;
+
+  std::lock_guard<std::mutex> lck(staging_mutex_);
+  std::vector<void*>& free_list = staging_free_[key];
+  if (!free_list.empty()) {
+    void* ptr = free_list.back();
+    free_list.pop_back();
+    staging_cached_ -= class_size;
+    return reinterpret_cast<uint8_t*>(ptr);
+  }
+
+  hsa_status_t status = HSA_STATUS_ERROR;
+  uint8_t* buffer = NULL;
+  if (!cpu_agents_.empty()) {
+    const hsa_amd_memory_pool_t* pool = (agent_info->cpu_pool.handle != 0) ? &agent_info->cpu_pool : cpu_pool_;
+    status = hsa_api_.hsa_amd_memory_pool_allocate(*pool, class_size, 0, reinterpret_cast<void**>(&buffer));
+    // The buffer is shared by the contexts of all GPU agents
+    if (status == HSA_STATUS_SUCCESS) {
+      status = hsa_api_.hsa_amd_agents_allow_access(gpu_agents_.size(), gpu_agents_.data(), NULL, buffer);
+    }
+  }
+  if (status != HSA_STATUS_SUCCESS) return NULL;
+  staging_map_[buffer] = key;
+  return buffer;
+}
+
+// Release staging memory to the arena
+void HsaRsrcFactory::ReleaseStagingMemory(void* ptr) {
+  if (ptr == NULL) return;
+  std::lock_guard<std::mutex> lck(staging_mutex_);
+  auto it = staging_map_.find(ptr);
+  if (it == staging_map_.end()) {
+    std::cerr << "Error: HsaRsrcFactory::ReleaseStagingMemory: not a staging buffer (" << ptr << ")" << std::endl << std::flush;
+    abort();
+  }
+  const uint32_t key = it->second;
+  const size_t class_size = size_t(1) << (STAGING_CLASS_MIN + key % STAGING_CLASS_COUNT);
+  if ((staging_cached_ + class_size) <= STAGING_CACHE_MAX) {
+    staging_free_[key].push_back(ptr);
+    staging_cached_ += class_size;
+  } else {
+    staging_map_.erase(it);
+    FreeMemory(ptr);
+  }
+}
+
 // Wait signal
 hsa_signal_value_t HsaRsrcFactory::SignalWait(const hsa_signal_t& signal, const hsa_signal_value_t& signal_value) const {
   const hsa_signal_value_t exp_value = signal_value - 1;
@@ -577,6 +673,15 @@ bool HsaRsrcFactory::Memcpy(const hsa_agent_t& agent, void* dst, const void* src
 bool HsaRsrcFactory::Memcpy(const AgentInfo* agent_info, void* dst, const void* src, size_t size) {
   return Memcpy(agent_info->dev_id, dst, src, size);
 }
+bool HsaRsrcFactory::MemcpyAsync(const hsa_agent_t& agent, void* dst, const void* src, size_t size, const hsa_signal_t& signal) {
+  hsa_status_t status = HSA_STATUS_ERROR;
+  if (!cpu_agents_.empty()) {
+    hsa_api_.hsa_signal_store_relaxed(signal, 1);
+    status = hsa_api_.hsa_amd_memory_async_copy(dst, cpu_agents_[0], src, agent, size, 0, NULL, signal);
+    CHECK_STATUS("hsa_amd_memory_async_copy()", status);
+  }
+  return (status == HSA_STATUS_SUCCESS);
+}
 
 // Memory free method
 bool HsaRsrcFactory::FreeMemory(void* ptr) {
@@ -726,13 +831,84 @@ uint64_t HsaRsrcFactory::Submit(hsa_queue_t* queue, const void* packet, size_t s
 }
 
 const char* HsaRsrcFactory::GetKernelNameRef(uint64_t addr) {
-  std::lock_guard<mutex_t> lck(mutex_);
-  const auto it = symbols_map_->find(addr);
-  if (it == symbols_map_->end()) {
+  const kernel_info_t* info = GetKernelInfo(addr);
+  if (info == NULL) {
     fprintf(stderr, "HsaRsrcFactory::GetKernelNameRef: kernel addr (0x%lx) is not found\n", addr);
     abort();
   }
-  return it->second;
+  return info->name.load(std::memory_order_acquire);
+}
+
+HsaRsrcFactory::kernel_info_t* HsaRsrcFactory::KernelCacheFind(uint64_t kernel_object) {
+  kernel_info_t* info = kernel_cache_[KernelCacheHash(kernel_object)].load(std::memory_order_acquire);
+  while ((info != NULL) && (info->object.load(std::memory_order_acquire) != kernel_object)) info = info->next;
+  return info;
+}
+
+// Called under mutex_, an invalidated entry of the bucket is reused for a new kernel object
+// and the replaced name is released
+void HsaRsrcFactory::KernelCacheSet(uint64_t kernel_object, const char* name, const amd_kernel_code_t* code) {
+  std::atomic<kernel_info_t*>& head = kernel_cache_[KernelCacheHash(kernel_object)];
+  kernel_info_t* info = KernelCacheFind(kernel_object);
+  if (info == NULL) {
+    info = head.load(std::memory_order_relaxed);
+    while ((info != NULL) && info->valid.load(std::memory_order_relaxed)) info = info->next;
+  }
+  const bool is_new = (info == NULL);
+  if (is_new) {
+    info = new kernel_info_t{};
+    info->next = head.load(std::memory_order_relaxed);
+  } else {
+    info->valid.store(false, std::memory_order_release);
+  }
+
+  const char* prev_name = info->name.load(std::memory_order_relaxed);
+  kernel_props_t props{};
+  if (code != NULL) {
+    props.vgpr_count = AMD_HSA_BITS_GET(code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WORKITEM_VGPR_COUNT);
+    props.sgpr_count = AMD_HSA_BITS_GET(code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WAVEFRONT_SGPR_COUNT);
+    props.fbarrier_count = code->workgroup_fbarrier_count;
+  }
+  info->props = props;
+  info->code.store(code, std::memory_order_relaxed);
+  info->name.store(name, std::memory_order_relaxed);
+  info->object.store(kernel_object, std::memory_order_release);
+  info->valid.store(true, std::memory_order_release);
+  if (is_new) head.store(info, std::memory_order_release);
+
+  if ((prev_name != NULL) && (prev_name != name)) free(const_cast<char*>(prev_name));
+}
+
+// Called under mutex_
+void HsaRsrcFactory::KernelCacheInvalidate(uint64_t kernel_object) {
+  kernel_info_t* info = KernelCacheFind(kernel_object);
+  if (info != NULL) info->valid.store(false, std::memory_order_release);
+}
+
+const HsaRsrcFactory::kernel_info_t* HsaRsrcFactory::GetKernelInfo(uint64_t kernel_object) {
+  const kernel_info_t* info = KernelCacheFind(kernel_object);
+  return ((info != NULL) && info->valid.load(std::memory_order_acquire)) ? info : NULL;
+}
+
+const amd_kernel_code_t* HsaRsrcFactory::GetKernelCode(uint64_t kernel_object) {
+  kernel_info_t* info = KernelCacheFind(kernel_object);
+  const amd_kernel_code_t* kernel_code = (info != NULL) ? info->code.load(std::memory_order_acquire) : NULL;
+  if (kernel_code == NULL) {
+    kernel_code = QueryKernelCode(kernel_object);
+    if (info != NULL) info->code.store(kernel_code, std::memory_order_release);
+  }
+  return kernel_code;
+}
+
+const amd_kernel_code_t* HsaRsrcFactory::QueryKernelCode(uint64_t kernel_object) const {
+  const amd_kernel_code_t* kernel_code = NULL;
+  hsa_status_t status = loader_api_.hsa_ven_amd_loader_query_host_address(
+      reinterpret_cast<const void*>(kernel_object),
+      reinterpret_cast<const void**>(&kernel_code));
+  if (HSA_STATUS_SUCCESS != status) {
+    kernel_code = reinterpret_cast<amd_kernel_code_t*>(kernel_object);
+  }
+  return kernel_code;
 }
 
 void HsaRsrcFactory::EnableExecutableTracking(HsaApiTable* table) {
@@ -758,14 +934,16 @@ hsa_status_t HsaRsrcFactory::executable_symbols_cb(hsa_executable_t exec, hsa_ex
     CHECK_STATUS("Error in getting kernel name", status);
     symname[len] = 0;
     if (data == NULL) {
+      // The replaced name is released by the kernel info cache, the kernel code
+      // and properties are pre-computed for the dispatches
       const char* name = cpp_demangle(symname);
       auto ret = symbols_map_->insert({addr, name});
-      if (ret.second == false) {
-        delete[] ret.first->second;
-        ret.first->second = name;
-      }
+      if (ret.second == false) ret.first->second = name;
+      const HsaRsrcFactory* obj = instance_.load(std::memory_order_acquire);
+      KernelCacheSet(addr, name, (obj != NULL) ? obj->QueryKernelCode(addr) : NULL);
     } else {
       symbols_map_->erase(addr);
+      KernelCacheInvalidate(addr);
     }
   }
   return HSA_STATUS_SUCCESS;
@@ -774,9 +952,12 @@ hsa_status_t HsaRsrcFactory::executable_symbols_cb(hsa_executable_t exec, hsa_ex
 hsa_status_t HsaRsrcFactory::hsa_executable_freeze_interceptor(hsa_executable_t executable, const char *options) {
   std::lock_guard<mutex_t> lck(mutex_);
   if (symbols_map_ == NULL) symbols_map_ = new symbols_map_t;
-  hsa_status_t status = hsa_api_.hsa_executable_iterate_symbols(executable, executable_symbols_cb, NULL);
+  // The symbols are iterated after the freeze for the kernel code being loaded
+  hsa_status_t status = hsa_api_.hsa_executable_freeze(executable, options);
+  if (status != HSA_STATUS_SUCCESS) return status;
+  status = hsa_api_.hsa_executable_iterate_symbols(executable, executable_symbols_cb, NULL);
   CHECK_STATUS("Error in iterating executable symbols", status);
-  return hsa_api_.hsa_executable_freeze(executable, options);
+  return status;
 }
 
 hsa_status_t HsaRsrcFactory::hsa_executable_destroy_interceptor(hsa_executable_t executable) {
@@ -794,6 +975,7 @@ HsaRsrcFactory::timestamp_t HsaRsrcFactory::timeout_ns_ = HsaTimer::TIMESTAMP_MA
 hsa_pfn_t HsaRsrcFactory::hsa_api_{};
 bool HsaRsrcFactory::executable_tracking_on_ = false;
 HsaRsrcFactory::symbols_map_t* HsaRsrcFactory::symbols_map_ = NULL;
+std::atomic<HsaRsrcFactory::kernel_info_t*> HsaRsrcFactory::kernel_cache_[HsaRsrcFactory::KERNEL_CACHE_SIZE]{};
 void* HsaRsrcFactory::to_dump_code_obj_ = NULL;
 
 }  // namespace util
@@ -27,6 +27,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #define AMD_INTERNAL_BUILD
 
+#include <amd_hsa_kernel_code.h>
 #include <hsa.h>
 #include <hsa_api_trace.h>
 #include <hsa_ext_amd.h>
@@ -38,7 +39,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <x86intrin.h>
 
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <mutex>
@@ -107,11 +110,13 @@ struct hsa_pfn_t {
 
   decltype(hsa_amd_agent_iterate_memory_pools)* hsa_amd_agent_iterate_memory_pools;
   decltype(hsa_amd_memory_pool_get_info)* hsa_amd_memory_pool_get_info;
+  decltype(hsa_amd_agent_memory_pool_get_info)* hsa_amd_agent_memory_pool_get_info;
   decltype(hsa_amd_memory_pool_allocate)* hsa_amd_memory_pool_allocate;
   decltype(hsa_amd_agents_allow_access)* hsa_amd_agents_allow_access;
   decltype(hsa_amd_memory_async_copy)* hsa_amd_memory_async_copy;
 
   decltype(hsa_amd_signal_async_handler)* hsa_amd_signal_async_handler;
+  decltype(hsa_amd_signal_wait_any)* hsa_amd_signal_wait_any;
   decltype(hsa_amd_profiling_set_profiler_enabled)* hsa_amd_profiling_set_profiler_enabled;
   decltype(hsa_amd_profiling_get_async_copy_time)* hsa_amd_profiling_get_async_copy_time;
   decltype(hsa_amd_profiling_get_dispatch_time)* hsa_amd_profiling_get_dispatch_time;
@@ -148,10 +153,14 @@ struct AgentInfo {
   hsa_profile_t profile;
 
   // CPU/GPU/kern-arg memory pools
+  // The GPU agent CPU/kern-arg pools are of the nearest NUMA node CPU agent
   hsa_amd_memory_pool_t cpu_pool;
   hsa_amd_memory_pool_t gpu_pool;
   hsa_amd_memory_pool_t kern_arg_pool;
 
+  // NUMA node, the nearest one for GPU agent
+  uint32_t numa_node;
+
   // The number of compute unit available in the agent.
   uint32_t cu_num;
 
@@ -176,6 +185,10 @@ struct AgentInfo {
 
 // HSA timer class
 // Provides current HSA timestampa and system-clock/ns conversion API
+// The conversions are fixed point, the timestamp is interpolated by the TSC
+// linear model fitted to the HSA timestamp. The model is calibrated by a short
+// interval at the start and is refitted over the growing interval by the
+// timestamp caller, the refit period grows with the interval.
 class HsaTimer {
  public:
   typedef uint64_t timestamp_t;
@@ -191,32 +204,57 @@ class HsaTimer {
     TIME_ID_NUMBER
   };
 
-  HsaTimer(const hsa_pfn_t* hsa_api) : hsa_api_(hsa_api) {
+  HsaTimer(const hsa_pfn_t* hsa_api) :
+    hsa_api_(hsa_api),
+    model_seq_(0),
+    model_tsc_base_(0),
+    model_ns_base_(0),
+    model_mult_(0),
+    model_refit_ticks_(0),
+    last_ns_(0)
+  {
     timestamp_t sysclock_hz = 0;
     hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY, &sysclock_hz);
     CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY)", status);
     sysclock_factor_ = (freq_t)1000000000 / (freq_t)sysclock_hz;
+    to_ns_mult_ = FixedFactor(sysclock_factor_);
+    to_sysclock_mult_ = FixedFactor(1 / sysclock_factor_);
+
+    // Short calibration, the model is refined by the refits
+    SamplePair(&anchor_tsc_, &anchor_ns_);
+    uint64_t tsc = 0;
+    timestamp_t ns = 0;
+    do {
+      SamplePair(&tsc, &ns);
+    } while ((ns - anchor_ns_) < CALIBRATION_NS);
+    Fit(tsc, ns);
   }
 
   // Methods for system-clock/ns conversion
-  timestamp_t sysclock_to_ns(const timestamp_t& sysclock) const {
-    return timestamp_t((freq_t)sysclock * sysclock_factor_);
-  }
-  timestamp_t ns_to_sysclock(const timestamp_t& time) const {
-    return timestamp_t((freq_t)time / sysclock_factor_);
-  }
+  timestamp_t sysclock_to_ns(const timestamp_t& sysclock) const { return FixedMul(sysclock, to_ns_mult_); }
+  timestamp_t ns_to_sysclock(const timestamp_t& time) const { return FixedMul(time, to_sysclock_mult_); }
 
   // Method for timespec/ns conversion
   static timestamp_t timespec_to_ns(const timespec& time) {
     return ((timestamp_t)time.tv_sec * 1000000000) + time.tv_nsec;
   }
 
-  // Return timestamp in 'ns'
+  // Return timestamp in 'ns', the returned timestamps do not go backwards across the refits
   timestamp_t timestamp_ns() const {
-    timestamp_t sysclock;
-    hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &sysclock);
-    CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP)", status);
-    return sysclock_to_ns(sysclock);
+    clock_model_t model;
+    ReadModel(&model);
+    if (model.mult == 0) return Monotonic(sysclock_to_ns(sysclock()));
+    const uint64_t tsc = __rdtsc();
+    if (((tsc - model.tsc_base) > model.refit_ticks) && refit_mutex_.try_lock()) {
+      uint64_t fit_tsc = 0;
+      timestamp_t fit_ns = 0;
+      SamplePair(&fit_tsc, &fit_ns);
+      Fit(fit_tsc, fit_ns);
+      refit_mutex_.unlock();
+      ReadModel(&model);
+    }
+    const int64_t delta = tsc - model.tsc_base;
+    return Monotonic((delta >= 0) ? model.ns_base + FixedMul(delta, model.mult) : model.ns_base - FixedMul(-delta, model.mult));
   }
 
   // Return time in 'ns'
@@ -277,10 +315,108 @@ class HsaTimer {
   }
 
  private:
+  // TSC to timestamp ns linear model, ns = ns_base + (tsc - tsc_base) * mult
+  struct clock_model_t {
+    uint64_t tsc_base;
+    timestamp_t ns_base;
+    uint64_t mult;
+    uint64_t refit_ticks;
+  };
+  static const timestamp_t CALIBRATION_NS = 1000000;
+  static const timestamp_t REFIT_NS = 1000000000;
+  static const uint32_t PAIR_TRIES = 4;
+  static const uint32_t FIXED_SHIFT = 32;
+
+  static uint64_t FixedFactor(const freq_t& factor) { return uint64_t(factor * (freq_t)(1ull << FIXED_SHIFT) + 0.5); }
+  static uint64_t FixedMul(const uint64_t& value, const uint64_t& mult) {
+    return uint64_t(((unsigned __int128)value * mult) >> FIXED_SHIFT);
+  }
+
+  timestamp_t sysclock() const {
+    timestamp_t sysclock;
+    hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &sysclock);
+    CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP)", status);
+    return sysclock;
+  }
+
+  // Correlated TSC and timestamp pair, the TSC is the middle of the narrowest read interval
+  void SamplePair(uint64_t* tsc, timestamp_t* ns) const {
+    uint64_t width = UINT64_MAX;
+    for (uint32_t i = 0; i < PAIR_TRIES; ++i) {
+      const uint64_t begin = __rdtsc();
+      const timestamp_t value = sysclock();
+      const uint64_t end = __rdtsc();
+      if ((end - begin) < width) {
+        width = end - begin;
+        *tsc = begin + width / 2;
+        *ns = sysclock_to_ns(value);
+      }
+    }
+  }
+
+  // Fitting the model slope from the anchor pair to the given pair, the model is not used
+  // if the TSC is not advancing. The refit period is doubled up to REFIT_NS. The model is
+  // published by a seqlock, the writers are serialized by the refit mutex.
+  void Fit(const uint64_t& tsc, const timestamp_t& ns) const {
+    if ((tsc <= anchor_tsc_) || (ns <= anchor_ns_)) return;
+    const uint64_t mult = uint64_t(((unsigned __int128)(ns - anchor_ns_) << FIXED_SHIFT) / (tsc - anchor_tsc_));
+    if (mult == 0) return;
+    const timestamp_t refit_ns = std::min<timestamp_t>(ns - anchor_ns_, REFIT_NS);
+    const uint64_t refit_ticks = uint64_t(((unsigned __int128)refit_ns << FIXED_SHIFT) / mult);
+
+    const uint32_t seq = model_seq_.load(std::memory_order_relaxed);
+    model_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    model_tsc_base_.store(tsc, std::memory_order_relaxed);
+    model_ns_base_.store(ns, std::memory_order_relaxed);
+    model_mult_.store(mult, std::memory_order_relaxed);
+    model_refit_ticks_.store(refit_ticks, std::memory_order_relaxed);
+    model_seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Reading a consistent model copy, retried if a refit is in progress
+  void ReadModel(clock_model_t* model) const {
+    while (true) {
+      const uint32_t seq = model_seq_.load(std::memory_order_acquire);
+      if ((seq & 1) == 0) {
+        model->tsc_base = model_tsc_base_.load(std::memory_order_relaxed);
+        model->ns_base = model_ns_base_.load(std::memory_order_relaxed);
+        model->mult = model_mult_.load(std::memory_order_relaxed);
+        model->refit_ticks = model_refit_ticks_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (model_seq_.load(std::memory_order_relaxed) == seq) return;
+      }
+    }
+  }
+
+  // Clamping the timestamp to the last returned one, a refit can move the model back
+  timestamp_t Monotonic(const timestamp_t& ns) const {
+    timestamp_t last = last_ns_.load(std::memory_order_relaxed);
+    while (ns > last) {
+      if (last_ns_.compare_exchange_weak(last, ns, std::memory_order_relaxed)) return ns;
+    }
+    return last;
+  }
+
   // Timestamp frequency factor
   freq_t sysclock_factor_;
+  // Fixed point conversion factors
+  uint64_t to_ns_mult_;
+  uint64_t to_sysclock_mult_;
   // HSA API table
   const hsa_pfn_t* const hsa_api_;
+  // TSC model calibration anchor and the current model
+  uint64_t anchor_tsc_;
+  timestamp_t anchor_ns_;
+  // The current model fields, published by the model sequence
+  mutable std::atomic<uint32_t> model_seq_;
+  mutable std::atomic<uint64_t> model_tsc_base_;
+  mutable std::atomic<timestamp_t> model_ns_base_;
+  mutable std::atomic<uint64_t> model_mult_;
+  mutable std::atomic<uint64_t> model_refit_ticks_;
+  mutable std::mutex refit_mutex_;
+  // The last returned timestamp
+  mutable std::atomic<timestamp_t> last_ns_;
 };
 
 class HsaRsrcFactory {
@@ -357,14 +493,15 @@ class HsaRsrcFactory {
   uint8_t* AllocateLocalMemory(const AgentInfo* agent_info, size_t size);
 
   // Allocate memory tp pass kernel parameters
-  // Memory is alocated accessible for all CPU agents and for GPU given by AgentInfo parameter.
+  // Memory is alocated accessible for all CPU agents and for GPU given by AgentInfo parameter,
+  // from the GPU agent nearest NUMA node.
   // @param agent_info Agent from whose memory region to allocate
   // @param size Size of memory in terms of bytes
   // @return uint8_t* Pointer to buffer, null if allocation fails.
   uint8_t* AllocateKernArgMemory(const AgentInfo* agent_info, size_t size);
 
   // Allocate system memory accessible from both CPU and GPU
-  // Memory is alocated accessible to all CPU agents and AgentInfo parameter is ignored.
+  // Memory is alocated accessible to all CPU agents from the GPU agent nearest NUMA node.
   // @param agent_info Agent from whose memory region to allocate
   // @param size Size of memory in terms of bytes
   // @return uint8_t* Pointer to buffer, null if allocation fails.
@@ -376,6 +513,17 @@ class HsaRsrcFactory {
   // @return uint8_t* Pointer to buffer, null if allocation fails.
   uint8_t* AllocateCmdMemory(const AgentInfo* agent_info, size_t size);
 
+  // Allocate pinned staging memory accessible from CPU and all GPU agents
+  // The buffers are recycled by the power of two size classes per NUMA node
+  // @param agent_info Agent from whose nearest NUMA node to allocate
+  // @param size Size of memory in terms of bytes
+  // @param capacity Output parameter updated with the buffer size class bytes
+  // @return uint8_t* Pointer to buffer, null if allocation fails.
+  uint8_t* AllocateStagingMemory(const AgentInfo* agent_info, size_t size, size_t* capacity = NULL);
+
+  // Release staging memory to the arena
+  void ReleaseStagingMemory(void* ptr);
+
   // Wait signal
   hsa_signal_value_t SignalWait(const hsa_signal_t& signal, const hsa_signal_value_t& signal_value) const;
 
@@ -386,6 +534,9 @@ class HsaRsrcFactory {
   bool Memcpy(const hsa_agent_t& agent, void* dst, const void* src, size_t size);
   bool Memcpy(const AgentInfo* agent_info, void* dst, const void* src, size_t size);
 
+  // Start the copy from GPU to host memory, the signal is set to 1 and is decremented on completion
+  bool MemcpyAsync(const hsa_agent_t& agent, void* dst, const void* src, size_t size, const hsa_signal_t& signal);
+
   // Memory free method
   static bool FreeMemory(void* ptr);
 
@@ -413,6 +564,33 @@ class HsaRsrcFactory {
   static void EnableExecutableTracking(HsaApiTable* table);
   static const char* GetKernelNameRef(uint64_t addr);
 
+  // Kernel properties pre-computed from the kernel code
+  struct kernel_props_t {
+    uint32_t vgpr_count;
+    uint32_t sgpr_count;
+    uint32_t fbarrier_count;
+  };
+
+  // Kernel info cache entry, keyed by kernel object. Filled at executable freeze and
+  // invalidated at executable destroy. The entries are never released, the invalidated
+  // entries are reused and the replaced names are released, so the returned name
+  // stays valid until the kernel executable is destroyed.
+  struct kernel_info_t {
+    std::atomic<uint64_t> object;
+    std::atomic<const char*> name;
+    std::atomic<const amd_kernel_code_t*> code;
+    std::atomic<bool> valid;
+    kernel_props_t props;
+    kernel_info_t* next;
+  };
+
+  // Lock-free lookup of the kernel info, returns NULL if not found
+  static const kernel_info_t* GetKernelInfo(uint64_t kernel_object);
+  // Return kernel code, the loader is queried once per kernel object
+  const amd_kernel_code_t* GetKernelCode(uint64_t kernel_object);
+  // Query kernel code from the loader
+  const amd_kernel_code_t* QueryKernelCode(uint64_t kernel_object) const;
+
   // Initialize HSA API table
   void static InitHsaApiTable(HsaApiTable* table);
   static const hsa_pfn_t* HsaApi() { return &hsa_api_; }
@@ -477,6 +655,9 @@ class HsaRsrcFactory {
   // Add an instance of AgentInfo representing a Hsa Gpu agent
   const AgentInfo* AddAgentInfo(const hsa_agent_t agent);
 
+  // Set the GPU agents nearest CPU memory pools by the NUMA distance
+  void SetNumaAffinity();
+
   // To mmap command buffer memory
   static const bool CMD_MEMORY_MMAP = false;
 
@@ -500,6 +681,12 @@ class HsaRsrcFactory {
   // Executables loading tracking
   typedef std::map<uint64_t, const char*> symbols_map_t;
   static symbols_map_t* symbols_map_;
+  static const uint32_t KERNEL_CACHE_SIZE = 4096;
+  static std::atomic<kernel_info_t*> kernel_cache_[KERNEL_CACHE_SIZE];
+  static uint32_t KernelCacheHash(uint64_t kernel_object) { return (kernel_object >> 6) & (KERNEL_CACHE_SIZE - 1); }
+  static kernel_info_t* KernelCacheFind(uint64_t kernel_object);
+  static void KernelCacheSet(uint64_t kernel_object, const char* name, const amd_kernel_code_t* code);
+  static void KernelCacheInvalidate(uint64_t kernel_object);
   static bool executable_tracking_on_;
   static void* to_dump_code_obj_;
   static hsa_status_t hsa_executable_freeze_interceptor(hsa_executable_t executable, const char *options);
@@ -530,6 +717,16 @@ class HsaRsrcFactory {
   // CPU/kern-arg memory pools
   hsa_amd_memory_pool_t *cpu_pool_;
   hsa_amd_memory_pool_t *kern_arg_pool_;
+
+  // Staging memory arena, the released buffers are cached per size class
+  // up to the cached bytes limit
+  static const uint32_t STAGING_CLASS_MIN = 16;  // 64K
+  static const uint32_t STAGING_CLASS_COUNT = 17;
+  static const size_t STAGING_CACHE_MAX = 0x10000000;  // 256M
+  std::mutex staging_mutex_;
+  std::map<void*, uint32_t> staging_map_;
+  std::map<uint32_t, std::vector<void*> > staging_free_;
+  size_t staging_cached_;
 };
 
 }  // namespace util
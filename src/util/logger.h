@@ -25,54 +25,59 @@ THE SOFTWARE.
 
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/file.h>
-#include <stdarg.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <string>
 #include <iostream>
 #include <sstream>
-#include <fstream>
-#include <exception>
 #include <mutex>
-#include <map>
+#include <thread>
+#include <vector>
 
 namespace rocprofiler {
 namespace util {
 
+// Library diagnostics logger. The messages are put to the calling thread ring and
+// written to the log files by a background flusher thread. A full ring or a thread
+// over the messages rate drops the messages, the drops are reported by the flusher.
+//   ROCPROFILER_LOG=<level> - logging to '/tmp/rocprofiler_log.txt', level 2 is verbose
+//   ROCPROFILER_LOG_RATE=<messages per second per thread> - 0 is not limited [1000]
 class Logger {
  public:
-  typedef std::recursive_mutex mutex_t;
-
-  template <typename T> Logger& operator<<(const T& m) {
-    std::ostringstream oss;
-    oss << m;
-    if (!streaming_)
-      Log(oss.str());
-    else
-      Put(oss.str());
-    streaming_ = true;
-    return *this;
+  typedef std::mutex mutex_t;
+
+  enum level_t {
+    LOG_NONE = 0,
+    LOG_INFO = 1,
+    LOG_VERBOSE = 2
+  };
+
+  // Disabled levels check, the messages are not formatted if disabled
+  static bool Enabled(const level_t& level) { return Instance().level_ >= level; }
+
+  // The error message is kept as the thread last message
+  void Error(const std::string& m) {
+    Message() = m;
+    SetError();
+    Put("error: ", m);
   }
-
-  typedef void (*manip_t)();
-  Logger& operator<<(manip_t f) {
-    f();
-    return *this;
+  void Warning(const std::string& m) {
+    Message() = m;
+    Put("warning: ", m);
   }
+  void Info(const std::string& m) { Put("info: ", m); }
+  void Verbose(const std::string& m) { Put("verbose: ", m); }
 
-  static void begm() { Instance().ResetStreaming(true); }
-  static void endl() { Instance().ResetStreaming(false); }
-  static void errm() { Instance().SetError(); }
-
-  static const std::string& LastMessage() {
-    Logger& logger = Instance();
-    std::lock_guard<mutex_t> lck(mutex_);
-    return logger.message_[GetTid()];
-  }
+  static const std::string& LastMessage() { return Message(); }
 
   static Logger* Create() {
     std::lock_guard<mutex_t> lck(mutex_);
@@ -89,9 +94,12 @@ class Logger {
   }
 
   static void Destroy() {
-    std::lock_guard<mutex_t> lck(mutex_);
-    if (instance_ != NULL) delete instance_.load();
-    instance_ = NULL;
+    Logger* obj = NULL;
+    {
+      std::lock_guard<mutex_t> lck(mutex_);
+      obj = instance_.exchange(NULL, std::memory_order_acq_rel);
+    }
+    delete obj;
   }
 
   static Logger& Instance() {
@@ -101,12 +109,55 @@ class Logger {
   }
 
  private:
+  static const uint32_t kRingSize = 128;
+  static const uint32_t kRecordSize = 512;
+  static const uint32_t kFlushPeriodMs = 10;
+  static const uint32_t kRateDefault = 1000;
+
+  struct record_t {
+    uint64_t seq;
+    time_t time;
+    uint32_t size;
+    char text[kRecordSize];
+  };
+
+  // Single producer ring, the thread is the producer and the flusher is the consumer
+  struct ring_t {
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped;
+    uint32_t tid;
+    uint64_t window_begin;
+    uint32_t window_count;
+    record_t records[kRingSize];
+  };
+
   static uint32_t GetPid() { return syscall(__NR_getpid); }
   static uint32_t GetTid() { return syscall(__NR_gettid); }
 
-  Logger() : file_(NULL), session_file_(NULL), dirty_(false), streaming_(false), messaging_(false), error_(false) {
+  static std::string& Message() {
+    static thread_local std::string message;
+    return message;
+  }
+
+  Logger() :
+    file_(NULL),
+    session_file_(NULL),
+    level_(LOG_NONE),
+    rate_(kRateDefault),
+    pid_(GetPid()),
+    seq_(0),
+    error_(false),
+    stop_(false)
+  {
     const char* var = getenv("ROCPROFILER_LOG");
-    if (var != NULL) file_ = fopen("/tmp/rocprofiler_log.txt", "a");
+    if (var != NULL) {
+      file_ = fopen("/tmp/rocprofiler_log.txt", "a");
+      level_ = (atoi(var) >= LOG_VERBOSE) ? LOG_VERBOSE : LOG_INFO;
+    }
+
+    var = getenv("ROCPROFILER_LOG_RATE");
+    if (var != NULL) rate_ = atol(var);
 
     var = getenv("ROCPROFILER_SESS");
     if (var != NULL) {
@@ -118,77 +169,174 @@ class Logger {
       else std::cerr << "ROCProfiler: cannot create session log '" << name << "'" << std::endl << std::flush;
     }
 
-    ResetStreaming(false);
+    if (file_ == NULL) level_ = LOG_NONE;
   }
 
   ~Logger() {
-    if (dirty_) Put("\n");
+    {
+      std::lock_guard<mutex_t> lck(flush_mutex_);
+      stop_ = true;
+      flush_cond_.notify_one();
+    }
+    if (flusher_.joinable()) flusher_.join();
+    Flush();
+    for (ring_t* ring : rings_) delete ring;
     if (file_ != NULL) fclose(file_);
     if (session_file_ != NULL) fclose(session_file_);
   }
 
-  void ResetStreaming(const bool messaging) {
-    std::lock_guard<mutex_t> lck(mutex_);
-    if (messaging) {
-      message_[GetTid()] = "";
-    } else if (streaming_) {
-      Put("\n");
-      dirty_ = false;
+  // The thread ring is created on the thread first message, the rings are
+  // kept to the logger destruction and the flusher is started with the first one
+  ring_t* GetRing() {
+    static thread_local Logger* owner = NULL;
+    static thread_local ring_t* ring = NULL;
+    if (owner != this) {
+      owner = this;
+      ring = new ring_t{};
+      ring->tid = GetTid();
+      std::lock_guard<mutex_t> lck(flush_mutex_);
+      rings_.push_back(ring);
+      if (!flusher_.joinable()) flusher_ = std::thread(FlushThread, this);
     }
-    messaging_ = messaging;
-    streaming_ = messaging;
+    return ring;
   }
 
-  void Put(const std::string& m) {
-    std::lock_guard<mutex_t> lck(mutex_);
-    if (messaging_) {
-      message_[GetTid()] += m;
+  // The message is dropped if over the thread rate or if the ring is full
+  void Put(const char* prefix, const std::string& m) {
+    if (file_ == NULL) return;
+    ring_t* ring = GetRing();
+
+    if (rate_ != 0) {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+      const uint64_t now_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+      if ((now_ms - ring->window_begin) >= 1000) {
+        ring->window_begin = now_ms;
+        ring->window_count = 0;
+      }
+      if (ring->window_count >= rate_) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      ++(ring->window_count);
+    }
+
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    const uint64_t pending = head - ring->tail.load(std::memory_order_acquire);
+    if (pending >= kRingSize) {
+      ring->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
     }
-    if (file_ != NULL) {
-      dirty_ = true;
-      flock(fileno(file_), LOCK_EX);
+    // Waking up the flusher at the half full ring
+    if (pending == (kRingSize / 2)) flush_cond_.notify_one();
+
+    record_t* rec = &(ring->records[head % kRingSize]);
+    rec->seq = seq_.fetch_add(1, std::memory_order_relaxed);
+    rec->time = time(NULL);
+    const size_t prefix_size = strlen(prefix);
+    const size_t size = std::min(prefix_size + m.size(), (size_t)kRecordSize);
+    memcpy(rec->text, prefix, prefix_size);
+    memcpy(rec->text + prefix_size, m.data(), size - prefix_size);
+    rec->size = size;
+    ring->head.store(head + 1, std::memory_order_release);
+  }
+
+  static void FlushThread(Logger* logger) {
+    std::unique_lock<mutex_t> lck(logger->flush_mutex_);
+    while (!logger->stop_) {
+      logger->flush_cond_.wait_for(lck, std::chrono::milliseconds((uint32_t)kFlushPeriodMs));
+      lck.unlock();
+      logger->Flush();
+      lck.lock();
+    }
+  }
 
-      fprintf(file_, "%s", m.c_str());
-      fflush(file_);
+  // Writing the pending messages of all threads in the messages order
+  void Flush() {
+    struct entry_t {
+      uint64_t seq;
+      const record_t* rec;
+      uint32_t tid;
+      bool operator<(const entry_t& e) const { return seq < e.seq; }
+    };
+    std::vector<entry_t> entries;
+    std::vector<std::pair<uint64_t, uint64_t> > ranges;
+    std::vector<ring_t*> rings;
+    {
+      std::lock_guard<mutex_t> lck(flush_mutex_);
+      rings = rings_;
+    }
 
-      if (session_file_ != NULL) {
-        fprintf(session_file_, "%s", m.c_str());
-        fflush(session_file_);
+    for (ring_t* ring : rings) {
+      const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      const uint64_t head = ring->head.load(std::memory_order_acquire);
+      for (uint64_t i = tail; i < head; ++i) {
+        const record_t* rec = &(ring->records[i % kRingSize]);
+        entries.push_back(entry_t{rec->seq, rec, ring->tid});
       }
+      ranges.push_back(std::make_pair(tail, head));
+    }
+    std::sort(entries.begin(), entries.end());
 
-      flock(fileno(file_), LOCK_UN);
+    std::ostringstream oss;
+    for (const entry_t& e : entries) {
+      oss << Prefix(e.rec->time, e.tid);
+      oss.write(e.rec->text, e.rec->size);
+      oss << std::endl;
+    }
+    for (ring_t* ring : rings) {
+      const uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+      if (dropped != 0) {
+        oss << Prefix(time(NULL), ring->tid) << "warning: " << dropped << " log messages dropped" << std::endl;
+      }
     }
+    for (uint32_t i = 0; i < rings.size(); ++i) rings[i]->tail.store(ranges[i].second, std::memory_order_release);
+
+    const std::string& str = oss.str();
+    if (str.empty()) return;
+    flock(fileno(file_), LOCK_EX);
+    fwrite(str.data(), 1, str.size(), file_);
+    fflush(file_);
+    if (session_file_ != NULL) {
+      fwrite(str.data(), 1, str.size(), session_file_);
+      fflush(session_file_);
+    }
+    flock(fileno(file_), LOCK_UN);
   }
 
-  void Log(const std::string& m) {
-    const time_t rawtime = time(NULL);
+  std::string Prefix(const time_t& rawtime, const uint32_t& tid) const {
     tm tm_info;
     localtime_r(&rawtime, &tm_info);
     char tm_str[26];
     strftime(tm_str, 26, "%Y-%m-%d %H:%M:%S", &tm_info);
     std::ostringstream oss;
-    oss << "<" << tm_str << std::dec << " pid" << GetPid() << " tid" << GetTid() << "> " << m;
-    Put(oss.str());
+    oss << "<" << tm_str << std::dec << " pid" << pid_ << " tid" << tid << "> ";
+    return oss.str();
   }
 
   void SetError() {
-    std::lock_guard<mutex_t> lck(mutex_);
-    if (error_ == false) {
-      error_ = true;
+    if (error_.exchange(true) == false) {
       if (session_dir_.empty() == false) {
-        auto x = fopen(std::string(session_dir_ + "error").c_str(), "w"); (void)x;
+        FILE* file = fopen(std::string(session_dir_ + "error").c_str(), "w");
+        if (file != NULL) fclose(file);
       }
     }
   }
 
   FILE* file_;
   FILE* session_file_;
-  bool dirty_;
-  bool streaming_;
-  bool messaging_;
-  bool error_;
+  level_t level_;
+  uint32_t rate_;
+  const uint32_t pid_;
+  std::atomic<uint64_t> seq_;
+  std::atomic<bool> error_;
   std::string session_dir_;
-  std::map<uint32_t, std::string> message_;
+
+  mutex_t flush_mutex_;
+  std::condition_variable flush_cond_;
+  std::thread flusher_;
+  bool stop_;
+  std::vector<ring_t*> rings_;
 
   static mutex_t mutex_;
   static std::atomic<Logger*> instance_;
@@ -199,32 +347,41 @@ class Logger {
 
 #define ERR_LOGGING(stream)                                                                        \
   do {                                                                                             \
-    rocprofiler::util::Logger::Instance() << rocprofiler::util::Logger::errm                       \
-                                          << "error: " << rocprofiler::util::Logger::begm          \
-                                          << stream << rocprofiler::util::Logger::endl;            \
+    std::ostringstream oss_;                                                                       \
+    oss_ << stream;                                                                                \
+    rocprofiler::util::Logger::Instance().Error(oss_.str());                                       \
+  } while(0)
+
+#define WARN_LOGGING(stream)                                                                       \
+  do {                                                                                             \
+    std::ostringstream oss_;                                                                       \
+    oss_ << stream;                                                                                \
+    std::cerr << "ROCProfiler: " << oss_.str() << std::endl;                                       \
+    rocprofiler::util::Logger::Instance().Warning(oss_.str());                                     \
   } while(0)
 
 #define INFO_LOGGING(stream)                                                                       \
   do {                                                                                             \
-    rocprofiler::util::Logger::Instance() << "info: " << rocprofiler::util::Logger::begm << stream \
-                                          << rocprofiler::util::Logger::endl;                      \
+    if (rocprofiler::util::Logger::Enabled(rocprofiler::util::Logger::LOG_INFO)) {                 \
+      std::ostringstream oss_;                                                                     \
+      oss_ << stream;                                                                              \
+      rocprofiler::util::Logger::Instance().Info(oss_.str());                                      \
+    }                                                                                              \
   } while(0)
 
-#define WARN_LOGGING(stream)                                                                       \
+#define VERB_LOGGING(stream)                                                                       \
   do {                                                                                             \
-    std::cerr << "ROCProfiler: " << stream << std::endl;                                           \
-    rocprofiler::util::Logger::Instance() << "warning: " << rocprofiler::util::Logger::begm << stream \
-                                          << rocprofiler::util::Logger::endl;                      \
+    if (rocprofiler::util::Logger::Enabled(rocprofiler::util::Logger::LOG_VERBOSE)) {              \
+      std::ostringstream oss_;                                                                     \
+      oss_ << stream;                                                                              \
+      rocprofiler::util::Logger::Instance().Verbose(oss_.str());                                   \
+    }                                                                                              \
   } while(0)
 
 #ifdef DEBUG
 #define DBG_LOGGING(stream)                                                                        \
-  do {                                                                                             \
-    rocprofiler::util::Logger::Instance() << rocprofiler::util::Logger::begm << "debug: \""        \
-                                          << stream << "\"" < < < <                                \
-        " in " << __FUNCTION__ << " at " << __FILE__ << " line " << __LINE__                       \
-               << rocprofiler::util::Logger::endl;                                                 \
-  } while(0)
+  VERB_LOGGING("debug: \"" << stream << "\"" << " in " << __FUNCTION__ << " at " << __FILE__       \
+               << " line " << __LINE__)
 #endif
 
 #endif  // SRC_UTIL_LOGGER_H_
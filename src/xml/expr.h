@@ -30,6 +30,8 @@ THE SOFTWARE.
 #include <sstream>
 #include <string.h>
 #include <float.h>
+#include <stdint.h>
+#include <vector>
 
 namespace xml {
 class exception_t : public std::exception {
@@ -59,6 +61,161 @@ template <class T> class any_cache_t {
 
 typedef any_cache_t<std::string> expr_cache_t;
 typedef any_cache_t<args_t> args_cache_t;
+// Variables dense slots, the variable name to the arguments array index
+typedef any_cache_t<uint32_t> slots_cache_t;
+
+// Compiled expression, linear stack program over the dense arguments array
+class expr_prog_t {
+ public:
+  enum op_code_t {
+    OP_CONST = 0,
+    OP_VAR = 1,
+    OP_ADD = 2,
+    OP_SUB = 3,
+    OP_MUL = 4,
+    OP_DIV = 5,
+    OP_MIN = 6,
+    OP_MAX = 7
+  };
+
+  struct op_t {
+    op_code_t code;
+    uint32_t slot;
+    args_t value;
+  };
+
+  static const uint32_t STACK_MAX = 256;
+  // Batch evaluation lanes
+  static const uint32_t LANES = 16;
+
+  expr_prog_t() : depth_(0), max_depth_(0) {}
+
+  void Clear() {
+    code_.clear();
+    depth_ = 0;
+    max_depth_ = 0;
+  }
+
+  bool Empty() const { return code_.empty(); }
+  const std::vector<op_t>& GetCode() const { return code_; }
+  bool Valid() const { return !code_.empty() && (depth_ == 1) && (max_depth_ <= STACK_MAX); }
+
+  void Emit(const op_code_t code, const uint32_t slot = 0, const args_t value = 0) {
+    code_.push_back(op_t{code, slot, value});
+    if ((code == OP_CONST) || (code == OP_VAR)) {
+      ++depth_;
+      if (depth_ > max_depth_) max_depth_ = depth_;
+    } else {
+      --depth_;
+    }
+  }
+
+  // Evaluation, the division by zero results in zero as for the tree evaluation
+  args_t Eval(const args_t* args) const {
+    args_t stack[STACK_MAX];
+    uint32_t sp = 0;
+    for (const op_t& op : code_) {
+      switch (op.code) {
+        case OP_CONST:
+          stack[sp++] = op.value;
+          break;
+        case OP_VAR:
+          stack[sp++] = args[op.slot];
+          break;
+        case OP_ADD:
+          --sp;
+          stack[sp - 1] += stack[sp];
+          break;
+        case OP_SUB:
+          --sp;
+          stack[sp - 1] -= stack[sp];
+          break;
+        case OP_MUL:
+          --sp;
+          stack[sp - 1] *= stack[sp];
+          break;
+        case OP_DIV:
+          --sp;
+          if (stack[sp] == 0) return 0;
+          stack[sp - 1] /= stack[sp];
+          break;
+        case OP_MIN:
+          --sp;
+          if (stack[sp] < stack[sp - 1]) stack[sp - 1] = stack[sp];
+          break;
+        case OP_MAX:
+          --sp;
+          if (stack[sp] > stack[sp - 1]) stack[sp - 1] = stack[sp];
+          break;
+      }
+    }
+    return stack[0];
+  }
+
+  // Batch evaluation in the structure-of-arrays layout, the slot values of
+  // the item 'i' are 'args[slot * stride + i]'
+  void EvalBatch(const args_t* args, const uint32_t stride, const uint32_t count, args_t* results) const {
+    static thread_local std::vector<args_t> stack_vec;
+    const size_t stack_size = (size_t)max_depth_ * LANES;
+    if (stack_vec.size() < stack_size) stack_vec.resize(stack_size);
+    args_t* stack = stack_vec.data();
+
+    for (uint32_t base = 0; base < count; base += LANES) {
+      const uint32_t n = ((count - base) < LANES) ? (count - base) : LANES;
+      bool div_zero[LANES] = {};
+      // The next free stack row
+      args_t* top = stack;
+      for (const op_t& op : code_) {
+        if (op.code == OP_CONST) {
+          for (uint32_t i = 0; i < n; ++i) top[i] = op.value;
+          top += LANES;
+          continue;
+        }
+        if (op.code == OP_VAR) {
+          const args_t* src = args + (size_t)op.slot * stride + base;
+          for (uint32_t i = 0; i < n; ++i) top[i] = src[i];
+          top += LANES;
+          continue;
+        }
+        top -= LANES;
+        args_t* a = top - LANES;
+        const args_t* b = top;
+        switch (op.code) {
+          case OP_ADD:
+            for (uint32_t i = 0; i < n; ++i) a[i] += b[i];
+            break;
+          case OP_SUB:
+            for (uint32_t i = 0; i < n; ++i) a[i] -= b[i];
+            break;
+          case OP_MUL:
+            for (uint32_t i = 0; i < n; ++i) a[i] *= b[i];
+            break;
+          case OP_DIV:
+            for (uint32_t i = 0; i < n; ++i) {
+              const bool zero = (b[i] == 0);
+              div_zero[i] |= zero;
+              a[i] /= zero ? 1 : b[i];
+            }
+            break;
+          case OP_MIN:
+            for (uint32_t i = 0; i < n; ++i) a[i] = (b[i] < a[i]) ? b[i] : a[i];
+            break;
+          case OP_MAX:
+            for (uint32_t i = 0; i < n; ++i) a[i] = (b[i] > a[i]) ? b[i] : a[i];
+            break;
+          default:
+            break;
+        }
+      }
+      for (uint32_t i = 0; i < n; ++i) results[base + i] = div_zero[i] ? 0 : stack[i];
+    }
+  }
+
+ private:
+  std::vector<op_t> code_;
+  uint32_t depth_;
+  uint32_t max_depth_;
+};
 
 class bin_expr_t {
  public:
@@ -74,6 +231,7 @@ class bin_expr_t {
   }
 
   virtual args_t Eval(const args_cache_t& args) const = 0;
+  virtual bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const = 0;
   virtual std::string Symbol() const = 0;
 
   std::string String() const {
@@ -86,6 +244,12 @@ class bin_expr_t {
   }
 
  protected:
+  bool CompileBin(const slots_cache_t& slots, expr_prog_t* prog, const expr_prog_t::op_code_t code) const {
+    if (!arg1_->Compile(slots, prog) || !arg2_->Compile(slots, prog)) return false;
+    prog->Emit(code);
+    return true;
+  }
+
   const bin_expr_t* arg1_;
   const bin_expr_t* arg2_;
 };
@@ -140,6 +304,14 @@ class Expr {
     return result;
   }
 
+  // Compiling to the linear program, returns false if the expression cannot be compiled
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    prog->Clear();
+    const bool suc = tree_->Compile(slots, prog) && prog->Valid();
+    if (!suc) prog->Clear();
+    return suc;
+  }
+
   std::string Lookup(const std::string& str) const {
     std::string result;
     if (cache_ && !(cache_->Lookup(str, result)))
@@ -253,18 +425,21 @@ class add_expr_t : public bin_expr_t {
  public:
   add_expr_t(const bin_expr_t* arg1, const bin_expr_t* arg2) : bin_expr_t(arg1, arg2) {}
   args_t Eval(const args_cache_t& args) const { return (arg1_->Eval(args) + arg2_->Eval(args)); }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const { return CompileBin(slots, prog, expr_prog_t::OP_ADD); }
   std::string Symbol() const { return "+"; }
 };
 class sub_expr_t : public bin_expr_t {
  public:
   sub_expr_t(const bin_expr_t* arg1, const bin_expr_t* arg2) : bin_expr_t(arg1, arg2) {}
   args_t Eval(const args_cache_t& args) const { return (arg1_->Eval(args) - arg2_->Eval(args)); }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const { return CompileBin(slots, prog, expr_prog_t::OP_SUB); }
   std::string Symbol() const { return "-"; }
 };
 class mul_expr_t : public bin_expr_t {
  public:
   mul_expr_t(const bin_expr_t* arg1, const bin_expr_t* arg2) : bin_expr_t(arg1, arg2) {}
   args_t Eval(const args_cache_t& args) const { return (arg1_->Eval(args) * arg2_->Eval(args)); }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const { return CompileBin(slots, prog, expr_prog_t::OP_MUL); }
   std::string Symbol() const { return "*"; }
 };
 class div_expr_t : public bin_expr_t {
@@ -275,12 +450,17 @@ class div_expr_t : public bin_expr_t {
     if (denominator == 0) throw div_zero_exception_t("div_expr_t::Eval()");
     return (arg1_->Eval(args) / denominator);
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const { return CompileBin(slots, prog, expr_prog_t::OP_DIV); }
   std::string Symbol() const { return "/"; }
 };
 class const_expr_t : public bin_expr_t {
  public:
   const_expr_t(const args_t value) : value_(value) {}
   args_t Eval(const args_cache_t&) const { return value_; }
+  bool Compile(const slots_cache_t&, expr_prog_t* prog) const {
+    prog->Emit(expr_prog_t::OP_CONST, 0, value_);
+    return true;
+  }
   std::string Symbol() const {
     std::ostringstream os;
     os << value_;
@@ -298,6 +478,12 @@ class var_expr_t : public bin_expr_t {
     if (!args.Lookup(name_, result)) throw exception_t("expr arg lookup '" + name_ + "' failed");
     return result;
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    uint32_t slot = 0;
+    if (!slots.Lookup(name_, slot)) return false;
+    prog->Emit(expr_prog_t::OP_VAR, slot);
+    return true;
+  }
   std::string Symbol() const { return name_; }
 
  private:
@@ -315,6 +501,15 @@ class fun_expr_t : public bin_expr_t {
     }
   }
   const vvect_t& GetVars() const { return vvect; }
+  // Folding the variables with the given operation starting from the initial value
+  bool CompileFold(const slots_cache_t& slots, expr_prog_t* prog, const args_t init, const expr_prog_t::op_code_t code) const {
+    prog->Emit(expr_prog_t::OP_CONST, 0, init);
+    for (const auto& var : vvect) {
+      if (!var.Compile(slots, prog)) return false;
+      prog->Emit(code);
+    }
+    return true;
+  }
   std::string Symbol() const {
     const std::string var = vvect[0].Symbol();
     const std::string vname = var.substr(0, var.length() - 3);
@@ -337,6 +532,9 @@ class sum_expr_t : public fun_expr_t {
     for (const auto& var : GetVars()) result += var.Eval(args);
     return result;
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    return CompileFold(slots, prog, 0, expr_prog_t::OP_ADD);
+  }
 };
 class avr_expr_t : public fun_expr_t {
  public:
@@ -346,6 +544,13 @@ class avr_expr_t : public fun_expr_t {
     for (const auto& var : GetVars()) result += var.Eval(args);
     return result / GetVars().size();
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    if (GetVars().empty()) return false;
+    if (!CompileFold(slots, prog, 0, expr_prog_t::OP_ADD)) return false;
+    prog->Emit(expr_prog_t::OP_CONST, 0, GetVars().size());
+    prog->Emit(expr_prog_t::OP_DIV);
+    return true;
+  }
 };
 class min_expr_t : public fun_expr_t {
  public:
@@ -358,6 +563,9 @@ class min_expr_t : public fun_expr_t {
     }
     return result;
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    return CompileFold(slots, prog, ARGS_MAX, expr_prog_t::OP_MIN);
+  }
 };
 class max_expr_t : public fun_expr_t {
  public:
@@ -370,6 +578,9 @@ class max_expr_t : public fun_expr_t {
     }
     return result;
   }
+  bool Compile(const slots_cache_t& slots, expr_prog_t* prog) const {
+    return CompileFold(slots, prog, 0, expr_prog_t::OP_MAX);
+  }
 };
 
 inline const bin_expr_t* bin_expr_t::CreateExpr(const bin_expr_t* arg1, const bin_expr_t* arg2,
@@ -26,30 +26,104 @@ THE SOFTWARE.
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <fstream>
+#include <deque>
 #include <iostream>
+#include <list>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
 namespace xml {
 
-class Xml {
+// String slice of a mapped XML file or of the document strings,
+// the slices are NUL terminated
+class str_t {
+ public:
+  str_t() : ptr_(""), size_(0) {}
+  str_t(const char* ptr, const size_t& size) : ptr_(ptr), size_(size) {}
+  str_t(const char* str) : ptr_(str), size_(strlen(str)) {}
+  str_t(const std::string& str) : ptr_(str.c_str()), size_(str.size()) {}
+
+  const char* c_str() const { return ptr_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  std::string str() const { return std::string(ptr_, size_); }
+  operator std::string() const { return str(); }
+
+  bool operator==(const str_t& s) const { return (size_ == s.size_) && (memcmp(ptr_, s.ptr_, size_) == 0); }
+  bool operator!=(const str_t& s) const { return !(*this == s); }
+
+ private:
+  const char* ptr_;
+  size_t size_;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const str_t& s) { return os.write(s.c_str(), s.size()); }
+
+// Node attributes, a flat array in the file order
+struct opt_t {
+  str_t first;
+  str_t second;
+};
+
+class opts_t {
  public:
-  typedef std::vector<char> token_t;
+  typedef std::vector<opt_t> vec_t;
+  typedef vec_t::iterator iterator;
+  typedef vec_t::const_iterator const_iterator;
+
+  iterator begin() { return vec_.begin(); }
+  iterator end() { return vec_.end(); }
+  const_iterator begin() const { return vec_.begin(); }
+  const_iterator end() const { return vec_.end(); }
+  size_t size() const { return vec_.size(); }
+  bool empty() const { return vec_.empty(); }
+
+  iterator find(const str_t& key) {
+    iterator it = vec_.begin();
+    while ((it != vec_.end()) && (it->first != key)) ++it;
+    return it;
+  }
+  const_iterator find(const str_t& key) const {
+    const_iterator it = vec_.begin();
+    while ((it != vec_.end()) && (it->first != key)) ++it;
+    return it;
+  }
+
+  // The key is stored as a slice, a string literal or a document string only
+  str_t& operator[](const char* key) {
+    iterator it = find(key);
+    if (it != vec_.end()) return it->second;
+    vec_.push_back(opt_t{key, str_t()});
+    return vec_.back().second;
+  }
+  str_t& operator[](const str_t& key) {
+    iterator it = find(key);
+    if (it != vec_.end()) return it->second;
+    vec_.push_back(opt_t{key, str_t()});
+    return vec_.back().second;
+  }
+  str_t& operator[](const std::string& key) = delete;
+
+ private:
+  vec_t vec_;
+};
 
+class Xml {
+ public:
   struct level_t;
   typedef std::vector<level_t*> node_vect_t;
   typedef std::list<level_t*> node_list_t;
 
   typedef node_vect_t nodes_t;
-  typedef std::map<std::string, std::string> opts_t;
   struct level_t {
-    std::string tag;
+    str_t tag;
     nodes_t nodes;
     opts_t opts;
     const level_t* copy;
@@ -78,7 +152,7 @@ class Xml {
           }
         }
         for (auto* incl : incl_nodes) {
-          const std::string& incl_name = path + incl->opts["file"];
+          const std::string& incl_name = path + incl->opts["file"].str();
           Xml* ixml = Create(incl_name, xml);
           if (ixml == NULL) {
             delete xml;
@@ -104,12 +178,11 @@ class Xml {
   void AddExpr(const std::string& full_tag, const std::string& name, const std::string& expr) {
     const std::size_t pos = full_tag.rfind('.');
     const std::size_t pos1 = (pos == std::string::npos) ? 0 : pos + 1;
-    const std::string level_tag = full_tag.substr(pos1);
-    level_t* level = new level_t;
+    level_t* level = NewLevel();
     (*map_)[full_tag].push_back(level);
-    level->tag = level_tag;
-    level->opts["name"] = name;
-    level->opts["expr"] = expr;
+    level->tag = AddString(full_tag.substr(pos1));
+    level->opts["name"] = AddString(name);
+    level->opts["expr"] = AddString(expr);
   }
 
   void AddConst(const std::string& full_tag, const std::string& name, const uint64_t& val) {
@@ -118,7 +191,7 @@ class Xml {
     AddExpr(full_tag, name, oss.str());
   }
 
-  nodes_t GetNodes(const std::string& global_tag) { return (*map_)[global_tag]; }
+  const nodes_t& GetNodes(const std::string& global_tag) { return (*map_)[global_tag]; }
 
   template <class F> F ForEach(const F& f_i) {
     F f = f_i;
@@ -160,143 +233,162 @@ class Xml {
   }
 
  private:
+  // Parsed document, shared with the included files and owned by the top one
+  struct doc_t {
+    map_t map;
+    std::deque<level_t> levels;
+    std::deque<std::string> strings;
+    std::vector<std::pair<void*, size_t> > files;
+  };
+
+  // Input token, a mutable slice of the mapped file
+  struct token_t {
+    char* ptr;
+    size_t size;
+  };
+
   Xml(const std::string& file_name, const Xml* obj)
       : file_name_(file_name),
         file_line_(0),
+        data_(NULL),
         data_size_(0),
         index_(0),
         state_(BODY_STATE),
         comment_(false),
         included_(false),
         level_(NULL),
+        doc_(NULL),
         map_(NULL) {
     if (obj != NULL) {
+      doc_ = obj->doc_;
       map_ = obj->map_;
       level_ = obj->level_;
       included_ = true;
     }
   }
 
-  struct delete_func {
-    bool fun(const std::string&, level_t* node) {
-      delete node;
-      return true;
-    }
-  };
-
   ~Xml() {
     if (included_ == false) {
-      ForEach(delete_func());
-      delete map_;
+      if (doc_ != NULL) {
+        for (auto& file : doc_->files) munmap(file.first, file.second);
+      }
+      delete doc_;
     }
   }
 
+  // The file is mapped privately, the tokens are unescaped and terminated in place.
+  // The mapping is one byte longer than the file to terminate the last token
   bool Init() {
-    fd_ = open(file_name_.c_str(), O_RDONLY);
-    if (fd_ == -1) {
+    const int fd = open(file_name_.c_str(), O_RDONLY);
+    if (fd == -1) {
       // perror((std::string("open XML file ") + file_name_).c_str());
       return false;
     }
 
-    if (map_ == NULL) {
-      map_ = new map_t;
-      if (map_ == NULL) return false;
+    struct stat st;
+    bool suc = (fstat(fd, &st) == 0);
+    if (suc) {
+      data_size_ = st.st_size;
+      void* base = mmap(NULL, data_size_ + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      suc = (base != MAP_FAILED);
+      if (suc && (data_size_ != 0)) {
+        suc = (mmap(base, data_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED);
+        if (!suc) munmap(base, data_size_ + 1);
+      }
+      if (suc) {
+        data_ = reinterpret_cast<char*>(base);
+        data_[data_size_] = '\0';
+      }
+    }
+    close(fd);
+    if (!suc) return false;
+
+    if (doc_ == NULL) {
+      doc_ = new doc_t;
+      map_ = &(doc_->map);
       AddLevel("top");
     }
+    doc_->files.push_back(std::make_pair(reinterpret_cast<void*>(data_), data_size_ + 1));
 
     return true;
   }
 
   void PreProcess() {
-    uint32_t ind = 0;
-    char buf[kBufSize];
-    bool error = false;
-
-    while (1) {
-      const uint32_t pos = lseek(fd_, 0, SEEK_CUR);
-      uint32_t size = read(fd_, buf, kBufSize);
-      if (size <= 0) break;
-      buf[size - 1] = '\0';
-
-      if (strncmp(buf, "#include \"", 10) == 0) {
-        for (ind = 0; (ind < size) && (buf[ind] != '\n'); ++ind) {}
-        if (ind < size) {
-          buf[ind] = '\0';
-          size = ind;
-          lseek(fd_, pos + ind + 1, SEEK_SET);
-        }
-
-        for (ind = 10; (ind < size) && (buf[ind] != '"'); ++ind) {}
-        if (ind == size) {
-          error = true;
-          break;
+    static const char kInclude[] = "#include \"";
+    static const size_t kIncludeLen = sizeof(kInclude) - 1;
+
+    size_t pos = 0;
+    while (pos < data_size_) {
+      char* line = data_ + pos;
+      char* line_end = reinterpret_cast<char*>(memchr(line, '\n', data_size_ - pos));
+      if (line_end == NULL) line_end = data_ + data_size_;
+      const size_t line_size = line_end - line;
+
+      if ((line_size >= kIncludeLen) && (strncmp(line, kInclude, kIncludeLen) == 0)) {
+        char* name = line + kIncludeLen;
+        char* name_end = reinterpret_cast<char*>(memchr(name, '"', line_end - name));
+        if (name_end == NULL) {
+          fprintf(stderr, "XML PreProcess failed, line '%s'\n", std::string(line, line_size).c_str());
+          abort();
         }
-        buf[ind] = '\0';
+        // The include line is a comment for the parser
+        *name_end = '\0';
 
         AddLevel("include");
-        AddOption("file", &buf[10]);
+        AddOption("file", str_t(name, name_end - name));
         UpLevel();
       }
-    }
 
-    if (error) {
-      fprintf(stderr, "XML PreProcess failed, line '%s'\n", buf);
-      abort();
+      pos += line_size + 1;
     }
-
-    lseek(fd_, 0, SEEK_SET);
   }
 
   void Process() {
-    token_t remainder;
+    token_t remainder = {NULL, 0};
 
     while (1) {
-      token_t token = (remainder.size()) ? remainder : NextToken();
-      remainder.clear();
-
-      // token_t token1 = token;
-      // token1.push_back('\0');
-      // std::cout << ">>> " << &token1[0] << std::endl;
+      token_t token = (remainder.size) ? remainder : NextToken();
+      remainder.size = 0;
 
       // End of file
-      if (token.size() == 0) break;
+      if (token.size == 0) break;
 
+      char* tok = token.ptr;
       switch (state_) {
         case BODY_STATE:
-          if (token[0] == '<') {
+          if (tok[0] == '<') {
             bool node_begin = true;
-            unsigned ind = 1;
-            if (token[1] == '/') {
+            size_t ind = 1;
+            if ((token.size > 1) && (tok[1] == '/')) {
               node_begin = false;
               ++ind;
             }
 
-            unsigned i = ind;
-            while (i < token.size()) {
-              if (token[i] == '>') break;
+            size_t i = ind;
+            while (i < token.size) {
+              if (tok[i] == '>') break;
               ++i;
             }
-            for (unsigned j = i + 1; j < token.size(); ++j) remainder.push_back(token[j]);
+            if ((i + 1) < token.size) remainder = token_t{tok + i + 1, token.size - i - 1};
 
-            if (i == token.size()) {
+            if (i == token.size) {
               if (node_begin)
                 state_ = DECL_STATE;
               else
                 BadFormat(token);
-              token.push_back('\0');
             } else {
-              token[i] = '\0';
+              tok[i] = '\0';
             }
 
-            const char* tag = &token[ind];
+            const str_t tag(tok + ind, i - ind);
             if (node_begin) {
               AddLevel(tag);
             } else {
               Inherit(GetOption("base"));
 
-              if (strncmp(CurrentLevel().c_str(), tag, strlen(tag)) != 0) {
-                token.back() = '>';
-                BadFormat(token);
+              if (strncmp(CurrentLevel().c_str(), tag.c_str(), tag.size()) != 0) {
+                tok[i] = '>';
+                BadFormat(token_t{tok, i + 1});
               }
               UpLevel();
             }
@@ -305,20 +397,17 @@ class Xml {
           }
           break;
         case DECL_STATE:
-          if (token[0] == '>') {
+          if (tok[0] == '>') {
             state_ = BODY_STATE;
-            for (unsigned j = 1; j < token.size(); ++j) remainder.push_back(token[j]);
+            if (token.size > 1) remainder = token_t{tok + 1, token.size - 1};
             continue;
           } else {
-            token.push_back('\0');
-            unsigned j = 0;
-            for (j = 0; j < token.size(); ++j)
-              if (token[j] == '=') break;
-            if (j == token.size()) BadFormat(token);
-            token[j] = '\0';
-            const std::string key = &token[0];
-            const std::string value = &token[j + 1];
-            AddOption(key, value);
+            size_t j = 0;
+            for (j = 0; j < token.size; ++j)
+              if (tok[j] == '=') break;
+            if (j == token.size) BadFormat(token);
+            tok[j] = '\0';
+            AddOption(str_t(tok, j), str_t(tok + j + 1, token.size - j - 1));
           }
           break;
         default:
@@ -329,92 +418,92 @@ class Xml {
   }
 
   bool SpaceCheck() const {
-    bool cond = ((buffer_[index_] == ' ') || (buffer_[index_] == '\t'));
+    bool cond = ((data_[index_] == ' ') || (data_[index_] == '\t'));
     return cond;
   }
 
   bool LineEndCheck() {
     bool found = false;
-    if (buffer_[index_] == '\n') {
-      buffer_[index_] = ' ';
+    if (data_[index_] == '\n') {
       ++file_line_;
       found = true;
       comment_ = false;
-    } else if (comment_ || (buffer_[index_] == '#')) {
+    } else if (comment_ || (data_[index_] == '#')) {
       found = true;
       comment_ = true;
     }
     return found;
   }
 
+  // The token is unescaped and NUL terminated in place, the terminating separator
+  // or the closing quote is consumed
   token_t NextToken() {
-    token_t token;
+    while ((index_ < data_size_) && (SpaceCheck() || LineEndCheck())) {
+      ++index_;
+    }
+
+    char* begin = data_ + index_;
+    char* out = begin;
     bool in_string = false;
     bool special_symb = false;
+    bool closed = false;
 
-    while (1) {
-      if (data_size_ == 0) {
-        data_size_ = read(fd_, buffer_, kBufSize);
-        if (data_size_ <= 0) break;
-      }
+    while ((index_ < data_size_) && (in_string || !(SpaceCheck() || LineEndCheck()))) {
+      const char symb = data_[index_++];
+      bool skip_symb = false;
 
-      if (token.empty()) {
-        while ((index_ < data_size_) && (SpaceCheck() || LineEndCheck())) {
-          ++index_;
-        }
+      switch (symb) {
+        case '\\':
+          if (special_symb) {
+            special_symb = false;
+          } else {
+            special_symb = true;
+            skip_symb = true;
+          }
+          break;
+        case '"':
+          if (special_symb) {
+            special_symb = false;
+          } else {
+            in_string = !in_string;
+            closed = !in_string;
+            skip_symb = true;
+          }
+          break;
       }
-      while ((index_ < data_size_) && (in_string || !(SpaceCheck() || LineEndCheck()))) {
-        const char symb = buffer_[index_];
-        bool skip_symb = false;
-
-        switch (symb) {
-          case '\\':
-            if (special_symb) {
-              special_symb = false;
-            } else {
-              special_symb = true;
-              skip_symb = true;
-            }
-            break;
-          case '"':
-            if (special_symb) {
-              special_symb = false;
-            } else {
-              in_string = !in_string;
-              if (!in_string) {
-                buffer_[index_] = ' ';
-                --index_;
-              }
-              skip_symb = true;
-            }
-            break;
-        }
 
-        if (!skip_symb) token.push_back(symb);
-        ++index_;
-      }
+      if (!skip_symb) *out++ = symb;
+      if (closed) break;
+    }
 
-      if (index_ == data_size_) {
-        index_ = 0;
-        data_size_ = 0;
-      } else {
-        if (special_symb || in_string) BadFormat(token);
-        break;
-      }
+    token_t token = {begin, static_cast<size_t>(out - begin)};
+    if (closed || (index_ < data_size_)) {
+      if (special_symb || in_string) BadFormat(token);
+      if (!closed) ++index_;
     }
+    *out = '\0';
 
     return token;
   }
 
-  void BadFormat(token_t token) {
-    token.push_back('\0');
+  void BadFormat(const token_t& token) {
     std::cout << "Error: " << file_name_ << ", line " << file_line_ << ", bad XML token '"
-              << &token[0] << "'" << std::endl;
+              << std::string(token.ptr, token.size) << "'" << std::endl;
     abort();
   }
 
-  void AddLevel(const std::string& tag) {
-    level_t* level = new level_t{};
+  level_t* NewLevel() {
+    doc_->levels.push_back(level_t());
+    return &(doc_->levels.back());
+  }
+
+  str_t AddString(const std::string& str) {
+    doc_->strings.push_back(str);
+    return str_t(doc_->strings.back());
+  }
+
+  void AddLevel(const str_t& tag) {
+    level_t* level = NewLevel();
     level->tag = tag;
     if (level_) {
       level_->nodes.push_back(level);
@@ -442,8 +531,8 @@ class Xml {
 
     for (auto node : from->nodes) {
       bool found = false;
-      const std::string name = GetOption("name", node);
-      const std::string global_tag = GlobalTag(level->tag) + "." + node->tag;
+      const str_t name = GetOption("name", node);
+      const std::string global_tag = GlobalTag(level->tag) + "." + node->tag.str();
       for (auto item : (*map_)[global_tag]) {
         if ((name == GetOption("name", item)) || (node == item->copy)) {
           found = true;
@@ -456,7 +545,7 @@ class Xml {
     if (to == NULL) UpLevel();
   }
 
-  void Inherit(const std::string& tag) {
+  void Inherit(const str_t& tag) {
     if (!tag.empty()) {
       const std::string global_tag = GlobalTag(tag);
       auto it = map_->find(global_tag);
@@ -470,40 +559,39 @@ class Xml {
     }
   }
 
-  std::string CurrentLevel() const { return level_->tag; }
+  str_t CurrentLevel() const { return level_->tag; }
 
-  std::string GlobalTag(const std::string& tag) const {
+  std::string GlobalTag(const str_t& tag) const {
     std::string global_tag;
     for (level_t* level : stack_) {
-      global_tag += level->tag + ".";
+      global_tag.append(level->tag.c_str(), level->tag.size());
+      global_tag += '.';
     }
-    global_tag += tag;
+    global_tag.append(tag.c_str(), tag.size());
     return global_tag;
   }
 
-  void AddOption(const std::string& key, const std::string& value) {
+  void AddOption(const str_t& key, const str_t& value) {
     level_->opts[key] = value;
   }
-  std::string GetOption(const std::string& key, const level_t* level = NULL) {
+  str_t GetOption(const char* key, const level_t* level = NULL) {
     level = (level != NULL) ? level : level_;
     auto it = level->opts.find(key);
-    return (it != level->opts.end()) ? it->second : "";
+    return (it != level->opts.end()) ? it->second : str_t();
   }
 
   const std::string file_name_;
   unsigned file_line_;
-  int fd_;
-
-  static const size_t kBufSize = 256;
-  char buffer_[kBufSize];
 
-  unsigned data_size_;
-  unsigned index_;
+  char* data_;
+  size_t data_size_;
+  size_t index_;
   unsigned state_;
   bool comment_;
   std::vector<level_t*> stack_;
   bool included_;
   level_t* level_;
+  doc_t* doc_;
   map_t* map_;
 };
 
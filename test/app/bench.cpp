@@ -0,0 +1,188 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+// Profiler overhead benchmark, the empty DummyKernel is dispatched from the given
+// number of threads, round robin to the thread queues, every dispatch is waited for.
+// The profiling mode is set by the environment, see 'bench.sh'.
+//   rocprof-bench [-n <dispatches per thread>] [-t <threads>] [-q <queues per thread>]
+//                 [-w <warmup dispatches>] [-l <label>] [-o <CSV file to append>]
+
+#include <hsa.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ctrl/test_hsa.h"
+#include "dummy_kernel/dummy_kernel.h"
+#include "util/hsa_rsrc_factory.h"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+struct bench_arg_t {
+  uint32_t dispatches;
+  uint32_t queues;
+  uint32_t warmup;
+  uint32_t threads;
+};
+
+std::atomic<uint32_t> ready_count{0};
+std::atomic<bool> start_flag{false};
+
+void usage(const char* name) {
+  printf("Usage: %s [-n <dispatches>] [-t <threads>] [-q <queues>] [-w <warmup>] [-l <label>] [-o <CSV file>]\n", name);
+  printf("  -n <dispatches> - dispatches number per thread [100000]\n");
+  printf("  -t <threads> - dispatching threads number [1]\n");
+  printf("  -q <queues> - queues number per thread [1]\n");
+  printf("  -w <warmup> - warmup dispatches number per thread, not measured [1000]\n");
+  printf("  -l <label> - profiling mode label [none]\n");
+  printf("  -o <CSV file> - the results row is appended to the file\n");
+  exit(1);
+}
+
+void thread_fun(const uint32_t thread_id, const bench_arg_t* arg, std::vector<uint64_t>* latency) {
+  HsaRsrcFactory* rsrc = &HsaRsrcFactory::Instance();
+  const AgentInfo* agent_info = NULL;
+  if (rsrc->GetGpuAgentInfo(thread_id % rsrc->GetCountOfGpuAgents(), &agent_info) == false) {
+    fprintf(stderr, "AgentInfo failed\n");
+    abort();
+  }
+
+  std::vector<DummyKernel> kernels(arg->queues);
+  std::vector<TestHsa*> tests(arg->queues);
+  for (uint32_t n = 0; n < arg->queues; ++n) {
+    hsa_queue_t* queue = NULL;
+    if (rsrc->CreateQueue(agent_info, 128, &queue) == false) {
+      fprintf(stderr, "CreateQueue failed\n");
+      abort();
+    }
+    tests[n] = new TestHsa(&kernels[n]);
+    tests[n]->SetAgentInfo(agent_info);
+    tests[n]->SetQueue(queue);
+    if ((tests[n]->Initialize(0, NULL) == false) || (tests[n]->Setup() == false)) {
+      fprintf(stderr, "DummyKernel setup failed\n");
+      abort();
+    }
+  }
+
+  for (uint32_t i = 0; i < arg->warmup; ++i) tests[i % arg->queues]->Run();
+
+  // All threads dispatches are started together
+  ready_count.fetch_add(1);
+  while (start_flag.load() == false) sched_yield();
+
+  latency->resize(arg->dispatches);
+  for (uint32_t i = 0; i < arg->dispatches; ++i) {
+    const bench_clock_t::time_point begin = bench_clock_t::now();
+    tests[i % arg->queues]->Run();
+    const bench_clock_t::time_point end = bench_clock_t::now();
+    (*latency)[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  }
+
+  for (uint32_t n = 0; n < arg->queues; ++n) {
+    hsa_queue_t* queue = tests[n]->GetQueue();
+    tests[n]->Cleanup();
+    delete tests[n];
+    hsa_queue_destroy(queue);
+  }
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, const double& p) {
+  if (sorted.empty()) return 0;
+  const size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bench_arg_t arg = {100000, 1, 1000, 1};
+  std::string label = "none";
+  const char* csv_file = NULL;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:t:q:w:l:o:h")) != -1) {
+    switch (opt) {
+      case 'n': arg.dispatches = atol(optarg); break;
+      case 't': arg.threads = atol(optarg); break;
+      case 'q': arg.queues = atol(optarg); break;
+      case 'w': arg.warmup = atol(optarg); break;
+      case 'l': label = optarg; break;
+      case 'o': csv_file = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if ((arg.threads == 0) || (arg.queues == 0)) usage(argv[0]);
+
+  if (getenv("ROC_TEST_TRACE") == NULL) std::clog.rdbuf(NULL);
+  TestHsa::HsaInstantiate();
+
+  std::vector<std::vector<uint64_t> > latency(arg.threads);
+  std::vector<std::thread> threads(arg.threads);
+  for (uint32_t n = 0; n < arg.threads; ++n) threads[n] = std::thread(thread_fun, n, &arg, &latency[n]);
+  while (ready_count.load() != arg.threads) sched_yield();
+
+  const bench_clock_t::time_point begin = bench_clock_t::now();
+  start_flag.store(true);
+  for (uint32_t n = 0; n < arg.threads; ++n) threads[n].join();
+  const bench_clock_t::time_point end = bench_clock_t::now();
+  const double time_sec = std::chrono::duration<double>(end - begin).count();
+
+  std::vector<uint64_t> all;
+  all.reserve((size_t)arg.dispatches * arg.threads);
+  for (const auto& vec : latency) all.insert(all.end(), vec.begin(), vec.end());
+  std::sort(all.begin(), all.end());
+  const uint64_t total = all.size();
+  const double throughput = (time_sec > 0) ? total / time_sec : 0;
+  const uint64_t p50 = percentile(all, 0.5);
+  const uint64_t p90 = percentile(all, 0.9);
+  const uint64_t p99 = percentile(all, 0.99);
+  const uint64_t p999 = percentile(all, 0.999);
+  const uint64_t max = all.empty() ? 0 : all.back();
+
+  printf("rocprof-bench: mode(%s) threads(%u) queues(%u) dispatches(%lu) time(%.3fs) throughput(%.0f/s)\n",
+    label.c_str(), arg.threads, arg.queues, total, time_sec, throughput);
+  printf("  latency-ns p50(%lu) p90(%lu) p99(%lu) p99.9(%lu) max(%lu)\n", p50, p90, p99, p999, max);
+
+  if (csv_file != NULL) {
+    FILE* file = fopen(csv_file, "a");
+    if (file == NULL) {
+      perror(csv_file);
+      abort();
+    }
+    fprintf(file, "%s,%u,%u,%lu,%.0f,%lu,%lu,%lu,%lu,%lu\n",
+      label.c_str(), arg.threads, arg.queues, total, throughput, p50, p90, p99, p999, max);
+    fclose(file);
+  }
+
+  TestHsa::HsaShutdown();
+  return 0;
+}
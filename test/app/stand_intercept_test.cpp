@@ -56,6 +56,23 @@ void check_status(hsa_status_t status) {
   }
 }
 
+// Asynchronous trace data test, the contexts trace data are iterated asynchronously
+// and the contexts are closed from the completion handler with the copies in flight
+bool trace_async = false;
+std::atomic<uint64_t> trace_samples{0};
+rocprofiler_parameter_t trace_parameters[2];
+rocprofiler_feature_t trace_feature;
+
+// Trace data async callback, called on the sample copy completion
+hsa_status_t trace_data_callback(hsa_ven_amd_aqlprofile_info_type_t info_type,
+                                 hsa_ven_amd_aqlprofile_info_data_t* info_data, void* /*data*/) {
+  if (info_type == HSA_VEN_AMD_AQLPROFILE_INFO_TRACE_DATA) {
+    if ((info_data->trace_data.size != 0) && (info_data->trace_data.ptr == NULL)) fatal("trace data copy is NULL");
+    trace_samples.fetch_add(1, std::memory_order_relaxed);
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
 // Context stored entry type
 struct context_entry_t {
   bool valid;
@@ -89,6 +106,10 @@ void dump_context_entry(context_entry_t* entry) {
     abort();
   }
 
+  if (trace_async) {
+    hsa_status_t status = rocprofiler_iterate_trace_data_async(group.context, trace_data_callback, NULL);
+    check_status(status);
+  }
   rocprofiler_close(group.context);
 }
 
@@ -132,7 +153,7 @@ hsa_status_t dispatch_callback(const rocprofiler_callback_data_t* callback_data,
   properties.handler_arg = (void*)entry;
 
   // Open profiling context
-  status = rocprofiler_open(callback_data->agent, NULL, 0,
+  status = rocprofiler_open(callback_data->agent, (trace_async) ? &trace_feature : NULL, (trace_async) ? 1 : 0,
                             &context, 0 /*ROCPROFILER_MODE_SINGLEGROUP*/, &properties);
   check_status(status);
 
@@ -156,6 +177,19 @@ int main() {
   const char* diter_s = getenv("ROCP_DITER");
   const unsigned kiter = (kiter_s != NULL) ? atol(kiter_s) : 1;
   const unsigned diter = (diter_s != NULL) ? atol(diter_s) : 1;
+  const char* trace_async_s = getenv("ROCP_TRACE_ASYNC");
+  trace_async = (trace_async_s != NULL) && (atol(trace_async_s) != 0);
+
+  // Tracing feature and parameters
+  trace_feature = {};
+  trace_feature.kind = ROCPROFILER_FEATURE_KIND_TRACE;
+  trace_feature.name = "THREAD_TRACE";
+  trace_feature.parameters = trace_parameters;
+  trace_feature.parameter_count = 2;
+  trace_parameters[0].parameter_name = HSA_VEN_AMD_AQLPROFILE_PARAMETER_NAME_MASK;
+  trace_parameters[0].value = 0;
+  trace_parameters[1].parameter_name = HSA_VEN_AMD_AQLPROFILE_PARAMETER_NAME_TOKEN_MASK;
+  trace_parameters[1].value = 0;
 
   // Adding dispatch observer
   rocprofiler_queue_callbacks_t callbacks_ptrs{};
@@ -185,6 +219,7 @@ int main() {
   }
 
   TestHsa::HsaShutdown();
+  if (trace_async) printf("trace samples %lu\n", trace_samples.load());
 
   return (ret_val) ? 0 : 1;
 }
@@ -0,0 +1,119 @@
+#!/bin/bash
+
+################################################################################
+# Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+################################################################################
+
+# Profiler overhead benchmark, run from the build directory:
+#   ./bench.sh [<modes list>]
+# The modes: none, intercept, timestamp, concurrent, pmc, pmc-pool.
+# The dispatches per thread, threads and queues sweeps and the PMC counters
+# number are set by BENCH_DISPATCHES, BENCH_THREADS, BENCH_QUEUES and BENCH_PMC_COUNT,
+# the results are appended to BENCH_CSV and the added latency is reported
+# relative to the 'none' mode.
+
+bench_modes="none intercept timestamp concurrent pmc pmc-pool"
+if [ -n "$1" ] ; then
+  bench_modes="$*"
+fi
+
+BENCH_DISPATCHES=${BENCH_DISPATCHES:-100000}
+BENCH_THREADS=${BENCH_THREADS:-"1 4"}
+BENCH_QUEUES=${BENCH_QUEUES:-"1 4"}
+BENCH_PMC_COUNT=${BENCH_PMC_COUNT:-4}
+BENCH_CSV=${BENCH_CSV:-./bench_results.csv}
+BENCH_COUNTERS="SQ_WAVES SQ_INSTS_VALU SQ_INSTS_SALU SQ_INSTS_SMEM GRBM_COUNT GRBM_GUI_ACTIVE SQ_WAVE_CYCLES SQ_BUSY_CYCLES"
+
+# paths to ROC profiler and oher libraries
+export LD_LIBRARY_PATH=$LD_LIBRARY_PATH:$PWD:$PWD/../../lib:/opt/rocm/lib:/opt/rocm/lib/rocprofiler
+export ROCP_METRICS=metrics.xml
+export ROCP_OBJ_TRACKING=1
+unset ROC_TEST_TRACE
+
+TOOL_LIB=librocprof-tool.so
+if [ ! -e $TOOL_LIB ] ; then
+  TOOL_LIB=test/librocprof-tool.so
+fi
+BENCH_BIN=./test/rocprof-bench
+if [ ! -e $BENCH_BIN ] ; then
+  BENCH_BIN=./rocprof-bench
+fi
+
+BENCH_DIR=`mktemp -d /tmp/rocprof-bench.XXXXXX`
+echo "<metric></metric>" > $BENCH_DIR/input_none.xml
+pmc_list=`echo $BENCH_COUNTERS | tr ' ' '\n' | head -n $BENCH_PMC_COUNT | tr '\n' ',' | sed 's/,$//'`
+echo "<metric name=$pmc_list></metric>" > $BENCH_DIR/input_pmc.xml
+
+set_mode() {
+  unset HSA_TOOLS_LIB ROCP_TOOL_LIB ROCP_INPUT ROCP_OUTPUT_DIR ROCP_TIMESTAMP_ON ROCP_K_CONCURRENT ROCP_OPT_MODE
+  if [ "$1" = "none" ] ; then
+    return
+  fi
+  export HSA_TOOLS_LIB=librocprofiler64.so.1
+  export ROCP_TOOL_LIB=$TOOL_LIB
+  export ROCP_OUTPUT_DIR=$BENCH_DIR
+  export ROCP_INPUT=$BENCH_DIR/input_none.xml
+  export ROCP_TIMESTAMP_ON=0
+  export ROCP_OPT_MODE=0
+  case "$1" in
+    intercept) ;;
+    timestamp) export ROCP_TIMESTAMP_ON=1 ;;
+    concurrent) export ROCP_TIMESTAMP_ON=1; export ROCP_K_CONCURRENT=1 ;;
+    pmc) export ROCP_INPUT=$BENCH_DIR/input_pmc.xml ;;
+    pmc-pool) export ROCP_INPUT=$BENCH_DIR/input_pmc.xml; export ROCP_OPT_MODE=1 ;;
+    *) echo "bench.sh: bad mode '$1'"; exit 1 ;;
+  esac
+}
+
+bench_status=0
+for mode in $bench_modes ; do
+  set_mode $mode
+  for thrs in $BENCH_THREADS ; do
+    for ques in $BENCH_QUEUES ; do
+      $BENCH_BIN -n $BENCH_DISPATCHES -t $thrs -q $ques -l $mode -o $BENCH_CSV
+      if [ $? != 0 ] ; then
+        echo "bench.sh: mode '$mode' threads($thrs) queues($ques) FAILED"
+        bench_status=$(($bench_status + 1))
+      fi
+      rm -f $BENCH_DIR/*_results.*
+    done
+  done
+done
+set_mode none
+rm -rf $BENCH_DIR
+
+# Added per-dispatch latency and throughput relative to the 'none' mode
+echo ""
+echo "mode,threads,queues,throughput,added-p50-ns,added-p90-ns,added-p99-ns"
+awk -F, '
+  $1 == "none" { base[$2 "," $3] = $0 }
+  { rows[NR] = $0 }
+  END {
+    for (i = 1; i <= NR; ++i) {
+      split(rows[i], r, ",")
+      key = r[2] "," r[3]
+      if (!(key in base)) continue
+      split(base[key], b, ",")
+      printf("%s,%s,%s,%s,%d,%d,%d\n", r[1], r[2], r[3], r[5], r[6] - b[6], r[7] - b[7], r[8] - b[8])
+    }
+  }' $BENCH_CSV
+
+exit $bench_status
@@ -0,0 +1,425 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+// Binary results merging tool
+//
+// The per-process binary results files are k-way merged by the dispatch begin
+// timestamp, or by the process dispatch index, into one sorted binary results file
+// or a JSON trace. The per-thread output shards files of a process are merged the same.
+// Every input file is split into per-GPU streams, the streams are read from
+// the mapped files and a bounded reorder window sorts the records completed
+// out of order. The processes timestamps are aligned by the realtime clock
+// correlation records to the timebase of the process with the smallest clock
+// offset, so the aligned timestamps are only shifted forward.
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "util/rpl_bin.h"
+
+namespace {
+
+const uint32_t WINDOW_DFLT = 4096;
+const size_t JSON_BUFFER_SIZE = 0x400000;  // 4M
+
+void fatal(const std::string& msg) {
+  fprintf(stderr, "rocprof-merge: %s\n", msg.c_str());
+  exit(1);
+}
+
+void usage(const char* name) {
+  printf("Usage: %s [-w <window>] [-c <on|off>] [-k <time|index>] -o <output file> <input files or directories>...\n", name);
+  printf("  -o <output file> - merged output, JSON trace if the file name ends with '.json', binary results otherwise\n");
+  printf("  -w <window> - reorder window, the number of the records kept to sort the out of order records [%u]\n", WINDOW_DFLT);
+  printf("  -c <on|off> - to align the processes timestamps by the realtime clock [on]\n");
+  printf("  -k <time|index> - the merge key, the dispatch begin timestamp or the process id and dispatch index [time]\n");
+  printf("  The directories are searched for the '<pid>_results.bin' and '<pid>_<shard>_results.bin' files.\n");
+  exit(1);
+}
+
+// Return the record at the position, the record is validated
+const rpl_bin_record_t* get_record(RplBinFile* input, size_t pos) {
+  const rpl_bin_record_t* rec = input->GetRecord(pos);
+  if (rec == NULL) fatal(input->Error());
+  return rec;
+}
+
+// Clock offset of the process timestamps to the realtime
+int64_t clock_offset(const rpl_bin_clock_t* clock) {
+  return (int64_t)(clock->realtime_ns - clock->timestamp_ns);
+}
+
+// Input file per-GPU stream
+class Stream {
+ public:
+  Stream(RplBinFile* input, uint32_t gpu_id, uint32_t id, const rpl_bin_clock_t* ref_clock, bool index_key) :
+    input_(input),
+    gpu_id_(gpu_id),
+    id_(id),
+    ref_clock_(ref_clock),
+    index_key_(index_key),
+    pos_(0),
+    pid_(0),
+    shift_(0),
+    cur_(NULL)
+  {}
+
+  // Advance to the next stream dispatch record, returns false at the end
+  bool Next() {
+    cur_ = NULL;
+    while ((cur_ == NULL) && (pos_ < input_->Size())) {
+      const rpl_bin_record_t* rec = get_record(input_, pos_);
+      pos_ += rec->size;
+      switch (rec->type) {
+        case RPL_BIN_HEADER:
+          strings_.clear();
+          kernels_.Clear();
+          pid_ = reinterpret_cast<const rpl_bin_header_t*>(rec)->pid;
+          shift_ = 0;
+          break;
+        case RPL_BIN_STRING: {
+          const rpl_bin_string_t* str = reinterpret_cast<const rpl_bin_string_t*>(rec);
+          strings_[str->id] = str;
+          break;
+        }
+        case RPL_BIN_CLOCK:
+          if (ref_clock_ != NULL) {
+            shift_ = clock_offset(reinterpret_cast<const rpl_bin_clock_t*>(rec)) - clock_offset(ref_clock_);
+          }
+          break;
+        case RPL_BIN_DISPATCH: {
+          const rpl_bin_dispatch_t* disp = reinterpret_cast<const rpl_bin_dispatch_t*>(rec);
+          if (disp->gpu_id == gpu_id_) cur_ = disp;
+          break;
+        }
+        case RPL_BIN_KERNEL:
+          kernels_.Add(reinterpret_cast<const rpl_bin_kernel_t*>(rec));
+          break;
+        case RPL_BIN_KDISPATCH: {
+          const rpl_bin_kdispatch_t* kdisp = reinterpret_cast<const rpl_bin_kdispatch_t*>(rec);
+          const rpl_bin_dispatch_t* disp = kernels_.Expand(kdisp, pid_, &expanded_);
+          if (disp == NULL) {
+            fatal("kernel id (" + std::to_string(kdisp->kernel_id) + ") not found in '" + input_->Path() + "'");
+          }
+          if (disp->gpu_id == gpu_id_) cur_ = disp;
+          break;
+        }
+      }
+    }
+    return (cur_ != NULL);
+  }
+
+  // Current record merge key, the aligned begin timestamp or the process id and dispatch index
+  uint64_t Key() const {
+    if (index_key_) return ((uint64_t)cur_->pid << 32) | cur_->index;
+    return (cur_->flags & RPL_BIN_DISPATCH_TIME) ? Align(cur_->begin) : 0;
+  }
+
+  uint64_t Align(uint64_t timestamp) const { return (timestamp != 0) ? timestamp + shift_ : 0; }
+
+  // Return the string of the current strings scope
+  std::string GetString(uint32_t str_id) const {
+    auto it = strings_.find(str_id);
+    if (it == strings_.end()) fatal("string id (" + std::to_string(str_id) + ") not found in '" + input_->Path() + "'");
+    return RplBinFile::GetString(it->second);
+  }
+
+  const rpl_bin_dispatch_t* Current() const { return cur_; }
+  uint32_t Id() const { return id_; }
+
+ private:
+  RplBinFile* input_;
+  const uint32_t gpu_id_;
+  const uint32_t id_;
+  const rpl_bin_clock_t* ref_clock_;
+  const bool index_key_;
+  size_t pos_;
+  uint32_t pid_;
+  int64_t shift_;
+  const rpl_bin_dispatch_t* cur_;
+  // The strings and kernels records of the current header scope
+  std::map<uint32_t, const rpl_bin_string_t*> strings_;
+  RplBinKernels kernels_;
+  // The current compact record expansion
+  RplBinKernels::buffer_t expanded_;
+};
+
+// Merged dispatch record, the strings ids are the output ids
+struct pending_t {
+  uint64_t key;
+  uint64_t seq;
+  rpl_bin_dispatch_t rec;
+  std::vector<rpl_bin_value_t> values;
+};
+
+template <class T>
+struct key_greater {
+  bool operator()(const T* a, const T* b) const {
+    return (a->key != b->key) ? (a->key > b->key) : (a->seq > b->seq);
+  }
+};
+
+// Merged output, binary results or JSON trace
+class Output {
+ public:
+  Output(const std::string& path, const rpl_bin_clock_t* ref_clock) :
+    json_(false),
+    first_(true),
+    bin_writer_(NULL)
+  {
+    json_ = (path.size() > 5) && (path.compare(path.size() - 5, 5, ".json") == 0);
+    file_ = fopen(path.c_str(), "w");
+    if (file_ == NULL) fatal("cannot open output '" + path + "'");
+    if (json_) {
+      setvbuf(file_, NULL, _IOFBF, JSON_BUFFER_SIZE);
+      fprintf(file_, "{\"traceEvents\":[\n");
+    } else {
+      bin_writer_ = new RplBinWriter(file_, 0);
+      // The merged timestamps are in the reference timebase
+      if (ref_clock != NULL) bin_writer_->WriteClock(ref_clock->timestamp_ns, ref_clock->realtime_ns, ref_clock->error_ns);
+    }
+  }
+
+  ~Output() {
+    if (json_) fprintf(file_, "\n]}\n");
+    delete bin_writer_;
+    fclose(file_);
+  }
+
+  // Return the output string id, the string record is written on the first use
+  uint32_t GetStringId(const std::string& str) {
+    auto ret = string_map_.insert({str, (uint32_t)strings_.size()});
+    if (ret.second) {
+      strings_.push_back(str);
+      if (bin_writer_ != NULL) bin_writer_->GetStringId(str.c_str());
+    }
+    return ret.first->second;
+  }
+
+  void Write(pending_t* pending) {
+    if (json_) WriteJson(pending);
+    else bin_writer_->WriteDispatch(&(pending->rec), pending->values);
+  }
+
+ private:
+  void WriteJsonString(const std::string& str) {
+    fputc('"', file_);
+    for (const char c : str) {
+      if ((c == '"') || (c == '\\')) fprintf(file_, "\\%c", c);
+      else if ((unsigned char)c < 0x20) fprintf(file_, "\\u%04x", (unsigned char)c);
+      else fputc(c, file_);
+    }
+    fputc('"', file_);
+  }
+
+  // Chrome trace complete event, the timestamps are in 'us'
+  void WriteJson(pending_t* pending) {
+    const rpl_bin_dispatch_t& rec = pending->rec;
+    const bool time_valid = (rec.flags & RPL_BIN_DISPATCH_TIME) != 0;
+    const uint64_t dur = (time_valid && (rec.end > rec.begin)) ? rec.end - rec.begin : 0;
+    fprintf(file_, "%s{\"ph\":\"X\",\"name\":", (first_) ? "" : ",\n");
+    WriteJsonString(strings_[rec.name_id]);
+    fprintf(file_, ",\"pid\":%u,\"tid\":%u,\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,\"args\":{",
+            rec.pid, rec.gpu_id, rec.begin / 1000, rec.begin % 1000, dur / 1000, dur % 1000);
+    fprintf(file_, "\"index\":%u,\"queue-id\":%u,\"queue-index\":%lu,\"tid\":%u", rec.index, rec.queue_id,
+            rec.queue_index, rec.tid);
+    if (rec.flags & RPL_BIN_DISPATCH_WEIGHT) fprintf(file_, ",\"weight\":%.3f", rec.weight);
+    for (const rpl_bin_value_t& value : pending->values) {
+      fputc(',', file_);
+      WriteJsonString(strings_[value.name_id]);
+      if (value.kind == RPL_BIN_VALUE_DOUBLE) fprintf(file_, ":%.10f", value.result_double);
+      else fprintf(file_, ":%lu", value.result_int64);
+    }
+    fprintf(file_, "}}");
+    first_ = false;
+  }
+
+  FILE* file_;
+  bool json_;
+  bool first_;
+  RplBinWriter* bin_writer_;
+  std::map<std::string, uint32_t> string_map_;
+  std::vector<std::string> strings_;
+};
+
+// Adding the input path, the directories are searched for the results files
+void add_input(const std::string& path, std::vector<std::string>* inputs) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) fatal("input '" + path + "' not found");
+  if (S_ISDIR(st.st_mode) == false) {
+    inputs->push_back(path);
+    return;
+  }
+
+  DIR* dir = opendir(path.c_str());
+  if (dir == NULL) fatal("cannot open directory '" + path + "'");
+  std::set<std::string> names;
+  const std::string suffix = "_results.bin";
+  while (struct dirent* ent = readdir(dir)) {
+    const std::string name = ent->d_name;
+    if ((name.size() > suffix.size()) &&
+        (name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) &&
+        (name.substr(0, name.size() - suffix.size()).find_first_not_of("0123456789_") == std::string::npos) &&
+        (isdigit(name[0]) != 0)) {
+      names.insert(name);
+    }
+  }
+  closedir(dir);
+  for (const std::string& name : names) inputs->push_back(path + "/" + name);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string output_path;
+  uint32_t window = WINDOW_DFLT;
+  bool clock_align = true;
+  bool index_key = false;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "o:w:c:k:h")) != -1) {
+    switch (opt) {
+      case 'o': output_path = optarg; break;
+      case 'w': window = atoi(optarg); break;
+      case 'c': clock_align = (strcmp(optarg, "off") != 0); break;
+      case 'k': index_key = (strcmp(optarg, "index") == 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (output_path.empty() || (optind == argc)) usage(argv[0]);
+
+  std::vector<std::string> input_paths;
+  for (int i = optind; i < argc; ++i) add_input(argv[i], &input_paths);
+  if (input_paths.empty()) fatal("no input results files found");
+
+  // Mapping the inputs, finding the GPU streams and the reference clock
+  const rpl_bin_clock_t* ref_clock = NULL;
+  std::vector<RplBinFile*> inputs;
+  std::vector<std::set<uint32_t> > input_gpu_ids(input_paths.size());
+  for (uint32_t i = 0; i < input_paths.size(); ++i) {
+    RplBinFile* input = new RplBinFile(input_paths[i]);
+    if (input->IsValid() == false) fatal(input->Error());
+    inputs.push_back(input);
+    size_t pos = 0;
+    while (pos < input->Size()) {
+      const rpl_bin_record_t* rec = get_record(input, pos);
+      if (rec->type == RPL_BIN_DISPATCH) {
+        input_gpu_ids[i].insert(reinterpret_cast<const rpl_bin_dispatch_t*>(rec)->gpu_id);
+      } else if (rec->type == RPL_BIN_KERNEL) {
+        input_gpu_ids[i].insert(reinterpret_cast<const rpl_bin_kernel_t*>(rec)->gpu_id);
+      } else if ((rec->type == RPL_BIN_CLOCK) && clock_align) {
+        const rpl_bin_clock_t* clock = reinterpret_cast<const rpl_bin_clock_t*>(rec);
+        if ((ref_clock == NULL) || (clock_offset(clock) < clock_offset(ref_clock))) ref_clock = clock;
+      }
+      pos += rec->size;
+    }
+  }
+  std::vector<Stream*> streams;
+  for (uint32_t i = 0; i < inputs.size(); ++i) {
+    for (const uint32_t gpu_id : input_gpu_ids[i]) {
+      streams.push_back(new Stream(inputs[i], gpu_id, streams.size(), ref_clock, index_key));
+    }
+  }
+
+  Output output(output_path, ref_clock);
+
+  // K-way merge of the streams
+  struct head_t {
+    uint64_t key;
+    uint64_t seq;
+    Stream* stream;
+  };
+  std::priority_queue<head_t*, std::vector<head_t*>, key_greater<head_t> > heads;
+  std::vector<head_t> head_vec(streams.size());
+  for (Stream* stream : streams) {
+    if (stream->Next()) {
+      head_t* head = &head_vec[stream->Id()];
+      *head = head_t{stream->Key(), stream->Id(), stream};
+      heads.push(head);
+    }
+  }
+
+  // Reorder window
+  std::priority_queue<pending_t*, std::vector<pending_t*>, key_greater<pending_t> > pending_queue;
+  uint64_t seq = 0;
+  uint64_t record_count = 0;
+
+  while (!heads.empty()) {
+    head_t* head = heads.top();
+    heads.pop();
+    Stream* stream = head->stream;
+    const rpl_bin_dispatch_t* disp = stream->Current();
+
+    pending_t* pending = new pending_t;
+    pending->key = head->key;
+    pending->seq = seq++;
+    pending->rec = *disp;
+    pending->rec.name_id = output.GetStringId(stream->GetString(disp->name_id));
+    if (disp->flags & RPL_BIN_DISPATCH_TIME) {
+      pending->rec.dispatch = stream->Align(disp->dispatch);
+      pending->rec.begin = stream->Align(disp->begin);
+      pending->rec.end = stream->Align(disp->end);
+      pending->rec.complete = stream->Align(disp->complete);
+    }
+    const rpl_bin_value_t* values = RplBinFile::GetValues(disp);
+    pending->values.assign(values, values + disp->value_count);
+    for (rpl_bin_value_t& value : pending->values) value.name_id = output.GetStringId(stream->GetString(value.name_id));
+    pending_queue.push(pending);
+
+    if (pending_queue.size() > window) {
+      output.Write(pending_queue.top());
+      delete pending_queue.top();
+      pending_queue.pop();
+      ++record_count;
+    }
+
+    if (stream->Next()) {
+      head->key = stream->Key();
+      heads.push(head);
+    }
+  }
+  while (!pending_queue.empty()) {
+    output.Write(pending_queue.top());
+    delete pending_queue.top();
+    pending_queue.pop();
+    ++record_count;
+  }
+
+  for (Stream* stream : streams) delete stream;
+  for (RplBinFile* input : inputs) delete input;
+
+  printf("rocprof-merge: %lu records merged from %zu files, %zu streams, clock %s\n", record_count, inputs.size(),
+         streams.size(), (ref_clock != NULL) ? "aligned" : "not aligned");
+  return 0;
+}
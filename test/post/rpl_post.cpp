@@ -0,0 +1,136 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+// Binary results post-processing tool, the tblextr.py command line:
+//   rocprof-post [-t <threads>] [-j] [-p] <output CSV or DB file> <binary results files>...
+// With a '.csv' output the results CSV is generated. With a '.db' output
+// the results CSV with the durations, the '.stats.csv' kernels stats and the
+// KERN table DB are generated, the '-j' option adds the kernels '.json' trace.
+// The tracked memory copies are output to the '.copy.csv' with the copies bandwidth.
+// The '-p' option adds the '.parquet' results and '.copy.parquet' copies tables.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "util/rpl_post.h"
+
+namespace {
+
+void fatal(const std::string& msg) {
+  fprintf(stderr, "rocprof-post: %s\n", msg.c_str());
+  exit(1);
+}
+
+void usage(const char* name) {
+  printf("Usage: %s [-t <threads>] [-j] [-p] <output CSV or DB file> <binary results files>...\n", name);
+  printf("  -t <threads> - the rows formatting threads number [hardware concurrency]\n");
+  printf("  -j - to generate the kernels JSON trace, DB output only\n");
+  printf("  -p - to generate the Parquet results and copies tables\n");
+  exit(1);
+}
+
+bool has_suffix(const std::string& str, const std::string& suffix) {
+  return (str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+std::string replace_suffix(const std::string& str, const std::string& suffix, const std::string& sub) {
+  return str.substr(0, str.size() - suffix.size()) + sub;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t thread_count = std::thread::hardware_concurrency();
+  bool json = false;
+  bool parquet = false;
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "t:jph")) != -1) {
+    switch (opt) {
+      case 't': thread_count = atoi(optarg); break;
+      case 'j': json = true; break;
+      case 'p': parquet = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if ((argc - optind) < 2) usage(argv[0]);
+
+  const std::string outfile = argv[optind];
+  std::string csvfile;
+  std::string dbfile;
+  if (has_suffix(outfile, ".csv")) {
+    csvfile = outfile;
+  } else if (has_suffix(outfile, ".db")) {
+    dbfile = outfile;
+    csvfile = replace_suffix(outfile, ".db", ".csv");
+  } else {
+    fatal("Bad output file '" + outfile + "'");
+  }
+
+  RplPost post(!dbfile.empty(), getenv("ROCP_MERGE_PIDS") != NULL, thread_count);
+  for (int i = optind + 1; i < argc; ++i) {
+    if (post.AddInput(argv[i]) == false) fatal(post.Error());
+  }
+  post.Process(json && !dbfile.empty());
+
+  if (post.WriteCsv(csvfile) == false) fatal(post.Error());
+  printf("File '%s' is generating\n", csvfile.c_str());
+
+  if (post.HasCopies()) {
+    const std::string copyfile = replace_suffix(csvfile, ".csv", ".copy.csv");
+    if (post.WriteCopies(copyfile) == false) fatal(post.Error());
+    printf("File '%s' is generating\n", copyfile.c_str());
+  }
+
+  if (parquet) {
+    const std::string pqfile = replace_suffix(csvfile, ".csv", ".parquet");
+    if (post.WriteParquet(pqfile) == false) fatal(post.Error());
+    printf("File '%s' is generating\n", pqfile.c_str());
+    if (post.HasCopies()) {
+      const std::string copyfile = replace_suffix(csvfile, ".csv", ".copy.parquet");
+      if (post.WriteCopiesParquet(copyfile) == false) fatal(post.Error());
+      printf("File '%s' is generating\n", copyfile.c_str());
+    }
+  }
+
+  if (!dbfile.empty()) {
+    const std::string statfile = replace_suffix(csvfile, ".csv", ".stats.csv");
+    if (post.WriteStats(statfile) == false) fatal(post.Error());
+    printf("File '%s' is generating\n", statfile.c_str());
+    if (json) {
+      const std::string jsonfile = replace_suffix(csvfile, ".csv", ".json");
+      if (post.WriteJson(jsonfile) == false) fatal(post.Error());
+      printf("File '%s' is generating\n", jsonfile.c_str());
+    }
+#ifdef RPL_POST_SQLITE
+    if (post.WriteSqlite(dbfile) == false) fatal(post.Error());
+#else
+    printf("rocprof-post: built without SQLite, '%s' is not generated\n", dbfile.c_str());
+#endif
+  }
+
+  return 0;
+}
@@ -92,6 +92,9 @@ export ROCP_KITER=20
 # test macro for per-kernel dispatching number
 export ROCP_DITER=10
 eval_test "Standalone intercepting test" ./test/stand_intercept_test
+export ROCP_TRACE_ASYNC=1
+eval_test "Standalone intercepting async trace test" ./test/stand_intercept_test
+unset ROCP_TRACE_ASYNC
 unset ROCP_HSA_INTERCEPT
 
 ## Intercepting usage model test
@@ -152,6 +155,19 @@ export ROCP_THRS=10
 export ROCP_INPUT=pmc_input1.xml
 eval_test "'rocprof' rocprof-tool PMC n-thread test1" ./test/rocprof-ctrl
 
+export ROCP_KITER=20
+export ROCP_DITER=20
+export ROCP_AGENTS=1
+export ROCP_THRS=1
+export ROCP_INPUT=pmc_input1.xml
+export ROCP_K_CONCURRENT=3
+export ROCP_K_WINDOW=4
+export ROCP_K_WINDOW_TIME=1000
+eval_test "'rocprof' rocprof-tool PMC concurrent window test" ./test/rocprof-ctrl
+unset ROCP_K_CONCURRENT
+unset ROCP_K_WINDOW
+unset ROCP_K_WINDOW_TIME
+
 unset ROCP_MCOPY_TRACKING
 # enable HSA intercepting
 export ROCP_HSA_INTERC=1
@@ -0,0 +1,123 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+// Live profiling session control agent, the process is profiled with ROCP_SHM_CTRL:
+//   rocprof-shm <pid> enable|disable|status
+//   rocprof-shm <pid> metrics <comma separated metrics>
+//   rocprof-shm <pid> read [<period msec>]
+// The 'read' command prints the completed dispatch records, periodically if the period is given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "util/rpl_shm.h"
+
+namespace {
+
+const uint32_t COMMAND_TIMEOUT_MS = 10000;
+
+void fatal(const std::string& msg) {
+  fprintf(stderr, "rocprof-shm: %s\n", msg.c_str());
+  exit(1);
+}
+
+void usage(const char* name) {
+  printf("Usage: %s <pid> enable|disable|status|metrics <metrics>|read [<period msec>]\n", name);
+  exit(1);
+}
+
+void print_status(const rpl_shm_header_t* header) {
+  printf("pid(%u) enabled(%u) metrics-set(%u) records(%lu) busy-ns(%lu)\n",
+    header->pid, header->enabled.load(), header->metrics_seq.load(), header->head.load(), header->busy_ns.load());
+}
+
+void print_record(const RplShmChannel::record_t& rec) {
+  const rpl_bin_dispatch_t& d = rec.dispatch;
+  printf("record[%lu] dispatch[%u] gpu-id(%u) queue-id(%u) tid(%u) kernel-name(\"%s\")",
+    rec.number, d.index, d.gpu_id, d.queue_id, d.tid, rec.kernel_name.c_str());
+  if (d.flags & RPL_BIN_DISPATCH_TIME) printf(" time(%lu,%lu,%lu,%lu)", d.dispatch, d.begin, d.end, d.complete);
+  printf("\n");
+  for (uint32_t i = 0; i < rec.values.size(); ++i) {
+    const rpl_bin_value_t& value = rec.values[i];
+    if (value.kind == RPL_BIN_VALUE_INT64) printf("  %s (%lu)\n", rec.names[i].c_str(), value.result_int64);
+    else printf("  %s (%.10lf)\n", rec.names[i].c_str(), value.result_double);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) usage(argv[0]);
+  const uint32_t pid = atoi(argv[1]);
+  const std::string command = argv[2];
+
+  RplShmChannel* channel = RplShmChannel::Attach(pid);
+  if (channel == NULL) fatal("control channel '" + RplShmChannel::Name(pid) + "' is not found");
+  rpl_shm_header_t* header = channel->Header();
+
+  rpl_shm_command_t cmd = RPL_SHM_CMD_NONE;
+  const char* metrics = NULL;
+  if (command == "enable") {
+    cmd = RPL_SHM_CMD_ENABLE;
+  } else if (command == "disable") {
+    cmd = RPL_SHM_CMD_DISABLE;
+  } else if (command == "metrics") {
+    if (argc < 4) usage(argv[0]);
+    if (strlen(argv[3]) >= RPL_SHM_METRICS_MAX) fatal("metrics list is too long");
+    cmd = RPL_SHM_CMD_METRICS;
+    metrics = argv[3];
+  } else if (command == "status") {
+    print_status(header);
+  } else if (command == "read") {
+    const uint32_t period_ms = (argc > 3) ? atoi(argv[3]) : 0;
+    uint64_t next = 0;
+    do {
+      std::vector<RplShmChannel::record_t> records;
+      const uint64_t head = channel->Read(next, &records);
+      if ((next != 0) && (head > next + header->ring_size)) {
+        printf("rocprof-shm: %lu records overwritten\n", head - next - header->ring_size);
+      }
+      for (const auto& rec : records) print_record(rec);
+      fflush(stdout);
+      next = head;
+      if (period_ms != 0) usleep(period_ms * 1000);
+    } while (period_ms != 0);
+  } else {
+    usage(argv[0]);
+  }
+
+  if (cmd != RPL_SHM_CMD_NONE) {
+    rpl_shm_status_t status = RPL_SHM_STATUS_OK;
+    if (channel->Command(cmd, metrics, COMMAND_TIMEOUT_MS, &status) == false) fatal("command timeout");
+    if (status == RPL_SHM_STATUS_UNSUPPORTED) fatal("command is not supported in the session mode");
+    if (status == RPL_SHM_STATUS_BAD_METRIC) fatal("bad metrics '" + std::string(metrics) + "'");
+    print_status(header);
+  }
+
+  delete channel;
+  return 0;
+}
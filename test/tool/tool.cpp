@@ -40,17 +40,24 @@ THE SOFTWARE.
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <list>
 #include <map>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 #include "inc/rocprofiler.h"
+#include "src/core/core_timer.h"
 #include "util/hsa_rsrc_factory.h"
-#include "util/xml.h"
+#include "util/rpl_bin.h"
+#include "util/rpl_shm.h"
+#include "util/rpl_stats.h"
+#include "util/rpl_writer.h"
+#include "src/xml/xml.h"
 
 #define PUBLIC_API __attribute__((visibility("default")))
 #define CONSTRUCTOR_API __attribute__((constructor))
@@ -91,10 +98,12 @@ struct kernel_properties_t {
 };
 
 // Context stored entry type
+struct context_shard_t;
 struct context_entry_t {
-  bool valid;
+  std::atomic<bool> valid;
   bool active;
   uint32_t index;
+  context_shard_t* shard;
   hsa_agent_t agent;
   rocprofiler_group_t group;
   rocprofiler_feature_t* features;
@@ -113,22 +122,79 @@ static uint32_t verbose = 0;
 static const bool trace_on = false;
 // Tool is unloaded
 volatile bool is_loaded = false;
-// Dispatch callbacks and context handlers synchronization
+// Tool loading and collected contexts waiting synchronization
 pthread_mutex_t mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+// Signaled on a context collection, used with the mutex
+pthread_cond_t collected_cond = PTHREAD_COND_INITIALIZER;
 // Dispatch callback data
 callbacks_data_t* callbacks_data = NULL;
 // Stored contexts array
 typedef std::map<uint32_t, context_entry_t> context_array_t;
-context_array_t* context_array = NULL;
-// Contexts collected count
-volatile uint32_t context_count = 0;
-volatile uint32_t context_collected = 0;
+// Stored contexts are sharded per GPU agent, the dispatch callbacks and the context
+// handlers of the agent are synchronized by the shard mutex. The active entries are
+// counted to skip the idle shards without locking.
+static const uint32_t CONTEXT_SHARD_MAX = 64;
+struct context_shard_t {
+  pthread_mutex_t mutex;
+  context_array_t array;
+  std::atomic<uint32_t> active;
+};
+context_shard_t* context_shards = NULL;
+// Dispatches count and contexts collected count
+std::atomic<uint32_t> context_count{0};
+std::atomic<uint32_t> context_collected{0};
+// Threads waiting for the contexts collection, the collection is signaled if any
+std::atomic<uint32_t> collected_waiters{0};
+// Results output synchronization if the writer thread is disabled
+std::mutex output_mutex;
+// Contexts fetched from the contexts pools
+std::atomic<uint32_t> context_fetched{0};
 // Profiling results output dir
 const char* result_prefix = NULL;
 // Global results file handle
 FILE* result_file_handle = NULL;
 // True if a result file is opened
 bool result_file_opened = false;
+// Binary results output enabled
+uint32_t binary_output = 0;
+// Binary results writer
+RplBinWriter* bin_writer = NULL;
+// Per-thread binary output shards, every thread writing the results owns a shard
+// writer and file '<pid>_<shard>_results.bin'. The shards are registered in a lock-free
+// list and flushed independently, the records are ordered by the dispatch index on merging.
+uint32_t output_shards_on = 0;
+struct output_shard_t {
+  FILE* file_handle;
+  RplBinWriter* writer;
+  output_shard_t* next;
+};
+std::atomic<output_shard_t*> output_shards{NULL};
+std::atomic<uint32_t> output_shard_count{0};
+thread_local output_shard_t* output_shard = NULL;
+// Completed context snapshot, dispatch properties and results values,
+// or a completed memory copy record
+struct result_snapshot_t {
+  FILE* file_handle;
+  bool header_on;
+  bool is_memcopy;
+  rpl_bin_memcopy_t memcopy;
+  rpl_bin_dispatch_t dispatch;
+  std::string kernel_name;
+  std::vector<const char*> names;
+  std::vector<rpl_bin_value_t> values;
+  std::vector<uint64_t> window_objects;
+};
+// Asynchronous results writer
+typedef RplAsyncWriter<result_snapshot_t> results_writer_t;
+results_writer_t* results_writer = NULL;
+// Results writer parameters, thread enabling, queue size, flush interval in msec and overflow policy
+uint32_t writer_thread = 1;
+uint32_t writer_queue_size = results_writer_t::QUEUE_SIZE_DFLT;
+uint32_t writer_flush_interval = results_writer_t::FLUSH_INTERVAL_DFLT;
+results_writer_t::policy_t writer_policy = results_writer_t::POLICY_BLOCK;
+// On-line kernels statistics, 1 - aggregated with the records output, 2 - the records are not output
+uint32_t kernel_stats_mode = 0;
+RplKernelStats* kernel_stats = NULL;
 // Dispatch filters
 // Metrics set
 std::vector<uint32_t>* metrics_set = NULL;
@@ -144,8 +210,59 @@ static uint32_t CTX_OUTSTANDING_MAX = 0;
 static uint32_t CTX_OUTSTANDING_MON = 0;
 // to truncate kernel names
 uint32_t to_truncate_names = 0;
+// Kernel names are interned by the library if code objects tracking is enabled
+bool kernel_names_interned = false;
+// Filtered kernel names cache, keyed by the interned kernel name
+typedef std::map<const char*, std::string> kernel_name_map_t;
+kernel_name_map_t* kernel_name_map = NULL;
 // local trace buffer
 bool is_trace_local = true;
+// Kernel replay mode, a context can have more than one group
+uint32_t kernel_replay = 0;
+// Dispatches sampling mode, the sampling weights are output
+uint32_t sampling_on = 0;
+// Counters accumulated over the same kernel dispatches, the ranges dispatches numbers are output as weights
+uint32_t accumulate_on = 0;
+// Concurrent counters window, the windows dispatches numbers are output as weights
+uint32_t window_on = 0;
+// Per-kernel adaptive profiling, the dispatches observations are passed to the library
+uint32_t converge_on = 0;
+// Overhead accounting, the library sections are reported by the library
+uint32_t overhead_on = 0;
+std::atomic<uint64_t> dump_overhead_calls{0};
+std::atomic<uint64_t> dump_overhead_ticks{0};
+// Periodic collection, the dispatch callbacks are enabled for the sample windows,
+// initial delay, window length and period in usec, the delay is -1 if the collection is off
+int64_t ctrl_delay_us = 0;
+uint32_t ctrl_length_us = 0;
+uint32_t ctrl_period_us = 0;
+bool ctrl_on = false;
+// Completed contexts release and results flush period in usec
+uint32_t flush_period_us = 0;
+// Periodic collection and flush threads, stopped on the tool unloading
+std::thread* ctrl_thread = NULL;
+std::thread* flush_thread = NULL;
+std::mutex ctrl_mutex;
+std::condition_variable ctrl_cond;
+bool ctrl_stop = false;
+// Shared memory control channel, the dispatch callbacks are enabled by the agent commands,
+// the ring size in records and the commands polling period in msec
+RplShmChannel* shm_channel = NULL;
+uint32_t shm_ring_size = 0;
+uint32_t shm_poll_ms = 100;
+std::thread* shm_thread = NULL;
+
+// Context entry dump overhead scope
+struct dump_overhead_scope_t {
+  const rocprofiler::CoreTimer::tick_t begin;
+  dump_overhead_scope_t() : begin(overhead_on ? rocprofiler::CoreTimer::Get() : 0) {}
+  ~dump_overhead_scope_t() {
+    if (begin != 0) {
+      dump_overhead_calls.fetch_add(1, std::memory_order_relaxed);
+      dump_overhead_ticks.fetch_add(rocprofiler::CoreTimer::Get() - begin, std::memory_order_relaxed);
+    }
+  }
+};
 
 static inline uint32_t GetPid() { return syscall(__NR_getpid); }
 static inline uint32_t GetTid() { return syscall(__NR_gettid); }
@@ -174,9 +291,35 @@ void check_status(hsa_status_t status) {
 // Dispatch opt code /////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////
 // Context callback arg
+// The agent pool is opened on the first dispatch to the agent
 struct callbacks_arg_t {
-  rocprofiler_pool_t** pools;
+  std::atomic<rocprofiler_pool_t*>* pools;
+  unsigned pool_count;
+  const callbacks_data_t* filter;
+  rocprofiler_feature_t* features;
+  unsigned feature_count;
+  rocprofiler_pool_properties_t properties;
 };
+// Contexts pools callback arg, the pools are used if not NULL
+callbacks_arg_t* callbacks_arg = NULL;
+// Contexts pools opening synchronization
+std::mutex pools_mutex;
+
+// Return the agent contexts pool, opened on the first use
+rocprofiler_pool_t* get_context_pool(callbacks_arg_t* arg, const unsigned gpu_id, const hsa_agent_t& agent) {
+  rocprofiler_pool_t* pool = arg->pools[gpu_id].load(std::memory_order_acquire);
+  if (pool == NULL) {
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    pool = arg->pools[gpu_id].load(std::memory_order_relaxed);
+    if (pool == NULL) {
+      hsa_status_t status = rocprofiler_pool_open(agent, arg->features, arg->feature_count,
+                                                  &pool, 0, &(arg->properties));
+      check_status(status);
+      arg->pools[gpu_id].store(pool, std::memory_order_release);
+    }
+  }
+  return pool;
+}
 
 // Handler callback arg
 struct handler_arg_t {
@@ -234,84 +377,155 @@ std::string filtr_kernel_name(const std::string name) {
   return name.substr(pos, length);
 }
 
+// Filtered kernel name, cached for the interned names
+std::mutex kernel_name_mutex;
+std::string get_filtr_kernel_name(const char* name) {
+  if (kernel_names_interned == false) return filtr_kernel_name(name);
+  std::lock_guard<std::mutex> lock(kernel_name_mutex);
+  if (kernel_name_map == NULL) kernel_name_map = new kernel_name_map_t;
+  auto ret = kernel_name_map->insert({name, std::string()});
+  if (ret.second) ret.first->second = filtr_kernel_name(name);
+  return ret.first->second;
+}
+
 // Inflight submits monitoring thread
 void* monitor_thr_fun(void*) {
-  while (context_array != NULL) {
+  while (context_shards != NULL) {
     sleep(CTX_OUTSTANDING_MON);
-    if (pthread_mutex_lock(&mutex) != 0) {
-      perror("pthread_mutex_lock");
-      abort();
-    }
     const uint32_t inflight = context_count - context_collected;
     std::cerr << std::flush;
     std::clog << std::flush;
-    std::cout << "ROCProfiler: count(" << context_count << "), outstanding(" << inflight << "/" << CTX_OUTSTANDING_MAX << ")" << std::endl << std::flush;
-    if (pthread_mutex_unlock(&mutex) != 0) {
-      perror("pthread_mutex_unlock");
-      abort();
-    }
+    std::cout << "ROCProfiler: count(" << context_count.load() << "), outstanding(" << inflight << "/" << CTX_OUTSTANDING_MAX << ")" << std::endl << std::flush;
   }
   return NULL;
 }
 
-// Increment profiling context counter value
-uint32_t next_context_count() {
-  if (pthread_mutex_lock(&mutex) != 0) {
+// Contexts shards
+void init_context_shards() {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  context_shards = new context_shard_t[CONTEXT_SHARD_MAX];
+  for (uint32_t i = 0; i < CONTEXT_SHARD_MAX; ++i) {
+    pthread_mutex_init(&(context_shards[i].mutex), &attr);
+    context_shards[i].active.store(0, std::memory_order_relaxed);
+  }
+  pthread_mutexattr_destroy(&attr);
+}
+
+context_shard_t* get_context_shard(const hsa_agent_t& agent) {
+  const uint32_t gpu_id = HsaRsrcFactory::Instance().GetAgentInfo(agent)->dev_index;
+  return &context_shards[gpu_id % CONTEXT_SHARD_MAX];
+}
+
+void lock_context_shard(context_shard_t* shard) {
+  if (pthread_mutex_lock(&(shard->mutex)) != 0) {
     perror("pthread_mutex_lock");
     abort();
   }
-  ++context_count;
-  if (pthread_mutex_unlock(&mutex) != 0) {
+}
+
+void unlock_context_shard(context_shard_t* shard) {
+  if (pthread_mutex_unlock(&(shard->mutex)) != 0) {
     perror("pthread_mutex_unlock");
     abort();
   }
-  return context_count;
+}
+
+// Waiting for the contexts collection condition
+// Called under the mutex
+template <class Cond>
+void wait_collected(const Cond& cond) {
+  collected_waiters.fetch_add(1);
+  while (cond() == false) {
+    if (pthread_cond_wait(&collected_cond, &mutex) != 0) {
+      perror("pthread_cond_wait");
+      abort();
+    }
+  }
+  collected_waiters.fetch_sub(1);
+}
+
+// Signaling the context collection, the mutex is taken only if there are waiters
+void signal_collected() {
+  context_collected.fetch_add(1);
+  if (collected_waiters.load() != 0) {
+    if (pthread_mutex_lock(&mutex) != 0) {
+      perror("pthread_mutex_lock");
+      abort();
+    }
+    if (pthread_cond_broadcast(&collected_cond) != 0) {
+      perror("pthread_cond_broadcast");
+      abort();
+    }
+    if (pthread_mutex_unlock(&mutex) != 0) {
+      perror("pthread_mutex_unlock");
+      abort();
+    }
+  }
+}
+
+// Increment profiling context counter value
+uint32_t next_context_count() {
+  return context_count.fetch_add(1, std::memory_order_acq_rel) + 1;
 }
 
 // Allocate entry to store profiling context
-context_entry_t* alloc_context_entry() {
+context_entry_t* alloc_context_entry(const hsa_agent_t& agent) {
+  // Waiting for the outstanding contexts to be collected
   if (CTX_OUTSTANDING_MAX != 0) {
-    while((context_count - context_collected) > CTX_OUTSTANDING_MAX) usleep(1000);
+    if (pthread_mutex_lock(&mutex) != 0) {
+      perror("pthread_mutex_lock");
+      abort();
+    }
+    wait_collected([]() { return (context_count - context_collected) <= CTX_OUTSTANDING_MAX; });
+    if (pthread_mutex_unlock(&mutex) != 0) {
+      perror("pthread_mutex_unlock");
+      abort();
+    }
   }
 
-  if (pthread_mutex_lock(&mutex) != 0) {
-    perror("pthread_mutex_lock");
-    abort();
-  }
+  context_shard_t* shard = get_context_shard(agent);
+  lock_context_shard(shard);
 
   const uint32_t index = next_context_count() - 1;
-  auto ret = context_array->insert({index, context_entry_t{}});
+  auto ret = shard->array.emplace(std::piecewise_construct, std::forward_as_tuple(index), std::forward_as_tuple());
   if (ret.second == false) {
     fprintf(stderr, "context_array corruption, index repeated %u\n", index);
     abort();
   }
 
-  if (pthread_mutex_unlock(&mutex) != 0) {
-    perror("pthread_mutex_unlock");
-    abort();
-  }
+  unlock_context_shard(shard);
 
   context_entry_t* entry = &(ret.first->second);
   entry->index = index;
+  entry->shard = shard;
   return entry;
 }
 
-// Allocate entry to store profiling context
-void dealloc_context_entry(context_entry_t* entry) {
-  if (pthread_mutex_lock(&mutex) != 0) {
-    perror("pthread_mutex_lock");
-    abort();
-  }
-
-  assert(context_array != NULL);
-  context_array->erase(entry->index);
+// Activate the stored context entry
+void activate_context_entry(context_entry_t* entry) {
+  entry->active = true;
+  entry->shard->active.fetch_add(1, std::memory_order_release);
+}
 
-  if (pthread_mutex_unlock(&mutex) != 0) {
-    perror("pthread_mutex_unlock");
-    abort();
+// Deactivate the stored context entry, called under the shard mutex
+void deactivate_context_entry(context_entry_t* entry) {
+  if (entry->active == true) {
+    entry->active = false;
+    entry->shard->active.fetch_sub(1, std::memory_order_release);
   }
 }
 
+// Allocate entry to store profiling context
+void dealloc_context_entry(context_entry_t* entry) {
+  context_shard_t* shard = entry->shard;
+  lock_context_shard(shard);
+  deactivate_context_entry(entry);
+  shard->array.erase(entry->index);
+  unlock_context_shard(shard);
+}
+
 // Global context map
 static std::mutex ctx_a_mutex;
 typedef std::map<hsa_agent_handle_t, context_entry_t*> ctx_a_map_t;
@@ -337,49 +551,304 @@ unsigned align_size(unsigned size, unsigned alignment) {
   return ((size + alignment - 1) & ~(alignment - 1));
 }
 
-// Output profiling results for input features
-void output_results(const context_entry_t* entry, const char* label) {
-  FILE* file = entry->file_handle;
-  const rocprofiler_feature_t* features = entry->features;
-  const unsigned feature_count = entry->feature_count;
-
+// Append features values to the context snapshot
+// Features of not supported data kinds are skipped if not strict
+void snapshot_values(const rocprofiler_feature_t* features, unsigned feature_count, result_snapshot_t* snapshot, bool strict) {
   for (unsigned i = 0; i < feature_count; ++i) {
     const rocprofiler_feature_t* p = &features[i];
-    fprintf(file, "  %s ", p->name);
+    rpl_bin_value_t value{};
     switch (p->data.kind) {
       // Output metrics results
       case ROCPROFILER_DATA_KIND_INT64:
-        fprintf(file, "(%lu)\n", p->data.result_int64);
+        value.kind = RPL_BIN_VALUE_INT64;
+        value.result_int64 = p->data.result_int64;
         break;
       case ROCPROFILER_DATA_KIND_DOUBLE:
-        fprintf(file, "(%.10lf)\n", p->data.result_double);
+        value.kind = RPL_BIN_VALUE_DOUBLE;
+        value.result_double = p->data.result_double;
         break;
       default:
+        if (!strict) continue;
         fprintf(stderr, "RPL-tool: undefined data kind(%u)\n", p->data.kind);
         abort();
     }
+    snapshot->names.push_back(p->name);
+    snapshot->values.push_back(value);
   }
 }
 
-// Output group intermediate profiling results, created internally for complex metrics
-void output_group(const context_entry_t* entry, const char* label) {
+// Make the context entry snapshot
+result_snapshot_t* new_snapshot(const context_entry_t* entry) {
+  const rocprofiler_dispatch_record_t* record = entry->data.record;
+  const AgentInfo* agent_info = HsaRsrcFactory::Instance().GetAgentInfo(entry->agent);
+
+  result_snapshot_t* snapshot = new result_snapshot_t();
+  snapshot->file_handle = entry->file_handle;
+  snapshot->header_on = (entry->index != UINT32_MAX) || (binary_output != 0);
+  snapshot->kernel_name = (to_truncate_names == 0) ? entry->data.kernel_name : get_filtr_kernel_name(entry->data.kernel_name);
+
+  rpl_bin_dispatch_t& rec = snapshot->dispatch;
+  rec.index = entry->index;
+  rec.gpu_id = agent_info->dev_index;
+  rec.queue_id = entry->data.queue_id;
+  rec.pid = my_pid;
+  rec.tid = entry->data.thread_id;
+  rec.grid_size = entry->kernel_properties.grid_size;
+  rec.workgroup_size = entry->kernel_properties.workgroup_size;
+  rec.lds_size = (entry->kernel_properties.lds_size + (AgentInfo::lds_block_size - 1)) & ~(AgentInfo::lds_block_size - 1);
+  rec.scratch_size = entry->kernel_properties.scratch_size;
+  rec.vgpr_count = (entry->kernel_properties.vgpr_count + 1) * agent_info->vgpr_block_size;
+  rec.sgpr_count = (entry->kernel_properties.sgpr_count + agent_info->sgpr_block_dflt) * agent_info->sgpr_block_size;
+  rec.fbarrier_count = entry->kernel_properties.fbarrier_count;
+  rec.queue_index = entry->data.queue_index;
+  rec.signal = entry->kernel_properties.signal.handle;
+  rec.object = entry->kernel_properties.object;
+  if (record) {
+    rec.flags = RPL_BIN_DISPATCH_TIME;
+    rec.dispatch = record->dispatch;
+    rec.begin = record->begin;
+    rec.end = record->end;
+    rec.complete = record->complete;
+  }
+  if (sampling_on) {
+    rec.flags |= RPL_BIN_DISPATCH_WEIGHT;
+    rec.weight = entry->data.weight;
+  }
+  if ((accumulate_on || window_on) && (entry->group.context != NULL)) {
+    uint32_t dispatch_count = 1;
+    hsa_status_t status = rocprofiler_group_get_dispatch_count(&(entry->group), &dispatch_count);
+    check_status(status);
+    rec.weight = ((rec.flags & RPL_BIN_DISPATCH_WEIGHT) ? rec.weight : 1) * dispatch_count;
+    rec.flags |= RPL_BIN_DISPATCH_WEIGHT;
+  }
+  if (window_on && (entry->group.context != NULL)) {
+    const uint64_t* objects = NULL;
+    uint32_t object_count = 0;
+    hsa_status_t status = rocprofiler_group_get_kernel_objects(&(entry->group), &objects, &object_count);
+    check_status(status);
+    snapshot->window_objects.assign(objects, objects + object_count);
+  }
+
   const rocprofiler_group_t* group = &(entry->group);
-  context_entry_t group_entry = *entry;
-  for (unsigned i = 0; i < group->feature_count; ++i) {
-    if (group->features[i]->data.kind == ROCPROFILER_DATA_KIND_INT64 ||
-        group->features[i]->data.kind == ROCPROFILER_DATA_KIND_DOUBLE) {
-      group_entry.features = group->features[i];
-      group_entry.feature_count = 1;
-      output_results(&group_entry, label);
+  if (group->context != NULL) {
+    if ((verbose == 1) && (entry->feature_count > 0)) {
+      // Group intermediate profiling results, created internally for complex metrics
+      for (unsigned i = 0; i < group->feature_count; ++i) snapshot_values(group->features[i], 1, snapshot, false);
+    }
+    snapshot_values(entry->features, entry->feature_count, snapshot, (binary_output == 0));
+  }
+
+  return snapshot;
+}
+
+// Output the context snapshot
+// Called by the results writer thread or under the output mutex,
+// or by the output shard owner thread with the shard writer argument
+void write_snapshot(result_snapshot_t* snapshot, void* arg) {
+  RplBinWriter* writer = (arg != NULL) ? reinterpret_cast<RplBinWriter*>(arg) : bin_writer;
+  if (snapshot->is_memcopy) {
+    writer->WriteMemcopy(&(snapshot->memcopy));
+    return;
+  }
+
+  rpl_bin_dispatch_t& rec = snapshot->dispatch;
+  const unsigned value_count = snapshot->values.size();
+
+  if (writer != NULL) {
+    const uint32_t kernel_id = writer->GetKernelId(rec, snapshot->kernel_name.c_str());
+    for (unsigned i = 0; i < value_count; ++i) snapshot->values[i].name_id = writer->GetStringId(snapshot->names[i]);
+    writer->WriteKernelDispatch(rec, kernel_id, snapshot->values);
+    return;
+  }
+
+  FILE* file_handle = snapshot->file_handle;
+  if (snapshot->header_on) {
+    fprintf(file_handle, "dispatch[%u], gpu-id(%u), queue-id(%u), queue-index(%lu), pid(%u), tid(%u), grd(%u), wgr(%u), lds(%u), scr(%u), vgpr(%u), sgpr(%u), fbar(%u), sig(0x%lx), obj(0x%lx)",
+      rec.index,
+      rec.gpu_id,
+      rec.queue_id,
+      rec.queue_index,
+      rec.pid,
+      rec.tid,
+      rec.grid_size,
+      rec.workgroup_size,
+      rec.lds_size,
+      rec.scratch_size,
+      rec.vgpr_count,
+      rec.sgpr_count,
+      rec.fbarrier_count,
+      rec.signal,
+      rec.object);
+    if (rec.flags & RPL_BIN_DISPATCH_WEIGHT) fprintf(file_handle, ", weight(%.3f)", rec.weight);
+    fprintf(file_handle, ", kernel-name(\"%s\")", snapshot->kernel_name.c_str());
+    if (rec.flags & RPL_BIN_DISPATCH_TIME) fprintf(file_handle, ", time(%lu,%lu,%lu,%lu)",
+      rec.dispatch,
+      rec.begin,
+      rec.end,
+      rec.complete);
+    fprintf(file_handle, "\n");
+    // The counters window dispatches kernel objects
+    if (!snapshot->window_objects.empty()) {
+      fprintf(file_handle, "  window-objs(");
+      for (unsigned i = 0; i < snapshot->window_objects.size(); ++i) {
+        fprintf(file_handle, "%s0x%lx", (i == 0) ? "" : ",", snapshot->window_objects[i]);
+      }
+      fprintf(file_handle, ")\n");
     }
   }
+
+  for (unsigned i = 0; i < value_count; ++i) {
+    const rpl_bin_value_t& value = snapshot->values[i];
+    fprintf(file_handle, "  %s ", snapshot->names[i]);
+    if (value.kind == RPL_BIN_VALUE_INT64) fprintf(file_handle, "(%lu)\n", value.result_int64);
+    else fprintf(file_handle, "(%.10lf)\n", value.result_double);
+  }
+}
+
+// Recording the realtime clock correlation for the results merging
+void write_clock(RplBinWriter* writer) {
+  HsaRsrcFactory& rsrc = HsaRsrcFactory::Instance();
+  const uint64_t timestamp_ns = rsrc.TimestampNs();
+  uint64_t realtime_ns = 0;
+  uint64_t error_ns = 0;
+  rsrc.GetTimeVal(HsaTimer::TIME_ID_CLOCK_REALTIME, timestamp_ns, &realtime_ns);
+  rsrc.GetTimeErr(HsaTimer::TIME_ID_CLOCK_REALTIME, &error_ns);
+  writer->WriteClock(timestamp_ns, realtime_ns, error_ns);
+}
+
+// Return the calling thread output shard, the shard is opened and registered on the first use
+output_shard_t* get_output_shard() {
+  if (output_shard != NULL) return output_shard;
+
+  std::ostringstream oss;
+  oss << result_prefix << "/" << GetPid() << "_" << output_shard_count.fetch_add(1) << "_results.bin";
+  FILE* file_handle = fopen(oss.str().c_str(), "w");
+  if (file_handle == NULL) {
+    std::ostringstream errmsg;
+    errmsg << "ROCProfiler: fopen error, file '" << oss.str().c_str() << "'";
+    perror(errmsg.str().c_str());
+    abort();
+  }
+  output_shard_t* shard = new output_shard_t{file_handle, new RplBinWriter(file_handle, GetPid()), NULL};
+  write_clock(shard->writer);
+
+  shard->next = output_shards.load(std::memory_order_relaxed);
+  while (!output_shards.compare_exchange_weak(shard->next, shard, std::memory_order_release, std::memory_order_relaxed)) {}
+  output_shard = shard;
+  return shard;
+}
+
+// Output the snapshot to the calling thread shard
+void write_shard_snapshot(result_snapshot_t* snapshot) {
+  write_snapshot(snapshot, get_output_shard()->writer);
+}
+
+// Close the output shards, the shards owner threads are not writing
+void close_output_shards() {
+  output_shard_t* shard = output_shards.exchange(NULL, std::memory_order_acquire);
+  while (shard != NULL) {
+    output_shard_t* next = shard->next;
+    delete shard->writer;
+    fclose(shard->file_handle);
+    delete shard;
+    shard = next;
+  }
+}
+
+// Memory copy GPU id, -1 for a CPU agent
+int32_t memcopy_gpu_id(const hsa_agent_t& agent) {
+  const AgentInfo* agent_info = HsaRsrcFactory::Instance().GetAgentInfo(agent);
+  return ((agent_info != NULL) && (agent_info->dev_type == HSA_DEVICE_TYPE_GPU)) ? (int32_t)agent_info->dev_index : -1;
+}
+
+// Memory copy completion callback, the binary copy record is written to the results stream
+void memcopy_callback(const rocprofiler_memcopy_record_t* record, void*) {
+  result_snapshot_t* snapshot = new result_snapshot_t();
+  snapshot->is_memcopy = true;
+  rpl_bin_memcopy_t& rec = snapshot->memcopy;
+  rec.pid = my_pid;
+  rec.src_gpu_id = memcopy_gpu_id(record->src_agent);
+  rec.dst_gpu_id = memcopy_gpu_id(record->dst_agent);
+  rec.index = record->index;
+  rec.size = record->size;
+  rec.begin = record->begin;
+  rec.end = record->end;
+  if (output_shards_on != 0) {
+    write_shard_snapshot(snapshot);
+    delete snapshot;
+  } else if (results_writer != NULL) {
+    results_writer->Push(snapshot);
+  } else {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    write_snapshot(snapshot, NULL);
+    delete snapshot;
+  }
+}
+
+// Flush the output results
+// Called by the results writer thread or under the output mutex
+void flush_results(void*) {
+  if (bin_writer != NULL) bin_writer->Flush();
+  else fflush(result_file_handle);
+}
+
+// Aggregate the context snapshot to the kernels statistics
+void add_kernel_stats(const result_snapshot_t* snapshot) {
+  const rpl_bin_dispatch_t& rec = snapshot->dispatch;
+  const uint64_t duration_ns = ((rec.flags & RPL_BIN_DISPATCH_TIME) && (rec.end > rec.begin)) ? rec.end - rec.begin : 0;
+  const double weight = (rec.flags & RPL_BIN_DISPATCH_WEIGHT) ? rec.weight : 1.0;
+  kernel_stats->AddDispatch(snapshot->kernel_name, duration_ns, weight);
+  for (unsigned i = 0; i < snapshot->values.size(); ++i) {
+    const rpl_bin_value_t& value = snapshot->values[i];
+    const double v = (value.kind == RPL_BIN_VALUE_INT64) ? static_cast<double>(value.result_int64) : value.result_double;
+    kernel_stats->AddValue(snapshot->kernel_name, i, snapshot->names[i], v);
+  }
+}
+
+// Pass the context snapshot duration and values to the kernel convergence statistics
+void add_converge_values(const result_snapshot_t* snapshot) {
+  static thread_local std::vector<double> values;
+  const rpl_bin_dispatch_t& rec = snapshot->dispatch;
+  values.clear();
+  if (rec.flags & RPL_BIN_DISPATCH_TIME) values.push_back((rec.end > rec.begin) ? double(rec.end - rec.begin) : 0);
+  for (const rpl_bin_value_t& value : snapshot->values) {
+    values.push_back((value.kind == RPL_BIN_VALUE_INT64) ? static_cast<double>(value.result_int64) : value.result_double);
+  }
+  const hsa_status_t status = rocprofiler_converge_update(rec.object, values.data(), values.size());
+  check_status(status);
+}
+
+// Output the kernels statistics, to '<pid>_kernel_stats.csv' if the output directory is set
+void dump_kernel_stats() {
+  FILE* file = stdout;
+  std::string path;
+  if (result_prefix != NULL) {
+    std::ostringstream oss;
+    oss << result_prefix << "/" << GetPid() << "_kernel_stats.csv";
+    path = oss.str();
+    file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+      std::ostringstream errmsg;
+      errmsg << "ROCProfiler: fopen error, file '" << path << "'";
+      perror(errmsg.str().c_str());
+      abort();
+    }
+  } else {
+    printf("ROCProfiler: kernels statistics:\n");
+  }
+  kernel_stats->Dump(file, (sampling_on != 0) || (accumulate_on != 0) || (window_on != 0));
+  if (file != stdout) {
+    fclose(file);
+    printf("ROCProfiler: kernels statistics '%s'\n", path.c_str());
+  }
 }
 
 // Dump stored context entry
 bool dump_context_entry(context_entry_t* entry, bool to_clean = true) {
+  dump_overhead_scope_t overhead;
   hsa_status_t status = HSA_STATUS_ERROR;
 
-  volatile std::atomic<bool>* valid = reinterpret_cast<std::atomic<bool>*>(&entry->valid);
+  std::atomic<bool>* valid = &(entry->valid);
   while (valid->load() == false) sched_yield();
 
   const rocprofiler_dispatch_record_t* record = entry->data.record;
@@ -389,58 +858,55 @@ bool dump_context_entry(context_entry_t* entry, bool to_clean = true) {
     }
   }
 
-  ++context_collected;
-
-  const uint32_t index = entry->index;
-  if (index != UINT32_MAX) {
-    FILE* file_handle = entry->file_handle;
-    const std::string nik_name = (to_truncate_names == 0) ? entry->data.kernel_name : filtr_kernel_name(entry->data.kernel_name);
-    const AgentInfo* agent_info = HsaRsrcFactory::Instance().GetAgentInfo(entry->agent);
-
-    fprintf(file_handle, "dispatch[%u], gpu-id(%u), queue-id(%u), queue-index(%lu), pid(%u), tid(%u), grd(%u), wgr(%u), lds(%u), scr(%u), vgpr(%u), sgpr(%u), fbar(%u), sig(0x%lx), obj(0x%lx), kernel-name(\"%s\")",
-      index,
-      agent_info->dev_index,
-      entry->data.queue_id,
-      entry->data.queue_index,
-      my_pid,
-      entry->data.thread_id,
-      entry->kernel_properties.grid_size,
-      entry->kernel_properties.workgroup_size,
-      (entry->kernel_properties.lds_size + (AgentInfo::lds_block_size - 1)) & ~(AgentInfo::lds_block_size - 1),
-      entry->kernel_properties.scratch_size,
-      (entry->kernel_properties.vgpr_count + 1) * agent_info->vgpr_block_size,
-      (entry->kernel_properties.sgpr_count + agent_info->sgpr_block_dflt) * agent_info->sgpr_block_size,
-      entry->kernel_properties.fbarrier_count,
-      entry->kernel_properties.signal.handle,
-      entry->kernel_properties.object,
-      nik_name.c_str());
-    if (record) fprintf(file_handle, ", time(%lu,%lu,%lu,%lu)",
-      record->dispatch,
-      record->begin,
-      record->end,
-      record->complete);
-    fprintf(file_handle, "\n");
-    fflush(file_handle);
+  signal_collected();
+
+  rocprofiler_group_t& group = entry->group;
+  if ((group.context != NULL) && (entry->feature_count > 0)) {
+    // All replayed groups data are collected
+    uint32_t group_count = 1;
+    if (kernel_replay != 0) {
+      status = rocprofiler_group_count(group.context, &group_count);
+      check_status(status);
+    }
+    for (uint32_t group_index = 0; group_index < group_count; ++group_index) {
+      rocprofiler_group_t replay_group = group;
+      if (group_count > 1) {
+        status = rocprofiler_get_group(group.context, group_index, &replay_group);
+        check_status(status);
+      }
+      status = rocprofiler_group_get_data(&replay_group);
+      check_status(status);
+    }
+    status = rocprofiler_get_metrics(group.context);
+    check_status(status);
   }
+
+  // The snapshot is written by the writer thread if enabled
+  result_snapshot_t* snapshot = new_snapshot(entry);
+  if (kernel_stats != NULL) add_kernel_stats(snapshot);
+  if (converge_on) add_converge_values(snapshot);
+  if (shm_channel != NULL) shm_channel->Push(snapshot->dispatch, snapshot->kernel_name.c_str(), snapshot->names, snapshot->values);
+  if (kernel_stats_mode == 2) {
+    delete snapshot;
+  } else if (output_shards_on != 0) {
+    write_shard_snapshot(snapshot);
+    delete snapshot;
+  } else if (results_writer != NULL) {
+    results_writer->Push(snapshot);
+  } else {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    write_snapshot(snapshot, NULL);
+    if (bin_writer == NULL) fflush(snapshot->file_handle);
+    delete snapshot;
+  }
+
   if (record && to_clean) {
     delete record;
     entry->data.record = NULL;
   }
 
-  rocprofiler_group_t& group = entry->group;
   if (group.context != NULL) {
-    if (entry->feature_count > 0) {
-      status = rocprofiler_group_get_data(&group);
-      check_status(status);
-      if (verbose == 1) output_group(entry, "group0-data");
-
-      status = rocprofiler_get_metrics(group.context);
-      check_status(status);
-    }
-    std::ostringstream oss;
-    oss << index << "__" << filtr_kernel_name(entry->data.kernel_name);
-    output_results(entry, oss.str().substr(0, KERNEL_NAME_LEN_MAX).c_str());
-    if (to_clean) free(const_cast<char*>(entry->data.kernel_name));
+    if (to_clean && !kernel_names_interned) free(const_cast<char*>(entry->data.kernel_name));
 
     // Finishing cleanup
     // Deleting profiling context will delete all allocated resources
@@ -453,47 +919,263 @@ bool dump_context_entry(context_entry_t* entry, bool to_clean = true) {
 // Wait for and dump all stored contexts for a given queue if not NULL
 void dump_context_array(hsa_queue_t* queue) {
   bool done = false;
-  while (done == false) {
+  while ((done == false) && (context_shards != NULL)) {
     done = true;
-    if (pthread_mutex_lock(&mutex) != 0) {
-      perror("pthread_mutex_lock");
-      abort();
-    }
+    for (uint32_t i = 0; i < CONTEXT_SHARD_MAX; ++i) {
+      context_shard_t* shard = &context_shards[i];
+      if (shard->active.load(std::memory_order_acquire) == 0) continue;
+      lock_context_shard(shard);
 
-    if (context_array) {
-      auto it = context_array->begin();
-      auto end = context_array->end();
+      auto it = shard->array.begin();
+      auto end = shard->array.end();
       while (it != end) {
         auto cur = it++;
         context_entry_t* entry = &(cur->second);
-        volatile std::atomic<bool>* valid = reinterpret_cast<std::atomic<bool>*>(&entry->valid);
+        std::atomic<bool>* valid = &(entry->valid);
         while (valid->load() == false) sched_yield();
         if ((queue == NULL) || (entry->data.queue == queue)) {
           if (entry->active == true) {
             if (dump_context_entry(&(cur->second)) == false) done = false;
-            else entry->active = false;
+            else deactivate_context_entry(entry);
           }
         }
       }
-    }
 
-    if (pthread_mutex_unlock(&mutex) != 0) {
-      perror("pthread_mutex_unlock");
-      abort();
+      unlock_context_shard(shard);
     }
     if (done == false) sched_yield();
   }
 }
 
-// Profiling completion handler
-// Dump and delete the context entry
-bool context_handler(rocprofiler_group_t group, void* arg) {
-  context_entry_t* entry = reinterpret_cast<context_entry_t*>(arg);
+// Wait for all fetched contexts pools entries to be collected
+void wait_context_pools() {
+  if (callbacks_arg == NULL) return;
+  for (unsigned i = 0; i < callbacks_arg->pool_count; ++i) {
+    rocprofiler_pool_t* pool = callbacks_arg->pools[i].load(std::memory_order_acquire);
+    if (pool == NULL) continue;
+    hsa_status_t status = rocprofiler_pool_flush(pool);
+    check_status(status);
+  }
 
   if (pthread_mutex_lock(&mutex) != 0) {
     perror("pthread_mutex_lock");
     abort();
   }
+  wait_collected([]() { return context_collected >= context_fetched.load(std::memory_order_relaxed); });
+  if (pthread_mutex_unlock(&mutex) != 0) {
+    perror("pthread_mutex_unlock");
+    abort();
+  }
+}
+
+// Dump and release the stored contexts, only the completed ones if 'complete_only'
+// The contexts are released by the completion handlers if the handlers are used
+void release_context_array(bool complete_only) {
+  if (result_prefix != NULL) return;
+  bool done = false;
+  while ((done == false) && (context_shards != NULL)) {
+    done = true;
+    for (uint32_t i = 0; i < CONTEXT_SHARD_MAX; ++i) {
+      context_shard_t* shard = &context_shards[i];
+      lock_context_shard(shard);
+
+      auto it = shard->array.begin();
+      while (it != shard->array.end()) {
+        auto cur = it++;
+        context_entry_t* entry = &(cur->second);
+        std::atomic<bool>* valid = &(entry->valid);
+        if (valid->load() == false) {
+          if (!complete_only) done = false;
+          continue;
+        }
+        if (entry->active == true) {
+          const rocprofiler_dispatch_record_t* record = entry->data.record;
+          if (complete_only && ((record == NULL) || (record->complete == 0))) continue;
+          if (dump_context_entry(entry) == false) {
+            if (!complete_only) done = false;
+            continue;
+          }
+        }
+        deactivate_context_entry(entry);
+        shard->array.erase(cur);
+      }
+
+      unlock_context_shard(shard);
+    }
+    if (done == false) sched_yield();
+  }
+}
+
+// Flush the output results if the writer thread is not used
+void flush_output() {
+  if (results_writer != NULL) return;
+  std::lock_guard<std::mutex> lock(output_mutex);
+  flush_results(NULL);
+}
+
+// Sleeping for the given time, returns false if the tool is unloading
+bool ctrl_sleep(const uint64_t& time_us) {
+  std::unique_lock<std::mutex> lck(ctrl_mutex);
+  return !ctrl_cond.wait_for(lck, std::chrono::microseconds(time_us), []() { return ctrl_stop; });
+}
+
+// Periodic collection thread, the completed window contexts are drained and released
+// at the window end, so the memory is bounded by one window
+void ctrl_thr_fun() {
+  if (ctrl_sleep(ctrl_delay_us) == false) return;
+  while (true) {
+    check_status(rocprofiler_start_queue_callbacks());
+    // Collecting to the end after the delay
+    if (ctrl_length_us == 0) return;
+    if (ctrl_sleep(ctrl_length_us) == false) return;
+    check_status(rocprofiler_stop_queue_callbacks());
+
+    wait_context_pools();
+    release_context_array(false);
+    flush_output();
+
+    // Single window
+    if (ctrl_period_us == 0) return;
+    const uint32_t pause_us = (ctrl_period_us > ctrl_length_us) ? ctrl_period_us - ctrl_length_us : 0;
+    if (ctrl_sleep(pause_us) == false) return;
+  }
+}
+
+// Periodic flush thread, the completed contexts are released
+void flush_thr_fun() {
+  while (ctrl_sleep(flush_period_us)) {
+    release_context_array(true);
+    flush_output();
+  }
+}
+
+// Replacing the dispatch callbacks metrics, the callbacks should be stopped and the contexts drained
+rpl_shm_status_t shm_set_metrics(const std::string& metrics) {
+  std::vector<std::string> names;
+  std::istringstream iss(metrics);
+  std::string token;
+  while (std::getline(iss, token, ',')) {
+    const size_t first = token.find_first_not_of(" \t");
+    if (first == std::string::npos) continue;
+    names.push_back(token.substr(first, token.find_last_not_of(" \t") - first + 1));
+  }
+  const unsigned feature_count = names.size();
+  // The contexts pools require the metrics
+  if ((callbacks_arg != NULL) && (feature_count == 0)) return RPL_SHM_STATUS_BAD_METRIC;
+  rocprofiler_feature_t* features = new rocprofiler_feature_t[feature_count];
+  for (unsigned i = 0; i < feature_count; ++i) {
+    features[i] = {};
+    features[i].kind = ROCPROFILER_FEATURE_KIND_METRIC;
+    features[i].name = strdup(names[i].c_str());
+  }
+
+  // The metrics are checked on the first GPU agent, one group is required if the replay is off
+  bool valid = true;
+  if (feature_count != 0) {
+    const AgentInfo* agent_info = NULL;
+    rocprofiler_t* context = NULL;
+    rocprofiler_properties_t properties{};
+    uint32_t group_count = 0;
+    valid = HsaRsrcFactory::Instance().GetGpuAgentInfo(0, &agent_info) &&
+            (rocprofiler_open(agent_info->dev_id, features, feature_count, &context, 0, &properties) == HSA_STATUS_SUCCESS);
+    if (valid) {
+      valid = (rocprofiler_group_count(context, &group_count) == HSA_STATUS_SUCCESS) &&
+              ((group_count == 1) || (kernel_replay != 0));
+      rocprofiler_close(context);
+    }
+  }
+  if (!valid) {
+    for (unsigned i = 0; i < feature_count; ++i) free(const_cast<char*>(features[i].name));
+    delete[] features;
+    return RPL_SHM_STATUS_BAD_METRIC;
+  }
+
+  // The previous features are not released, the dumped entries names reference them
+  if (callbacks_arg != NULL) {
+    // The drained pools are closed, the new metrics pools are opened on the next dispatches
+    for (unsigned i = 0; i < callbacks_arg->pool_count; ++i) {
+      rocprofiler_pool_t* pool = callbacks_arg->pools[i].exchange(NULL);
+      if (pool != NULL) check_status(rocprofiler_pool_close(pool));
+    }
+    handler_arg_t* handler_arg = reinterpret_cast<handler_arg_t*>(callbacks_arg->properties.handler_arg);
+    handler_arg->features = features;
+    handler_arg->feature_count = feature_count;
+    callbacks_arg->features = features;
+    callbacks_arg->feature_count = feature_count;
+  } else {
+    callbacks_data->features = features;
+    callbacks_data->feature_count = feature_count;
+    callbacks_data->set = NULL;
+  }
+  shm_channel->Header()->metrics_seq.fetch_add(1, std::memory_order_relaxed);
+  printf("ROCProfiler: control channel metrics set '%s'\n", metrics.c_str());
+  return RPL_SHM_STATUS_OK;
+}
+
+// Shared memory control thread, the agent commands are polled and executed
+void shm_thr_fun() {
+  rpl_shm_header_t* header = shm_channel->Header();
+  while (ctrl_sleep((uint64_t)shm_poll_ms * 1000)) {
+    uint32_t seq = 0;
+    uint32_t command = RPL_SHM_CMD_NONE;
+    std::string metrics;
+    if (shm_channel->PendingCommand(&seq, &command, &metrics) == false) continue;
+
+    rpl_shm_status_t status = RPL_SHM_STATUS_OK;
+    const bool enabled = (header->enabled.load() != 0);
+    if (command == RPL_SHM_CMD_ENABLE) {
+      if (!enabled) check_status(rocprofiler_start_queue_callbacks());
+      header->enabled.store(1);
+    } else if ((command == RPL_SHM_CMD_DISABLE) || (command == RPL_SHM_CMD_METRICS)) {
+      if (enabled) {
+        check_status(rocprofiler_stop_queue_callbacks());
+        wait_context_pools();
+        release_context_array(false);
+        flush_output();
+      }
+      if (command == RPL_SHM_CMD_METRICS) {
+        status = shm_set_metrics(metrics);
+        if (enabled) check_status(rocprofiler_start_queue_callbacks());
+      } else {
+        header->enabled.store(0);
+      }
+    } else {
+      status = RPL_SHM_STATUS_UNSUPPORTED;
+    }
+    shm_channel->CompleteCommand(seq, status);
+  }
+}
+
+// Stopping the periodic collection, flush and control channel threads
+void ctrl_threads_stop() {
+  {
+    std::lock_guard<std::mutex> lck(ctrl_mutex);
+    ctrl_stop = true;
+  }
+  ctrl_cond.notify_all();
+  if (ctrl_thread != NULL) {
+    ctrl_thread->join();
+    delete ctrl_thread;
+    ctrl_thread = NULL;
+  }
+  if (flush_thread != NULL) {
+    flush_thread->join();
+    delete flush_thread;
+    flush_thread = NULL;
+  }
+  if (shm_thread != NULL) {
+    shm_thread->join();
+    delete shm_thread;
+    shm_thread = NULL;
+  }
+}
+
+// Profiling completion handler
+// Dump and delete the context entry
+bool context_handler(rocprofiler_group_t group, void* arg) {
+  context_entry_t* entry = reinterpret_cast<context_entry_t*>(arg);
+  context_shard_t* shard = entry->shard;
+  lock_context_shard(shard);
 
   bool ret = true;
   if (entry->active == true) {
@@ -506,14 +1188,11 @@ bool context_handler(rocprofiler_group_t group, void* arg) {
   if (ret) dealloc_context_entry(entry);
 
   if (trace_on) {
-    fprintf(stdout, "tool::handler: context_array %d tid %u\n", (int)(context_array->size()), GetTid());
+    fprintf(stdout, "tool::handler: context_array %d tid %u\n", (int)(shard->array.size()), GetTid());
     fflush(stdout);
   }
 
-  if (pthread_mutex_unlock(&mutex) != 0) {
-    perror("pthread_mutex_unlock");
-    abort();
-  }
+  unlock_context_shard(shard);
 
   return false;
 }
@@ -529,17 +1208,10 @@ bool context_pool_handler(const rocprofiler_pool_entry_t* entry, void* arg) {
   ctx_entry->data.kernel_name = ctx_entry->kernel_name_it->second.name;
   ctx_entry->file_handle = result_file_handle;
 
-  if (pthread_mutex_lock(&mutex) != 0) {
-    perror("pthread_mutex_lock");
-    abort();
-  }
-
+  context_shard_t* shard = get_context_shard(ctx_entry->agent);
+  lock_context_shard(shard);
   dump_context_entry(ctx_entry, false);
-
-  if (pthread_mutex_unlock(&mutex) != 0) {
-    perror("pthread_mutex_unlock");
-    abort();
-  }
+  unlock_context_shard(shard);
 
   HsaRsrcFactory::ReleaseKernelNameRef(ctx_entry->kernel_name_it);
 
@@ -551,11 +1223,8 @@ bool context_pool_handler(const rocprofiler_pool_entry_t* entry, void* arg) {
 // Return true if the context was dumped successfully
 bool context_handler_con(rocprofiler_group_t group, void* arg) {
   context_entry_t* entry = reinterpret_cast<context_entry_t*>(arg);
-
-  if (pthread_mutex_lock(&mutex) != 0) {
-    perror("pthread_mutex_lock");
-    abort();
-  }
+  context_shard_t* shard = get_context_shard(entry->agent);
+  lock_context_shard(shard);
 
   bool ret = true;
   ret = dump_context_entry(entry);
@@ -569,10 +1238,7 @@ bool context_handler_con(rocprofiler_group_t group, void* arg) {
     fflush(stdout);
   }
 
-  if (pthread_mutex_unlock(&mutex) != 0) {
-    perror("pthread_mutex_unlock");
-    abort();
-  }
+  unlock_context_shard(shard);
 
   return false;
 }
@@ -603,6 +1269,7 @@ bool check_filter(const rocprofiler_callback_data_t* callback_data, const callba
   if (found && kernel_string) {
     found = false;
     for (const std::string& s : *kernel_string) {
+      if (callback_data->kernel_name == NULL) break;
       if (std::string(callback_data->kernel_name).find(s) != std::string::npos) {
         found = true;
       }
@@ -631,15 +1298,19 @@ void set_kernel_properties(const rocprofiler_callback_data_t* callback_data,
   const hsa_kernel_dispatch_packet_t* packet = callback_data->packet;
   kernel_properties_t* kernel_properties_ptr = &(entry->kernel_properties);
   const amd_kernel_code_t* kernel_code = callback_data->kernel_code;
+  HsaRsrcFactory::kernel_props_t kernel_props{};
 
   entry->data = *callback_data;
 
   if (kernel_code == NULL) {
+    // The kernel properties pre-computed at the kernel symbol loading
     const uint64_t kernel_object = callback_data->packet->kernel_object;
-    kernel_code = GetKernelCode(kernel_object);
     entry->kernel_name_it = HsaRsrcFactory::AcquireKernelNameRef(kernel_object);
+    const HsaRsrcFactory::symbols_map_data_t& symbol = entry->kernel_name_it->second;
+    kernel_props = (symbol.code != NULL) ? symbol.props : HsaRsrcFactory::KernelProps(GetKernelCode(kernel_object));
   } else {
-    entry->data.kernel_name = strdup(callback_data->kernel_name);
+    if (!kernel_names_interned) entry->data.kernel_name = strdup(callback_data->kernel_name);
+    kernel_props = HsaRsrcFactory::KernelProps(kernel_code);
   }
 
   uint64_t grid_size = packet->grid_size_x * packet->grid_size_y * packet->grid_size_z;
@@ -650,9 +1321,9 @@ void set_kernel_properties(const rocprofiler_callback_data_t* callback_data,
   kernel_properties_ptr->workgroup_size = (uint32_t)workgroup_size;
   kernel_properties_ptr->lds_size = packet->group_segment_size;
   kernel_properties_ptr->scratch_size = packet->private_segment_size;
-  kernel_properties_ptr->vgpr_count = AMD_HSA_BITS_GET(kernel_code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WORKITEM_VGPR_COUNT);
-  kernel_properties_ptr->sgpr_count = AMD_HSA_BITS_GET(kernel_code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WAVEFRONT_SGPR_COUNT);
-  kernel_properties_ptr->fbarrier_count = kernel_code->workgroup_fbarrier_count;
+  kernel_properties_ptr->vgpr_count = kernel_props.vgpr_count;
+  kernel_properties_ptr->sgpr_count = kernel_props.sgpr_count;
+  kernel_properties_ptr->fbarrier_count = kernel_props.fbarrier_count;
   kernel_properties_ptr->signal = callback_data->completion_signal;
   kernel_properties_ptr->object = callback_data->packet->kernel_object;
 }
@@ -674,7 +1345,7 @@ hsa_status_t dispatch_callback(const rocprofiler_callback_data_t* callback_data,
   }
   // Profiling context
   // Context entry
-  context_entry_t* entry = alloc_context_entry();
+  context_entry_t* entry = alloc_context_entry(callback_data->agent);
   // Setting kernel properties
   set_kernel_properties(callback_data, entry);
 
@@ -707,11 +1378,11 @@ hsa_status_t dispatch_callback(const rocprofiler_callback_data_t* callback_data,
                             &context, 0 /*ROCPROFILER_MODE_SINGLEGROUP*/, &properties);
   check_status(status);
 
-  // Check that we have only one profiling group
+  // Check that we have only one profiling group, the groups are replayed otherwise
   uint32_t group_count = 0;
   status = rocprofiler_group_count(context, &group_count);
   check_status(status);
-  assert(group_count == 1);
+  assert((group_count == 1) || (kernel_replay != 0));
   // Get group[0]
   const uint32_t group_index = 0;
   status = rocprofiler_get_group(context, group_index, group);
@@ -723,11 +1394,11 @@ hsa_status_t dispatch_callback(const rocprofiler_callback_data_t* callback_data,
   entry->features = features;
   entry->feature_count = feature_count;
   entry->file_handle = tool_data->file_handle;
-  entry->active = true;
-  reinterpret_cast<std::atomic<bool>*>(&entry->valid)->store(true);
+  activate_context_entry(entry);
+  entry->valid.store(true, std::memory_order_release);
 
   if (trace_on) {
-    fprintf(stdout, "tool::dispatch: context_array %d tid %u\n", (int)(context_array->size()), GetTid());
+    fprintf(stdout, "tool::dispatch: context_array %d tid %u\n", (int)(entry->shard->array.size()), GetTid());
     fflush(stdout);
   }
 
@@ -741,10 +1412,28 @@ hsa_status_t dispatch_callback_opt(const rocprofiler_callback_data_t* callback_d
   hsa_agent_t agent = callback_data->agent;
   const unsigned gpu_id = HsaRsrcFactory::Instance().GetAgentInfo(agent)->dev_index;
   callbacks_arg_t* callbacks_arg = reinterpret_cast<callbacks_arg_t*>(user_data);
-  rocprofiler_pool_t* pool = callbacks_arg->pools[gpu_id];
+
+  // Checking dispatch condition, the kernel name is not passed in the optimized mode
+  const callbacks_data_t* filter = callbacks_arg->filter;
+  if (filter != NULL) {
+    rocprofiler_callback_data_t filter_data = *callback_data;
+    // The not registered kernel, the code objects tracking is off, does not match the kernel filter
+    if ((filter->kernel_string != NULL) && (filter_data.kernel_name == NULL)) {
+      filter_data.kernel_name = HsaRsrcFactory::FindKernelNameRef(callback_data->packet->kernel_object);
+    }
+    if (check_filter(&filter_data, filter) == false) {
+      next_context_count();
+      return HSA_STATUS_SUCCESS;
+    }
+  }
+  const uint32_t index = next_context_count() - 1;
+
+  // Fetching the context, waiting for a free pool entry if the outstanding limit is reached
+  rocprofiler_pool_t* pool = get_context_pool(callbacks_arg, gpu_id, agent);
   rocprofiler_pool_entry_t pool_entry{};
   status = rocprofiler_pool_fetch(pool, &pool_entry);
   check_status(status);
+  context_fetched.fetch_add(1, std::memory_order_relaxed);
   // Profiling context entry
   rocprofiler_t* context = pool_entry.context;
   context_entry_t* entry = reinterpret_cast<context_entry_t*>(pool_entry.payload);
@@ -755,11 +1444,11 @@ hsa_status_t dispatch_callback_opt(const rocprofiler_callback_data_t* callback_d
   check_status(status);
 
   // Fill profiling context entry
-  entry->index = UINT32_MAX;
+  entry->index = index;
   entry->agent = agent;
   entry->group = *group;
 
-  reinterpret_cast<std::atomic<bool>*>(&entry->valid)->store(true);
+  entry->valid.store(true, std::memory_order_release);
   return status;
 }
 
@@ -866,6 +1555,25 @@ static inline void check_env_var(const char* var_name, uint64_t& val) {
   if (str != NULL ) val = atoll(str);
 }
 
+// Size option value with optional K/M suffix
+static inline uint32_t get_size_option(const std::string& value, const char* label) {
+  std::string str = normalize_token(value, true, label);
+  uint32_t multiplier = 1;
+  switch (str.back()) {
+    case 'K': multiplier = 1024; break;
+    case 'M': multiplier = 1024 * 1024; break;
+  }
+  if (multiplier != 1) str = str.substr(0, str.length() - 1);
+  return strtoull(str.c_str(), NULL, 0) * multiplier;
+}
+
+// Set results writer overflow policy
+static inline void set_writer_policy(const char* name) {
+  if (results_writer_t::ParsePolicy(name, &writer_policy) == false) {
+    fatal(std::string("ROCProfiler: bad results writer policy '") + name + "', expected block|drop-oldest|count");
+  }
+}
+
 // HSA intercepting routines
 
 // HSA unified callback function
@@ -928,7 +1636,9 @@ hsa_status_t hsa_ksymbol_cb(rocprofiler_hsa_cb_id_t id,
                     const rocprofiler_hsa_callback_data_t* data,
                     void* arg)
 {
-  HsaRsrcFactory::SetKernelNameRef(data->ksymbol.object, data->ksymbol.name, data->ksymbol.unload);
+  // The kernel code is queried once at the kernel symbol loading
+  const amd_kernel_code_t* kernel_code = (data->ksymbol.unload == 0) ? GetKernelCode(data->ksymbol.object) : NULL;
+  HsaRsrcFactory::SetKernelNameRef(data->ksymbol.object, data->ksymbol.name, data->ksymbol.unload, kernel_code);
   return HSA_STATUS_SUCCESS;
 }
 
@@ -978,28 +1688,57 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
       it = opts.find("heartbeat");
       if (it != opts.end()) { CTX_OUTSTANDING_MON = atol(it->second.c_str()); }
       it = opts.find("trace-size");
-      if (it != opts.end()) {
-        std::string str = normalize_token(it->second, true, "option trace-size");
-        uint32_t multiplier = 1;
-        switch (str.back()) {
-          case 'K': multiplier = 1024; break;
-          case 'M': multiplier = 1024 * 1024; break;
-        }
-        if (multiplier != 1) str = str.substr(0, str.length() - 1);
-        settings->trace_size = strtoull(str.c_str(), NULL, 0) * multiplier;
-      }
+      if (it != opts.end()) { settings->trace_size = get_size_option(it->second, "option trace-size"); }
+      it = opts.find("trace-stream");
+      if (it != opts.end()) { settings->trace_stream = get_size_option(it->second, "option trace-stream"); }
       it = opts.find("trace-local");
       if (it != opts.end()) { settings->trace_local = (it->second == "on"); }
       it = opts.find("obj-tracking");
       if (it != opts.end()) { settings->code_obj_tracking = (it->second == "on"); }
       it = opts.find("memcopies");
       if (it != opts.end()) { settings->memcopy_tracking = (it->second == "on"); }
+      it = opts.find("kernel-replay");
+      if (it != opts.end()) { settings->kernel_replay = (it->second == "on") ? 1 : 0; }
+      it = opts.find("sample-rate");
+      if (it != opts.end()) { settings->sample_rate = atol(it->second.c_str()); }
+      it = opts.find("sample-budget");
+      if (it != opts.end()) { settings->sample_budget = atol(it->second.c_str()); }
+      it = opts.find("converge-tol");
+      if (it != opts.end()) { settings->converge_tol = atol(it->second.c_str()); }
+      it = opts.find("converge-rate");
+      if (it != opts.end()) { settings->converge_rate = atol(it->second.c_str()); }
+      it = opts.find("binary");
+      if (it != opts.end()) { binary_output = (it->second == "on") ? 1 : 0; }
+      it = opts.find("output-shards");
+      if (it != opts.end()) { output_shards_on = (it->second == "on") ? 1 : 0; }
+      it = opts.find("writer-thread");
+      if (it != opts.end()) { writer_thread = (it->second == "on") ? 1 : 0; }
+      it = opts.find("writer-queue");
+      if (it != opts.end()) { writer_queue_size = atol(it->second.c_str()); }
+      it = opts.find("writer-flush");
+      if (it != opts.end()) { writer_flush_interval = atol(it->second.c_str()); }
+      it = opts.find("writer-policy");
+      if (it != opts.end()) { set_writer_policy(it->second.c_str()); }
+      it = opts.find("kernel-stats");
+      if (it != opts.end()) { kernel_stats_mode = (it->second == "only") ? 2 : (it->second == "on") ? 1 : 0; }
     }
   }
   // Enable verbose mode
   check_env_var("ROCP_VERBOSE_MODE", verbose);
   // Enable kernel names truncating
   check_env_var("ROCP_TRUNCATE_NAMES", to_truncate_names);
+  // Enable binary results output
+  check_env_var("ROCP_BINARY_OUTPUT", binary_output);
+  // Set results writer parameters
+  check_env_var("ROCP_WRITER_THREAD", writer_thread);
+  check_env_var("ROCP_OUTPUT_SHARDS", output_shards_on);
+  check_env_var("ROCP_WRITER_QUEUE", writer_queue_size);
+  check_env_var("ROCP_WRITER_FLUSH", writer_flush_interval);
+  const char* writer_policy_str = getenv("ROCP_WRITER_POLICY");
+  if (writer_policy_str != NULL) set_writer_policy(writer_policy_str);
+  // Enable on-line kernels statistics, 2 - the statistics only
+  check_env_var("ROCP_KERNEL_STATS", kernel_stats_mode);
+  if (kernel_stats_mode != 0) kernel_stats = new RplKernelStats;
   // Set outstanding dispatches parameter
   check_env_var("ROCP_OUTSTANDING_WAIT", CTX_OUTSTANDING_WAIT);
   check_env_var("ROCP_OUTSTANDING_MAX", CTX_OUTSTANDING_MAX);
@@ -1012,6 +1751,8 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
   check_env_var("ROCP_TRACE_SIZE", settings->trace_size);
   // Set trace local buffer
   check_env_var("ROCP_TRACE_LOCAL", settings->trace_local);
+  // Set trace streaming readback chunk size
+  check_env_var("ROCP_TRACE_STREAM", settings->trace_stream);
   // Set code objects tracking
   check_env_var("ROCP_OBJ_TRACKING", settings->code_obj_tracking);
   // Set memcopies tracking
@@ -1021,7 +1762,59 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
   if (settings->hsa_intercepting) rocprofiler_set_hsa_callbacks(hsa_callbacks, (void*)14);
   // Enable concurrent mode
   check_env_var("ROCP_K_CONCURRENT", settings->k_concurrent);
-  // Enable optmized mode
+  // Concurrent counters window, by dispatches number and by time in usec
+  check_env_var("ROCP_K_WINDOW", settings->k_window);
+  check_env_var("ROCP_K_WINDOW_TIME", settings->k_window_time);
+  // Enable kernel replay mode
+  check_env_var("ROCP_KERNEL_REPLAY", settings->kernel_replay);
+  kernel_replay = settings->kernel_replay;
+  // Enable dispatches sampling, by rate or by events per second budget
+  check_env_var("ROCP_SAMPLE_RATE", settings->sample_rate);
+  check_env_var("ROCP_SAMPLE_BUDGET", settings->sample_budget);
+  // Per-kernel adaptive profiling, the convergence tolerance in percent and the background rate
+  check_env_var("ROCP_CONVERGE_TOL", settings->converge_tol);
+  check_env_var("ROCP_CONVERGE_RATE", settings->converge_rate);
+  converge_on = (settings->converge_tol != 0) ? 1 : 0;
+  sampling_on = ((settings->sample_rate > 1) || (settings->sample_budget != 0) || converge_on) ? 1 : 0;
+  // Intercepted queues filters, GPU indexes and queue types masks, and the per-queue profiled dispatches budget
+  check_env_var("ROCP_QUEUE_AGENTS", settings->q_agents);
+  check_env_var("ROCP_QUEUE_TYPES", settings->q_types);
+  check_env_var("ROCP_QUEUE_BUDGET", settings->q_budget);
+  // Accumulate the counters over the same kernel dispatches ranges, the range dispatches number
+  check_env_var("ROCP_K_ACCUMULATE", settings->k_accumulate);
+  accumulate_on = ((settings->k_accumulate > 1) && (settings->k_concurrent == 0) && (settings->kernel_replay == 0)) ? 1 : 0;
+  window_on = (settings->k_concurrent == 3) ? 1 : 0;
+  // Enable overhead accounting
+  check_env_var("ROCP_OVERHEAD", overhead_on);
+  // Periodic collection, '<delay>:<length>:<period>' in usec
+  const char* ctrl_str = getenv("ROCP_CTRL_RATE");
+  if (ctrl_str != NULL) {
+    long long delay = 0;
+    if (sscanf(ctrl_str, "%lld:%u:%u", &delay, &ctrl_length_us, &ctrl_period_us) != 3) {
+      fprintf(stderr, "ROCProfiler: bad ROCP_CTRL_RATE env '%s'\n", ctrl_str);
+      abort();
+    }
+    ctrl_delay_us = delay;
+    ctrl_on = true;
+  }
+  // Shared memory control channel, '<ring size>[:<poll msec>]'
+  const char* shm_str = getenv("ROCP_SHM_CTRL");
+  if (shm_str != NULL) {
+    shm_ring_size = RplShmChannel::RING_SIZE_DFLT;
+    if (((*shm_str != 0) && (sscanf(shm_str, "%u:%u", &shm_ring_size, &shm_poll_ms) < 1)) ||
+        (shm_ring_size == 0) || (shm_poll_ms == 0)) {
+      fprintf(stderr, "ROCProfiler: bad ROCP_SHM_CTRL env '%s'\n", shm_str);
+      abort();
+    }
+    if (ctrl_on) {
+      fprintf(stderr, "ROCProfiler: ROCP_SHM_CTRL and ROCP_CTRL_RATE are exclusive\n");
+      abort();
+    }
+  }
+  // Completed contexts flush period in usec
+  check_env_var("ROCP_FLUSH_RATE", flush_period_us);
+  // Enable optmized mode, the contexts pools are used by default
+  settings->opt_mode = 1;
   check_env_var("ROCP_OPT_MODE", settings->opt_mode);
 
   is_trace_local = settings->trace_local;
@@ -1051,7 +1844,7 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
       abort();
     }
     std::ostringstream oss;
-    oss << result_prefix << "/" << GetPid() << "_results.txt";
+    oss << result_prefix << "/" << GetPid() << ((binary_output != 0) ? "_results.bin" : "_results.txt");
     result_file_handle = fopen(oss.str().c_str(), "w");
     if (result_file_handle == NULL) {
       std::ostringstream errmsg;
@@ -1062,6 +1855,23 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
   } else result_file_handle = stdout;
 
   result_file_opened = (result_prefix != NULL) && (result_file_handle != NULL);
+  if (result_file_opened && (binary_output != 0)) {
+    bin_writer = new RplBinWriter(result_file_handle, GetPid());
+    write_clock(bin_writer);
+    // The tracked memory copies are written to the binary results
+    if (settings->memcopy_tracking) rocprofiler_set_memcopy_callback(memcopy_callback, NULL);
+  }
+  // The output shards are written by the results producing threads, binary format only
+  if (output_shards_on != 0) {
+    if (bin_writer == NULL) {
+      fprintf(stderr, "ROCProfiler: output shards require the binary results output to a directory, disabled\n");
+      output_shards_on = 0;
+    } else printf("ROCProfiler: per-thread output shards '%s/%u_<shard>_results.bin'\n", result_prefix, GetPid());
+  }
+  if (result_file_opened && (writer_thread != 0) && (output_shards_on == 0)) {
+    results_writer = new results_writer_t(writer_queue_size, writer_flush_interval, writer_policy,
+                                          write_snapshot, flush_results, NULL);
+  }
 
   // Getting input
   const char* xml_name = getenv("ROCP_INPUT");
@@ -1131,11 +1941,15 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
   const uint32_t features_found = metrics_vec.size();
 
   // Context array aloocation
-  context_array = new context_array_t;
+  init_context_shards();
 
+  // The contexts pools are used by default, one pool per GPU agent
+  // sized by the outstanding contexts limit
   bool opt_mode_cond = ((features_found != 0) &&
-                              (metrics_set->empty()) &&
-                              (filter_disabled == true));
+                        (metrics_set->empty()) &&
+                        (settings->k_concurrent == 0) &&
+                        (settings->kernel_replay == 0) &&
+                        (accumulate_on == 0));
   if (settings->opt_mode == 0) opt_mode_cond = false;
   if (!opt_mode_cond) settings->opt_mode = 0;
   if (opt_mode_cond) {
@@ -1151,24 +1965,22 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
     properties.handler = context_pool_handler;
     properties.handler_arg = handler_arg;
 
-    // Available GPU agents
+    // Available GPU agents, the agents pools are opened on the first dispatch
     const unsigned gpu_count = HsaRsrcFactory::Instance().GetCountOfGpuAgents();
-    callbacks_arg_t* callbacks_arg = new callbacks_arg_t{};
-    callbacks_arg->pools = new rocprofiler_pool_t* [gpu_count];
-    for (unsigned gpu_id = 0; gpu_id < gpu_count; gpu_id++) {
-      // Getting GPU device info
-      const AgentInfo* agent_info = NULL;
-      if (HsaRsrcFactory::Instance().GetGpuAgentInfo(gpu_id, &agent_info) == false) {
-        fprintf(stderr, "GetGpuAgentInfo failed\n");
-        abort();
-      }
-
-      // Open profiling pool
-      rocprofiler_pool_t* pool = NULL;
-      hsa_status_t status = rocprofiler_pool_open(agent_info->dev_id, features, features_found,
-                                                  &pool, 0, &properties);
-      check_status(status);
-      callbacks_arg->pools[gpu_id] = pool;
+    callbacks_arg = new callbacks_arg_t{};
+    callbacks_arg->pools = new std::atomic<rocprofiler_pool_t*>[gpu_count];
+    for (unsigned gpu_id = 0; gpu_id < gpu_count; gpu_id++) callbacks_arg->pools[gpu_id].store(NULL);
+    callbacks_arg->pool_count = gpu_count;
+    callbacks_arg->features = features;
+    callbacks_arg->feature_count = features_found;
+    callbacks_arg->properties = properties;
+    if (filter_disabled == false) {
+      callbacks_data_t* filter = new callbacks_data_t{};
+      filter->gpu_index = (gpu_index_vec->empty()) ? NULL : gpu_index_vec;
+      filter->kernel_string = (kernel_string_vec->empty()) ? NULL : kernel_string_vec;
+      filter->range = (range_vec->empty()) ? NULL : range_vec;
+      filter->filter_on = 1;
+      callbacks_arg->filter = filter;
     }
 
     // Adding dispatch observer
@@ -1208,6 +2020,25 @@ extern "C" PUBLIC_API void OnLoadToolProp(rocprofiler_settings_t* settings)
 
   xml::Xml::Destroy(xml);
 
+  // With code objects tracking the kernel names are held by the library kernel info cache
+  kernel_names_interned = (settings->code_obj_tracking != 0);
+
+  // The dispatch callbacks are enabled by the periodic collection thread
+  if (ctrl_on) {
+    check_status(rocprofiler_stop_queue_callbacks());
+    if (ctrl_delay_us >= 0) ctrl_thread = new std::thread(ctrl_thr_fun);
+    else printf("ROCProfiler: collection is off\n");
+  }
+  if (flush_period_us != 0) flush_thread = new std::thread(flush_thr_fun);
+  // The dispatch callbacks are enabled by the control channel agent
+  if (shm_ring_size != 0) {
+    shm_channel = RplShmChannel::Create(my_pid, shm_ring_size);
+    if (shm_channel == NULL) fatal("ROCProfiler: control channel creation failed");
+    check_status(rocprofiler_stop_queue_callbacks());
+    shm_thread = new std::thread(shm_thr_fun);
+    printf("ROCProfiler: control channel '%s', collection is off\n", RplShmChannel::Name(my_pid).c_str());
+  }
+
   if (CTX_OUTSTANDING_MON != 0) {
     pthread_t thread;
     pthread_attr_t attr;
@@ -1234,26 +2065,66 @@ void rocprofiler_unload(bool is_destr) {
     abort();
   }
 
-  // Unregister dispatch callback
+  // Stopping periodic collection and unregister dispatch callback
+  ctrl_threads_stop();
   rocprofiler_remove_queue_callbacks();
 
   // Dump stored profiling output data
   fflush(stdout);
   if (result_file_opened) {
     printf("\nROCPRofiler:"); fflush(stdout);
-    if (CTX_OUTSTANDING_WAIT == 1) dump_context_array(NULL);
+    if (CTX_OUTSTANDING_WAIT == 1) {
+      wait_context_pools();
+      dump_context_array(NULL);
+    }
+    uint64_t writer_dropped = 0;
+    if (bin_writer != NULL) rocprofiler_set_memcopy_callback(NULL, NULL);
+    if (results_writer != NULL) {
+      // Draining the writer queue
+      writer_dropped = results_writer->GetDropped();
+      delete results_writer;
+      results_writer = NULL;
+    }
+    close_output_shards();
+    delete bin_writer;
+    bin_writer = NULL;
     fclose(result_file_handle);
-    printf(" %u contexts collected, output directory %s\n", context_collected, result_prefix);
+    printf(" %u contexts collected, output directory %s\n", context_collected.load(), result_prefix);
+    if (writer_dropped != 0) {
+      printf("ROCProfiler: %lu records dropped by results writer, policy '%s'\n",
+        writer_dropped, results_writer_t::PolicyName(writer_policy));
+    }
   } else {
-    if (context_collected != context_count) {
+    if (context_collected.load() != context_count.load()) {
       results_output_break();
-      if (CTX_OUTSTANDING_WAIT == 1) dump_context_array(NULL);
+      if (CTX_OUTSTANDING_WAIT == 1) {
+        wait_context_pools();
+        dump_context_array(NULL);
+      }
+    }
+    printf("\nROCPRofiler: %u contexts collected\n", context_collected.load());
+  }
+  if (kernel_stats != NULL) {
+    dump_kernel_stats();
+    delete kernel_stats;
+    kernel_stats = NULL;
+  }
+  if (overhead_on) {
+    const uint64_t calls = dump_overhead_calls.load();
+    const uint64_t time_ns = rocprofiler::CoreTimer::TicksToNs(dump_overhead_ticks.load());
+    printf("ROCProfiler: tool overhead:\n  dump-context-entry calls(%lu) time(%luns) avg(%luns)\n",
+      calls, time_ns, (calls != 0) ? time_ns / calls : 0);
+    rocprofiler_queue_stats_t qstats{};
+    if (rocprofiler_get_info(NULL, ROCPROFILER_INFO_KIND_QUEUE_STATS, &qstats) == HSA_STATUS_SUCCESS) {
+      printf("ROCProfiler: queues(%lu) bypassed(%lu) detached(%lu) submits(%lu) packets(%lu) dispatches(%lu) profiled(%lu)\n",
+        qstats.queues, qstats.bypassed, qstats.detached, qstats.submits, qstats.packets, qstats.dispatches, qstats.profiled);
     }
-    printf("\nROCPRofiler: %u contexts collected\n", context_collected);
   }
   fflush(stdout);
 
   // Cleanup
+  delete shm_channel;
+  shm_channel = NULL;
   if (callbacks_data != NULL) {
     delete[] callbacks_data->features;
     delete callbacks_data;
@@ -1267,8 +2138,10 @@ void rocprofiler_unload(bool is_destr) {
   kernel_string_vec = NULL;
   delete range_vec;
   range_vec = NULL;
-  delete context_array;
-  context_array = NULL;
+  delete[] context_shards;
+  context_shards = NULL;
+  delete kernel_name_map;
+  kernel_name_map = NULL;
 
   ONLOAD_TRACE_END();
 }
@@ -727,6 +727,7 @@ hsa_status_t HsaRsrcFactory::executable_symbols_cb(hsa_executable_t exec, hsa_ex
 
     const int to_free = reinterpret_cast<long>(arg);
     const char* name = NULL;
+    const amd_kernel_code_t* code = NULL;
     if (to_free == 0) {
       uint32_t len = 0;
       status = hsa_api_.hsa_executable_symbol_get_info(symbol, HSA_EXECUTABLE_SYMBOL_INFO_NAME_LENGTH, &len);
@@ -736,9 +737,15 @@ hsa_status_t HsaRsrcFactory::executable_symbols_cb(hsa_executable_t exec, hsa_ex
       CHECK_STATUS("Error in getting kernel name", status);
       sym_name[len] = 0;
       name = cpp_demangle(sym_name);
+      const HsaRsrcFactory* obj = instance_.load(std::memory_order_acquire);
+      if (obj != NULL) {
+        status = obj->LoaderApi()->hsa_ven_amd_loader_query_host_address(
+            reinterpret_cast<const void*>(addr), reinterpret_cast<const void**>(&code));
+        if (status != HSA_STATUS_SUCCESS) code = reinterpret_cast<const amd_kernel_code_t*>(addr);
+      }
     }
 
-    SetKernelNameRef(addr, name, to_free);
+    SetKernelNameRef(addr, name, to_free, code);
   }
 
   return HSA_STATUS_SUCCESS;
@@ -747,9 +754,12 @@ hsa_status_t HsaRsrcFactory::executable_symbols_cb(hsa_executable_t exec, hsa_ex
 hsa_status_t HsaRsrcFactory::hsa_executable_freeze_interceptor(hsa_executable_t executable, const char *options) {
   std::lock_guard<mutex_t> lck(mutex_);
   if (symbols_map_ == NULL) symbols_map_ = new symbols_map_t;
-  hsa_status_t status = hsa_api_.hsa_executable_iterate_symbols(executable, executable_symbols_cb, (void*)0);
+  // The symbols are iterated after the freeze for the kernel code being loaded
+  hsa_status_t status = hsa_api_.hsa_executable_freeze(executable, options);
+  if (status != HSA_STATUS_SUCCESS) return status;
+  status = hsa_api_.hsa_executable_iterate_symbols(executable, executable_symbols_cb, (void*)0);
   CHECK_STATUS("Error in iterating executable symbols", status);
-  return hsa_api_.hsa_executable_freeze(executable, options);
+  return status;
 }
 
 hsa_status_t HsaRsrcFactory::hsa_executable_destroy_interceptor(hsa_executable_t executable) {
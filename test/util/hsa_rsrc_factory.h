@@ -27,6 +27,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #define AMD_INTERNAL_BUILD
 
+#include <amd_hsa_kernel_code.h>
 #include <hsa.h>
 #include <hsa_api_trace.h>
 #include <hsa_ext_amd.h>
@@ -38,7 +39,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <x86intrin.h>
 
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <mutex>
@@ -174,6 +177,10 @@ struct AgentInfo {
 
 // HSA timer class
 // Provides current HSA timestampa and system-clock/ns conversion API
+// The conversions are fixed point, the timestamp is interpolated by the TSC
+// linear model fitted to the HSA timestamp. The model is calibrated by a short
+// interval at the start and is refitted over the growing interval by the
+// timestamp caller, the refit period grows with the interval.
 class HsaTimer {
  public:
   typedef uint64_t timestamp_t;
@@ -189,32 +196,57 @@ class HsaTimer {
     TIME_ID_NUMBER
   };
 
-  HsaTimer(const hsa_pfn_t* hsa_api) : hsa_api_(hsa_api) {
+  HsaTimer(const hsa_pfn_t* hsa_api) :
+    hsa_api_(hsa_api),
+    model_seq_(0),
+    model_tsc_base_(0),
+    model_ns_base_(0),
+    model_mult_(0),
+    model_refit_ticks_(0),
+    last_ns_(0)
+  {
     timestamp_t sysclock_hz = 0;
     hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY, &sysclock_hz);
     CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY)", status);
     sysclock_factor_ = (freq_t)1000000000 / (freq_t)sysclock_hz;
+    to_ns_mult_ = FixedFactor(sysclock_factor_);
+    to_sysclock_mult_ = FixedFactor(1 / sysclock_factor_);
+
+    // Short calibration, the model is refined by the refits
+    SamplePair(&anchor_tsc_, &anchor_ns_);
+    uint64_t tsc = 0;
+    timestamp_t ns = 0;
+    do {
+      SamplePair(&tsc, &ns);
+    } while ((ns - anchor_ns_) < CALIBRATION_NS);
+    Fit(tsc, ns);
   }
 
   // Methods for system-clock/ns conversion
-  timestamp_t sysclock_to_ns(const timestamp_t& sysclock) const {
-    return timestamp_t((freq_t)sysclock * sysclock_factor_);
-  }
-  timestamp_t ns_to_sysclock(const timestamp_t& time) const {
-    return timestamp_t((freq_t)time / sysclock_factor_);
-  }
+  timestamp_t sysclock_to_ns(const timestamp_t& sysclock) const { return FixedMul(sysclock, to_ns_mult_); }
+  timestamp_t ns_to_sysclock(const timestamp_t& time) const { return FixedMul(time, to_sysclock_mult_); }
 
   // Method for timespec/ns conversion
   static timestamp_t timespec_to_ns(const timespec& time) {
     return ((timestamp_t)time.tv_sec * 1000000000) + time.tv_nsec;
   }
 
-  // Return timestamp in 'ns'
+  // Return timestamp in 'ns', the returned timestamps do not go backwards across the refits
   timestamp_t timestamp_ns() const {
-    timestamp_t sysclock;
-    hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &sysclock);
-    CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP)", status);
-    return sysclock_to_ns(sysclock);
+    clock_model_t model;
+    ReadModel(&model);
+    if (model.mult == 0) return Monotonic(sysclock_to_ns(sysclock()));
+    const uint64_t tsc = __rdtsc();
+    if (((tsc - model.tsc_base) > model.refit_ticks) && refit_mutex_.try_lock()) {
+      uint64_t fit_tsc = 0;
+      timestamp_t fit_ns = 0;
+      SamplePair(&fit_tsc, &fit_ns);
+      Fit(fit_tsc, fit_ns);
+      refit_mutex_.unlock();
+      ReadModel(&model);
+    }
+    const int64_t delta = tsc - model.tsc_base;
+    return Monotonic((delta >= 0) ? model.ns_base + FixedMul(delta, model.mult) : model.ns_base - FixedMul(-delta, model.mult));
   }
 
   // Return time in 'ns'
@@ -275,10 +307,108 @@ class HsaTimer {
   }
 
  private:
+  // TSC to timestamp ns linear model, ns = ns_base + (tsc - tsc_base) * mult
+  struct clock_model_t {
+    uint64_t tsc_base;
+    timestamp_t ns_base;
+    uint64_t mult;
+    uint64_t refit_ticks;
+  };
+  static const timestamp_t CALIBRATION_NS = 1000000;
+  static const timestamp_t REFIT_NS = 1000000000;
+  static const uint32_t PAIR_TRIES = 4;
+  static const uint32_t FIXED_SHIFT = 32;
+
+  static uint64_t FixedFactor(const freq_t& factor) { return uint64_t(factor * (freq_t)(1ull << FIXED_SHIFT) + 0.5); }
+  static uint64_t FixedMul(const uint64_t& value, const uint64_t& mult) {
+    return uint64_t(((unsigned __int128)value * mult) >> FIXED_SHIFT);
+  }
+
+  timestamp_t sysclock() const {
+    timestamp_t sysclock;
+    hsa_status_t status = hsa_api_->hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &sysclock);
+    CHECK_STATUS("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP)", status);
+    return sysclock;
+  }
+
+  // Correlated TSC and timestamp pair, the TSC is the middle of the narrowest read interval
+  void SamplePair(uint64_t* tsc, timestamp_t* ns) const {
+    uint64_t width = UINT64_MAX;
+    for (uint32_t i = 0; i < PAIR_TRIES; ++i) {
+      const uint64_t begin = __rdtsc();
+      const timestamp_t value = sysclock();
+      const uint64_t end = __rdtsc();
+      if ((end - begin) < width) {
+        width = end - begin;
+        *tsc = begin + width / 2;
+        *ns = sysclock_to_ns(value);
+      }
+    }
+  }
+
+  // Fitting the model slope from the anchor pair to the given pair, the model is not used
+  // if the TSC is not advancing. The refit period is doubled up to REFIT_NS. The model is
+  // published by a seqlock, the writers are serialized by the refit mutex.
+  void Fit(const uint64_t& tsc, const timestamp_t& ns) const {
+    if ((tsc <= anchor_tsc_) || (ns <= anchor_ns_)) return;
+    const uint64_t mult = uint64_t(((unsigned __int128)(ns - anchor_ns_) << FIXED_SHIFT) / (tsc - anchor_tsc_));
+    if (mult == 0) return;
+    const timestamp_t refit_ns = std::min<timestamp_t>(ns - anchor_ns_, REFIT_NS);
+    const uint64_t refit_ticks = uint64_t(((unsigned __int128)refit_ns << FIXED_SHIFT) / mult);
+
+    const uint32_t seq = model_seq_.load(std::memory_order_relaxed);
+    model_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    model_tsc_base_.store(tsc, std::memory_order_relaxed);
+    model_ns_base_.store(ns, std::memory_order_relaxed);
+    model_mult_.store(mult, std::memory_order_relaxed);
+    model_refit_ticks_.store(refit_ticks, std::memory_order_relaxed);
+    model_seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Reading a consistent model copy, retried if a refit is in progress
+  void ReadModel(clock_model_t* model) const {
+    while (true) {
+      const uint32_t seq = model_seq_.load(std::memory_order_acquire);
+      if ((seq & 1) == 0) {
+        model->tsc_base = model_tsc_base_.load(std::memory_order_relaxed);
+        model->ns_base = model_ns_base_.load(std::memory_order_relaxed);
+        model->mult = model_mult_.load(std::memory_order_relaxed);
+        model->refit_ticks = model_refit_ticks_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (model_seq_.load(std::memory_order_relaxed) == seq) return;
+      }
+    }
+  }
+
+  // Clamping the timestamp to the last returned one, a refit can move the model back
+  timestamp_t Monotonic(const timestamp_t& ns) const {
+    timestamp_t last = last_ns_.load(std::memory_order_relaxed);
+    while (ns > last) {
+      if (last_ns_.compare_exchange_weak(last, ns, std::memory_order_relaxed)) return ns;
+    }
+    return last;
+  }
+
   // Timestamp frequency factor
   freq_t sysclock_factor_;
+  // Fixed point conversion factors
+  uint64_t to_ns_mult_;
+  uint64_t to_sysclock_mult_;
   // HSA API table
   const hsa_pfn_t* const hsa_api_;
+  // TSC model calibration anchor and the current model
+  uint64_t anchor_tsc_;
+  timestamp_t anchor_ns_;
+  // The current model fields, published by the model sequence
+  mutable std::atomic<uint32_t> model_seq_;
+  mutable std::atomic<uint64_t> model_tsc_base_;
+  mutable std::atomic<timestamp_t> model_ns_base_;
+  mutable std::atomic<uint64_t> model_mult_;
+  mutable std::atomic<uint64_t> model_refit_ticks_;
+  mutable std::mutex refit_mutex_;
+  // The last returned timestamp
+  mutable std::atomic<timestamp_t> last_ns_;
 };
 
 class HsaRsrcFactory {
@@ -287,10 +417,30 @@ class HsaRsrcFactory {
   typedef std::recursive_mutex mutex_t;
   typedef HsaTimer::timestamp_t timestamp_t;
 
-  // Executables loading tracking
+  // Kernel properties pre-computed from the kernel code
+  struct kernel_props_t {
+    uint32_t vgpr_count;
+    uint32_t sgpr_count;
+    uint32_t fbarrier_count;
+  };
+
+  static kernel_props_t KernelProps(const amd_kernel_code_t* code) {
+    kernel_props_t props{};
+    if (code != NULL) {
+      props.vgpr_count = AMD_HSA_BITS_GET(code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WORKITEM_VGPR_COUNT);
+      props.sgpr_count = AMD_HSA_BITS_GET(code->compute_pgm_rsrc1, AMD_COMPUTE_PGM_RSRC_ONE_GRANULATED_WAVEFRONT_SGPR_COUNT);
+      props.fbarrier_count = code->workgroup_fbarrier_count;
+    }
+    return props;
+  }
+
+  // Executables loading tracking, the kernel code and properties are filled
+  // at the executable freeze
   struct symbols_map_data_t {
     const char* name;
     uint64_t refs_count;
+    const amd_kernel_code_t* code;
+    kernel_props_t props;
   };
   typedef std::map<uint64_t, symbols_map_data_t> symbols_map_t;
 
@@ -435,6 +585,14 @@ class HsaRsrcFactory {
     return it->second.name;
   }
 
+  // Return the kernel name, NULL if the kernel object is not registered
+  static inline const char* FindKernelNameRef(const uint64_t& addr) {
+    if (symbols_map_ == NULL) return NULL;
+    std::lock_guard<mutex_t> lck(mutex_);
+    const auto it = symbols_map_->find(addr);
+    return (it != symbols_map_->end()) ? it->second.name : NULL;
+  }
+
   static inline symbols_map_it_t AcquireKernelNameRef(const uint64_t& addr) {
     if (symbols_map_ == NULL) {
       fprintf(stderr, "HsaRsrcFactory::GetKernelNameRef: kernel addr (0x%lx), error\n", addr);
@@ -462,7 +620,8 @@ class HsaRsrcFactory {
     atomic_ptr->fetch_sub(1, std::memory_order_relaxed);
   }
   
-  static inline void SetKernelNameRef(const uint64_t& addr, const char* name, const int& free) {
+  static inline void SetKernelNameRef(const uint64_t& addr, const char* name, const int& free,
+                                      const amd_kernel_code_t* code = NULL) {
     if (symbols_map_ == NULL) {
       std::lock_guard<mutex_t> lck(mutex_);
       if (symbols_map_ == NULL) symbols_map_ = new symbols_map_t;
@@ -488,7 +647,7 @@ class HsaRsrcFactory {
       }
     } else {
       if (free == 0) {
-        symbols_map_->insert({addr, symbols_map_data_t{name, 0}});
+        symbols_map_->insert({addr, symbols_map_data_t{name, 0, code, KernelProps(code)}});
       } else {
         fprintf(stderr, "HsaRsrcFactory::SetKernelNameRef: to free kernel addr (0x%lx) not found\n", addr);
         abort();
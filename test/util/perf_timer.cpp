@@ -67,9 +67,9 @@ int PerfTimer::StartTimer(int index) {
 #else
 // General Linux timing method
 #ifndef _AMD
-  struct timeval s;
-  gettimeofday(&s, 0);
-  timers_[index]->start = s.tv_sec * 1.0E3 + ((double)(s.tv_usec / 1.0E3));
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  timers_[index]->start = s.tv_sec * 1.0E3 + ((double)(s.tv_nsec / 1.0E6));
 #else
   // AMD timing method
   unsigned int unused;
@@ -99,9 +99,9 @@ int PerfTimer::StopTimer(int index) {
 #else
 // General Linux timing method
 #ifndef _AMD
-  struct timeval s;
-  gettimeofday(&s, 0);
-  n = s.tv_sec * 1.0E3 + (double)(s.tv_usec / 1.0E3);
+  struct timespec s;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  n = s.tv_sec * 1.0E3 + (double)(s.tv_nsec / 1.0E6);
 #else
   // AMD Linux timing
   unsigned int unused;
@@ -0,0 +1,523 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_BIN_H_
+#define TEST_UTIL_RPL_BIN_H_
+
+// Binary profiling results format
+//
+// The results file is a sequence of records, every record starts with a
+// record header {type, size}, size is the total record size in bytes and
+// is 8 bytes aligned. The file starts with a RPL_BIN_HEADER record and
+// files can be concatenated, the strings ids are scoped by the preceding
+// header record. All values are little-endian.
+// The optional RPL_BIN_CLOCK record following the header correlates the
+// process timestamps with the system realtime clock, it is used to align
+// the timestamps of the processes results on merging.
+// The RPL_BIN_MEMCOPY records are the tracked async memory copies, the copy
+// bandwidth is computed by the post-processing.
+// The RPL_BIN_KDISPATCH records are the dispatches with the static kernel
+// properties moved to the RPL_BIN_KERNEL descriptor record, written on the
+// kernel first dispatch. The descriptors ids are scoped by the preceding
+// header record as the strings ids, the readers expand the compact records
+// to the RPL_BIN_DISPATCH records by RplBinKernels.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define RPL_BIN_MAGIC 0x424c5052  // "RPLB"
+#define RPL_BIN_VERSION_MAJOR 1
+#define RPL_BIN_VERSION_MINOR 4
+
+enum rpl_bin_record_type_t {
+  RPL_BIN_HEADER = 1,
+  RPL_BIN_STRING = 2,
+  RPL_BIN_DISPATCH = 3,
+  RPL_BIN_CLOCK = 4,
+  RPL_BIN_MEMCOPY = 5,
+  RPL_BIN_KERNEL = 6,
+  RPL_BIN_KDISPATCH = 7
+};
+
+enum rpl_bin_value_kind_t {
+  RPL_BIN_VALUE_INT64 = 2,
+  RPL_BIN_VALUE_DOUBLE = 4
+};
+
+enum rpl_bin_dispatch_flags_t {
+  RPL_BIN_DISPATCH_TIME = 1,  // the dispatch timestamps are valid
+  RPL_BIN_DISPATCH_WEIGHT = 2  // the dispatch sampling weight is valid
+};
+
+struct rpl_bin_record_t {
+  uint32_t type;
+  uint32_t size;
+};
+
+struct rpl_bin_header_t {
+  rpl_bin_record_t record;
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  uint32_t pid;
+  uint32_t reserved;
+};
+
+// Followed by the string characters, not null terminated
+struct rpl_bin_string_t {
+  rpl_bin_record_t record;
+  uint32_t id;
+  uint32_t length;
+};
+
+// Correlated pair of the timestamp and the realtime clock, with the correlation error
+struct rpl_bin_clock_t {
+  rpl_bin_record_t record;
+  uint64_t timestamp_ns;
+  uint64_t realtime_ns;
+  uint64_t error_ns;
+};
+
+struct rpl_bin_value_t {
+  uint32_t name_id;
+  uint32_t kind;
+  union {
+    uint64_t result_int64;
+    double result_double;
+  };
+};
+
+// Followed by 'value_count' values
+struct rpl_bin_dispatch_t {
+  rpl_bin_record_t record;
+  uint32_t index;
+  uint32_t gpu_id;
+  uint32_t queue_id;
+  uint32_t pid;
+  uint32_t tid;
+  uint32_t grid_size;
+  uint32_t workgroup_size;
+  uint32_t lds_size;
+  uint32_t scratch_size;
+  uint32_t vgpr_count;
+  uint32_t sgpr_count;
+  uint32_t fbarrier_count;
+  uint32_t name_id;
+  uint32_t value_count;
+  uint64_t queue_index;
+  uint64_t signal;
+  uint64_t object;
+  uint32_t flags;
+  float weight;
+  uint64_t dispatch;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t complete;
+};
+
+// Kernel descriptor, the static properties of the kernel dispatches
+struct rpl_bin_kernel_t {
+  rpl_bin_record_t record;
+  uint32_t id;
+  uint32_t name_id;
+  uint32_t gpu_id;
+  uint32_t vgpr_count;
+  uint32_t sgpr_count;
+  uint32_t fbarrier_count;
+  uint64_t object;
+};
+
+// Compact dispatch of the descriptor kernel, the pid is the header pid
+// Followed by 'value_count' values
+struct rpl_bin_kdispatch_t {
+  rpl_bin_record_t record;
+  uint32_t index;
+  uint32_t kernel_id;
+  uint32_t queue_id;
+  uint32_t tid;
+  uint32_t grid_size;
+  uint32_t workgroup_size;
+  uint32_t lds_size;
+  uint32_t scratch_size;
+  uint32_t value_count;
+  uint32_t flags;
+  float weight;
+  uint32_t reserved;
+  uint64_t queue_index;
+  uint64_t signal;
+  uint64_t dispatch;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t complete;
+};
+
+// Async memory copy, the agents GPU ids are -1 for CPU agents
+struct rpl_bin_memcopy_t {
+  rpl_bin_record_t record;
+  uint32_t pid;
+  int32_t src_gpu_id;
+  int32_t dst_gpu_id;
+  uint32_t reserved;
+  uint64_t index;
+  uint64_t size;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Buffered binary results writer
+// The writer is not thread safe, the calls should be serialized
+class RplBinWriter {
+ public:
+  static const size_t BUFFER_SIZE_DFLT = 0x400000;  // 4M
+  static const uint32_t RECORD_ALIGN = 8;
+
+  RplBinWriter(FILE* file, uint32_t pid, size_t buffer_size = BUFFER_SIZE_DFLT) :
+    file_(file),
+    buffer_size_(buffer_size),
+    fill_(0),
+    kernel_count_(0)
+  {
+    buffer_ = reinterpret_cast<char*>(malloc(buffer_size_));
+    if (buffer_ == NULL) {
+      fprintf(stderr, "RplBinWriter: buffer allocation failed (%zu)\n", buffer_size_);
+      abort();
+    }
+    rpl_bin_header_t header{};
+    header.record = {RPL_BIN_HEADER, sizeof(header)};
+    header.magic = RPL_BIN_MAGIC;
+    header.version_major = RPL_BIN_VERSION_MAJOR;
+    header.version_minor = RPL_BIN_VERSION_MINOR;
+    header.pid = pid;
+    Write(&header, sizeof(header));
+  }
+
+  ~RplBinWriter() {
+    Flush();
+    free(buffer_);
+  }
+
+  // Return the string id, the string record is written on the first use
+  uint32_t GetStringId(const char* str) {
+    auto ret = string_map_.insert({std::string(str), (uint32_t)string_map_.size()});
+    if (ret.second) {
+      const uint32_t length = ret.first->first.length();
+      rpl_bin_string_t rec{};
+      rec.record = {RPL_BIN_STRING, AlignSize(sizeof(rec) + length)};
+      rec.id = ret.first->second;
+      rec.length = length;
+      Write(&rec, sizeof(rec));
+      Write(str, length);
+      Pad(rec.record.size - sizeof(rec) - length);
+    }
+    return ret.first->second;
+  }
+
+  // Write the clock correlation record
+  void WriteClock(uint64_t timestamp_ns, uint64_t realtime_ns, uint64_t error_ns) {
+    rpl_bin_clock_t rec{};
+    rec.record = {RPL_BIN_CLOCK, sizeof(rec)};
+    rec.timestamp_ns = timestamp_ns;
+    rec.realtime_ns = realtime_ns;
+    rec.error_ns = error_ns;
+    Write(&rec, sizeof(rec));
+  }
+
+  // Write a dispatch record, the record size and value count are set here
+  void WriteDispatch(rpl_bin_dispatch_t* rec, const std::vector<rpl_bin_value_t>& values) {
+    rec->record.type = RPL_BIN_DISPATCH;
+    rec->record.size = sizeof(*rec) + values.size() * sizeof(rpl_bin_value_t);
+    rec->value_count = values.size();
+    Write(rec, sizeof(*rec));
+    if (!values.empty()) Write(&values[0], values.size() * sizeof(rpl_bin_value_t));
+  }
+
+  // Return the kernel descriptor id, the descriptor record is written on the first use
+  // The descriptors are keyed by the kernel object, GPU id and name
+  uint32_t GetKernelId(const rpl_bin_dispatch_t& rec, const char* name) {
+    std::vector<kernel_key_t>& keys = kernel_map_[rec.object];
+    for (const kernel_key_t& key : keys) {
+      if ((key.gpu_id == rec.gpu_id) && (key.name == name)) return key.id;
+    }
+    rpl_bin_kernel_t kernel{};
+    kernel.record = {RPL_BIN_KERNEL, sizeof(kernel)};
+    kernel.id = kernel_count_++;
+    kernel.name_id = GetStringId(name);
+    kernel.gpu_id = rec.gpu_id;
+    kernel.vgpr_count = rec.vgpr_count;
+    kernel.sgpr_count = rec.sgpr_count;
+    kernel.fbarrier_count = rec.fbarrier_count;
+    kernel.object = rec.object;
+    Write(&kernel, sizeof(kernel));
+    keys.push_back(kernel_key_t{rec.gpu_id, name, kernel.id});
+    return kernel.id;
+  }
+
+  // Write a compact dispatch record of the given kernel descriptor
+  void WriteKernelDispatch(const rpl_bin_dispatch_t& rec, uint32_t kernel_id, const std::vector<rpl_bin_value_t>& values) {
+    rpl_bin_kdispatch_t disp{};
+    disp.record = {RPL_BIN_KDISPATCH, (uint32_t)(sizeof(disp) + values.size() * sizeof(rpl_bin_value_t))};
+    disp.index = rec.index;
+    disp.kernel_id = kernel_id;
+    disp.queue_id = rec.queue_id;
+    disp.tid = rec.tid;
+    disp.grid_size = rec.grid_size;
+    disp.workgroup_size = rec.workgroup_size;
+    disp.lds_size = rec.lds_size;
+    disp.scratch_size = rec.scratch_size;
+    disp.value_count = values.size();
+    disp.flags = rec.flags;
+    disp.weight = rec.weight;
+    disp.queue_index = rec.queue_index;
+    disp.signal = rec.signal;
+    disp.dispatch = rec.dispatch;
+    disp.begin = rec.begin;
+    disp.end = rec.end;
+    disp.complete = rec.complete;
+    Write(&disp, sizeof(disp));
+    if (!values.empty()) Write(&values[0], values.size() * sizeof(rpl_bin_value_t));
+  }
+
+  // Write a memory copy record
+  void WriteMemcopy(rpl_bin_memcopy_t* rec) {
+    rec->record = {RPL_BIN_MEMCOPY, sizeof(*rec)};
+    Write(rec, sizeof(*rec));
+  }
+
+  void Flush() {
+    if (fill_ != 0) {
+      if (fwrite(buffer_, 1, fill_, file_) != fill_) {
+        perror("RplBinWriter: fwrite");
+        abort();
+      }
+      fill_ = 0;
+    }
+    fflush(file_);
+  }
+
+ private:
+  static uint32_t AlignSize(size_t size) { return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1); }
+
+  void Write(const void* data, size_t size) {
+    const char* ptr = reinterpret_cast<const char*>(data);
+    while (size != 0) {
+      if (fill_ == buffer_size_) Flush();
+      const size_t bytes = (size < (buffer_size_ - fill_)) ? size : (buffer_size_ - fill_);
+      memcpy(buffer_ + fill_, ptr, bytes);
+      fill_ += bytes;
+      ptr += bytes;
+      size -= bytes;
+    }
+  }
+
+  void Pad(size_t size) {
+    const uint64_t zero = 0;
+    Write(&zero, size);
+  }
+
+  struct kernel_key_t {
+    uint32_t gpu_id;
+    std::string name;
+    uint32_t id;
+  };
+
+  FILE* file_;
+  char* buffer_;
+  const size_t buffer_size_;
+  size_t fill_;
+  std::map<std::string, uint32_t> string_map_;
+  std::map<uint64_t, std::vector<kernel_key_t> > kernel_map_;
+  uint32_t kernel_count_;
+};
+
+// Memory mapped binary results file reader
+// The records are validated on the access, on an error NULL is returned
+// and the error message is set.
+class RplBinFile {
+ public:
+  explicit RplBinFile(const std::string& path) :
+    path_(path),
+    data_(NULL),
+    size_(0)
+  {
+    const int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error_ = "cannot open '" + path_ + "'";
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      error_ = "cannot stat '" + path_ + "'";
+    } else if (st.st_size != 0) {
+      void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        error_ = "cannot map '" + path_ + "'";
+      } else {
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        data_ = reinterpret_cast<const char*>(ptr);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  ~RplBinFile() {
+    if (data_ != NULL) munmap(const_cast<char*>(data_), size_);
+  }
+
+  bool IsValid() const { return error_.empty(); }
+  const std::string& Error() const { return error_; }
+  const std::string& Path() const { return path_; }
+  size_t Size() const { return size_; }
+
+  // Return the validated record at the position
+  const rpl_bin_record_t* GetRecord(size_t pos) {
+    if ((pos + sizeof(rpl_bin_record_t)) > size_) return SetError("truncated record header");
+    const rpl_bin_record_t* rec = reinterpret_cast<const rpl_bin_record_t*>(data_ + pos);
+    if ((rec->size < sizeof(rpl_bin_record_t)) || ((pos + rec->size) > size_)) {
+      return SetError("bad record size (" + std::to_string(rec->size) + ")");
+    }
+    if ((pos == 0) && (rec->type != RPL_BIN_HEADER)) return SetError("header record expected");
+    switch (rec->type) {
+      case RPL_BIN_HEADER: {
+        const rpl_bin_header_t* header = reinterpret_cast<const rpl_bin_header_t*>(rec);
+        if ((rec->size < sizeof(rpl_bin_header_t)) || (header->magic != RPL_BIN_MAGIC)) return SetError("bad header");
+        if (header->version_major != RPL_BIN_VERSION_MAJOR) {
+          return SetError("unsupported version " + std::to_string(header->version_major) + "." +
+                          std::to_string(header->version_minor));
+        }
+        break;
+      }
+      case RPL_BIN_STRING: {
+        const rpl_bin_string_t* str = reinterpret_cast<const rpl_bin_string_t*>(rec);
+        if ((rec->size < sizeof(rpl_bin_string_t)) || ((sizeof(rpl_bin_string_t) + str->length) > rec->size)) {
+          return SetError("bad string record");
+        }
+        break;
+      }
+      case RPL_BIN_DISPATCH: {
+        const rpl_bin_dispatch_t* disp = reinterpret_cast<const rpl_bin_dispatch_t*>(rec);
+        if ((rec->size < sizeof(rpl_bin_dispatch_t)) ||
+            ((sizeof(rpl_bin_dispatch_t) + (size_t)disp->value_count * sizeof(rpl_bin_value_t)) > rec->size)) {
+          return SetError("bad dispatch record");
+        }
+        break;
+      }
+      case RPL_BIN_CLOCK:
+        if (rec->size < sizeof(rpl_bin_clock_t)) return SetError("bad clock record");
+        break;
+      case RPL_BIN_MEMCOPY:
+        if (rec->size < sizeof(rpl_bin_memcopy_t)) return SetError("bad memcopy record");
+        break;
+      case RPL_BIN_KERNEL:
+        if (rec->size < sizeof(rpl_bin_kernel_t)) return SetError("bad kernel record");
+        break;
+      case RPL_BIN_KDISPATCH: {
+        const rpl_bin_kdispatch_t* disp = reinterpret_cast<const rpl_bin_kdispatch_t*>(rec);
+        if ((rec->size < sizeof(rpl_bin_kdispatch_t)) ||
+            ((sizeof(rpl_bin_kdispatch_t) + (size_t)disp->value_count * sizeof(rpl_bin_value_t)) > rec->size)) {
+          return SetError("bad dispatch record");
+        }
+        break;
+      }
+    }
+    return rec;
+  }
+
+  static std::string GetString(const rpl_bin_string_t* str) {
+    return std::string(reinterpret_cast<const char*>(str + 1), str->length);
+  }
+  static const rpl_bin_value_t* GetValues(const rpl_bin_dispatch_t* disp) {
+    return reinterpret_cast<const rpl_bin_value_t*>(disp + 1);
+  }
+
+ private:
+  const rpl_bin_record_t* SetError(const std::string& msg) {
+    error_ = msg + " in '" + path_ + "'";
+    return NULL;
+  }
+
+  const std::string path_;
+  const char* data_;
+  size_t size_;
+  std::string error_;
+};
+
+// Kernel descriptors of the current header scope, the compact dispatch records
+// are expanded to the full records followed by the values
+class RplBinKernels {
+ public:
+  typedef std::vector<uint64_t> buffer_t;
+
+  void Clear() { kernels_.clear(); }
+  void Add(const rpl_bin_kernel_t* kernel) { kernels_[kernel->id] = kernel; }
+
+  // Return the expanded record in the buffer, NULL if the kernel id is unknown
+  const rpl_bin_dispatch_t* Expand(const rpl_bin_kdispatch_t* disp, uint32_t pid, buffer_t* buffer) const {
+    auto it = kernels_.find(disp->kernel_id);
+    if (it == kernels_.end()) return NULL;
+    const rpl_bin_kernel_t* kernel = it->second;
+    const size_t values_size = (size_t)disp->value_count * sizeof(rpl_bin_value_t);
+    buffer->assign((sizeof(rpl_bin_dispatch_t) + values_size) / sizeof(uint64_t), 0);
+    rpl_bin_dispatch_t* rec = reinterpret_cast<rpl_bin_dispatch_t*>(buffer->data());
+    rec->record = {RPL_BIN_DISPATCH, (uint32_t)(sizeof(rpl_bin_dispatch_t) + values_size)};
+    rec->index = disp->index;
+    rec->gpu_id = kernel->gpu_id;
+    rec->queue_id = disp->queue_id;
+    rec->pid = pid;
+    rec->tid = disp->tid;
+    rec->grid_size = disp->grid_size;
+    rec->workgroup_size = disp->workgroup_size;
+    rec->lds_size = disp->lds_size;
+    rec->scratch_size = disp->scratch_size;
+    rec->vgpr_count = kernel->vgpr_count;
+    rec->sgpr_count = kernel->sgpr_count;
+    rec->fbarrier_count = kernel->fbarrier_count;
+    rec->name_id = kernel->name_id;
+    rec->value_count = disp->value_count;
+    rec->queue_index = disp->queue_index;
+    rec->signal = disp->signal;
+    rec->object = kernel->object;
+    rec->flags = disp->flags;
+    rec->weight = disp->weight;
+    rec->dispatch = disp->dispatch;
+    rec->begin = disp->begin;
+    rec->end = disp->end;
+    rec->complete = disp->complete;
+    if (values_size != 0) memcpy(rec + 1, disp + 1, values_size);
+    return rec;
+  }
+
+ private:
+  std::map<uint32_t, const rpl_bin_kernel_t*> kernels_;
+};
+
+#endif  // TEST_UTIL_RPL_BIN_H_
@@ -0,0 +1,375 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_PARQUET_H_
+#define TEST_UTIL_RPL_PARQUET_H_
+
+// Parquet file writer for the flat results tables
+//
+// The rows are buffered by columns and written by row groups, a row group
+// column chunk is one data page, so the memory is bounded by a row group.
+// The text columns are dictionary encoded by the column chunk, the optional
+// columns have the bit-packed definition levels. The pages are GZIP compressed
+// if built with zlib (RPL_POST_ZLIB). The file metadata is Thrift compact
+// encoded by the parquet.thrift field ids.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef RPL_POST_ZLIB
+#include <zlib.h>
+#endif
+
+class RplParquet {
+ public:
+  // Physical types by the parquet.thrift values, the text is a UTF8 byte array
+  enum type_t {
+    TYPE_INT64 = 2,
+    TYPE_DOUBLE = 5,
+    TYPE_TEXT = 6
+  };
+
+  static const uint32_t ROW_GROUP_ROWS = 1 << 17;
+
+  RplParquet() : file_(NULL), offset_(0), group_rows_(0), total_rows_(0) {}
+  ~RplParquet() { if (file_ != NULL) fclose(file_); }
+
+  // The columns are to be added before the file open
+  void AddColumn(const std::string& name, type_t type, bool optional) {
+    columns_.push_back(column_t{name, type, optional});
+  }
+
+  bool Open(const std::string& path) {
+    file_ = fopen(path.c_str(), "w");
+    if (file_ == NULL) return false;
+    return Write("PAR1", 4);
+  }
+
+  // Setting the current row values in any order, a not set optional value is NULL
+  void SetInt(uint32_t col, int64_t val) { Plain(col, &val); }
+  void SetDouble(uint32_t col, double val) { Plain(col, &val); }
+  void SetText(uint32_t col, const std::string& val) {
+    column_t& column = columns_[col];
+    auto ret = column.dict.insert({val, (uint32_t)column.dict_order.size()});
+    if (ret.second) column.dict_order.push_back(&(ret.first->first));
+    column.indices.push_back(ret.first->second);
+    column.set = true;
+  }
+
+  // Completing the row, the row group is written when full
+  bool EndRow() {
+    for (column_t& column : columns_) {
+      if (column.optional) column.defs.push_back(column.set ? 1 : 0);
+      column.set = false;
+    }
+    ++group_rows_;
+    return (group_rows_ < ROW_GROUP_ROWS) || WriteGroup();
+  }
+
+  // Writing the last row group and the footer
+  bool Close() {
+    if ((group_rows_ != 0) && (WriteGroup() == false)) return false;
+
+    Thrift meta;
+    meta.I32(1, 1);  // version
+    meta.BeginList(2, Thrift::T_STRUCT, columns_.size() + 1);  // schema
+    meta.BeginElem();
+    meta.String(4, "schema");
+    meta.I32(5, columns_.size());  // num_children
+    meta.EndElem();
+    for (const column_t& column : columns_) {
+      meta.BeginElem();
+      meta.I32(1, column.type);
+      meta.I32(3, column.optional ? REPETITION_OPTIONAL : REPETITION_REQUIRED);
+      meta.String(4, column.name);
+      if (column.type == TYPE_TEXT) meta.I32(6, CONVERTED_UTF8);
+      meta.EndElem();
+    }
+    meta.I64(3, total_rows_);
+    meta.BeginList(4, Thrift::T_STRUCT, groups_.size());  // row_groups
+    for (const group_t& group : groups_) meta.Append(group.meta);
+    meta.String(6, "rocprof-post");  // created_by
+    meta.Stop();
+
+    const uint32_t size = meta.buf.size();
+    const bool ret = Write(meta.buf.data(), size) && Write(&size, sizeof(size)) && Write("PAR1", 4);
+    fclose(file_);
+    file_ = NULL;
+    return ret;
+  }
+
+ private:
+  enum {
+    REPETITION_REQUIRED = 0,
+    REPETITION_OPTIONAL = 1,
+    CONVERTED_UTF8 = 0,
+    ENCODING_PLAIN = 0,
+    ENCODING_RLE = 3,
+    ENCODING_RLE_DICTIONARY = 8,
+    CODEC_UNCOMPRESSED = 0,
+    CODEC_GZIP = 2,
+    PAGE_DATA = 0,
+    PAGE_DICTIONARY = 2
+  };
+
+  // Thrift compact protocol encoder
+  struct Thrift {
+    enum { T_BOOL_TRUE = 1, T_BOOL_FALSE = 2, T_I32 = 5, T_I64 = 6, T_BINARY = 8, T_LIST = 9, T_STRUCT = 12 };
+
+    Thrift() : last(0) {}
+
+    void Varint(uint64_t val) {
+      while (val >= 0x80) {
+        buf += char((val & 0x7f) | 0x80);
+        val >>= 7;
+      }
+      buf += char(val);
+    }
+    static uint64_t Zigzag(int64_t val) { return (uint64_t(val) << 1) ^ uint64_t(val >> 63); }
+
+    void Field(int16_t id, uint8_t type) {
+      const int16_t delta = id - last;
+      if ((delta > 0) && (delta <= 15)) {
+        buf += char((delta << 4) | type);
+      } else {
+        buf += char(type);
+        Varint(Zigzag(id));
+      }
+      last = id;
+    }
+    void I32(int16_t id, int32_t val) { Field(id, T_I32); Varint(Zigzag(val)); }
+    void I64(int16_t id, int64_t val) { Field(id, T_I64); Varint(Zigzag(val)); }
+    void String(int16_t id, const std::string& str) { Field(id, T_BINARY); Str(str); }
+    void Str(const std::string& str) { Varint(str.size()); buf += str; }
+    void BeginStruct(int16_t id) { Field(id, T_STRUCT); BeginElem(); }
+    void EndStruct() { EndElem(); }
+    void BeginList(int16_t id, uint8_t type, uint32_t size) {
+      Field(id, T_LIST);
+      if (size < 15) {
+        buf += char((size << 4) | type);
+      } else {
+        buf += char(0xf0 | type);
+        Varint(size);
+      }
+    }
+    void BeginElem() { stack.push_back(last); last = 0; }
+    void EndElem() { Stop(); last = stack.back(); stack.pop_back(); }
+    void Append(const std::string& data) { buf += data; }
+    void Stop() { buf += char(0); }
+
+    std::string buf;
+    int16_t last;
+    std::vector<int16_t> stack;
+  };
+
+  struct column_t {
+    column_t(const std::string& n, type_t t, bool o) : name(n), type(t), optional(o), set(false) {}
+    std::string name;
+    type_t type;
+    bool optional;
+    bool set;
+    std::string values;            // plain encoded values
+    std::vector<uint32_t> defs;    // definition levels
+    std::map<std::string, uint32_t> dict;
+    std::vector<const std::string*> dict_order;
+    std::vector<uint32_t> indices; // dictionary indices
+  };
+
+  struct group_t {
+    std::string meta;  // the RowGroup list element
+  };
+
+  void Plain(uint32_t col, const void* val) {
+    column_t& column = columns_[col];
+    column.values.append(reinterpret_cast<const char*>(val), 8);
+    column.set = true;
+  }
+
+  static uint32_t BitWidth(uint32_t max_val) {
+    uint32_t width = 1;
+    while ((width < 32) && ((max_val >> width) != 0)) ++width;
+    return width;
+  }
+
+  // RLE/bit-packed hybrid encoding as one bit-packed run, the last group is zero padded
+  static void BitPack(const std::vector<uint32_t>& vals, uint32_t width, std::string* out) {
+    if (vals.empty()) return;
+    Thrift header;
+    header.Varint((((vals.size() + 7) / 8) << 1) | 1);
+    out->append(header.buf);
+    const size_t size = ((vals.size() + 7) / 8) * width;
+    const size_t pos = out->size();
+    out->append(size, '\0');
+    char* ptr = &(*out)[pos];
+    uint64_t bit = 0;
+    for (uint32_t val : vals) {
+      for (uint32_t i = 0; i < width; ++i, ++bit) {
+        if ((val >> i) & 1) ptr[bit >> 3] |= char(1 << (bit & 7));
+      }
+    }
+  }
+
+  bool Write(const void* data, size_t size) {
+    offset_ += size;
+    return fwrite(data, 1, size, file_) == size;
+  }
+
+  // Writing the page with its header, returns the uncompressed size with the header
+  bool WritePage(uint32_t page_type, const std::string& data, uint32_t num_values, uint32_t encoding,
+                 int64_t* uncompressed, int64_t* compressed) {
+    const std::string* page = &data;
+#ifdef RPL_POST_ZLIB
+    std::string zdata;
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    zdata.resize(deflateBound(&zs, data.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&zdata[0]);
+    zs.avail_out = zdata.size();
+    const int zret = deflate(&zs, Z_FINISH);
+    zdata.resize(zs.total_out);
+    deflateEnd(&zs);
+    if (zret != Z_STREAM_END) return false;
+    page = &zdata;
+#endif
+
+    Thrift header;
+    header.I32(1, page_type);
+    header.I32(2, data.size());
+    header.I32(3, page->size());
+    if (page_type == PAGE_DATA) {
+      header.BeginStruct(5);  // data_page_header
+      header.I32(1, num_values);
+      header.I32(2, encoding);
+      header.I32(3, ENCODING_RLE);
+      header.I32(4, ENCODING_RLE);
+      header.EndStruct();
+    } else {
+      header.BeginStruct(7);  // dictionary_page_header
+      header.I32(1, num_values);
+      header.I32(2, encoding);
+      header.EndStruct();
+    }
+    header.Stop();
+
+    *uncompressed += header.buf.size() + data.size();
+    *compressed += header.buf.size() + page->size();
+    return Write(header.buf.data(), header.buf.size()) && Write(page->data(), page->size());
+  }
+
+  bool WriteGroup() {
+    Thrift meta;
+    meta.BeginElem();
+    meta.BeginList(1, Thrift::T_STRUCT, columns_.size());  // columns
+    int64_t group_size = 0;
+    for (column_t& column : columns_) {
+      const int64_t chunk_offset = offset_;
+      int64_t uncompressed = 0;
+      int64_t compressed = 0;
+      int64_t dict_offset = -1;
+      std::string data;
+
+      if (column.type == TYPE_TEXT) {
+        dict_offset = offset_;
+        std::string dict;
+        for (const std::string* str : column.dict_order) {
+          const uint32_t size = str->size();
+          dict.append(reinterpret_cast<const char*>(&size), sizeof(size));
+          dict.append(*str);
+        }
+        if (!WritePage(PAGE_DICTIONARY, dict, column.dict_order.size(), ENCODING_PLAIN,
+                       &uncompressed, &compressed)) return false;
+      }
+
+      const int64_t data_offset = offset_;
+      if (column.optional) {
+        std::string levels;
+        BitPack(column.defs, 1, &levels);
+        const uint32_t size = levels.size();
+        data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        data.append(levels);
+      }
+      if (column.type == TYPE_TEXT) {
+        const uint32_t width = BitWidth((column.dict_order.size() > 1) ? column.dict_order.size() - 1 : 0);
+        data += char(width);
+        BitPack(column.indices, width, &data);
+      } else {
+        data.append(column.values);
+      }
+      const uint32_t encoding = (column.type == TYPE_TEXT) ? ENCODING_RLE_DICTIONARY : ENCODING_PLAIN;
+      if (!WritePage(PAGE_DATA, data, group_rows_, encoding, &uncompressed, &compressed)) return false;
+
+      meta.BeginElem();
+      meta.I64(2, chunk_offset);  // file_offset
+      meta.BeginStruct(3);  // meta_data
+      meta.I32(1, column.type);
+      meta.BeginList(2, Thrift::T_I32, (column.type == TYPE_TEXT) ? 3 : 2);  // encodings
+      meta.Varint(Thrift::Zigzag(ENCODING_PLAIN));
+      meta.Varint(Thrift::Zigzag(ENCODING_RLE));
+      if (column.type == TYPE_TEXT) meta.Varint(Thrift::Zigzag(ENCODING_RLE_DICTIONARY));
+      meta.BeginList(3, Thrift::T_BINARY, 1);  // path_in_schema
+      meta.Str(column.name);
+#ifdef RPL_POST_ZLIB
+      meta.I32(4, CODEC_GZIP);
+#else
+      meta.I32(4, CODEC_UNCOMPRESSED);
+#endif
+      meta.I64(5, group_rows_);  // num_values
+      meta.I64(6, uncompressed);
+      meta.I64(7, compressed);
+      meta.I64(9, data_offset);
+      if (dict_offset >= 0) meta.I64(11, dict_offset);
+      meta.EndStruct();
+      meta.EndElem();
+      group_size += uncompressed;
+
+      column.values.clear();
+      column.defs.clear();
+      column.dict.clear();
+      column.dict_order.clear();
+      column.indices.clear();
+    }
+    meta.I64(2, group_size);  // total_byte_size
+    meta.I64(3, group_rows_);  // num_rows
+    meta.EndElem();
+
+    groups_.push_back(group_t{meta.buf});
+    total_rows_ += group_rows_;
+    group_rows_ = 0;
+    return true;
+  }
+
+  FILE* file_;
+  int64_t offset_;
+  std::vector<column_t> columns_;
+  std::vector<group_t> groups_;
+  uint32_t group_rows_;
+  uint64_t total_rows_;
+};
+
+#endif  // TEST_UTIL_RPL_PARQUET_H_
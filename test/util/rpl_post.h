@@ -0,0 +1,706 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_POST_H_
+#define TEST_UTIL_RPL_POST_H_
+
+// Binary results post-processing, the native counterpart of the tblextr.py
+// kernels results path with the same output schemas.
+//
+// The inputs are read in one streaming pass over the mapped files, only the
+// records references are kept. The rows are sorted by (pid, index), and the
+// rows formatting and the kernels stats reductions are done in parallel by
+// rows chunks. The CSV-only output keeps the results values text, the stats
+// output keeps the values as the tblextr SQLite dump prints them.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef RPL_POST_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include "util/rpl_bin.h"
+#include "util/rpl_parquet.h"
+
+class RplPost {
+ public:
+  // tblextr JSON trace GPU processes base id
+  static const uint32_t GPU_BASE_PID = 6;
+
+  // stats - the tblextr DB mode values, the duration column is added
+  RplPost(bool stats, bool merge_pids, uint32_t thread_count) :
+    stats_(stats),
+    merge_pids_(merge_pids),
+    thread_count_((thread_count != 0) ? thread_count : 1),
+    time_valid_(false),
+    weight_valid_(false),
+    max_gpu_id_(-1)
+  {}
+
+  ~RplPost() {
+    for (RplBinFile* file : files_) delete file;
+    for (scope_t* scope : scopes_) delete scope;
+  }
+
+  // Reading the binary results file, returns false on an error
+  bool AddInput(const std::string& path) {
+    RplBinFile* file = new RplBinFile(path);
+    files_.push_back(file);
+    if (file->IsValid() == false) return SetError(file->Error());
+
+    scope_t* scope = NULL;
+    size_t pos = 0;
+    while (pos < file->Size()) {
+      const rpl_bin_record_t* rec = file->GetRecord(pos);
+      if (rec == NULL) return SetError(file->Error());
+      pos += rec->size;
+      switch (rec->type) {
+        case RPL_BIN_HEADER:
+          scope = new scope_t;
+          scope->pid = reinterpret_cast<const rpl_bin_header_t*>(rec)->pid;
+          scopes_.push_back(scope);
+          break;
+        case RPL_BIN_STRING: {
+          const rpl_bin_string_t* str = reinterpret_cast<const rpl_bin_string_t*>(rec);
+          if (scope->strings.size() <= str->id) scope->strings.resize(str->id + 1);
+          scope->strings[str->id] = RplBinFile::GetString(str);
+          break;
+        }
+        case RPL_BIN_DISPATCH: {
+          const rpl_bin_dispatch_t* disp = reinterpret_cast<const rpl_bin_dispatch_t*>(rec);
+          if (AddDispatch(file, scope, disp) == false) return false;
+          break;
+        }
+        case RPL_BIN_KERNEL:
+          scope->kernels.Add(reinterpret_cast<const rpl_bin_kernel_t*>(rec));
+          break;
+        case RPL_BIN_KDISPATCH: {
+          // The expanded records are kept for the rows
+          expanded_.push_back(RplBinKernels::buffer_t());
+          const rpl_bin_kdispatch_t* kdisp = reinterpret_cast<const rpl_bin_kdispatch_t*>(rec);
+          const rpl_bin_dispatch_t* disp = scope->kernels.Expand(kdisp, scope->pid, &expanded_.back());
+          if (disp == NULL) {
+            return SetError("kernel id (" + std::to_string(kdisp->kernel_id) + ") not found in '" + file->Path() + "'");
+          }
+          if (AddDispatch(file, scope, disp) == false) return false;
+          break;
+        }
+        case RPL_BIN_MEMCOPY:
+          copies_.push_back(reinterpret_cast<const rpl_bin_memcopy_t*>(rec));
+          break;
+      }
+    }
+    return true;
+  }
+
+  // Sorting the rows and formatting the outputs in parallel
+  void Process(bool json) {
+    // Sorting by (pid, index), the first dispatch of a repeated key is kept
+    std::stable_sort(rows_.begin(), rows_.end(), [](const row_t& a, const row_t& b) {
+      return (a.pid != b.pid) ? (a.pid < b.pid) : (a.rec->index < b.rec->index);
+    });
+    rows_.erase(std::unique(rows_.begin(), rows_.end(), [](const row_t& a, const row_t& b) {
+      return (a.pid == b.pid) && (a.rec->index == b.rec->index);
+    }), rows_.end());
+    if (rows_.empty()) return;
+
+    // The columns are the fields of the first row, the timestamps go last
+    SetColumns(rows_[0]);
+
+    // Formatting the rows chunks
+    const size_t chunk_count = std::min<size_t>(thread_count_, rows_.size());
+    chunks_.assign(chunk_count, chunk_t{});
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < chunk_count; ++i) {
+      chunk_t* chunk = &chunks_[i];
+      chunk->begin = (rows_.size() * i) / chunk_count;
+      chunk->end = (rows_.size() * (i + 1)) / chunk_count;
+      threads.push_back(std::thread(&RplPost::FormatChunk, this, chunk, json));
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    // Reducing the chunks stats
+    stats_map_.clear();
+    for (chunk_t& chunk : chunks_) {
+      for (auto& item : chunk.stats) {
+        stat_t& stat = stats_map_[item.first];
+        stat.calls += item.second.calls;
+        stat.total_ns += item.second.total_ns;
+        stat.weighted_calls += item.second.weighted_calls;
+        stat.weighted_ns += item.second.weighted_ns;
+      }
+    }
+  }
+
+  // Results CSV, the tblextr 'dump_csv' or the KERN table dump schema
+  bool WriteCsv(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) return SetError("cannot open '" + path + "'");
+    std::string header;
+    for (const column_t& column : columns_) {
+      if (!header.empty()) header += ',';
+      header += (stats_) ? "\"" + column.name + "\"" : column.name;
+    }
+    fprintf(file, "%s\n", header.c_str());
+    for (const chunk_t& chunk : chunks_) fwrite(chunk.csv.data(), 1, chunk.csv.size(), file);
+    fclose(file);
+    return true;
+  }
+
+  // Kernels stats CSV, the tblextr 'gen_table_bins' schema, the sampled
+  // dispatches are scaled by the sampling weights
+  bool WriteStats(const std::string& path) {
+    if (time_valid_ == false) return true;
+    struct entry_t {
+      const std::string* name;
+      int64_t calls;
+      int64_t total_ns;
+    };
+    std::vector<entry_t> entries;
+    int64_t sum_ns = 0;
+    for (auto& item : stats_map_) {
+      const stat_t& stat = item.second;
+      entry_t entry{&item.first, stat.calls, stat.total_ns};
+      if (weight_valid_) {
+        entry.calls = (int64_t)round(stat.weighted_calls);
+        entry.total_ns = (int64_t)round(stat.weighted_ns);
+      }
+      sum_ns += entry.total_ns;
+      entries.push_back(entry);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) {
+      return a.total_ns > b.total_ns;
+    });
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) return SetError("cannot open '" + path + "'");
+    fprintf(file, "\"Name\",\"Calls\",\"TotalDurationNs\",\"AverageNs\",\"Percentage\"\n");
+    for (const entry_t& entry : entries) {
+      const std::string average = (entry.calls != 0) ? std::to_string(entry.total_ns / entry.calls) : "None";
+      const std::string percentage = (sum_ns != 0) ? FloatRepr((entry.total_ns * 100.0) / sum_ns) : "None";
+      fprintf(file, "%s,%ld,%ld,%s,%s\n", Quote(*entry.name).c_str(), entry.calls, entry.total_ns,
+              average.c_str(), percentage.c_str());
+    }
+    fclose(file);
+    return true;
+  }
+
+  bool HasCopies() const { return !copies_.empty(); }
+
+  // Memory copies CSV sorted by the begin timestamp, with the duration and the bandwidth
+  bool WriteCopies(const std::string& path) {
+    std::stable_sort(copies_.begin(), copies_.end(), [](const rpl_bin_memcopy_t* a, const rpl_bin_memcopy_t* b) {
+      return a->begin < b->begin;
+    });
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) return SetError("cannot open '" + path + "'");
+    fprintf(file, "\"Index\",\"Pid\",\"SrcGpuId\",\"DstGpuId\",\"Size\",\"BeginNs\",\"EndNs\",\"DurationNs\",\"BandwidthGBs\"\n");
+    for (const rpl_bin_memcopy_t* copy : copies_) {
+      const uint64_t duration_ns = (copy->end > copy->begin) ? copy->end - copy->begin : 0;
+      const std::string bandwidth = (duration_ns != 0) ? FloatRepr((double)copy->size / duration_ns) : "None";
+      fprintf(file, "%lu,%u,%d,%d,%lu,%lu,%lu,%lu,%s\n", copy->index, copy->pid, copy->src_gpu_id, copy->dst_gpu_id,
+              copy->size, copy->begin, copy->end, duration_ns, bandwidth.c_str());
+    }
+    fclose(file);
+    return true;
+  }
+
+  // Kernels JSON trace, the tblextr 'gen_kernel_json_trace' schema
+  bool WriteJson(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) return SetError("cannot open '" + path + "'");
+    fprintf(file, "{ \"traceEvents\":[{}\n");
+    for (int gpu_id = 0; gpu_id <= max_gpu_id_; ++gpu_id) {
+      fprintf(file, ",{\"args\":{\"name\":\"GPU%d\"},\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"sort_index\":%d}\n",
+              gpu_id, gpu_id + GPU_BASE_PID, gpu_id);
+    }
+    for (const chunk_t& chunk : chunks_) fwrite(chunk.json.data(), 1, chunk.json.size(), file);
+    fprintf(file, "],\n\"otherData\": {\n  }\n}");
+    fclose(file);
+    return true;
+  }
+
+  // Results Parquet table, the KERN table columns with the durations. The values are
+  // typed by the first row, the missing values are NULL and the names are dictionary encoded.
+  bool WriteParquet(const std::string& path) {
+    if (rows_.empty()) return true;
+    RplParquet parquet;
+    std::vector<const rpl_bin_value_t*> slots;
+    GetSlots(rows_[0], &slots);
+    for (size_t j = 0; j < data_columns_.size(); ++j) {
+      const column_t& column = data_columns_[j];
+      switch (column.kind) {
+        case COLUMN_NAME: parquet.AddColumn(column.name, RplParquet::TYPE_TEXT, false); break;
+        case COLUMN_WEIGHT: parquet.AddColumn(column.name, RplParquet::TYPE_DOUBLE, false); break;
+        case COLUMN_VALUE:
+          parquet.AddColumn(column.name, (slots[j]->kind == RPL_BIN_VALUE_DOUBLE) ?
+            RplParquet::TYPE_DOUBLE : RplParquet::TYPE_INT64, true);
+          break;
+        default: parquet.AddColumn(column.name, RplParquet::TYPE_INT64, false);
+      }
+    }
+    std::vector<bool> doubles(data_columns_.size(), false);
+    for (size_t j = 0; j < data_columns_.size(); ++j) {
+      doubles[j] = (data_columns_[j].kind == COLUMN_VALUE) && (slots[j]->kind == RPL_BIN_VALUE_DOUBLE);
+    }
+    const uint32_t duration_col = data_columns_.size();
+    if (time_valid_) parquet.AddColumn("DurationNs", RplParquet::TYPE_INT64, false);
+    if (parquet.Open(path) == false) return SetError("cannot open '" + path + "'");
+
+    for (const row_t& row : rows_) {
+      const rpl_bin_dispatch_t* rec = row.rec;
+      GetSlots(row, &slots);
+      for (uint32_t j = 0; j < data_columns_.size(); ++j) {
+        const column_t& column = data_columns_[j];
+        switch (column.kind) {
+          case COLUMN_INDEX: parquet.SetInt(j, rec->index); break;
+          case COLUMN_NAME: parquet.SetText(j, row.scope->strings[rec->name_id]); break;
+          case COLUMN_PROP: parquet.SetInt(j, PropValue(rec, column.id)); break;
+          case COLUMN_WEIGHT: parquet.SetDouble(j, rec->weight); break;
+          case COLUMN_VALUE: {
+            const rpl_bin_value_t* value = slots[j];
+            if (value == NULL) break;
+            const bool is_double = (value->kind == RPL_BIN_VALUE_DOUBLE);
+            if (doubles[j]) parquet.SetDouble(j, is_double ? value->result_double : double(value->result_int64));
+            else parquet.SetInt(j, is_double ? int64_t(value->result_double) : int64_t(value->result_int64));
+            break;
+          }
+          case COLUMN_TIME: parquet.SetInt(j, TimeValue(rec, column.id)); break;
+          default: break;
+        }
+      }
+      if (time_valid_) parquet.SetInt(duration_col, Duration(rec));
+      if (parquet.EndRow() == false) return SetError("cannot write '" + path + "'");
+    }
+    return parquet.Close() || SetError("cannot write '" + path + "'");
+  }
+
+  // Memory copies Parquet table, the copies CSV columns, the bandwidth is NULL for a zero duration
+  bool WriteCopiesParquet(const std::string& path) {
+    std::stable_sort(copies_.begin(), copies_.end(), [](const rpl_bin_memcopy_t* a, const rpl_bin_memcopy_t* b) {
+      return a->begin < b->begin;
+    });
+    RplParquet parquet;
+    const char* names[] = {"Index", "Pid", "SrcGpuId", "DstGpuId", "Size", "BeginNs", "EndNs", "DurationNs"};
+    for (const char* name : names) parquet.AddColumn(name, RplParquet::TYPE_INT64, false);
+    parquet.AddColumn("BandwidthGBs", RplParquet::TYPE_DOUBLE, true);
+    if (parquet.Open(path) == false) return SetError("cannot open '" + path + "'");
+    for (const rpl_bin_memcopy_t* copy : copies_) {
+      const uint64_t duration_ns = (copy->end > copy->begin) ? copy->end - copy->begin : 0;
+      const int64_t vals[] = {(int64_t)copy->index, copy->pid, copy->src_gpu_id, copy->dst_gpu_id,
+                              (int64_t)copy->size, (int64_t)copy->begin, (int64_t)copy->end, (int64_t)duration_ns};
+      for (uint32_t j = 0; j < 8; ++j) parquet.SetInt(j, vals[j]);
+      if (duration_ns != 0) parquet.SetDouble(8, (double)copy->size / duration_ns);
+      if (parquet.EndRow() == false) return SetError("cannot write '" + path + "'");
+    }
+    return parquet.Close() || SetError("cannot write '" + path + "'");
+  }
+
+#ifdef RPL_POST_SQLITE
+  // KERN table with the tblextr schema, the rows are inserted by a prepared
+  // statement in one transaction with the SQLite columns affinity conversions
+  bool WriteSqlite(const std::string& path) {
+    remove(path.c_str());
+    sqlite3* db = NULL;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+      sqlite3_close(db);
+      return SetError("cannot open DB '" + path + "'");
+    }
+
+    std::string descr;
+    std::string fields;
+    std::string templ;
+    for (const column_t& column : data_columns_) {
+      if (!descr.empty()) { descr += ", "; fields += ','; templ += ','; }
+      descr += "\"" + column.name + "\" " + column.type;
+      fields += "\"" + column.name + "\"";
+      templ += '?';
+    }
+    bool ret = Exec(db, "CREATE TABLE KERN (" + descr + ")") && Exec(db, "BEGIN TRANSACTION");
+
+    sqlite3_stmt* stmt = NULL;
+    if (ret) {
+      const std::string stm = "INSERT INTO KERN(" + fields + ") VALUES(" + templ + ");";
+      ret = (sqlite3_prepare_v2(db, stm.c_str(), -1, &stmt, NULL) == SQLITE_OK);
+      if (!ret) SetError(std::string("DB prepare failed: ") + sqlite3_errmsg(db));
+    }
+    std::vector<const rpl_bin_value_t*> slots;
+    for (size_t i = 0; ret && (i < rows_.size()); ++i) {
+      const row_t& row = rows_[i];
+      GetSlots(row, &slots);
+      for (size_t j = 0; j < data_columns_.size(); ++j) {
+        const std::string val = RawValue(row, data_columns_[j], slots[j]);
+        sqlite3_bind_text(stmt, j + 1, val.c_str(), val.size(), SQLITE_TRANSIENT);
+      }
+      ret = (sqlite3_step(stmt) == SQLITE_DONE);
+      if (!ret) SetError(std::string("DB insert failed: ") + sqlite3_errmsg(db));
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (ret && time_valid_) {
+      ret = Exec(db, "ALTER TABLE KERN ADD COLUMN \"DurationNs\" INTEGER") &&
+            Exec(db, "UPDATE KERN SET DurationNs = (EndNs - BeginNs);");
+    }
+    if (ret) ret = Exec(db, "COMMIT");
+    sqlite3_close(db);
+    return ret;
+  }
+#endif
+
+  size_t RowCount() const { return rows_.size(); }
+  const std::string& Error() const { return error_; }
+
+ private:
+  enum column_kind_t {
+    COLUMN_INDEX,
+    COLUMN_NAME,
+    COLUMN_PROP,
+    COLUMN_WEIGHT,
+    COLUMN_VALUE,
+    COLUMN_TIME,
+    COLUMN_DURATION
+  };
+
+  // Kernel properties in the text output order, 'sig' and 'obj' are hex
+  enum prop_t {
+    PROP_GPU_ID, PROP_QUEUE_ID, PROP_QUEUE_INDEX, PROP_PID, PROP_TID, PROP_GRD, PROP_WGR, PROP_LDS,
+    PROP_SCR, PROP_VGPR, PROP_SGPR, PROP_FBAR, PROP_SIG, PROP_OBJ, PROP_COUNT
+  };
+
+  struct column_t {
+    std::string name;
+    column_kind_t kind;
+    uint32_t id;  // the property, the value or the timestamp index
+    const char* type;  // SQLite column type
+  };
+
+  // Header record scope, the strings and the value columns by the string id
+  struct scope_t {
+    uint32_t pid;
+    std::vector<std::string> strings;
+    std::vector<int32_t> value_columns;
+    RplBinKernels kernels;
+  };
+
+  struct row_t {
+    uint32_t pid;
+    const rpl_bin_dispatch_t* rec;
+    const scope_t* scope;
+  };
+
+  struct stat_t {
+    int64_t calls;
+    int64_t total_ns;
+    double weighted_calls;
+    double weighted_ns;
+  };
+  typedef std::map<std::string, stat_t> stats_map_t;
+
+  struct chunk_t {
+    size_t begin;
+    size_t end;
+    std::string csv;
+    std::string json;
+    stats_map_t stats;
+  };
+
+  static const char* PropName(uint32_t prop) {
+    static const char* names[PROP_COUNT] = {
+      "gpu-id", "queue-id", "queue-index", "pid", "tid", "grd", "wgr", "lds", "scr", "vgpr", "sgpr", "fbar", "sig", "obj"
+    };
+    return names[prop];
+  }
+
+  bool SetError(const std::string& msg) {
+    error_ = msg;
+    return false;
+  }
+
+  bool AddDispatch(RplBinFile* file, scope_t* scope, const rpl_bin_dispatch_t* disp) {
+    if ((disp->name_id >= scope->strings.size())) {
+      return SetError("string id (" + std::to_string(disp->name_id) + ") not found in '" + file->Path() + "'");
+    }
+    // The variables columns in the first appearance order
+    const rpl_bin_value_t* values = RplBinFile::GetValues(disp);
+    for (uint32_t i = 0; i < disp->value_count; ++i) {
+      const uint32_t name_id = values[i].name_id;
+      if (name_id >= scope->strings.size()) {
+        return SetError("string id (" + std::to_string(name_id) + ") not found in '" + file->Path() + "'");
+      }
+      if (scope->value_columns.size() <= name_id) scope->value_columns.resize(name_id + 1, -1);
+      if (scope->value_columns[name_id] < 0) {
+        auto ret = value_map_.insert({scope->strings[name_id], (uint32_t)value_names_.size()});
+        if (ret.second) value_names_.push_back(ret.first->first);
+        scope->value_columns[name_id] = ret.first->second;
+      }
+    }
+    if ((int)disp->gpu_id > max_gpu_id_) max_gpu_id_ = disp->gpu_id;
+    rows_.push_back(row_t{(merge_pids_) ? 0 : disp->pid, disp, scope});
+    return true;
+  }
+
+  void SetColumns(const row_t& first) {
+    columns_.clear();
+    columns_.push_back(column_t{"Index", COLUMN_INDEX, 0, "INTEGER"});
+    columns_.push_back(column_t{"KernelName", COLUMN_NAME, 0, "TEXT"});
+    for (uint32_t i = 0; i < PROP_COUNT; ++i) columns_.push_back(column_t{PropName(i), COLUMN_PROP, i, "INTEGER"});
+    weight_valid_ = (first.rec->flags & RPL_BIN_DISPATCH_WEIGHT) != 0;
+    if (weight_valid_) columns_.push_back(column_t{"weight", COLUMN_WEIGHT, 0, "REAL"});
+    const rpl_bin_value_t* values = RplBinFile::GetValues(first.rec);
+    std::vector<bool> present(value_names_.size(), false);
+    for (uint32_t i = 0; i < first.rec->value_count; ++i) present[first.scope->value_columns[values[i].name_id]] = true;
+    for (uint32_t i = 0; i < value_names_.size(); ++i) {
+      if (present[i]) columns_.push_back(column_t{value_names_[i], COLUMN_VALUE, i, "INTEGER"});
+    }
+    time_valid_ = (first.rec->flags & RPL_BIN_DISPATCH_TIME) != 0;
+    if (time_valid_) {
+      const char* time_names[] = {"DispatchNs", "BeginNs", "EndNs", "CompleteNs"};
+      for (uint32_t i = 0; i < 4; ++i) columns_.push_back(column_t{time_names[i], COLUMN_TIME, i, "INTEGER"});
+    }
+    data_columns_ = columns_;
+    if (stats_ && time_valid_) columns_.push_back(column_t{"DurationNs", COLUMN_DURATION, 0, "INTEGER"});
+
+    value_slots_.assign(value_names_.size(), -1);
+    for (uint32_t j = 0; j < columns_.size(); ++j) {
+      if (columns_[j].kind == COLUMN_VALUE) value_slots_[columns_[j].id] = j;
+    }
+  }
+
+  // Row values by the value columns
+  void GetSlots(const row_t& row, std::vector<const rpl_bin_value_t*>* slots) const {
+    slots->assign(columns_.size(), NULL);
+    const rpl_bin_value_t* values = RplBinFile::GetValues(row.rec);
+    for (uint32_t i = 0; i < row.rec->value_count; ++i) {
+      const int32_t j = value_slots_[row.scope->value_columns[values[i].name_id]];
+      if (j >= 0) (*slots)[j] = &values[i];
+    }
+  }
+
+  static uint64_t PropValue(const rpl_bin_dispatch_t* rec, uint32_t prop) {
+    switch (prop) {
+      case PROP_GPU_ID: return rec->gpu_id;
+      case PROP_QUEUE_ID: return rec->queue_id;
+      case PROP_QUEUE_INDEX: return rec->queue_index;
+      case PROP_PID: return rec->pid;
+      case PROP_TID: return rec->tid;
+      case PROP_GRD: return rec->grid_size;
+      case PROP_WGR: return rec->workgroup_size;
+      case PROP_LDS: return rec->lds_size;
+      case PROP_SCR: return rec->scratch_size;
+      case PROP_VGPR: return rec->vgpr_count;
+      case PROP_SGPR: return rec->sgpr_count;
+      case PROP_FBAR: return rec->fbarrier_count;
+      case PROP_SIG: return rec->signal;
+      case PROP_OBJ: return rec->object;
+    }
+    return 0;
+  }
+
+  static uint64_t TimeValue(const rpl_bin_dispatch_t* rec, uint32_t id) {
+    const uint64_t times[] = {rec->dispatch, rec->begin, rec->end, rec->complete};
+    return times[id];
+  }
+
+  static std::string Format(const char* fmt, double val) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), fmt, val);
+    return buf;
+  }
+  static std::string Hex(uint64_t val) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "0x%lx", val);
+    return buf;
+  }
+
+  static std::string Quote(const std::string& str) {
+    return ((str.size() >= 2) && (str.front() == '"') && (str.back() == '"')) ? str : "\"" + str + "\"";
+  }
+
+  // The shortest round-trip double representation as Python prints it
+  static std::string FloatRepr(double val) {
+    if (isnan(val)) return "nan";
+    if (isinf(val)) return (val < 0) ? "-inf" : "inf";
+    char buf[64];
+    int prec = 1;
+    for (; prec < 17; ++prec) {
+      snprintf(buf, sizeof(buf), "%.*e", prec - 1, val);
+      if (strtod(buf, NULL) == val) break;
+    }
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, val);
+    std::string str = buf;
+    std::string sign;
+    if (str[0] == '-') { sign = "-"; str.erase(0, 1); }
+    const size_t epos = str.find('e');
+    const int exp = atoi(str.c_str() + epos + 1);
+    std::string digits = str.substr(0, epos);
+    digits.erase(std::remove(digits.begin(), digits.end(), '.'), digits.end());
+    while ((digits.size() > 1) && (digits.back() == '0')) digits.pop_back();
+    const int count = digits.size();
+
+    if ((exp < -4) || (exp >= 16)) {
+      std::string mantissa = digits.substr(0, 1);
+      if (count > 1) mantissa += "." + digits.substr(1);
+      snprintf(buf, sizeof(buf), "e%c%02d", (exp < 0) ? '-' : '+', abs(exp));
+      return sign + mantissa + buf;
+    }
+    if (exp < 0) return sign + "0." + std::string(-exp - 1, '0') + digits;
+    if (count <= exp + 1) return sign + digits + std::string(exp + 1 - count, '0') + ".0";
+    return sign + digits.substr(0, exp + 1) + "." + digits.substr(exp + 1);
+  }
+
+  // SQLite numeric column affinity, an integral real is stored as integer
+  static std::string NumericValue(double val) {
+    if ((val == floor(val)) && (fabs(val) < 9.2e18)) return std::to_string((int64_t)val);
+    return FloatRepr(val);
+  }
+
+  // The value text of the results output
+  std::string RawValue(const row_t& row, const column_t& column, const rpl_bin_value_t* value) const {
+    const rpl_bin_dispatch_t* rec = row.rec;
+    switch (column.kind) {
+      case COLUMN_INDEX: return std::to_string(rec->index);
+      case COLUMN_NAME: return "\"" + row.scope->strings[rec->name_id] + "\"";
+      case COLUMN_PROP: return ((column.id == PROP_SIG) || (column.id == PROP_OBJ)) ?
+        Hex(PropValue(rec, column.id)) : std::to_string(PropValue(rec, column.id));
+      case COLUMN_WEIGHT: return Format("%.3f", rec->weight);
+      case COLUMN_VALUE:
+        if (value == NULL) return std::string();
+        return (value->kind == RPL_BIN_VALUE_DOUBLE) ? Format("%.10f", value->result_double) :
+          std::to_string(value->result_int64);
+      case COLUMN_TIME: return std::to_string(TimeValue(rec, column.id));
+      case COLUMN_DURATION: return std::to_string(Duration(rec));
+    }
+    return std::string();
+  }
+
+  // The value as the SQLite DB stores it, text values are not quoted
+  std::string DbValue(const row_t& row, const column_t& column, const rpl_bin_value_t* value) const {
+    const std::string raw = RawValue(row, column, value);
+    switch (column.kind) {
+      case COLUMN_WEIGHT: return FloatRepr(strtod(raw.c_str(), NULL));
+      case COLUMN_VALUE:
+        if (value == NULL) return "None";
+        if ((value->kind == RPL_BIN_VALUE_INT64) && (value->result_int64 <= INT64_MAX)) return raw;
+        return NumericValue(strtod(raw.c_str(), NULL));
+      default: return raw;
+    }
+  }
+
+  static int64_t Duration(const rpl_bin_dispatch_t* rec) { return (int64_t)(rec->end - rec->begin); }
+
+  void FormatChunk(chunk_t* chunk, bool json) const {
+    std::vector<const rpl_bin_value_t*> slots;
+    std::vector<std::string> vals(columns_.size());
+    for (size_t i = chunk->begin; i < chunk->end; ++i) {
+      const row_t& row = rows_[i];
+      GetSlots(row, &slots);
+
+      // CSV row
+      for (size_t j = 0; j < columns_.size(); ++j) {
+        const column_t& column = columns_[j];
+        if (j != 0) chunk->csv += ',';
+        if (stats_) {
+          vals[j] = DbValue(row, column, slots[j]);
+          const bool text = (column.kind == COLUMN_PROP) && ((column.id == PROP_SIG) || (column.id == PROP_OBJ));
+          chunk->csv += (text) ? Quote(vals[j]) : vals[j];
+        } else {
+          chunk->csv += RawValue(row, column, slots[j]);
+        }
+      }
+      chunk->csv += '\n';
+
+      // Kernels stats
+      if (time_valid_) {
+        stat_t& stat = chunk->stats["\"" + row.scope->strings[row.rec->name_id] + "\""];
+        const double weight = (weight_valid_) ? strtod(Format("%.3f", row.rec->weight).c_str(), NULL) : 1.0;
+        stat.calls += 1;
+        stat.total_ns += Duration(row.rec);
+        stat.weighted_calls += weight;
+        stat.weighted_ns += Duration(row.rec) * weight;
+      }
+
+      // JSON trace event
+      if (json && time_valid_) {
+        const rpl_bin_dispatch_t* rec = row.rec;
+        const int64_t dur = Duration(rec) / 1000;
+        chunk->json += ",{\"ph\":\"X\",\"name\":\"" + row.scope->strings[rec->name_id] + "\",\"pid\":\"" +
+          std::to_string(rec->gpu_id + GPU_BASE_PID) + "\",\"tid\":\"" + std::to_string(rec->tid) + "\",\"ts\":\"" +
+          std::to_string(rec->begin / 1000) + "\",\"dur\":\"" + ((dur != 0) ? std::to_string(dur) : "1") +
+          "\",\n  \"args\":{\n    ";
+        bool first = true;
+        for (size_t j = 0; j < columns_.size(); ++j) {
+          const column_t& column = columns_[j];
+          if (column.kind == COLUMN_INDEX) continue;
+          std::string val = (stats_) ? vals[j] : DbValue(row, column, slots[j]);
+          if (column.kind == COLUMN_NAME) val = row.scope->strings[rec->name_id];
+          if (!first) chunk->json += ",\n    ";
+          chunk->json += "\"" + column.name + "\":\"" + val + "\"";
+          first = false;
+        }
+        chunk->json += "\n  }\n}\n";
+      }
+    }
+  }
+
+  static bool Exec(void* db, const std::string& stm) {
+#ifdef RPL_POST_SQLITE
+    return sqlite3_exec(reinterpret_cast<sqlite3*>(db), stm.c_str(), NULL, NULL, NULL) == SQLITE_OK;
+#else
+    return false;
+#endif
+  }
+
+  const bool stats_;
+  const bool merge_pids_;
+  const uint32_t thread_count_;
+  bool time_valid_;
+  bool weight_valid_;
+  int max_gpu_id_;
+  std::vector<RplBinFile*> files_;
+  std::vector<scope_t*> scopes_;
+  std::vector<row_t> rows_;
+  std::vector<const rpl_bin_memcopy_t*> copies_;
+  std::deque<RplBinKernels::buffer_t> expanded_;
+  std::map<std::string, uint32_t> value_map_;
+  std::vector<std::string> value_names_;
+  std::vector<column_t> columns_;
+  std::vector<column_t> data_columns_;
+  // The value columns indexes, by the value name id
+  std::vector<int32_t> value_slots_;
+  std::vector<chunk_t> chunks_;
+  stats_map_t stats_map_;
+  std::string error_;
+};
+
+#endif  // TEST_UTIL_RPL_POST_H_
@@ -0,0 +1,280 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_SHM_H_
+#define TEST_UTIL_RPL_SHM_H_
+
+// Shared memory control channel of a live profiling session
+//
+// The segment '/rocprof-<pid>' is created by the profiled process tool and
+// is attached by an external agent. The agent writes a command and then
+// increments the command sequence number, the tool executes the command and
+// stores the sequence number to the done sequence with the command status.
+// The completed dispatch records are written to a ring of slots with
+// a seqlock per slot, the slot sequence is odd while the slot is written
+// and is 2 * (record number + 1) when the record is complete. The reader
+// copies the slot and checks that the sequence is not changed, the records
+// overwritten by the writers are skipped. The ring should be larger than
+// the number of the concurrent writers.
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "util/rpl_bin.h"
+
+#define RPL_SHM_MAGIC 0x53485052  // "RPHS"
+#define RPL_SHM_VERSION 1
+#define RPL_SHM_METRICS_MAX 1024
+#define RPL_SHM_KERNEL_NAME_MAX 128
+#define RPL_SHM_VALUE_NAME_MAX 32
+#define RPL_SHM_VALUES_MAX 16
+
+enum rpl_shm_command_t {
+  RPL_SHM_CMD_NONE = 0,
+  RPL_SHM_CMD_ENABLE = 1,  // the dispatch callbacks are started
+  RPL_SHM_CMD_DISABLE = 2,  // the dispatch callbacks are stopped, the outstanding contexts are drained
+  RPL_SHM_CMD_METRICS = 3  // the metrics set is replaced by the comma separated 'metrics' names
+};
+
+enum rpl_shm_status_t {
+  RPL_SHM_STATUS_OK = 0,
+  RPL_SHM_STATUS_UNSUPPORTED = 1,
+  RPL_SHM_STATUS_BAD_METRIC = 2
+};
+
+struct rpl_shm_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t ring_size;
+  uint32_t slot_size;
+  uint32_t reserved;
+  // Control, the command and the metrics are written by the agent before the sequence increment
+  std::atomic<uint32_t> command_seq;
+  uint32_t command;
+  char metrics[RPL_SHM_METRICS_MAX];
+  std::atomic<uint32_t> done_seq;
+  std::atomic<uint32_t> done_status;
+  // Session state and stats, updated by the tool
+  std::atomic<uint32_t> enabled;
+  std::atomic<uint32_t> metrics_seq;  // incremented on the metrics set change
+  std::atomic<uint64_t> head;  // written records number
+  std::atomic<uint64_t> busy_ns;  // the records dispatches durations sum
+};
+
+struct rpl_shm_slot_t {
+  std::atomic<uint64_t> seq;
+  uint32_t metrics_seq;
+  uint32_t reserved;
+  rpl_bin_dispatch_t dispatch;
+  char kernel_name[RPL_SHM_KERNEL_NAME_MAX];
+  char names[RPL_SHM_VALUES_MAX][RPL_SHM_VALUE_NAME_MAX];
+  rpl_bin_value_t values[RPL_SHM_VALUES_MAX];
+};
+
+class RplShmChannel {
+ public:
+  static const uint32_t RING_SIZE_DFLT = 1024;
+
+  // Record copy read from the ring
+  struct record_t {
+    uint64_t number;
+    uint32_t metrics_seq;
+    rpl_bin_dispatch_t dispatch;
+    std::string kernel_name;
+    std::vector<std::string> names;
+    std::vector<rpl_bin_value_t> values;
+  };
+
+  // Creating the process segment, returns NULL on failure
+  static RplShmChannel* Create(uint32_t pid, uint32_t ring_size) {
+    const std::string name = Name(pid);
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+      perror(name.c_str());
+      return NULL;
+    }
+    const size_t size = sizeof(rpl_shm_header_t) + (size_t)ring_size * sizeof(rpl_shm_slot_t);
+    void* base = (ftruncate(fd, size) == 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+      perror(name.c_str());
+      shm_unlink(name.c_str());
+      return NULL;
+    }
+    rpl_shm_header_t* header = reinterpret_cast<rpl_shm_header_t*>(base);
+    header->pid = pid;
+    header->ring_size = ring_size;
+    header->slot_size = sizeof(rpl_shm_slot_t);
+    header->version = RPL_SHM_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = RPL_SHM_MAGIC;
+    return new RplShmChannel(name, base, size, true);
+  }
+
+  // Attaching the agent to the process segment, returns NULL on failure
+  static RplShmChannel* Attach(uint32_t pid) {
+    const std::string name = Name(pid);
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) return NULL;
+    struct stat st;
+    void* base = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && ((size_t)st.st_size >= sizeof(rpl_shm_header_t))) {
+      base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+    const rpl_shm_header_t* header = reinterpret_cast<const rpl_shm_header_t*>(base);
+    if ((header->magic != RPL_SHM_MAGIC) || (header->version != RPL_SHM_VERSION) ||
+        (header->slot_size != sizeof(rpl_shm_slot_t)) ||
+        ((size_t)st.st_size < sizeof(rpl_shm_header_t) + (size_t)header->ring_size * sizeof(rpl_shm_slot_t))) {
+      munmap(base, st.st_size);
+      return NULL;
+    }
+    return new RplShmChannel(name, base, st.st_size, false);
+  }
+
+  static std::string Name(uint32_t pid) { return "/rocprof-" + std::to_string(pid); }
+
+  ~RplShmChannel() {
+    munmap(base_, size_);
+    if (owner_) shm_unlink(name_.c_str());
+  }
+
+  rpl_shm_header_t* Header() const { return header_; }
+
+  // Tool side, returns true if a command is pending, the command is completed with its sequence number
+  bool PendingCommand(uint32_t* seq, uint32_t* command, std::string* metrics) const {
+    *seq = header_->command_seq.load(std::memory_order_acquire);
+    if (*seq == header_->done_seq.load(std::memory_order_relaxed)) return false;
+    *command = header_->command;
+    metrics->assign(header_->metrics, strnlen(header_->metrics, RPL_SHM_METRICS_MAX));
+    return true;
+  }
+
+  void CompleteCommand(uint32_t seq, rpl_shm_status_t status) {
+    header_->done_status.store(status, std::memory_order_relaxed);
+    header_->done_seq.store(seq, std::memory_order_release);
+  }
+
+  // Tool side, writing the completed dispatch record, thread safe
+  void Push(const rpl_bin_dispatch_t& dispatch, const char* kernel_name,
+            const std::vector<const char*>& names, const std::vector<rpl_bin_value_t>& values) {
+    const uint64_t number = header_->head.fetch_add(1, std::memory_order_relaxed);
+    rpl_shm_slot_t* slot = &slots_[number % header_->ring_size];
+    slot->seq.store(2 * number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const uint32_t count = std::min<size_t>(values.size(), RPL_SHM_VALUES_MAX);
+    slot->metrics_seq = header_->metrics_seq.load(std::memory_order_relaxed);
+    slot->dispatch = dispatch;
+    slot->dispatch.value_count = count;
+    CopyString(slot->kernel_name, kernel_name, RPL_SHM_KERNEL_NAME_MAX);
+    for (uint32_t i = 0; i < count; ++i) {
+      CopyString(slot->names[i], names[i], RPL_SHM_VALUE_NAME_MAX);
+      slot->values[i] = values[i];
+    }
+    if ((dispatch.flags & RPL_BIN_DISPATCH_TIME) && (dispatch.end > dispatch.begin)) {
+      header_->busy_ns.fetch_add(dispatch.end - dispatch.begin, std::memory_order_relaxed);
+    }
+
+    slot->seq.store(2 * number + 2, std::memory_order_release);
+  }
+
+  // Agent side, writing the command and waiting for the completion, returns false on timeout
+  bool Command(rpl_shm_command_t command, const char* metrics, uint32_t timeout_ms, rpl_shm_status_t* status) {
+    const uint32_t seq = header_->command_seq.load(std::memory_order_relaxed) + 1;
+    header_->command = command;
+    if (metrics != NULL) CopyString(header_->metrics, metrics, RPL_SHM_METRICS_MAX);
+    header_->command_seq.store(seq, std::memory_order_release);
+    for (uint32_t ms = 0; header_->done_seq.load(std::memory_order_acquire) != seq; ++ms) {
+      if (ms >= timeout_ms) return false;
+      usleep(1000);
+    }
+    *status = static_cast<rpl_shm_status_t>(header_->done_status.load(std::memory_order_relaxed));
+    return true;
+  }
+
+  // Agent side, reading the complete records starting from the given record number,
+  // returns the next record number
+  uint64_t Read(uint64_t from, std::vector<record_t>* records) const {
+    const uint64_t head = header_->head.load(std::memory_order_acquire);
+    const uint32_t ring_size = header_->ring_size;
+    if (head > from + ring_size) from = head - ring_size;
+    for (uint64_t number = from; number < head; ++number) {
+      const rpl_shm_slot_t* slot = &slots_[number % ring_size];
+      const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+      if (seq != 2 * number + 2) continue;
+
+      record_t rec{};
+      rec.number = number;
+      rec.metrics_seq = slot->metrics_seq;
+      rec.dispatch = slot->dispatch;
+      const uint32_t count = std::min<uint32_t>(rec.dispatch.value_count, RPL_SHM_VALUES_MAX);
+      rec.kernel_name.assign(slot->kernel_name, strnlen(slot->kernel_name, RPL_SHM_KERNEL_NAME_MAX));
+      for (uint32_t i = 0; i < count; ++i) {
+        rec.names.push_back(std::string(slot->names[i], strnlen(slot->names[i], RPL_SHM_VALUE_NAME_MAX)));
+        rec.values.push_back(slot->values[i]);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->seq.load(std::memory_order_relaxed) != seq) continue;
+      records->push_back(rec);
+    }
+    return head;
+  }
+
+ private:
+  RplShmChannel(const std::string& name, void* base, size_t size, bool owner) :
+    name_(name),
+    base_(base),
+    size_(size),
+    owner_(owner),
+    header_(reinterpret_cast<rpl_shm_header_t*>(base)),
+    slots_(reinterpret_cast<rpl_shm_slot_t*>(header_ + 1))
+  {}
+
+  // The truncated string is null terminated
+  static void CopyString(char* dst, const char* src, size_t size) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = 0;
+  }
+
+  const std::string name_;
+  void* const base_;
+  const size_t size_;
+  const bool owner_;
+  rpl_shm_header_t* const header_;
+  rpl_shm_slot_t* const slots_;
+};
+
+#endif  // TEST_UTIL_RPL_SHM_H_
@@ -0,0 +1,232 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_STATS_H_
+#define TEST_UTIL_RPL_STATS_H_
+
+// On-line kernels statistics aggregation
+//
+// Every producer thread updates its own table keyed by the kernel name, so
+// the recording is not synchronized. The tables are linked to a lock-free list
+// on the thread first use and merged on the dump. The durations are binned to
+// a log-linear histogram with 16 sub-buckets per power of two, the quantiles
+// relative error is bounded by 1/32. The counters values are aggregated as
+// count, sum, min and max.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+class RplKernelStats {
+ public:
+  // Log-linear histogram, values below 2^SUB_BITS are binned exactly
+  static const uint32_t SUB_BITS = 4;
+  static const uint32_t SUB_COUNT = 1u << SUB_BITS;
+  static const uint32_t BIN_COUNT = SUB_COUNT + (64 - SUB_BITS) * SUB_COUNT;
+
+  struct value_stat_t {
+    const char* name;
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+  };
+
+  struct kernel_stat_t {
+    uint64_t calls;
+    double weighted_calls;
+    uint64_t total_ns;
+    double weighted_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    std::vector<uint64_t> bins;
+    std::vector<value_stat_t> values;
+    kernel_stat_t() : calls(0), weighted_calls(0), total_ns(0), weighted_ns(0), min_ns(UINT64_MAX), max_ns(0) {}
+  };
+  typedef std::map<std::string, kernel_stat_t> stat_map_t;
+
+  RplKernelStats() : head_(NULL) {}
+
+  ~RplKernelStats() {
+    table_t* table = head_.load();
+    while (table != NULL) {
+      table_t* next = table->next;
+      delete table;
+      table = next;
+    }
+  }
+
+  // Recording the kernel dispatch duration, called by the producer thread
+  void AddDispatch(const std::string& kernel_name, const uint64_t& duration_ns, const double& weight) {
+    kernel_stat_t& stat = GetTable()->map[kernel_name];
+    if (stat.bins.empty()) stat.bins.assign(BIN_COUNT, 0);
+    stat.calls += 1;
+    stat.weighted_calls += weight;
+    stat.total_ns += duration_ns;
+    stat.weighted_ns += weight * duration_ns;
+    stat.min_ns = std::min(stat.min_ns, duration_ns);
+    stat.max_ns = std::max(stat.max_ns, duration_ns);
+    stat.bins[BinIndex(duration_ns)] += 1;
+  }
+
+  // Recording the kernel counter value, the counters order is stable across the dispatches
+  void AddValue(const std::string& kernel_name, const uint32_t& index, const char* name, const double& value) {
+    std::vector<value_stat_t>& values = GetTable()->map[kernel_name].values;
+    value_stat_t* stat = (index < values.size()) ? &values[index] : NULL;
+    if ((stat == NULL) || (strcmp(stat->name, name) != 0)) {
+      stat = NULL;
+      for (value_stat_t& v : values) if (strcmp(v.name, name) == 0) stat = &v;
+      if (stat == NULL) {
+        const value_stat_t init = {name, 0, 0, value, value};
+        values.push_back(init);
+        stat = &values.back();
+      }
+    }
+    stat->count += 1;
+    stat->sum += value;
+    stat->min = std::min(stat->min, value);
+    stat->max = std::max(stat->max, value);
+  }
+
+  // Merging the threads tables, the producers should be stopped
+  stat_map_t Merge() const {
+    stat_map_t result;
+    for (table_t* table = head_.load(); table != NULL; table = table->next) {
+      for (const auto& item : table->map) {
+        kernel_stat_t& dst = result[item.first];
+        const kernel_stat_t& src = item.second;
+        if (dst.bins.empty()) dst.bins.assign(BIN_COUNT, 0);
+        dst.calls += src.calls;
+        dst.weighted_calls += src.weighted_calls;
+        dst.total_ns += src.total_ns;
+        dst.weighted_ns += src.weighted_ns;
+        dst.min_ns = std::min(dst.min_ns, src.min_ns);
+        dst.max_ns = std::max(dst.max_ns, src.max_ns);
+        for (uint32_t i = 0; i < src.bins.size(); ++i) dst.bins[i] += src.bins[i];
+        for (const value_stat_t& v : src.values) {
+          auto it = std::find_if(dst.values.begin(), dst.values.end(),
+                                 [&v](const value_stat_t& d) { return strcmp(d.name, v.name) == 0; });
+          if (it == dst.values.end()) {
+            dst.values.push_back(v);
+          } else {
+            it->count += v.count;
+            it->sum += v.sum;
+            it->min = std::min(it->min, v.min);
+            it->max = std::max(it->max, v.max);
+          }
+        }
+      }
+    }
+    return result;
+  }
+
+  // Writing the merged statistics CSV, the kernels are sorted by the total duration
+  void Dump(FILE* file, const bool& weighted) const {
+    const stat_map_t map = Merge();
+    std::vector<stat_map_t::const_iterator> order;
+    for (auto it = map.begin(); it != map.end(); ++it) order.push_back(it);
+    std::stable_sort(order.begin(), order.end(),
+      [](const stat_map_t::const_iterator& a, const stat_map_t::const_iterator& b) {
+        return a->second.total_ns > b->second.total_ns;
+      });
+
+    fprintf(file, "\"Name\",\"Calls\",\"TotalDurationNs\",\"AverageNs\",\"MinNs\",\"MaxNs\",\"P50Ns\",\"P90Ns\",\"P99Ns\"");
+    if (weighted) fprintf(file, ",\"EstimatedCalls\",\"EstimatedDurationNs\"");
+    fprintf(file, ",\"Counters\"\n");
+    for (const auto& it : order) {
+      const kernel_stat_t& stat = it->second;
+      std::string name;
+      for (const char c : it->first) {
+        if (c == '"') name += '"';
+        name += c;
+      }
+      fprintf(file, "\"%s\",%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu", name.c_str(),
+        stat.calls, stat.total_ns, (stat.calls != 0) ? stat.total_ns / stat.calls : 0,
+        (stat.calls != 0) ? stat.min_ns : 0, stat.max_ns,
+        Quantile(stat, 0.5), Quantile(stat, 0.9), Quantile(stat, 0.99));
+      if (weighted) fprintf(file, ",%.0f,%.0f", stat.weighted_calls, stat.weighted_ns);
+      fprintf(file, ",\"");
+      for (uint32_t i = 0; i < stat.values.size(); ++i) {
+        const value_stat_t& v = stat.values[i];
+        fprintf(file, "%s%s(avg:%.6g min:%.6g max:%.6g)", (i != 0) ? " " : "", v.name,
+          v.sum / v.count, v.min, v.max);
+      }
+      fprintf(file, "\"\n");
+    }
+  }
+
+  static uint32_t BinIndex(const uint64_t& value) {
+    if (value < SUB_COUNT) return value;
+    const uint32_t exp = 63 - __builtin_clzll(value);
+    const uint32_t sub = (value >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+    return SUB_COUNT + (exp - SUB_BITS) * SUB_COUNT + sub;
+  }
+
+  // The bin middle value
+  static uint64_t BinValue(const uint32_t& index) {
+    if (index < SUB_COUNT) return index;
+    const uint32_t exp = (index - SUB_COUNT) / SUB_COUNT + SUB_BITS;
+    const uint64_t sub = (index - SUB_COUNT) % SUB_COUNT;
+    const uint64_t width = 1ull << (exp - SUB_BITS);
+    return (1ull << exp) + sub * width + width / 2;
+  }
+
+  static uint64_t Quantile(const kernel_stat_t& stat, const double& q) {
+    if (stat.calls == 0) return 0;
+    const uint64_t rank = static_cast<uint64_t>(q * (stat.calls - 1)) + 1;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < stat.bins.size(); ++i) {
+      count += stat.bins[i];
+      if (count >= rank) return std::min(std::max(BinValue(i), stat.min_ns), stat.max_ns);
+    }
+    return stat.max_ns;
+  }
+
+ private:
+  struct table_t {
+    stat_map_t map;
+    table_t* next;
+  };
+
+  // Returning the calling thread table, linked to the list on the first use
+  table_t* GetTable() {
+    static thread_local table_t* table = NULL;
+    static thread_local const RplKernelStats* owner = NULL;
+    if ((table == NULL) || (owner != this)) {
+      table = new table_t;
+      owner = this;
+      table->next = head_.load(std::memory_order_relaxed);
+      while (!head_.compare_exchange_weak(table->next, table, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+    return table;
+  }
+
+  std::atomic<table_t*> head_;
+};
+
+#endif  // TEST_UTIL_RPL_STATS_H_
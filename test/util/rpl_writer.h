@@ -0,0 +1,279 @@
+/******************************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*******************************************************************************/
+
+#ifndef TEST_UTIL_RPL_WRITER_H_
+#define TEST_UTIL_RPL_WRITER_H_
+
+// Asynchronous results writer
+//
+// Producers push completed records to a bounded lock-free queue which is
+// drained by a dedicated writer thread. The writer thread calls the write
+// function for every record and the flush function with the configured
+// flush interval. On the queue overflow the producer blocks until the writer
+// has drained a batch, drops the oldest queued record or drops the new record
+// counting the misses.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+template <typename T>
+class RplAsyncWriter {
+ public:
+  // Queue overflow policy
+  enum policy_t {
+    POLICY_BLOCK = 0,
+    POLICY_DROP_OLDEST = 1,
+    POLICY_COUNT = 2
+  };
+  typedef void (*write_fun_t)(T* record, void* arg);
+  typedef void (*flush_fun_t)(void* arg);
+
+  static const uint32_t QUEUE_SIZE_DFLT = 4096;
+  static const uint32_t FLUSH_INTERVAL_DFLT = 100;  // msec
+  static const uint32_t BATCH_SIZE = 256;
+
+  RplAsyncWriter(uint32_t queue_size, uint32_t flush_interval, policy_t policy,
+                 write_fun_t write_fun, flush_fun_t flush_fun, void* arg) :
+    mask_(QueueSize(queue_size) - 1),
+    flush_interval_(flush_interval),
+    policy_(policy),
+    write_fun_(write_fun),
+    flush_fun_(flush_fun),
+    arg_(arg),
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    blocked_(0),
+    sleeping_(false),
+    stop_(false),
+    dropped_(0)
+  {
+    cells_ = new cell_t[mask_ + 1];
+    for (uint64_t i = 0; i <= mask_; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    thread_ = std::thread(&RplAsyncWriter::Run, this);
+  }
+
+  // Drains the queue and joins the writer thread
+  ~RplAsyncWriter() {
+    stop_.store(true);
+    Wakeup(true);
+    thread_.join();
+    delete[] cells_;
+  }
+
+  // Pushing a record, the record ownership is passed to the writer
+  void Push(T* record) {
+    while (TryPush(record) == false) {
+      switch (policy_) {
+        case POLICY_BLOCK: {
+          // Blocking until the writer has drained a batch
+          Wakeup(false);
+          std::unique_lock<std::mutex> lck(mutex_);
+          blocked_.fetch_add(1);
+          space_cond_.wait(lck, [this] { return !IsFull(); });
+          blocked_.fetch_sub(1);
+          break;
+        }
+        case POLICY_DROP_OLDEST: {
+          T* oldest = NULL;
+          if (TryPop(&oldest)) {
+            delete oldest;
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+          }
+          break;
+        }
+        default:
+          delete record;
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Wakeup(false);
+  }
+
+  // Number of the dropped records
+  uint64_t GetDropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  static const char* PolicyName(policy_t policy) {
+    switch (policy) {
+      case POLICY_BLOCK: return "block";
+      case POLICY_DROP_OLDEST: return "drop-oldest";
+      default: return "count";
+    }
+  }
+
+  // Parsing the policy name, returns false if the name is unknown
+  static bool ParsePolicy(const char* name, policy_t* policy) {
+    const std::string str(name);
+    if (str == "block") *policy = POLICY_BLOCK;
+    else if (str == "drop-oldest") *policy = POLICY_DROP_OLDEST;
+    else if (str == "count") *policy = POLICY_COUNT;
+    else return false;
+    return true;
+  }
+
+ private:
+  // Bounded MPMC queue cell, the sequence number tracks the cell state
+  struct cell_t {
+    std::atomic<uint64_t> seq;
+    T* record;
+  };
+
+  static uint64_t QueueSize(uint32_t size) {
+    uint64_t pow2 = 2;
+    while (pow2 < size) pow2 <<= 1;
+    return pow2;
+  }
+
+  bool TryPush(T* record) {
+    uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell_t* cell = &cells_[pos & mask_];
+      const uint64_t seq = cell->seq.load(std::memory_order_acquire);
+      const int64_t diff = (int64_t)seq - (int64_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell->record = record;
+          cell->seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPop(T** record) {
+    uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell_t* cell = &cells_[pos & mask_];
+      const uint64_t seq = cell->seq.load(std::memory_order_acquire);
+      const int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          *record = cell->record;
+          cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool IsEmpty() const {
+    return dequeue_pos_.load() == enqueue_pos_.load();
+  }
+
+  bool IsFull() const {
+    return (enqueue_pos_.load() - dequeue_pos_.load()) > mask_;
+  }
+
+  // Signaling the blocked producers after draining a batch
+  void Release() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (blocked_.load() != 0) {
+      std::lock_guard<std::mutex> lck(mutex_);
+      space_cond_.notify_all();
+    }
+  }
+
+  // Waking up the writer thread if it is sleeping
+  void Wakeup(bool force) {
+    if (force || sleeping_.load()) {
+      std::lock_guard<std::mutex> lck(mutex_);
+      cond_.notify_one();
+    }
+  }
+
+  // Writer thread routine
+  void Run() {
+    typedef std::chrono::steady_clock clock_t;
+    const std::chrono::milliseconds interval(flush_interval_);
+    clock_t::time_point flush_time = clock_t::now() + interval;
+    bool dirty = false;
+
+    while (true) {
+      uint32_t count = 0;
+      T* record = NULL;
+      while ((count < BATCH_SIZE) && TryPop(&record)) {
+        write_fun_(record, arg_);
+        delete record;
+        ++count;
+      }
+      if (count != 0) {
+        dirty = true;
+        Release();
+      }
+
+      const bool to_stop = stop_.load() && IsEmpty();
+      const clock_t::time_point now = clock_t::now();
+      if (dirty && (to_stop || (now >= flush_time))) {
+        flush_fun_(arg_);
+        dirty = false;
+      }
+      if (now >= flush_time) flush_time = now + interval;
+      if (to_stop) break;
+
+      if (count == 0) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        sleeping_.store(true);
+        if (IsEmpty() && !stop_.load()) cond_.wait_until(lck, flush_time);
+        sleeping_.store(false);
+      }
+    }
+  }
+
+  const uint64_t mask_;
+  const uint32_t flush_interval_;
+  const policy_t policy_;
+  const write_fun_t write_fun_;
+  const flush_fun_t flush_fun_;
+  void* const arg_;
+
+  cell_t* cells_;
+  std::atomic<uint64_t> enqueue_pos_;
+  std::atomic<uint64_t> dequeue_pos_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable space_cond_;
+  std::atomic<uint32_t> blocked_;
+  std::atomic<bool> sleeping_;
+  std::atomic<bool> stop_;
+  std::atomic<uint64_t> dropped_;
+};
+
+#endif  // TEST_UTIL_RPL_WRITER_H_